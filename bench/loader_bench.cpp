@@ -0,0 +1,897 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <Windows.h>
+#else
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include "sp_tools_common.h"
+#include "sptex_stream.h"
+#include "spmdl_bvh.h"
+
+#define SP_BENCH_MAX_SECTIONS 256
+
+bool g_verbose;
+std::vector<spfile_dict> g_dicts;
+
+void failf(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	vfprintf(stderr, fmt, args);
+	putc('\n', stderr);
+
+	va_end(args);
+	exit(1);
+}
+
+// -- File access
+
+struct mapped_file
+{
+	const void *data = NULL;
+	size_t size = 0;
+	bool mapped = false;
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#endif
+};
+
+static mapped_file map_file(const char *path)
+{
+	mapped_file mf;
+	mf.mapped = true;
+#if defined(_WIN32)
+	mf.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mf.file == INVALID_HANDLE_VALUE) failf("Failed to open file: %s", path);
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mf.file, &size)) failf("Failed to get file size: %s", path);
+	mf.size = (size_t)size.QuadPart;
+	mf.mapping = CreateFileMappingA(mf.file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mf.mapping) failf("Failed to map file: %s", path);
+	mf.data = MapViewOfFile(mf.mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mf.data) failf("Failed to map file: %s", path);
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) failf("Failed to open file: %s", path);
+	struct stat st;
+	if (fstat(fd, &st) != 0) failf("Failed to get file size: %s", path);
+	mf.size = (size_t)st.st_size;
+	void *data = mmap(NULL, mf.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) failf("Failed to map file: %s", path);
+	close(fd);
+	mf.data = data;
+#endif
+	return mf;
+}
+
+static mapped_file read_file(const char *path)
+{
+	mapped_file mf;
+	FILE *f = fopen(path, "rb");
+	if (!f) failf("Failed to open file: %s", path);
+	fseek(f, 0, SEEK_END);
+	mf.size = (size_t)ftell(f);
+	fseek(f, 0, SEEK_SET);
+	void *data = malloc(mf.size);
+	if (!data) failf("Failed to allocate %zu bytes", mf.size);
+	if (fread(data, 1, mf.size, f) != mf.size) failf("Failed to read file: %s", path);
+	fclose(f);
+	mf.data = data;
+	return mf;
+}
+
+static void close_file(mapped_file &mf)
+{
+	if (mf.mapped) {
+#if defined(_WIN32)
+		UnmapViewOfFile(mf.data);
+		CloseHandle(mf.mapping);
+		CloseHandle(mf.file);
+#else
+		munmap((void*)mf.data, mf.size);
+#endif
+	} else {
+		free((void*)mf.data);
+	}
+	mf = mapped_file();
+}
+
+// -- Benchmark
+
+static double now_ms()
+{
+	using clock = std::chrono::steady_clock;
+	return std::chrono::duration<double, std::milli>(clock::now().time_since_epoch()).count();
+}
+
+struct bench_chunk
+{
+	uint32_t section;
+	uint32_t index;
+	uint32_t uncompressed_offset;
+};
+
+struct bench_file
+{
+	const char *path;
+	mapped_file file;
+	spfile_header header;
+	spfile_section *sections;
+	void **buffers;
+	size_t total_size;
+	std::vector<bench_chunk> chunks;
+};
+
+static const char *magic_name(uint32_t magic, char *buf)
+{
+	memcpy(buf, &magic, 4);
+	buf[4] = '\0';
+	return buf;
+}
+
+// Decode every section with the allocating API, uncompressed sections are
+// returned in place
+static void bench_decode(bench_file &bf)
+{
+	spfile_util su;
+	if (!spfile_util_init(&su, bf.file.data, bf.file.size)) failf("%s: Bad file header", bf.path);
+	spfile_util_set_dicts(&su, g_dicts.data(), g_dicts.size());
+	for (uint32_t i = 0; i < bf.header.num_sections; i++) {
+		if (!spfile_decode_section(&su, &bf.sections[i])) failf("%s: Failed to decode section %u", bf.path, i);
+	}
+	spfile_util_free(&su);
+}
+
+// Decode every section into pre-allocated buffers
+static void bench_decode_to(bench_file &bf)
+{
+	spfile_util su;
+	if (!spfile_util_init(&su, bf.file.data, bf.file.size)) failf("%s: Bad file header", bf.path);
+	spfile_util_set_dicts(&su, g_dicts.data(), g_dicts.size());
+	for (uint32_t i = 0; i < bf.header.num_sections; i++) {
+		if (!spfile_decode_section_to(&su, &bf.sections[i], bf.buffers[i])) failf("%s: Failed to decode section %u", bf.path, i);
+	}
+	spfile_util_free(&su);
+}
+
+// Decode all the chunks of every section into pre-allocated buffers in
+// parallel, each thread using its own `spfile_util` over the same data
+static void bench_decode_mt(bench_file &bf, int num_threads)
+{
+	std::atomic_int a_index { 0 };
+	int num_chunks = (int)bf.chunks.size();
+	auto worker = [&]() {
+		spfile_util su;
+		if (!spfile_util_init(&su, bf.file.data, bf.file.size)) failf("%s: Bad file header", bf.path);
+	spfile_util_set_dicts(&su, g_dicts.data(), g_dicts.size());
+		for (;;) {
+			int index = a_index.fetch_add(1, std::memory_order_relaxed);
+			if (index >= num_chunks) break;
+			const bench_chunk &chunk = bf.chunks[index];
+			char *dst = (char*)bf.buffers[chunk.section] + chunk.uncompressed_offset;
+			if (!spfile_decode_chunk_to(&su, &bf.sections[chunk.section], chunk.index, dst)) {
+				failf("%s: Failed to decode chunk %u of section %u", bf.path, chunk.index, chunk.section);
+			}
+		}
+		spfile_util_free(&su);
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < num_threads; i++) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+}
+
+static const spfile_dict *find_dict(const void *section_data)
+{
+	uint32_t dict_id;
+	memcpy(&dict_id, section_data, sizeof(uint32_t));
+	for (const spfile_dict &dict : g_dicts) {
+		if (dict.id == dict_id) return &dict;
+	}
+	return NULL;
+}
+
+// Reference: allocate and decompress each section individually with a fresh
+// decompression context, what a naive loader would do
+static void bench_baseline(bench_file &bf)
+{
+	void *buffers[SP_BENCH_MAX_SECTIONS];
+	for (uint32_t i = 0; i < bf.header.num_sections; i++) {
+		const spfile_section *s = &bf.sections[i];
+		buffers[i] = malloc(s->uncompressed_size + 1);
+		const char *src = (const char*)bf.file.data + s->offset;
+		size_t size = 0;
+		if (s->compression_type == SP_COMPRESSION_ZSTD_DICT) {
+			const spfile_dict *dict = find_dict(src);
+			if (dict) size = sp_decompress_buffer_dict(dict, buffers[i], s->uncompressed_size, src, s->compressed_size);
+		} else {
+			size = sp_decompress_buffer(s->compression_type, buffers[i], s->uncompressed_size, src, s->compressed_size);
+		}
+		if (size != s->uncompressed_size) failf("%s: Failed to decode section %u", bf.path, i);
+	}
+	for (uint32_t i = 0; i < bf.header.num_sections; i++) {
+		free(buffers[i]);
+	}
+}
+
+// Decode everything through the typed APIs and compare against the generic path
+static void verify_typed(bench_file &bf)
+{
+	size_t num_checked = 0;
+	auto check = [&](const void *data, uint32_t section) {
+		if (!data) failf("%s: Typed decode failed for section %u", bf.path, section);
+		if (memcmp(data, bf.buffers[section], bf.sections[section].uncompressed_size) != 0) {
+			failf("%s: Typed decode mismatch in section %u", bf.path, section);
+		}
+		num_checked++;
+	};
+
+	switch (bf.header.magic) {
+	case SPFILE_HEADER_SPTEX: {
+		sptex_util su;
+		if (!sptex_util_init(&su, bf.file.data, bf.file.size)) failf("%s: Bad sptex header", bf.path);
+		spfile_util_set_dicts(&su.file, g_dicts.data(), g_dicts.size());
+		sptex_header header = sptex_decode_header(&su);
+		uint32_t num_section_mips = header.info.num_mips - header.info.num_tail_mips;
+		for (uint32_t i = 0; i < num_section_mips; i++) {
+			check(sptex_decode_mip(&su, i), i);
+		}
+		if (header.info.num_tail_mips > 0) {
+			// Tail mips are ranges of the single mip tail section
+			const char *tail = (const char*)sptex_decode_mip_tail(&su);
+			check(tail, num_section_mips);
+			for (uint32_t i = 0; i < header.info.num_tail_mips; i++) {
+				uint32_t begin = header.info.tail_mip_offsets[i];
+				uint32_t end = i + 1 < header.info.num_tail_mips ? header.info.tail_mip_offsets[i + 1] : bf.sections[num_section_mips].uncompressed_size;
+				const void *mip = sptex_decode_mip(&su, num_section_mips + i);
+				if (!mip || memcmp(mip, tail + begin, end - begin) != 0) {
+					failf("%s: Typed decode mismatch in tail mip %u", bf.path, num_section_mips + i);
+				}
+				num_checked++;
+			}
+		}
+		if (header.info.tile_width > 0) {
+			// Tiles decoded through the page table match the chunks of the mips
+			for (uint32_t i = 0; i < num_section_mips; i++) {
+				uint32_t tiles_x = 0, tiles_y = 0;
+				sptex_get_mip_tiles(&su, i, &tiles_x, &tiles_y);
+				for (uint32_t y = 0; y < tiles_y; y++) {
+					for (uint32_t x = 0; x < tiles_x; x++) {
+						sptex_page page = { };
+						sptex_get_tile_page(&su, i, x, y, &page);
+						const char *tile = sptex_decode_tile(&su, i, x, y);
+						const char *ref = (const char*)bf.buffers[i] + (size_t)(y * tiles_x + x) * page.uncompressed_size;
+						if (!tile || memcmp(tile, ref, page.uncompressed_size) != 0) {
+							failf("%s: Typed decode mismatch in mip %u tile (%u, %u)", bf.path, i, x, y);
+						}
+						num_checked++;
+					}
+				}
+			}
+		}
+		if (spfile_util_failed(&su.file)) failf("%s: sptex decode failed", bf.path);
+		spfile_util_free(&su.file);
+	} break;
+	case SPFILE_HEADER_SPMDL: {
+		spmdl_util su;
+		if (!spmdl_util_init(&su, bf.file.data, bf.file.size)) failf("%s: Bad spmdl header", bf.path);
+		spfile_util_set_dicts(&su.file, g_dicts.data(), g_dicts.size());
+		spmdl_header header = spmdl_decode_header(&su);
+		if (header.header.num_sections < 9) failf("%s: Too few sections", bf.path);
+		check(spmdl_decode_nodes(&su), 0);
+		check(spmdl_decode_bones(&su), 1);
+		check(spmdl_decode_materials(&su), 2);
+		check(spmdl_decode_meshes(&su), 3);
+		check(spmdl_decode_strings(&su), 6);
+		check(spmdl_decode_vertex(&su), 7);
+		check(spmdl_decode_index(&su), 8);
+
+		// Every vertex and index buffer decodes from the geometry sections
+		{
+			const spmdl_mesh *meshes = (const spmdl_mesh*)bf.buffers[3];
+			std::vector<char> buf;
+			for (uint32_t i = 0; i < header.info.num_meshes; i++) {
+				const spmdl_mesh &mesh = meshes[i];
+				for (uint32_t si = 0; si < mesh.num_vertex_buffers; si++) {
+					buf.resize((size_t)mesh.num_vertices * mesh.vertex_buffers[si].stride + 1);
+					if (!spmdl_decode_vertex_buffer_to(&header, &mesh, si, (const char*)bf.buffers[7], buf.data(), buf.size())) {
+						failf("%s: Failed to decode vertex buffer %u of mesh %u", bf.path, si, i);
+					}
+					num_checked++;
+				}
+				for (uint32_t lod = 0; lod <= mesh.num_lods; lod++) {
+					const spmdl_buffer &ib = lod > 0 ? mesh.lods[lod - 1].index_buffer : mesh.index_buffer;
+					uint32_t num_indices = lod > 0 ? mesh.lods[lod - 1].num_indices : mesh.num_indices;
+					buf.resize((size_t)num_indices * ib.stride + 1);
+					if (!spmdl_decode_index_buffer_to(&header, &mesh, lod, (const char*)bf.buffers[8], buf.data(), buf.size())) {
+						failf("%s: Failed to decode index buffer %u of mesh %u", bf.path, lod, i);
+					}
+					num_checked++;
+				}
+			}
+		}
+		if (spfile_util_failed(&su.file)) failf("%s: spmdl decode failed", bf.path);
+		spfile_util_free(&su.file);
+	} break;
+	case SPFILE_HEADER_SPANIM: {
+		spanim_util su;
+		if (!spanim_util_init(&su, bf.file.data, bf.file.size)) failf("%s: Bad spanim header", bf.path);
+		spfile_util_set_dicts(&su.file, g_dicts.data(), g_dicts.size());
+		check(spanim_decode_bones(&su), 0);
+		check(spanim_decode_strings(&su), 1);
+		check(spanim_decode_animation(&su), 2);
+		if (spfile_util_failed(&su.file)) failf("%s: spanim decode failed", bf.path);
+		spfile_util_free(&su.file);
+	} break;
+	case SPFILE_HEADER_SPSOUND: {
+		spsound_util su;
+		if (!spsound_util_init(&su, bf.file.data, bf.file.size)) failf("%s: Bad spsound header", bf.path);
+		spfile_util_set_dicts(&su.file, g_dicts.data(), g_dicts.size());
+		spsound_header header = spsound_decode_header(&su);
+		const spsound_take *takes = spsound_decode_takes(&su);
+		check(takes, 0);
+		for (uint32_t i = 0; i < header.info.num_takes; i++) {
+			const char *audio = (const char*)spsound_decode_audio(&su, i);
+			const char *ref = (const char*)bf.buffers[1] + takes[i].file_offset;
+			if (!audio || memcmp(audio, ref, takes[i].file_size) != 0) failf("%s: Audio mismatch in take %u", bf.path, i);
+
+			char *buf = (char*)malloc(takes[i].file_size + 1);
+			if (!spsound_decode_audio_to(&su, i, buf) || memcmp(buf, ref, takes[i].file_size) != 0) failf("%s: Audio mismatch in take %u", bf.path, i);
+			free(buf);
+			num_checked++;
+		}
+		if (spfile_util_failed(&su.file)) failf("%s: spsound decode failed", bf.path);
+		spfile_util_free(&su.file);
+	} break;
+	default:
+		failf("%s: Unknown file type", bf.path);
+	}
+
+	if (g_verbose) {
+		printf("%s: verified %zu sections\n", bf.path, num_checked);
+	}
+}
+
+// Recompress the zstd sections with one and `num_threads` workers, the
+// compressed bytes must not depend on the number of workers
+static void verify_compress_workers(bench_file &bf, int num_threads)
+{
+	int num_workers = num_threads > 1 ? num_threads : 4;
+	size_t num_checked = 0;
+	std::vector<char> single, multi;
+	for (uint32_t i = 0; i < bf.header.num_sections; i++) {
+		const spfile_section &s = bf.sections[i];
+		if (s.compression_type != SP_COMPRESSION_ZSTD) continue;
+
+		size_t bound = sp_get_compression_bound(SP_COMPRESSION_ZSTD, s.uncompressed_size);
+		single.resize(bound);
+		multi.resize(bound);
+		size_t single_size = sp_compress_buffer(SP_COMPRESSION_ZSTD, single.data(), bound, bf.buffers[i], s.uncompressed_size, 10, 1);
+		size_t multi_size = sp_compress_buffer(SP_COMPRESSION_ZSTD, multi.data(), bound, bf.buffers[i], s.uncompressed_size, 10, num_workers);
+		if (single_size != multi_size || memcmp(single.data(), multi.data(), single_size) != 0) {
+			failf("%s: Section %u compresses differently with 1 and %d workers (%zu vs %zu bytes)", bf.path, i, num_workers, single_size, multi_size);
+		}
+		num_checked++;
+	}
+
+	printf("%s: %zu sections compress identically with 1 and %d workers\n", bf.path, num_checked, num_workers);
+}
+
+struct bench_result
+{
+	double best_ms = 1e30;
+	double total_ms = 0.0;
+};
+
+template <typename F>
+static bench_result run_bench(int iterations, F f)
+{
+	bench_result res;
+	for (int i = 0; i < iterations; i++) {
+		double begin = now_ms();
+		f();
+		double elapsed = now_ms() - begin;
+		if (elapsed < res.best_ms) res.best_ms = elapsed;
+		res.total_ms += elapsed;
+	}
+	return res;
+}
+
+static void print_result(const char *name, const bench_result &res, size_t bytes, int iterations)
+{
+	double avg_ms = res.total_ms / iterations;
+	double mb_per_s = res.best_ms > 0.0 ? (double)bytes / (1024.0 * 1024.0) / (res.best_ms * 0.001) : 0.0;
+	printf("  %-10s  best %9.3fms  avg %9.3fms  %9.1f MB/s\n", name, res.best_ms, avg_ms, mb_per_s);
+}
+
+// -- Streaming
+
+// List the .sptex files in `dir` sorted by name, paths are malloc'd
+static std::vector<char*> list_sptex_files(const char *dir)
+{
+	std::vector<char*> paths;
+	auto push_path = [&](const char *name) {
+		size_t len = strlen(name);
+		if (len < 6 || strcmp(name + len - 6, ".sptex") != 0) return;
+		size_t size = strlen(dir) + len + 2;
+		char *path = (char*)malloc(size);
+		snprintf(path, size, "%s/%s", dir, name);
+		paths.push_back(path);
+	};
+
+#if defined(_WIN32)
+	char pattern[1024];
+	snprintf(pattern, sizeof(pattern), "%s\\*.sptex", dir);
+	WIN32_FIND_DATAA fd;
+	HANDLE find = FindFirstFileA(pattern, &fd);
+	if (find == INVALID_HANDLE_VALUE) failf("Failed to list directory: %s", dir);
+	do {
+		push_path(fd.cFileName);
+	} while (FindNextFileA(find, &fd));
+	FindClose(find);
+#else
+	DIR *d = opendir(dir);
+	if (!d) failf("Failed to list directory: %s", dir);
+	while (struct dirent *entry = readdir(d)) {
+		push_path(entry->d_name);
+	}
+	closedir(d);
+#endif
+
+	std::sort(paths.begin(), paths.end(), [](const char *a, const char *b) { return strcmp(a, b) < 0; });
+	return paths;
+}
+
+struct stream_bench
+{
+	double begin_ms;
+	double resident_ms; // Every texture has at least one mip
+	std::atomic_uint32_t num_resident { 0 };
+	std::atomic_uint64_t decoded_size { 0 };
+	std::vector<uint32_t> last_mip;
+	std::vector<mapped_file> verify_files;
+	uint32_t num_textures;
+	std::atomic_uint32_t num_failed { 0 };
+};
+
+static void stream_mip_fn(void *user, uint32_t texture, uint32_t mip, const sptex_info *info, const void *data, size_t size)
+{
+	stream_bench *sb = (stream_bench*)user;
+	sb->decoded_size.fetch_add(size, std::memory_order_relaxed);
+
+	// Mips of a texture are delivered in order by a single thread at a time
+	uint32_t last = sb->last_mip[texture];
+	if (last <= mip) failf("Texture %u: Mip %u delivered after mip %u", texture, mip, last);
+	sb->last_mip[texture] = mip;
+	if (last == UINT32_MAX && sb->num_resident.fetch_add(1) + 1 == sb->num_textures) {
+		sb->resident_ms = now_ms();
+	}
+
+	if (!sb->verify_files.empty()) {
+		const mapped_file &mf = sb->verify_files[texture];
+		sptex_util su;
+		if (!sptex_util_init(&su, mf.data, mf.size)) failf("Texture %u: Bad sptex header", texture);
+		const char *ref = sptex_decode_mip(&su, mip);
+		if (!ref || memcmp(ref, data, size) != 0) failf("Texture %u: Streamed mip %u mismatch", texture, mip);
+		spfile_util_free(&su.file);
+	}
+}
+
+static void stream_done_fn(void *user, uint32_t texture, bool ok)
+{
+	stream_bench *sb = (stream_bench*)user;
+	if (!ok) sb->num_failed.fetch_add(1);
+}
+
+// Simulate a level load: stream all the textures in `paths` with varying
+// priorities, reporting when the lowest mips of every texture are resident
+static void bench_stream(const std::vector<char*> &paths, int iterations, int num_threads, size_t max_read_size)
+{
+	uint32_t num_textures = (uint32_t)paths.size();
+	bench_result r_resident, r_done;
+	sptex_stream_stats stats = { };
+	uint64_t decoded_size = 0;
+
+	for (int iter = 0; iter < iterations; iter++) {
+		stream_bench sb;
+		sb.num_textures = num_textures;
+		sb.last_mip.resize(num_textures, UINT32_MAX);
+		if (g_verbose && iter == 0) {
+			for (const char *path : paths) {
+				sb.verify_files.push_back(map_file(path));
+			}
+		}
+
+		sptex_stream_opts opts = { };
+		opts.num_threads = (uint32_t)num_threads;
+		opts.max_read_size = max_read_size;
+		opts.mip_fn = &stream_mip_fn;
+		opts.done_fn = &stream_done_fn;
+		opts.user = &sb;
+
+		sb.begin_ms = now_ms();
+		sptex_stream *s = sptex_stream_create(&opts);
+		for (uint32_t i = 0; i < num_textures; i++) {
+			// Deterministic pseudo-random priorities of 0-3 mip levels
+			float priority = (float)((i * 2654435761u) >> 30);
+			sptex_stream_add(s, paths[i], priority, 0);
+		}
+		// Bump some textures as if they came into view during the load
+		for (uint32_t i = 0; i < num_textures; i += 7) {
+			sptex_stream_set_priority(s, i, 4.0f);
+		}
+		sptex_stream_wait(s);
+		double end_ms = now_ms();
+		stats = sptex_stream_get_stats(s);
+		sptex_stream_free(s);
+
+		if (sb.num_failed > 0) failf("Failed to stream %u textures", sb.num_failed.load());
+		if (sb.num_resident != num_textures) failf("Only %u/%u textures received mips", sb.num_resident.load(), num_textures);
+		for (mapped_file &mf : sb.verify_files) {
+			close_file(mf);
+		}
+
+		double resident = sb.resident_ms - sb.begin_ms, done = end_ms - sb.begin_ms;
+		if (resident < r_resident.best_ms) r_resident.best_ms = resident;
+		if (done < r_done.best_ms) r_done.best_ms = done;
+		r_resident.total_ms += resident;
+		r_done.total_ms += done;
+		decoded_size = sb.decoded_size;
+	}
+
+	printf("stream: %u textures, %u reads, %.1fkB read -> %.1fkB, %.1fkB per read\n", num_textures,
+		(uint32_t)stats.num_reads, (double)stats.bytes_read / 1024.0, (double)decoded_size / 1024.0,
+		(double)stats.bytes_read / 1024.0 / (double)(stats.num_reads > 0 ? stats.num_reads : 1));
+	print_result("resident", r_resident, decoded_size, iterations);
+	print_result("done", r_done, decoded_size, iterations);
+}
+
+// -- BVH queries
+
+struct bvh_bench_ray
+{
+	spmdl_ray ray;
+	uint32_t mesh;
+};
+
+static uint32_t bvh_bench_random(uint32_t &state)
+{
+	// xorshift32
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static float bvh_bench_random_range(uint32_t &state, float min, float max)
+{
+	return min + (max - min) * (float)(bvh_bench_random(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Closest hit by testing every leaf triangle of a binary BVH
+static float bvh_brute_force(const spmdl_bvh &bvh, uint32_t node_index, const spmdl_ray &ray, float best_t)
+{
+	const spmdl_bvh_node &node = ((const spmdl_bvh_node*)bvh.nodes)[node_index];
+	for (const spmdl_bvh_split &split : node.splits) {
+		if (split.num_triangles < 0) {
+			best_t = bvh_brute_force(bvh, split.data_index, ray, best_t);
+			continue;
+		}
+		for (uint32_t i = 0; i < (uint32_t)split.num_triangles; i++) {
+			spmdl_vec3 v[3];
+			spmdl_bvh_decode_triangle(&bvh, split.data_index + i, split.aabb_min, split.aabb_max, v);
+			float e1[3] = { v[1].x - v[0].x, v[1].y - v[0].y, v[1].z - v[0].z };
+			float e2[3] = { v[2].x - v[0].x, v[2].y - v[0].y, v[2].z - v[0].z };
+			float s[3] = { ray.origin.x - v[0].x, ray.origin.y - v[0].y, ray.origin.z - v[0].z };
+			float d[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+			float p[3] = { d[1]*e2[2] - d[2]*e2[1], d[2]*e2[0] - d[0]*e2[2], d[0]*e2[1] - d[1]*e2[0] };
+			float q[3] = { s[1]*e1[2] - s[2]*e1[1], s[2]*e1[0] - s[0]*e1[2], s[0]*e1[1] - s[1]*e1[0] };
+			float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+			if (det == 0.0f) continue;
+			float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) / det;
+			float w = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2]) / det;
+			float t = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) / det;
+			if (u >= 0.0f && w >= 0.0f && u + w <= 1.0f && t >= 0.0f && t < best_t) best_t = t;
+		}
+	}
+	return best_t;
+}
+
+// Cast `num_rays` random rays through the mesh bounds of a .spmdl file with
+// a BVH, reporting rays/s and traversal statistics
+static void bench_bvh(const char *path, uint32_t num_rays, int iterations)
+{
+	mapped_file mf = read_file(path);
+	spmdl_util su;
+	if (!spmdl_util_init(&su, mf.data, mf.size)) failf("%s: Bad spmdl header", path);
+	spfile_util_set_dicts(&su.file, g_dicts.data(), g_dicts.size());
+	spmdl_header header = spmdl_decode_header(&su);
+	spmdl_mesh *meshes = spmdl_decode_meshes(&su);
+
+	uint32_t magic = header.s_bvh_nodes.magic;
+	void *nodes = NULL;
+	if (magic == SPFILE_SECTION_BVH_NODES) nodes = spmdl_decode_bvh_nodes(&su);
+	else if (magic == SPFILE_SECTION_BVH4_NODES) nodes = spmdl_decode_bvh4_nodes(&su);
+	else if (magic == SPFILE_SECTION_BVH8_NODES) nodes = spmdl_decode_bvh8_nodes(&su);
+	else if (magic == SPFILE_SECTION_BVHQ_NODES) nodes = spmdl_decode_bvh_qnodes(&su);
+	uint32_t *triangles = spmdl_decode_bvh_tris(&su);
+	if (!meshes || !nodes || !triangles || spfile_util_failed(&su.file)) failf("%s: Failed to decode BVH sections", path);
+
+	spmdl_bvh bvh;
+	if (!spmdl_bvh_init(&bvh, &header, nodes, triangles)) failf("%s: Unknown BVH layout", path);
+
+	std::vector<uint32_t> bvh_meshes;
+	for (uint32_t i = 0; i < header.info.num_meshes; i++) {
+		if (meshes[i].bvh_index != ~0u) bvh_meshes.push_back(i);
+	}
+	if (bvh_meshes.empty()) failf("%s: No meshes with a BVH, convert with sp-model --bvh", path);
+
+	// Rays from a random point around the mesh bounds towards a random point
+	// inside them
+	std::vector<bvh_bench_ray> rays(num_rays);
+	uint32_t state = 0x9e3779b9u;
+	for (bvh_bench_ray &r : rays) {
+		r.mesh = bvh_meshes[bvh_bench_random(state) % bvh_meshes.size()];
+		const spmdl_mesh &mesh = meshes[r.mesh];
+		spmdl_vec3 min = mesh.aabb_min, max = mesh.aabb_max;
+		spmdl_vec3 pad = { (max.x - min.x) * 0.5f, (max.y - min.y) * 0.5f, (max.z - min.z) * 0.5f };
+		spmdl_vec3 target;
+		r.ray.origin.x = bvh_bench_random_range(state, min.x - pad.x, max.x + pad.x);
+		r.ray.origin.y = bvh_bench_random_range(state, min.y - pad.y, max.y + pad.y);
+		r.ray.origin.z = bvh_bench_random_range(state, min.z - pad.z, max.z + pad.z);
+		target.x = bvh_bench_random_range(state, min.x, max.x);
+		target.y = bvh_bench_random_range(state, min.y, max.y);
+		target.z = bvh_bench_random_range(state, min.z, max.z);
+		r.ray.direction.x = target.x - r.ray.origin.x;
+		r.ray.direction.y = target.y - r.ray.origin.y;
+		r.ray.direction.z = target.z - r.ray.origin.z;
+		r.ray.max_t = HUGE_VALF;
+	}
+
+	spmdl_bvh_stats stats = { };
+	uint32_t num_hits = 0;
+	bench_result res = run_bench(iterations, [&]() {
+		stats = spmdl_bvh_stats{ };
+		num_hits = 0;
+		for (const bvh_bench_ray &r : rays) {
+			spmdl_ray_hit hit;
+			if (spmdl_bvh_raycast(&bvh, &meshes[r.mesh], &r.ray, &hit, &stats)) num_hits++;
+		}
+	});
+
+	char magic_buf[5];
+	printf("%s: '%s', %u nodes (%.1fkB), %u triangles\n", path, magic_name(magic, magic_buf),
+		header.info.num_bvh_nodes, (double)header.s_bvh_nodes.uncompressed_size / 1024.0, header.info.num_bvh_tris);
+	double rays_per_s = res.best_ms > 0.0 ? (double)num_rays / (res.best_ms * 0.001) : 0.0;
+	printf("  %-10s  best %9.3fms  avg %9.3fms  %9.2f Mrays/s\n", "raycast", res.best_ms, res.total_ms / iterations, rays_per_s * 1e-6);
+	printf("  %u rays, %.1f%% hit, %.2f nodes/ray, %.2f triangles/ray\n", num_rays,
+		100.0 * (double)num_hits / (double)num_rays, (double)stats.node_visits / (double)num_rays,
+		(double)stats.triangle_tests / (double)num_rays);
+
+	// Compare the closest hits to testing every triangle
+	if (g_verbose) {
+		if (magic != SPFILE_SECTION_BVH_NODES) {
+			printf("  (verification needs binary BVH nodes)\n");
+		} else {
+			uint32_t num_verify = num_rays < 10000 ? num_rays : 10000;
+			for (uint32_t i = 0; i < num_verify; i++) {
+				const bvh_bench_ray &r = rays[i];
+				spmdl_ray_hit hit;
+				float t = spmdl_bvh_raycast(&bvh, &meshes[r.mesh], &r.ray, &hit, NULL) ? hit.t : HUGE_VALF;
+				float ref = bvh_brute_force(bvh, meshes[r.mesh].bvh_index, r.ray, HUGE_VALF);
+				if (t != ref && fabsf(t - ref) > 1e-4f * fabsf(ref)) failf("%s: Ray %u hit at %g, expected %g", path, i, t, ref);
+			}
+			printf("  verified %u rays\n", num_verify);
+		}
+	}
+
+	spfile_util_free(&su.file);
+	close_file(mf);
+}
+
+int main(int argc, char **argv)
+{
+	const char *files[256];
+	std::vector<const char*> dict_files;
+	int num_files = 0;
+	int iterations = 20;
+	int num_threads = (int)std::thread::hardware_concurrency();
+	bool use_mmap = true;
+	bool show_help = false;
+	bool verify_compress = false;
+	const char *stream_dir = NULL;
+	size_t max_read_size = 0;
+	std::vector<const char*> bvh_files;
+	uint32_t num_rays = 1000000;
+
+	// -- Parse arguments
+
+	for (int argi = 1; argi < argc; argi++) {
+		const char *arg = argv[argi];
+		int left = argc - argi - 1;
+
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			g_verbose = true;
+		} else if (!strcmp(arg, "--help")) {
+			show_help = true;
+		} else if (!strcmp(arg, "--no-mmap")) {
+			use_mmap = false;
+		} else if (!strcmp(arg, "--verify-compress")) {
+			verify_compress = true;
+		} else if (left >= 1 && !strcmp(arg, "--stream")) {
+			stream_dir = argv[++argi];
+		} else if (left >= 1 && !strcmp(arg, "--max-read-size")) {
+			int size = atoi(argv[++argi]);
+			if (size <= 0) failf("Bad max read size: %s", argv[argi]);
+			max_read_size = (size_t)size;
+		} else if (left >= 1 && !strcmp(arg, "--bvh")) {
+			bvh_files.push_back(argv[++argi]);
+		} else if (left >= 1 && !strcmp(arg, "--rays")) {
+			int count = atoi(argv[++argi]);
+			if (count <= 0) failf("Bad ray count: %s", argv[argi]);
+			num_rays = (uint32_t)count;
+		} else if (left >= 1 && !strcmp(arg, "--dict")) {
+			dict_files.push_back(argv[++argi]);
+		} else if (left >= 1 && (!strcmp(arg, "-n") || !strcmp(arg, "--iterations"))) {
+			iterations = atoi(argv[++argi]);
+			if (iterations <= 0) failf("Invalid iteration count: %s", argv[argi]);
+		} else if (left >= 1 && (!strcmp(arg, "-j") || !strcmp(arg, "--threads"))) {
+			num_threads = atoi(argv[++argi]);
+			if (num_threads <= 0 || num_threads > 10000) failf("Bad number of threads: %s", argv[argi]);
+		} else if (arg[0] == '-') {
+			failf("Unknown option: %s", arg);
+		} else {
+			if (num_files >= 256) failf("Too many files");
+			files[num_files++] = arg;
+		}
+	}
+
+	if (num_threads <= 0) num_threads = 1;
+
+	if (show_help || (num_files == 0 && !stream_dir && bvh_files.empty())) {
+		printf("%s",
+			"Usage: sp-loader-bench [options] <files...>\n"
+			"    Benchmarks loading .sptex/.spmdl/.spanim/.spsound files with the spfile_util API\n"
+			"    -n / --iterations <count>: Number of iterations per file (default 20)\n"
+			"    -j / --threads <num>: Number of threads for parallel chunk decoding (default: all cores)\n"
+			"    --no-mmap: Read files into memory instead of memory mapping them\n"
+			"    --verify-compress: Check that zstd sections compress identically with 1 and -j workers\n"
+			"    --dict <path>: Register a .spdict dictionary, can be repeated\n"
+			"    --stream <dir>: Simulate a level load streaming every .sptex in <dir> with sptex_stream\n"
+			"    --max-read-size <bytes>: Coalesced read size for --stream (default 65536)\n"
+			"    --bvh <path>: Benchmark random raycasts against the BVH of a .spmdl file, can be repeated\n"
+			"    --rays <count>: Number of rays for --bvh (default 1000000)\n"
+			"    -v / --verbose: Verbose output, verifies streamed mips and raycasts\n"
+		);
+		return 0;
+	}
+
+	std::vector<mapped_file> dict_data;
+	for (const char *path : dict_files) {
+		dict_data.push_back(read_file(path));
+		spfile_dict dict;
+		if (!spfile_dict_init(&dict, dict_data.back().data, dict_data.back().size)) failf("%s: Bad dictionary", path);
+		g_dicts.push_back(dict);
+	}
+
+	for (int fi = 0; fi < num_files; fi++) {
+		bench_file bf = { };
+		bf.path = files[fi];
+		bf.file = use_mmap ? map_file(bf.path) : read_file(bf.path);
+
+		spfile_util su;
+		if (!spfile_util_init(&su, bf.file.data, bf.file.size)) failf("%s: Bad file header", bf.path);
+	spfile_util_set_dicts(&su, g_dicts.data(), g_dicts.size());
+		memcpy(&bf.header, bf.file.data, sizeof(spfile_header));
+		spfile_util_free(&su);
+
+		uint32_t num_sections = bf.header.num_sections;
+		if (num_sections > SP_BENCH_MAX_SECTIONS) failf("%s: Too many sections: %u", bf.path, num_sections);
+		bf.sections = (spfile_section*)malloc(sizeof(spfile_section) * (num_sections + 1));
+		bf.buffers = (void**)malloc(sizeof(void*) * (num_sections + 1));
+		memcpy(bf.sections, (const char*)bf.file.data + sizeof(spfile_header) + bf.header.header_info_size, sizeof(spfile_section) * num_sections);
+
+		size_t compressed_size = 0;
+		for (uint32_t i = 0; i < num_sections; i++) {
+			bf.buffers[i] = malloc(bf.sections[i].uncompressed_size + 1);
+			bf.total_size += bf.sections[i].uncompressed_size;
+			compressed_size += bf.sections[i].compressed_size;
+		}
+
+		if (!spfile_util_init(&su, bf.file.data, bf.file.size)) failf("%s: Bad file header", bf.path);
+	spfile_util_set_dicts(&su, g_dicts.data(), g_dicts.size());
+		for (uint32_t i = 0; i < num_sections; i++) {
+			uint32_t num_chunks = spfile_get_num_chunks(&su, &bf.sections[i]);
+			for (uint32_t ci = 0; ci < num_chunks; ci++) {
+				spfile_chunk chunk;
+				if (!spfile_get_chunk(&su, &bf.sections[i], ci, &chunk)) failf("%s: Bad chunk %u in section %u", bf.path, ci, i);
+				bf.chunks.push_back(bench_chunk{ i, ci, chunk.uncompressed_offset });
+			}
+		}
+		if (spfile_util_failed(&su)) failf("%s: Bad section", bf.path);
+		spfile_util_free(&su);
+
+		char magic_buf[5];
+		printf("%s: '%s', %u sections, %.1fkB -> %.1fkB\n", bf.path, magic_name(bf.header.magic, magic_buf),
+			num_sections, (double)compressed_size / 1024.0, (double)bf.total_size / 1024.0);
+		if (g_verbose) {
+			for (uint32_t i = 0; i < num_sections; i++) {
+				const spfile_section *s = &bf.sections[i];
+				const char *type = "zstd";
+				if (s->compression_type == SP_COMPRESSION_NONE) type = "none";
+				if (s->compression_type == SP_COMPRESSION_CHUNKED) type = "chunked";
+				if (s->compression_type == SP_COMPRESSION_ZSTD_DICT) type = "zstd_dict";
+				if (s->compression_type == SP_COMPRESSION_BLOCK_SPLIT) type = "block_split";
+				printf("  [%u] '%s' %s %u -> %u\n", i, magic_name(s->magic, magic_buf),
+					type, s->compressed_size, s->uncompressed_size);
+			}
+		}
+
+		bench_decode_mt(bf, num_threads);
+		verify_typed(bf);
+		if (verify_compress) verify_compress_workers(bf, num_threads);
+
+		bench_result r_baseline = run_bench(iterations, [&]() { bench_baseline(bf); });
+		bench_result r_decode = run_bench(iterations, [&]() { bench_decode(bf); });
+		bench_result r_decode_to = run_bench(iterations, [&]() { bench_decode_to(bf); });
+		bench_result r_decode_mt = run_bench(iterations, [&]() { bench_decode_mt(bf, num_threads); });
+
+		print_result("baseline", r_baseline, bf.total_size, iterations);
+		print_result("decode", r_decode, bf.total_size, iterations);
+		print_result("decode_to", r_decode_to, bf.total_size, iterations);
+		print_result("decode_mt", r_decode_mt, bf.total_size, iterations);
+
+		for (uint32_t i = 0; i < num_sections; i++) {
+			free(bf.buffers[i]);
+		}
+		free(bf.buffers);
+		free(bf.sections);
+		close_file(bf.file);
+	}
+
+	if (stream_dir) {
+		std::vector<char*> paths = list_sptex_files(stream_dir);
+		if (paths.empty()) failf("No .sptex files in %s", stream_dir);
+		bench_stream(paths, iterations, num_threads, max_read_size);
+		for (char *path : paths) {
+			free(path);
+		}
+	}
+
+	for (const char *path : bvh_files) {
+		bench_bvh(path, num_rays, iterations);
+	}
+
+	for (size_t i = 0; i < g_dicts.size(); i++) {
+		spfile_dict_free(&g_dicts[i]);
+		close_file(dict_data[i]);
+	}
+
+	return 0;
+}
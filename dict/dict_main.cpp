@@ -0,0 +1,312 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "sp_tools_common.h"
+
+bool g_verbose;
+
+void failf(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+
+	vfprintf(stderr, fmt, args);
+	putc('\n', stderr);
+
+	va_end(args);
+	exit(1);
+}
+
+static void write_data(FILE *f, const void *data, size_t size)
+{
+	size_t num = fwrite(data, 1, size, f);
+	if (num != size) {
+		fclose(f);
+		failf("Failed to write output data");
+	}
+}
+
+static std::vector<char> read_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) failf("Failed to open input file: %s", path);
+	fseek(f, 0, SEEK_END);
+	size_t size = (size_t)ftell(f);
+	fseek(f, 0, SEEK_SET);
+	std::vector<char> data(size);
+	if (fread(data.data(), 1, size, f) != size) failf("Failed to read input file: %s", path);
+	fclose(f);
+	return data;
+}
+
+// -- Training
+
+// Length of the substrings (dmers) used to score segments, the minimum
+// useful match length for zstd
+static const size_t DMER_SIZE = 8;
+
+struct sample_corpus
+{
+	std::vector<char> data;
+	std::vector<size_t> sample_begin;
+	std::vector<size_t> sample_end;
+};
+
+static uint64_t read_dmer(const char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(uint64_t));
+	return v;
+}
+
+// Select the segments of the corpus that contain the dmers shared by the most
+// samples, similar to zstd's COVER algorithm. The corpus is divided into
+// epochs and the best `segment_size` segment of each epoch is added to the
+// dictionary, after which its dmers no longer contribute to the score.
+// Raw content dictionaries are used as a prefix so the most useful segments
+// are placed at the end, closest to the compressed data.
+static std::vector<char> train_dictionary(const sample_corpus &corpus, size_t dict_size, size_t segment_size)
+{
+	const char *data = corpus.data.data();
+	size_t size = corpus.data.size();
+
+	if (size <= dict_size) return corpus.data;
+
+	// Number of samples each dmer appears in
+	std::unordered_map<uint64_t, uint32_t> freqs;
+	std::vector<bool> dmer_valid(size, false);
+	std::vector<uint64_t> sample_dmers;
+	for (size_t si = 0; si < corpus.sample_begin.size(); si++) {
+		size_t begin = corpus.sample_begin[si], end = corpus.sample_end[si];
+		sample_dmers.clear();
+		for (size_t i = begin; i + DMER_SIZE <= end; i++) {
+			dmer_valid[i] = true;
+			sample_dmers.push_back(read_dmer(data + i));
+		}
+		std::sort(sample_dmers.begin(), sample_dmers.end());
+		sample_dmers.erase(std::unique(sample_dmers.begin(), sample_dmers.end()), sample_dmers.end());
+		for (uint64_t dmer : sample_dmers) {
+			freqs[dmer]++;
+		}
+	}
+
+	size_t num_epochs = dict_size / segment_size;
+	if (num_epochs == 0) num_epochs = 1;
+	size_t epoch_size = size / num_epochs;
+	if (epoch_size < segment_size) {
+		epoch_size = segment_size;
+		num_epochs = size / epoch_size;
+	}
+
+	std::vector<char> dict(dict_size);
+	size_t dict_left = dict_size;
+	std::unordered_map<uint64_t, uint32_t> active;
+
+	for (size_t epoch = 0; epoch < num_epochs && dict_left > 0; epoch++) {
+		size_t epoch_begin = epoch * epoch_size;
+		size_t epoch_end = epoch_begin + epoch_size;
+		if (epoch_end > size) epoch_end = size;
+
+		// Slide a window of `segment_size` bytes over the epoch, scoring it
+		// by the sum of the frequencies of the distinct dmers it contains
+		size_t window = segment_size - DMER_SIZE + 1;
+		uint64_t score = 0, best_score = 0;
+		size_t best_begin = 0;
+		active.clear();
+		for (size_t i = epoch_begin; i < epoch_end; i++) {
+			if (dmer_valid[i]) {
+				uint64_t dmer = read_dmer(data + i);
+				if (active[dmer]++ == 0) score += freqs[dmer];
+			}
+			if (i >= epoch_begin + window) {
+				size_t out = i - window;
+				if (dmer_valid[out]) {
+					uint64_t dmer = read_dmer(data + out);
+					if (--active[dmer] == 0) {
+						score -= freqs[dmer];
+						active.erase(dmer);
+					}
+				}
+			}
+			if (score > best_score) {
+				best_score = score;
+				best_begin = i + 1 >= window ? i + 1 - window : 0;
+				if (best_begin < epoch_begin) best_begin = epoch_begin;
+			}
+		}
+		if (best_score == 0) continue;
+
+		size_t best_end = best_begin + segment_size;
+		if (best_end > size) best_end = size;
+		for (size_t i = best_begin; i < best_end; i++) {
+			if (dmer_valid[i]) freqs[read_dmer(data + i)] = 0;
+		}
+
+		size_t copy_size = best_end - best_begin;
+		if (copy_size > dict_left) copy_size = dict_left;
+		dict_left -= copy_size;
+		memcpy(dict.data() + dict_left, data + best_begin, copy_size);
+	}
+
+	dict.erase(dict.begin(), dict.begin() + dict_left);
+	return dict;
+}
+
+static uint32_t hash_dict(const std::vector<char> &dict)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (char c : dict) {
+		hash = (hash ^ (uint8_t)c) * 16777619u;
+	}
+	return hash != 0 ? hash : 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *output_file = NULL;
+	std::vector<const char*> input_files;
+	bool show_help = false;
+	size_t dict_size = 16 * 1024;
+	size_t segment_size = 64;
+	size_t max_sample_size = 64 * 1024;
+	uint32_t dict_id = 0;
+	bool has_dict_id = false;
+
+	// -- Parse arguments
+
+	for (int argi = 1; argi < argc; argi++) {
+		const char *arg = argv[argi];
+		int left = argc - argi - 1;
+
+		if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
+			g_verbose = true;
+		} else if (!strcmp(arg, "--help")) {
+			show_help = true;
+		} else if (left >= 1 && (!strcmp(arg, "-i") || !strcmp(arg, "--input"))) {
+			input_files.push_back(argv[++argi]);
+		} else if (left >= 1 && (!strcmp(arg, "-o") || !strcmp(arg, "--output"))) {
+			output_file = argv[++argi];
+		} else if (left >= 1 && !strcmp(arg, "--size")) {
+			int size = atoi(argv[++argi]);
+			if (size < 256 || size > 16 * 1024 * 1024) failf("Bad dictionary size: %d", size);
+			dict_size = (size_t)size;
+		} else if (left >= 1 && !strcmp(arg, "--segment-size")) {
+			int size = atoi(argv[++argi]);
+			if (size < (int)DMER_SIZE || size > 64 * 1024) failf("Bad segment size: %d", size);
+			segment_size = (size_t)size;
+		} else if (left >= 1 && !strcmp(arg, "--max-sample-size")) {
+			int size = atoi(argv[++argi]);
+			if (size <= 0) failf("Bad max sample size: %d", size);
+			max_sample_size = (size_t)size;
+		} else if (left >= 1 && !strcmp(arg, "--id")) {
+			dict_id = (uint32_t)strtoul(argv[++argi], NULL, 0);
+			has_dict_id = true;
+		} else if (arg[0] != '-') {
+			input_files.push_back(arg);
+		} else {
+			failf("Unknown option: %s", arg);
+		}
+	}
+
+	if (show_help) {
+		printf("%s",
+			"Usage: sp-dict -o <output.spdict> [options] <inputs...>\n"
+			"    Train a zstd dictionary from the small sections of existing .spmdl/.spanim/.spsound files\n"
+			"    -i / --input <path>: Input file, can be repeated (or list files without -i)\n"
+			"    -o / --output <path>: Destination .spdict filename\n"
+			"    -v / --verbose: Verbose output\n"
+			"    --size <bytes>: Dictionary size (default 16384)\n"
+			"    --segment-size <bytes>: Size of the corpus segments to select (default 64)\n"
+			"    --max-sample-size <bytes>: Ignore sections larger than this (default 65536)\n"
+			"    --id <id>: Dictionary ID (default: hash of the dictionary)\n"
+		);
+
+		return 0;
+	}
+
+	if (!output_file) failf("Output file required: -o <output>");
+	if (input_files.empty()) failf("Input files required");
+
+	// -- Gather samples
+
+	sample_corpus corpus;
+	for (const char *path : input_files) {
+		std::vector<char> file = read_file(path);
+
+		spfile_util su;
+		if (!spfile_util_init(&su, file.data(), file.size())) failf("Bad spfile header: %s", path);
+		spfile_header header;
+		memcpy(&header, file.data(), sizeof(spfile_header));
+
+		for (uint32_t i = 0; i < header.num_sections; i++) {
+			spfile_section s;
+			memcpy(&s, file.data() + sizeof(spfile_header) + header.header_info_size + i * sizeof(spfile_section), sizeof(spfile_section));
+			if (s.uncompressed_size < DMER_SIZE || s.uncompressed_size > max_sample_size) continue;
+
+			const char *data = (const char*)spfile_decode_section(&su, &s);
+			if (!data) {
+				if (g_verbose) printf("%s: Skipping section %u, failed to decode\n", path, i);
+				su.failed = false;
+				continue;
+			}
+
+			corpus.sample_begin.push_back(corpus.data.size());
+			corpus.data.insert(corpus.data.end(), data, data + s.uncompressed_size);
+			corpus.sample_end.push_back(corpus.data.size());
+		}
+
+		spfile_util_free(&su);
+	}
+
+	size_t num_samples = corpus.sample_begin.size();
+	if (num_samples == 0) failf("No samples found in the input files");
+
+	if (g_verbose) {
+		printf("Training from %zu samples (%.1fkB)\n", num_samples, (double)corpus.data.size() / 1024.0);
+	}
+
+	std::vector<char> dict = train_dictionary(corpus, dict_size, segment_size);
+	if (!has_dict_id) dict_id = hash_dict(dict);
+
+	// -- Write output
+
+	spdict_header header = { };
+	header.header.magic = SPFILE_HEADER_SPDICT;
+	header.header.version = 1;
+	header.header.header_info_size = sizeof(spdict_info);
+	header.header.num_sections = 1;
+	header.info.dict_id = dict_id;
+	header.info.num_samples = (uint32_t)num_samples;
+
+	size_t offset = (sizeof(spdict_header) + 15) & ~(size_t)15;
+	header.s_dict.magic = SPFILE_SECTION_DICT;
+	header.s_dict.compression_type = SP_COMPRESSION_NONE;
+	header.s_dict.index = 0;
+	header.s_dict.offset = (uint32_t)offset;
+	header.s_dict.uncompressed_size = (uint32_t)dict.size();
+	header.s_dict.compressed_size = (uint32_t)dict.size();
+
+	FILE *f = fopen(output_file, "wb");
+	if (!f) failf("Failed to open output file: %s", output_file);
+
+	static const char zero_buf[16] = { };
+	write_data(f, &header, sizeof(header));
+	write_data(f, zero_buf, offset - sizeof(header));
+	write_data(f, dict.data(), dict.size());
+
+	fclose(f);
+
+	if (g_verbose) {
+		printf("Wrote %zu byte dictionary 0x%08x to %s\n", dict.size(), dict_id, output_file);
+	}
+
+	return 0;
+}
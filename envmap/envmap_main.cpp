@@ -6,6 +6,7 @@
 
 #include "tinyexr.h"
 #include "sp_tools_common.h"
+#include "astcenc.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -103,6 +104,8 @@ void failf(const char *fmt, ...)
 
 typedef enum format_enum {
 	FORMAT_R11G11B10F,
+	FORMAT_ASTC_4X4_HDR,
+	FORMAT_ASTC_8X8_HDR,
 
 	FORMAT_COUNT,
 	FORMAT_ERROR = 0x7fffffff,
@@ -117,6 +120,8 @@ typedef struct pixel_format {
 
 const pixel_format format_list[] = {
 	{ FORMAT_R11G11B10F, SP_FORMAT_R11G11B10_FLOAT, "r11g11b10f", "Uncompressed 11/10-bits per float per channel" },
+	{ FORMAT_ASTC_4X4_HDR, SP_FORMAT_ASTC4X4_FLOAT, "astc4x4_hdr", "HDR RGB ASTC Compression (4x4 blocks)" },
+	{ FORMAT_ASTC_8X8_HDR, SP_FORMAT_ASTC8X8_FLOAT, "astc8x8_hdr", "HDR RGB ASTC Compression (8x8 blocks)" },
 };
 
 typedef enum container_enum {
@@ -335,7 +340,7 @@ int32_t clamp(int32_t v, int32_t min, int32_t max) {
 	return v;
 }
 
-void encode_format(char *dst, sp_format format, const float *data, int32_t width, int32_t height, int num_threads)
+void encode_format(char *dst, sp_format format, const float *data, int32_t width, int32_t height, int num_threads, int level)
 {
 	switch (format) {
 	case SP_FORMAT_R11G11B10_FLOAT:
@@ -365,6 +370,37 @@ void encode_format(char *dst, sp_format format, const float *data, int32_t width
 			}
 		});
 		break;
+	case SP_FORMAT_ASTC4X4_FLOAT:
+	case SP_FORMAT_ASTC8X8_FLOAT: {
+		const sp_format_info &info = sp_format_infos[format];
+
+		// astcenc expects RGBA input, alpha is unused
+		float *rgba = (float*)malloc(sizeof(float) * 4 * width * height);
+		if (!rgba) failf("Failed to allocate memory for ASTC source image");
+		parallel_for(num_threads, height, [&](int32_t y) {
+			float *dst_row = rgba + y * width * 4;
+			const float *row = data + y * width * 3;
+			for (int32_t x = 0; x < width; x++) {
+				dst_row[x * 4 + 0] = row[x * 3 + 0];
+				dst_row[x * 4 + 1] = row[x * 3 + 1];
+				dst_row[x * 4 + 2] = row[x * 3 + 2];
+				dst_row[x * 4 + 3] = 1.0f;
+			}
+		});
+
+		astcenc_opts opts = { 0 };
+		opts.linear = true;
+		opts.num_threads = num_threads;
+		opts.block_width = (int)info.block_x;
+		opts.block_height = (int)info.block_y;
+		opts.quality = astcenc_quality_for_level(level);
+		opts.progress_fn = &progress_update;
+		if (!astcenc_encode_image_hdr(&opts, (uint8_t*)dst, rgba, width, height)) {
+			failf("Failed to encode ASTC HDR image");
+		}
+
+		free(rgba);
+	} break;
 	}
 }
 
@@ -478,6 +514,9 @@ int main(int argc, char **argv)
 	if (format == FORMAT_ERROR) failf("Format required: -f <format> (see --help for available formats)");
 	if (!input_file[0]) failf("Input file required: -i <x+> <x-> <y+> <y-> <z+> <z->\n");
 	if (!output_file) failf("Output file required: -o <output>");
+	if (container == CONTAINER_DDS && (format == FORMAT_ASTC_4X4_HDR || format == FORMAT_ASTC_8X8_HDR)) {
+		failf("ASTC formats are not supported in DDS containers, use .sptex");
+	}
 
 	// -- Load cubemap faces
 
@@ -550,7 +589,18 @@ int main(int argc, char **argv)
 	const pixel_format &pxfmt = format_list[format];
 	const sp_format_info &format_info = sp_format_infos[pxfmt.sp_format];
 
-	uint32_t top_mip_size = format_info.block_size * ((resolution * resolution) / (format_info.block_x * format_info.block_y));
+	uint32_t top_blocks_x = (resolution + format_info.block_x - 1) / format_info.block_x;
+	uint32_t top_blocks_y = (resolution + format_info.block_y - 1) / format_info.block_y;
+	uint32_t top_mip_size = format_info.block_size * top_blocks_x * top_blocks_y;
+
+	switch (format) {
+	case FORMAT_ASTC_4X4_HDR:
+	case FORMAT_ASTC_8X8_HDR:
+		astcenc_init();
+		break;
+	default:
+		break;
+	}
 
 	char *encoded_data[20][6] = { };
 	uint32_t encoded_size[20];
@@ -559,8 +609,9 @@ int main(int argc, char **argv)
 		cubemap &dst_cube = mips[mip_i];
 		double roughness = (double)mip_i / (double)(num_mips - 1);
 		uint32_t res = resolution >> mip_i;
-		uint32_t mip_size = format_info.block_size * ((res * res) / (format_info.block_x * format_info.block_y));
-		if (mip_size == 0) mip_size = format_info.block_size;
+		uint32_t blocks_x = (res + format_info.block_x - 1) / format_info.block_x;
+		uint32_t blocks_y = (res + format_info.block_y - 1) / format_info.block_y;
+		uint32_t mip_size = format_info.block_size * blocks_x * blocks_y;
 		encoded_size[mip_i] = mip_size;
 
 		char *data = (char*)malloc(mip_size * 6);
@@ -568,7 +619,7 @@ int main(int argc, char **argv)
 		for (int face_i = 0; face_i < 6; face_i++) {
 			cubemap::face &dst_face = dst_cube.faces[face_i];
 
-			encode_format(data, pxfmt.sp_format, dst_face.data, dst_face.width, dst_face.height, num_threads);
+			encode_format(data, pxfmt.sp_format, dst_face.data, dst_face.width, dst_face.height, num_threads, level);
 
 			encoded_data[mip_i][face_i] = data;
 			data += mip_size;
@@ -598,7 +649,7 @@ int main(int argc, char **argv)
 		char *compress_buf = (char*)malloc(bound);
 		if (!compress_buf) failf("Failed to allocate lossless compression buffer");
 
-		sptex_header header;
+		sptex_header header = { };
 		header.header.magic = SPFILE_HEADER_SPTEX;
 		header.header.version = 1;
 		header.header.header_info_size = sizeof(sptex_info);
@@ -628,7 +679,7 @@ int main(int argc, char **argv)
 			size_t data_size = encoded_size[i] * 6;
 			size_t compressed_size = sp_compress_buffer(compression_type,
 				compress_buf + compress_offset, bound - compress_offset,
-				encoded_data[i][0], data_size, level);
+				encoded_data[i][0], data_size, level, num_threads);
 
 			double no_compress_ratio = 1.05;
 			sp_compression_type mip_type = compression_type;
@@ -1,8 +1,16 @@
 #include "sp_tools_common.h"
+#define ZSTD_STATIC_LINKING_ONLY
 #include "zstd.h"
+#include "meshoptimizer/meshoptimizer.h"
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define SP_SSE2 1
+	#include <emmintrin.h>
+#endif
+
 const sp_format_info sp_format_infos[SP_FORMAT_COUNT] = {
 	{ SP_FORMAT_UNKNOWN, "SP_FORMAT_UNKNOWN", "(unknown)", 0, 0, 0, 0, 0 },
 	{ SP_FORMAT_R8_UNORM, "SP_FORMAT_R8_UNORM", "r8", 1, 1, 1, SP_FORMAT_FLAG_NORMALIZED|SP_FORMAT_FLAG_BASIC },
@@ -112,6 +120,20 @@ const sp_format_info sp_format_infos[SP_FORMAT_COUNT] = {
 	{ SP_FORMAT_ASTC12X10_SRGB, "SP_FORMAT_ASTC12X10_SRGB", "astc12x10_srgb", 4, 16, 12, 10, SP_FORMAT_FLAG_NORMALIZED|SP_FORMAT_FLAG_SRGB },
 	{ SP_FORMAT_ASTC12X12_UNORM, "SP_FORMAT_ASTC12X12_UNORM", "astc12x12", 4, 16, 12, 12, SP_FORMAT_FLAG_NORMALIZED },
 	{ SP_FORMAT_ASTC12X12_SRGB, "SP_FORMAT_ASTC12X12_SRGB", "astc12x12_srgb", 4, 16, 12, 12, SP_FORMAT_FLAG_NORMALIZED|SP_FORMAT_FLAG_SRGB },
+	{ SP_FORMAT_ASTC4X4_FLOAT, "SP_FORMAT_ASTC4X4_FLOAT", "astc4x4_float", 4, 16, 4, 4, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC5X4_FLOAT, "SP_FORMAT_ASTC5X4_FLOAT", "astc5x4_float", 4, 16, 5, 4, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC5X5_FLOAT, "SP_FORMAT_ASTC5X5_FLOAT", "astc5x5_float", 4, 16, 5, 5, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC6X5_FLOAT, "SP_FORMAT_ASTC6X5_FLOAT", "astc6x5_float", 4, 16, 6, 5, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC6X6_FLOAT, "SP_FORMAT_ASTC6X6_FLOAT", "astc6x6_float", 4, 16, 6, 6, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC8X5_FLOAT, "SP_FORMAT_ASTC8X5_FLOAT", "astc8x5_float", 4, 16, 8, 5, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC8X6_FLOAT, "SP_FORMAT_ASTC8X6_FLOAT", "astc8x6_float", 4, 16, 8, 6, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC10X5_FLOAT, "SP_FORMAT_ASTC10X5_FLOAT", "astc10x5_float", 4, 16, 10, 5, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC10X6_FLOAT, "SP_FORMAT_ASTC10X6_FLOAT", "astc10x6_float", 4, 16, 10, 6, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC8X8_FLOAT, "SP_FORMAT_ASTC8X8_FLOAT", "astc8x8_float", 4, 16, 8, 8, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC10X8_FLOAT, "SP_FORMAT_ASTC10X8_FLOAT", "astc10x8_float", 4, 16, 10, 8, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC10X10_FLOAT, "SP_FORMAT_ASTC10X10_FLOAT", "astc10x10_float", 4, 16, 10, 10, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC12X10_FLOAT, "SP_FORMAT_ASTC12X10_FLOAT", "astc12x10_float", 4, 16, 12, 10, SP_FORMAT_FLAG_FLOAT },
+	{ SP_FORMAT_ASTC12X12_FLOAT, "SP_FORMAT_ASTC12X12_FLOAT", "astc12x12_float", 4, 16, 12, 12, SP_FORMAT_FLAG_FLOAT },
 };
 
 sp_format sp_find_format(uint32_t num_components, uint32_t component_size, sp_format_flags flags)
@@ -205,17 +227,225 @@ sp_format sp_find_format(uint32_t num_components, uint32_t component_size, sp_fo
 	return SP_FORMAT_UNKNOWN;
 }
 
+// -- Block split
+
+static size_t sp_compress_zstd(void *dst, size_t dst_size, const void *src, size_t src_size, int level, int num_workers);
+
+static bool sp_block_split_valid(const sp_block_split *split)
+{
+	return split->block_size >= 1 && split->block_size <= 32;
+}
+
+static void sp_block_split_planes(const sp_block_split *split, uint8_t *dst, const uint8_t *src, size_t size)
+{
+	size_t block_size = split->block_size;
+	size_t num_blocks = size / block_size;
+	for (size_t p = 0; p < block_size; p++) {
+		uint8_t *plane = dst + p * num_blocks;
+		bool delta = (split->delta_mask >> p) & 1;
+		uint8_t prev = 0;
+		for (size_t i = 0; i < num_blocks; i++) {
+			uint8_t value = src[i * block_size + p];
+			plane[i] = delta ? (uint8_t)(value - prev) : value;
+			prev = value;
+		}
+	}
+	memcpy(dst + num_blocks * block_size, src + num_blocks * block_size, size - num_blocks * block_size);
+}
+
+// Prefix sum of a delta coded plane in place
+static void sp_block_undelta(uint8_t *data, size_t size)
+{
+	size_t i = 0;
+	uint8_t prev = 0;
+#if SP_SSE2
+	__m128i carry = _mm_setzero_si128();
+	for (; i + 16 <= size; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(data + i));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi8(x, carry);
+		_mm_storeu_si128((__m128i*)(data + i), x);
+
+		// Broadcast the last byte to all lanes
+		carry = _mm_unpackhi_epi8(x, x);
+		carry = _mm_shufflehi_epi16(carry, 0xff);
+		carry = _mm_shuffle_epi32(carry, 0xff);
+	}
+	if (i > 0) prev = data[i - 1];
+#endif
+	for (; i < size; i++) {
+		prev = (uint8_t)(prev + data[i]);
+		data[i] = prev;
+	}
+}
+
+// Interleave blocks `[first, first + count)` from the planes to `dst`
+static void sp_block_merge(uint8_t *dst, const uint8_t *planes, size_t num_blocks, uint32_t block_size, size_t first, size_t count)
+{
+	size_t i = first, end = first + count;
+#if SP_SSE2
+	// Transpose 16 blocks at a time: interleaving rows `k` and `k + n/2`
+	// rotates the bits of the (row, column) byte index by one, 4 rounds
+	// transpose 16x16 bytes and 3 rounds turn 8 planes into 16 8-byte blocks.
+	if (block_size == 16 || block_size == 8) {
+		uint32_t half = block_size / 2;
+		int rounds = block_size == 16 ? 4 : 3;
+		for (; i + 16 <= end; i += 16) {
+			__m128i r[16], t[16];
+			for (uint32_t p = 0; p < block_size; p++) {
+				r[p] = _mm_loadu_si128((const __m128i*)(planes + p * num_blocks + i));
+			}
+			for (int round = 0; round < rounds; round++) {
+				for (uint32_t k = 0; k < half; k++) {
+					t[2 * k + 0] = _mm_unpacklo_epi8(r[k], r[k + half]);
+					t[2 * k + 1] = _mm_unpackhi_epi8(r[k], r[k + half]);
+				}
+				for (uint32_t p = 0; p < block_size; p++) r[p] = t[p];
+			}
+			uint8_t *d = dst + (i - first) * block_size;
+			for (uint32_t p = 0; p < block_size; p++) {
+				_mm_storeu_si128((__m128i*)(d + p * 16), r[p]);
+			}
+		}
+	}
+#endif
+	for (; i < end; i++) {
+		uint8_t *d = dst + (i - first) * block_size;
+		for (uint32_t p = 0; p < block_size; p++) {
+			d[p] = planes[p * num_blocks + i];
+		}
+	}
+}
+
+// Undo the block split for bytes `[offset, offset + size)` of `total_size`,
+// the delta coded planes are restored in place
+static void sp_block_unsplit(const sp_block_split *split, uint8_t *dst, uint8_t *planes, size_t total_size, size_t offset, size_t size)
+{
+	uint32_t block_size = split->block_size;
+	size_t num_blocks = total_size / block_size;
+	for (uint32_t p = 0; p < block_size; p++) {
+		if ((split->delta_mask >> p) & 1) sp_block_undelta(planes + p * num_blocks, num_blocks);
+	}
+
+	size_t end = offset + size;
+	size_t first_block = (offset + block_size - 1) / block_size;
+	size_t end_block = end / block_size < num_blocks ? end / block_size : num_blocks;
+	if (first_block < end_block) {
+		sp_block_merge(dst + (first_block * block_size - offset), planes, num_blocks, block_size, first_block, end_block - first_block);
+	}
+
+	// Partial blocks at the ends of the range and trailing bytes
+	for (size_t pos = offset; pos < end; pos++) {
+		size_t block = pos / block_size;
+		if (block >= first_block && block < end_block) {
+			pos = end_block * block_size - 1;
+			continue;
+		}
+		dst[pos - offset] = block < num_blocks ? planes[(pos % block_size) * num_blocks + block] : planes[pos];
+	}
+}
+
+size_t sp_compress_buffer_block_split(const sp_block_split *split, void *dst, size_t dst_size, const void *src, size_t src_size, int level, int num_workers)
+{
+	if (level < 1) level = 1;
+	if (level > 20) level = 20;
+	if (dst_size < sizeof(sp_block_split) || !sp_block_split_valid(split)) return 0;
+
+	uint8_t *planes = (uint8_t*)malloc(src_size > 0 ? src_size : 1);
+	if (!planes) return 0;
+	sp_block_split_planes(split, planes, (const uint8_t*)src, src_size);
+	size_t res = sp_compress_zstd((char*)dst + sizeof(sp_block_split), dst_size - sizeof(sp_block_split), planes, src_size, level, num_workers);
+	free(planes);
+	if (ZSTD_isError(res)) return res;
+
+	memcpy(dst, split, sizeof(sp_block_split));
+	return sizeof(sp_block_split) + res;
+}
+
+static size_t sp_decompress_block_split(void *dst, size_t dst_size, const void *src, size_t src_size)
+{
+	sp_block_split split;
+	if (src_size < sizeof(sp_block_split)) return 0;
+	memcpy(&split, src, sizeof(sp_block_split));
+	if (!sp_block_split_valid(&split)) return 0;
+
+	uint8_t *planes = (uint8_t*)malloc(dst_size > 0 ? dst_size : 1);
+	if (!planes) return 0;
+	size_t size = ZSTD_decompress(planes, dst_size, (const char*)src + sizeof(sp_block_split), src_size - sizeof(sp_block_split));
+	if (!ZSTD_isError(size)) {
+		sp_block_unsplit(&split, (uint8_t*)dst, planes, size, 0, size);
+	} else {
+		size = 0;
+	}
+	free(planes);
+	return size;
+}
+
+// -- Compression
+
+// Sections smaller than this are always compressed on the calling thread
+#define SP_COMPRESS_MT_MIN_SIZE (1024 * 1024)
+
+// Fixed zstd job size for larger sections, the frame is split into the same
+// jobs regardless of the number of workers so the output is identical
+#define SP_COMPRESS_JOB_SIZE (4 * 1024 * 1024)
+
+// Compress a single zstd frame. Sections of at least `SP_COMPRESS_MT_MIN_SIZE`
+// are split into `SP_COMPRESS_JOB_SIZE` jobs compressed on up to `num_workers`
+// threads, the number of workers only affects the speed.
+static size_t sp_compress_zstd(void *dst, size_t dst_size, const void *src, size_t src_size, int level, int num_workers)
+{
+	if (src_size < SP_COMPRESS_MT_MIN_SIZE) {
+		return ZSTD_compress(dst, dst_size, src, src_size, level - 1);
+	}
+
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	if (!cctx) return 0;
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level - 1);
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, num_workers > 1 ? num_workers : 1);
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_jobSize, SP_COMPRESS_JOB_SIZE);
+	ZSTD_CCtx_setPledgedSrcSize(cctx, src_size);
+
+	// Stream all input before ending the frame: ending on the first call takes
+	// a single-pass path that splits the jobs based on the number of workers
+	ZSTD_inBuffer input = { src, src_size, 0 };
+	ZSTD_outBuffer output = { dst, dst_size, 0 };
+	size_t res = 0;
+	while (input.pos < input.size) {
+		res = ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_continue);
+		if (ZSTD_isError(res)) break;
+	}
+	while (!ZSTD_isError(res)) {
+		res = ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_end);
+		if (res == 0) {
+			res = output.pos;
+			break;
+		}
+		if (output.pos == output.size) {
+			res = (size_t)-1; // Out of space, a generic zstd error code
+		}
+	}
+
+	ZSTD_freeCCtx(cctx);
+	return res;
+}
+
 size_t sp_get_compression_bound(sp_compression_type type, size_t src_size)
 {
 	switch (type)
 	{
 	case SP_COMPRESSION_NONE: return src_size;
 	case SP_COMPRESSION_ZSTD: return ZSTD_compressBound(src_size);
+	case SP_COMPRESSION_ZSTD_DICT: return sizeof(uint32_t) + ZSTD_compressBound(src_size);
+	case SP_COMPRESSION_BLOCK_SPLIT: return sizeof(sp_block_split) + ZSTD_compressBound(src_size);
 	default: return 0;
 	}
 }
 
-size_t sp_compress_buffer(sp_compression_type type, void *dst, size_t dst_size, const void *src, size_t src_size, int level)
+size_t sp_compress_buffer(sp_compression_type type, void *dst, size_t dst_size, const void *src, size_t src_size, int level, int num_workers)
 {
 	if (level < 1) level = 1;
 	if (level > 20) level = 20;
@@ -226,11 +456,34 @@ size_t sp_compress_buffer(sp_compression_type type, void *dst, size_t dst_size,
 		memcpy(dst, src, src_size);
 		return src_size;
 	case SP_COMPRESSION_ZSTD:
-		return ZSTD_compress(dst, dst_size, src, src_size, level - 1);
+		return sp_compress_zstd(dst, dst_size, src, src_size, level, num_workers);
 	default: return 0;
 	}
 }
 
+static size_t sp_decompress_chunked(void *dst, size_t dst_size, const void *src, size_t src_size)
+{
+	spfile_chunk_table table;
+	if (src_size < sizeof(spfile_chunk_table)) return 0;
+	memcpy(&table, src, sizeof(spfile_chunk_table));
+	if (src_size < sizeof(spfile_chunk_table) + (uint64_t)table.num_chunks * sizeof(spfile_chunk)) return 0;
+
+	size_t total_size = 0;
+	const spfile_chunk *chunks = (const spfile_chunk*)((const char*)src + sizeof(spfile_chunk_table));
+	for (uint32_t i = 0; i < table.num_chunks; i++) {
+		spfile_chunk chunk;
+		memcpy(&chunk, &chunks[i], sizeof(spfile_chunk));
+		if (chunk.compression_type == SP_COMPRESSION_CHUNKED) return 0;
+		if ((uint64_t)chunk.offset + chunk.compressed_size > src_size) return 0;
+		if ((uint64_t)chunk.uncompressed_offset + chunk.uncompressed_size > dst_size) return 0;
+		size_t size = sp_decompress_buffer(chunk.compression_type, (char*)dst + chunk.uncompressed_offset, chunk.uncompressed_size,
+			(const char*)src + chunk.offset, chunk.compressed_size);
+		if (size != chunk.uncompressed_size) return 0;
+		total_size += size;
+	}
+	return total_size;
+}
+
 size_t sp_decompress_buffer(sp_compression_type type, void *dst, size_t dst_size, const void *src, size_t src_size)
 {
 	switch (type)
@@ -241,7 +494,973 @@ size_t sp_decompress_buffer(sp_compression_type type, void *dst, size_t dst_size
 		return src_size;
 	case SP_COMPRESSION_ZSTD:
 		return ZSTD_decompress(dst, dst_size, src, src_size);
+	case SP_COMPRESSION_CHUNKED:
+		return sp_decompress_chunked(dst, dst_size, src, src_size);
+	case SP_COMPRESSION_BLOCK_SPLIT:
+		return sp_decompress_block_split(dst, dst_size, src, src_size);
 	default: return 0;
 	}
 }
 
+
+// -- spfile_dict
+
+bool spfile_dict_init(spfile_dict *dict, const void *data, size_t size)
+{
+	memset(dict, 0, sizeof(spfile_dict));
+
+	spfile_util su;
+	if (!spfile_util_init(&su, data, size)) return false;
+
+	spdict_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(&header, data, size < sizeof(header) ? size : sizeof(header));
+	bool ok = header.header.magic == SPFILE_HEADER_SPDICT && header.header.header_info_size == sizeof(spdict_info)
+		&& header.header.num_sections >= 1 && header.s_dict.magic == SPFILE_SECTION_DICT
+		&& header.s_dict.compression_type == SP_COMPRESSION_NONE && header.s_dict.uncompressed_size > 0;
+	const void *dict_data = ok ? spfile_decode_section(&su, &header.s_dict) : NULL;
+	spfile_util_free(&su);
+	if (!dict_data) return false;
+
+	dict->id = header.info.dict_id;
+	dict->data = dict_data;
+	dict->size = header.s_dict.uncompressed_size;
+	dict->ddict = ZSTD_createDDict_advanced(dict->data, dict->size, ZSTD_dlm_byRef, ZSTD_dct_rawContent, ZSTD_defaultCMem);
+	return dict->ddict != NULL;
+}
+
+void spfile_dict_free(spfile_dict *dict)
+{
+	if (dict->ddict) ZSTD_freeDDict((ZSTD_DDict*)dict->ddict);
+	memset(dict, 0, sizeof(spfile_dict));
+}
+
+size_t sp_compress_buffer_dict(const spfile_dict *dict, void *dst, size_t dst_size, const void *src, size_t src_size, int level)
+{
+	if (level < 1) level = 1;
+	if (level > 20) level = 20;
+	if (dst_size < sizeof(uint32_t)) return 0;
+
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+	if (!cctx) return 0;
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level - 1);
+	ZSTD_CCtx_loadDictionary_advanced(cctx, dict->data, dict->size, ZSTD_dlm_byRef, ZSTD_dct_rawContent);
+	size_t res = ZSTD_compress2(cctx, (char*)dst + sizeof(uint32_t), dst_size - sizeof(uint32_t), src, src_size);
+	ZSTD_freeCCtx(cctx);
+	if (ZSTD_isError(res)) return res;
+
+	memcpy(dst, &dict->id, sizeof(uint32_t));
+	return sizeof(uint32_t) + res;
+}
+
+size_t sp_decompress_buffer_dict(const spfile_dict *dict, void *dst, size_t dst_size, const void *src, size_t src_size)
+{
+	uint32_t dict_id;
+	if (src_size < sizeof(uint32_t)) return 0;
+	memcpy(&dict_id, src, sizeof(uint32_t));
+	if (dict_id != dict->id) return 0;
+
+	ZSTD_DCtx *dctx = ZSTD_createDCtx();
+	if (!dctx) return 0;
+	size_t res = ZSTD_decompress_usingDDict(dctx, dst, dst_size, (const char*)src + sizeof(uint32_t), src_size - sizeof(uint32_t), (const ZSTD_DDict*)dict->ddict);
+	ZSTD_freeDCtx(dctx);
+	return res;
+}
+
+// -- spfile_writer
+
+// Staging buffers are aligned for unbuffered I/O
+#define SPFILE_WRITER_ALIGN 4096
+
+static bool spfile_writer_fail(spfile_writer *w)
+{
+	w->failed = true;
+	return false;
+}
+
+static bool spfile_writer_flush(spfile_writer *w)
+{
+	if (w->buffer_pos == 0) return true;
+	if (fwrite(w->buffer, 1, w->buffer_pos, w->file) != w->buffer_pos) return spfile_writer_fail(w);
+	w->flushed_offset += w->buffer_pos;
+	w->buffer_pos = 0;
+	return true;
+}
+
+bool spfile_writer_init(spfile_writer *w, FILE *file, const spfile_header *header, size_t write_block_size)
+{
+	memset(w, 0, sizeof(spfile_writer));
+	w->file = file;
+	w->header = *header;
+	w->write_block_size = write_block_size;
+	if (!file) return spfile_writer_fail(w);
+
+	w->sections = (spfile_section*)calloc(header->num_sections > 0 ? header->num_sections : 1, sizeof(spfile_section));
+	if (!w->sections) return spfile_writer_fail(w);
+
+	if (write_block_size > 0) {
+		w->buffer_alloc = (char*)malloc(write_block_size + SPFILE_WRITER_ALIGN);
+		if (!w->buffer_alloc) return spfile_writer_fail(w);
+		w->buffer = (char*)(((uintptr_t)w->buffer_alloc + SPFILE_WRITER_ALIGN - 1) & ~(uintptr_t)(SPFILE_WRITER_ALIGN - 1));
+		setvbuf(file, NULL, _IONBF, 0);
+	}
+
+	// Reserve space for the header, written by `spfile_writer_finish()`
+	size_t header_size = sizeof(spfile_header) + header->header_info_size + header->num_sections * sizeof(spfile_section);
+	static const char zero_buf[256] = { 0 };
+	while (header_size > 0 && !w->failed) {
+		size_t size = header_size < sizeof(zero_buf) ? header_size : sizeof(zero_buf);
+		spfile_writer_write(w, zero_buf, size);
+		header_size -= size;
+	}
+	return !w->failed;
+}
+
+bool spfile_writer_write(spfile_writer *w, const void *data, size_t size)
+{
+	if (w->failed) return false;
+	w->offset += size;
+
+	if (!w->buffer) {
+		if (fwrite(data, 1, size, w->file) != size) return spfile_writer_fail(w);
+		w->flushed_offset += size;
+		return true;
+	}
+
+	const char *src = (const char*)data;
+	while (size > 0) {
+		size_t to_copy = w->write_block_size - w->buffer_pos;
+		if (to_copy > size) to_copy = size;
+		memcpy(w->buffer + w->buffer_pos, src, to_copy);
+		w->buffer_pos += to_copy;
+		src += to_copy;
+		size -= to_copy;
+		if (w->buffer_pos == w->write_block_size && !spfile_writer_flush(w)) return false;
+	}
+	return true;
+}
+
+bool spfile_writer_pad(spfile_writer *w, size_t align)
+{
+	static const char zero_buf[64] = { 0 };
+	size_t pad = (size_t)((align - w->offset % align) % align);
+	while (pad > 0) {
+		size_t size = pad < sizeof(zero_buf) ? pad : sizeof(zero_buf);
+		if (!spfile_writer_write(w, zero_buf, size)) return false;
+		pad -= size;
+	}
+	return !w->failed;
+}
+
+bool spfile_writer_add_section(spfile_writer *w, uint32_t section_index, const spfile_section *s, const void *data)
+{
+	if (section_index >= w->header.num_sections) return spfile_writer_fail(w);
+	if (!spfile_writer_pad(w, 16)) return false;
+	if (w->offset + s->compressed_size > UINT32_MAX) return spfile_writer_fail(w);
+
+	spfile_section *dst = &w->sections[section_index];
+	*dst = *s;
+	dst->offset = (uint32_t)w->offset;
+	return spfile_writer_write(w, data, s->compressed_size);
+}
+
+bool spfile_writer_finish(spfile_writer *w, const void *info)
+{
+	if (w->failed) return false;
+
+	size_t info_size = w->header.header_info_size;
+	size_t sections_size = w->header.num_sections * sizeof(spfile_section);
+	if (w->flushed_offset == 0) {
+		// Everything is still staged, patch the header in place
+		memcpy(w->buffer, &w->header, sizeof(spfile_header));
+		memcpy(w->buffer + sizeof(spfile_header), info, info_size);
+		memcpy(w->buffer + sizeof(spfile_header) + info_size, w->sections, sections_size);
+		return spfile_writer_flush(w);
+	}
+
+	if (!spfile_writer_flush(w)) return false;
+	if (fseek(w->file, 0, SEEK_SET) != 0) return spfile_writer_fail(w);
+	if (fwrite(&w->header, 1, sizeof(spfile_header), w->file) != sizeof(spfile_header)) return spfile_writer_fail(w);
+	if (fwrite(info, 1, info_size, w->file) != info_size) return spfile_writer_fail(w);
+	if (fwrite(w->sections, 1, sections_size, w->file) != sections_size) return spfile_writer_fail(w);
+	if (fseek(w->file, 0, SEEK_END) != 0) return spfile_writer_fail(w);
+	return true;
+}
+
+void spfile_writer_free(spfile_writer *w)
+{
+	free(w->sections);
+	free(w->buffer_alloc);
+	memset(w, 0, sizeof(spfile_writer));
+}
+
+// -- spfile_util
+
+// Allocations returned by non-`_to` decode functions are linked through
+// `page_to_free`, the 16 byte prefix keeps the returned data aligned.
+#define SPFILE_PAGE_HEADER_SIZE 16
+
+static bool spfile_fail(spfile_util *su)
+{
+	su->failed = true;
+	return false;
+}
+
+static void *spfile_alloc(spfile_util *su, size_t size)
+{
+	char *page = (char*)malloc(SPFILE_PAGE_HEADER_SIZE + size);
+	if (!page) {
+		spfile_fail(su);
+		return NULL;
+	}
+	*(void**)page = su->page_to_free;
+	su->page_to_free = page;
+	return page + SPFILE_PAGE_HEADER_SIZE;
+}
+
+static spfile_header spfile_get_header(const spfile_util *su)
+{
+	spfile_header header = { 0 };
+	if (su->data) memcpy(&header, su->data, sizeof(spfile_header));
+	return header;
+}
+
+static bool spfile_get_section(spfile_util *su, uint32_t index, spfile_section *s)
+{
+	spfile_header header = spfile_get_header(su);
+	if (!su->data || index >= header.num_sections) return spfile_fail(su);
+	size_t offset = sizeof(spfile_header) + header.header_info_size + index * sizeof(spfile_section);
+	memcpy(s, (const char*)su->data + offset, sizeof(spfile_section));
+	return true;
+}
+
+static bool spfile_get_section_magic(spfile_util *su, uint32_t index, spfile_section_magic magic, spfile_section *s)
+{
+	if (!spfile_get_section(su, index, s)) return false;
+	if (s->magic != magic) return spfile_fail(su);
+	return true;
+}
+
+// Copy the header, info and sections into a typed header struct, missing
+// fields are left zero
+static void spfile_decode_header_to(spfile_util *su, void *dst, size_t dst_size, size_t info_size)
+{
+	memset(dst, 0, dst_size);
+	if (!su->data) return;
+
+	spfile_header header = spfile_get_header(su);
+	const char *src = (const char*)su->data;
+	char *d = (char*)dst;
+	memcpy(d, src, sizeof(spfile_header));
+
+	size_t copy_info = header.header_info_size < info_size ? header.header_info_size : info_size;
+	memcpy(d + sizeof(spfile_header), src + sizeof(spfile_header), copy_info);
+
+	size_t max_sections = (dst_size - sizeof(spfile_header) - info_size) / sizeof(spfile_section);
+	size_t num_sections = header.num_sections < max_sections ? header.num_sections : max_sections;
+	memcpy(d + sizeof(spfile_header) + info_size, src + sizeof(spfile_header) + header.header_info_size, num_sections * sizeof(spfile_section));
+}
+
+static bool spfile_check_section(spfile_util *su, const spfile_section *s)
+{
+	if (!su->data) return spfile_fail(su);
+	if ((uint64_t)s->offset + s->compressed_size > su->size) return spfile_fail(su);
+	switch (s->compression_type) {
+	case SP_COMPRESSION_NONE:
+		if (s->compressed_size != s->uncompressed_size) return spfile_fail(su);
+		return true;
+	case SP_COMPRESSION_ZSTD:
+	case SP_COMPRESSION_CHUNKED:
+		return true;
+	case SP_COMPRESSION_ZSTD_DICT:
+		if (s->compressed_size < sizeof(uint32_t)) return spfile_fail(su);
+		return true;
+	case SP_COMPRESSION_BLOCK_SPLIT: {
+		sp_block_split split;
+		if (s->compressed_size < sizeof(sp_block_split)) return spfile_fail(su);
+		memcpy(&split, (const char*)su->data + s->offset, sizeof(sp_block_split));
+		if (!sp_block_split_valid(&split)) return spfile_fail(su);
+		return true;
+	}
+	default:
+		return spfile_fail(su);
+	}
+}
+
+// Get a chunk of a `SP_COMPRESSION_CHUNKED` section as a standalone section
+static bool spfile_get_chunk_section(spfile_util *su, const spfile_section *s, uint32_t index, spfile_section *dst, spfile_chunk *chunk)
+{
+	if (!spfile_get_chunk(su, s, index, chunk)) return false;
+	dst->magic = s->magic;
+	dst->compression_type = chunk->compression_type;
+	dst->index = s->index;
+	dst->offset = s->offset + chunk->offset;
+	dst->uncompressed_size = chunk->uncompressed_size;
+	dst->compressed_size = chunk->compressed_size;
+	return true;
+}
+
+static ZSTD_DCtx *spfile_get_dctx(spfile_util *su)
+{
+	if (!su->dctx) {
+		su->dctx = ZSTD_createDCtx();
+		if (!su->dctx) spfile_fail(su);
+	}
+	return (ZSTD_DCtx*)su->dctx;
+}
+
+static const spfile_dict *spfile_find_dict(spfile_util *su, uint32_t dict_id)
+{
+	for (size_t i = 0; i < su->num_dicts; i++) {
+		if (su->dicts[i].id == dict_id) return &su->dicts[i];
+	}
+	return NULL;
+}
+
+// Decode `[offset, offset + size)` of a zstd frame of `total_size` bytes.
+// Data before `offset` is streamed through a small scratch buffer so the
+// rest of the frame is never materialized.
+static bool spfile_zstd_decode(spfile_util *su, const char *src, size_t src_size, const ZSTD_DDict *ddict, void *buffer, size_t offset, size_t size, size_t total_size)
+{
+	ZSTD_DCtx *dctx = spfile_get_dctx(su);
+	if (!dctx) return false;
+
+	if (offset == 0 && size == total_size) {
+		size_t res = ddict
+			? ZSTD_decompress_usingDDict(dctx, buffer, size, src, src_size, ddict)
+			: ZSTD_decompress_usingDict(dctx, buffer, size, src, src_size, NULL, 0);
+		if (ZSTD_isError(res) || res != size) return spfile_fail(su);
+		return true;
+	}
+
+	ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+	ZSTD_DCtx_refDDict(dctx, ddict);
+	ZSTD_inBuffer input = { src, src_size, 0 };
+
+	bool ok = true;
+	char scratch[16*1024];
+	size_t skipped = 0;
+	while (ok && skipped < offset) {
+		size_t to_skip = offset - skipped;
+		ZSTD_outBuffer output = { scratch, to_skip < sizeof(scratch) ? to_skip : sizeof(scratch), 0 };
+		size_t res = ZSTD_decompressStream(dctx, &output, &input);
+		if (ZSTD_isError(res) || (res == 0 && output.pos < output.size)) ok = false;
+		skipped += output.pos;
+	}
+
+	ZSTD_outBuffer output = { buffer, size, 0 };
+	while (ok && output.pos < output.size) {
+		size_t res = ZSTD_decompressStream(dctx, &output, &input);
+		if (ZSTD_isError(res) || (res == 0 && output.pos < output.size)) ok = false;
+	}
+
+	ZSTD_DCtx_refDDict(dctx, NULL);
+	if (!ok) return spfile_fail(su);
+	return true;
+}
+
+// Decode `size` bytes starting from `offset` of the uncompressed section.
+static bool spfile_decode_range_to(spfile_util *su, const spfile_section *s, void *buffer, size_t offset, size_t size)
+{
+	if (!spfile_check_section(su, s)) return false;
+	if ((uint64_t)offset + size > s->uncompressed_size) return spfile_fail(su);
+	if (size == 0) return true;
+
+	const char *src = (const char*)su->data + s->offset;
+	switch (s->compression_type) {
+	case SP_COMPRESSION_NONE:
+		memcpy(buffer, src + offset, size);
+		return true;
+	case SP_COMPRESSION_ZSTD:
+		return spfile_zstd_decode(su, src, s->compressed_size, NULL, buffer, offset, size, s->uncompressed_size);
+	case SP_COMPRESSION_ZSTD_DICT: {
+		uint32_t dict_id;
+		memcpy(&dict_id, src, sizeof(uint32_t));
+		const spfile_dict *dict = spfile_find_dict(su, dict_id);
+		if (!dict) return spfile_fail(su);
+		return spfile_zstd_decode(su, src + sizeof(uint32_t), s->compressed_size - sizeof(uint32_t), (const ZSTD_DDict*)dict->ddict, buffer, offset, size, s->uncompressed_size);
+	}
+	case SP_COMPRESSION_BLOCK_SPLIT: {
+		// Planes span the whole section so it is always decoded fully
+		sp_block_split split;
+		memcpy(&split, src, sizeof(sp_block_split));
+		uint8_t *planes = (uint8_t*)malloc(s->uncompressed_size);
+		if (!planes) return spfile_fail(su);
+		bool ok = spfile_zstd_decode(su, src + sizeof(sp_block_split), s->compressed_size - sizeof(sp_block_split), NULL, planes, 0, s->uncompressed_size, s->uncompressed_size);
+		if (ok) sp_block_unsplit(&split, (uint8_t*)buffer, planes, s->uncompressed_size, offset, size);
+		free(planes);
+		return ok;
+	}
+	case SP_COMPRESSION_CHUNKED: {
+		// Decode the parts of the chunks that overlap the range
+		uint32_t num_chunks = spfile_get_num_chunks(su, s);
+		for (uint32_t i = 0; i < num_chunks; i++) {
+			spfile_section cs;
+			spfile_chunk chunk;
+			if (!spfile_get_chunk_section(su, s, i, &cs, &chunk)) return false;
+			size_t begin = offset > chunk.uncompressed_offset ? offset : chunk.uncompressed_offset;
+			size_t end = (size_t)chunk.uncompressed_offset + chunk.uncompressed_size;
+			if (end > offset + size) end = offset + size;
+			if (begin >= end) continue;
+			if (!spfile_decode_range_to(su, &cs, (char*)buffer + (begin - offset), begin - chunk.uncompressed_offset, end - begin)) return false;
+		}
+		return true;
+	}
+	default:
+		return spfile_fail(su);
+	}
+}
+
+static void *spfile_decode_range(spfile_util *su, const spfile_section *s, size_t offset, size_t size)
+{
+	if (!spfile_check_section(su, s)) return NULL;
+	if ((uint64_t)offset + size > s->uncompressed_size) {
+		spfile_fail(su);
+		return NULL;
+	}
+
+	if (s->compression_type == SP_COMPRESSION_NONE) {
+		return (char*)su->data + s->offset + offset;
+	}
+
+	void *buffer = spfile_alloc(su, size);
+	if (!buffer) return NULL;
+	if (!spfile_decode_range_to(su, s, buffer, offset, size)) return NULL;
+	return buffer;
+}
+
+bool spfile_util_init(spfile_util *su, const void *data, size_t size)
+{
+	memset(su, 0, sizeof(spfile_util));
+	if (!data || size < sizeof(spfile_header)) return spfile_fail(su);
+
+	spfile_header header;
+	memcpy(&header, data, sizeof(spfile_header));
+	uint64_t header_size = sizeof(spfile_header) + (uint64_t)header.header_info_size + (uint64_t)header.num_sections * sizeof(spfile_section);
+	if (header_size > size) return spfile_fail(su);
+
+	su->data = data;
+	su->size = size;
+	return true;
+}
+
+bool spfile_decode_section_to(spfile_util *su, const spfile_section *s, void *buffer)
+{
+	return spfile_decode_range_to(su, s, buffer, 0, s->uncompressed_size);
+}
+
+void *spfile_decode_section(spfile_util *su, const spfile_section *s)
+{
+	return spfile_decode_range(su, s, 0, s->uncompressed_size);
+}
+
+bool spfile_decode_strings_to(spfile_util *su, const spfile_section *s, char *buffer)
+{
+	if (!spfile_decode_section_to(su, s, buffer)) return false;
+	su->strings = buffer;
+	su->strings_size = s->uncompressed_size;
+	return true;
+}
+
+char *spfile_decode_strings(spfile_util *su, const spfile_section *s)
+{
+	char *strings = (char*)spfile_decode_section(su, s);
+	if (!strings) return NULL;
+	su->strings = strings;
+	su->strings_size = s->uncompressed_size;
+	return strings;
+}
+
+bool spfile_util_failed(spfile_util *su)
+{
+	return su->failed;
+}
+
+void spfile_util_set_dicts(spfile_util *su, const spfile_dict *dicts, size_t num_dicts)
+{
+	su->dicts = dicts;
+	su->num_dicts = num_dicts;
+}
+
+uint32_t spfile_get_num_chunks(spfile_util *su, const spfile_section *s)
+{
+	if (!spfile_check_section(su, s)) return 0;
+	if (s->compression_type != SP_COMPRESSION_CHUNKED) return 1;
+
+	spfile_chunk_table table;
+	if (s->compressed_size < sizeof(spfile_chunk_table)) {
+		spfile_fail(su);
+		return 0;
+	}
+	memcpy(&table, (const char*)su->data + s->offset, sizeof(spfile_chunk_table));
+	if (s->compressed_size < sizeof(spfile_chunk_table) + (uint64_t)table.num_chunks * sizeof(spfile_chunk)) {
+		spfile_fail(su);
+		return 0;
+	}
+	return table.num_chunks;
+}
+
+bool spfile_get_chunk(spfile_util *su, const spfile_section *s, uint32_t index, spfile_chunk *chunk)
+{
+	uint32_t num_chunks = spfile_get_num_chunks(su, s);
+	if (index >= num_chunks) return spfile_fail(su);
+
+	if (s->compression_type != SP_COMPRESSION_CHUNKED) {
+		chunk->compression_type = s->compression_type;
+		chunk->offset = 0;
+		chunk->compressed_size = s->compressed_size;
+		chunk->uncompressed_offset = 0;
+		chunk->uncompressed_size = s->uncompressed_size;
+		return true;
+	}
+
+	const char *src = (const char*)su->data + s->offset + sizeof(spfile_chunk_table) + index * sizeof(spfile_chunk);
+	memcpy(chunk, src, sizeof(spfile_chunk));
+	if (chunk->compression_type == SP_COMPRESSION_CHUNKED) return spfile_fail(su);
+	if ((uint64_t)chunk->offset + chunk->compressed_size > s->compressed_size) return spfile_fail(su);
+	if ((uint64_t)chunk->uncompressed_offset + chunk->uncompressed_size > s->uncompressed_size) return spfile_fail(su);
+	return true;
+}
+
+bool spfile_decode_chunk_to(spfile_util *su, const spfile_section *s, uint32_t index, void *buffer)
+{
+	spfile_section cs;
+	spfile_chunk chunk;
+	if (!spfile_get_chunk_section(su, s, index, &cs, &chunk)) return false;
+	return spfile_decode_range_to(su, &cs, buffer, 0, cs.uncompressed_size);
+}
+
+void *spfile_decode_chunk(spfile_util *su, const spfile_section *s, uint32_t index)
+{
+	spfile_section cs;
+	spfile_chunk chunk;
+	if (!spfile_get_chunk_section(su, s, index, &cs, &chunk)) return NULL;
+	return spfile_decode_range(su, &cs, 0, cs.uncompressed_size);
+}
+
+bool spfile_decode_section_data_to(spfile_util *su, const spfile_section *s, const void *data, void *buffer)
+{
+	// Temporarily view `data` as the file with the section at offset 0
+	const void *prev_data = su->data;
+	size_t prev_size = su->size;
+	spfile_section local = *s;
+	local.offset = 0;
+	su->data = data;
+	su->size = s->compressed_size;
+	bool ok = spfile_decode_range_to(su, &local, buffer, 0, s->uncompressed_size);
+	su->data = prev_data;
+	su->size = prev_size;
+	return ok;
+}
+
+void spfile_util_free(spfile_util *su)
+{
+	void *page = su->page_to_free;
+	while (page) {
+		void *next = *(void**)page;
+		free(page);
+		page = next;
+	}
+	if (su->dctx) ZSTD_freeDCtx((ZSTD_DCtx*)su->dctx);
+	memset(su, 0, sizeof(spfile_util));
+}
+
+static bool spfile_util_init_magic(spfile_util *su, const void *data, size_t size, spfile_header_magic magic)
+{
+	if (!spfile_util_init(su, data, size)) return false;
+	if (spfile_get_header(su).magic != magic) {
+		su->data = NULL;
+		su->size = 0;
+		return spfile_fail(su);
+	}
+	return true;
+}
+
+static bool spfile_decode_index_to(spfile_util *su, uint32_t index, spfile_section_magic magic, void *buffer)
+{
+	spfile_section s;
+	if (!spfile_get_section_magic(su, index, magic, &s)) return false;
+	return spfile_decode_section_to(su, &s, buffer);
+}
+
+static void *spfile_decode_index(spfile_util *su, uint32_t index, spfile_section_magic magic)
+{
+	spfile_section s;
+	if (!spfile_get_section_magic(su, index, magic, &s)) return NULL;
+	return spfile_decode_section(su, &s);
+}
+
+static bool spfile_decode_strings_index_to(spfile_util *su, uint32_t index, char *buffer)
+{
+	spfile_section s;
+	if (!spfile_get_section_magic(su, index, SPFILE_SECTION_STRINGS, &s)) return false;
+	return spfile_decode_strings_to(su, &s, buffer);
+}
+
+static char *spfile_decode_strings_index(spfile_util *su, uint32_t index)
+{
+	spfile_section s;
+	if (!spfile_get_section_magic(su, index, SPFILE_SECTION_STRINGS, &s)) return NULL;
+	return spfile_decode_strings(su, &s);
+}
+
+// -- spanim_util
+
+// Section indices, matching the order in `spanim_header`
+enum { SPANIM_BONES, SPANIM_STRINGS, SPANIM_ANIMATION };
+
+bool spanim_util_init(spanim_util *su, const void *data, size_t size)
+{
+	return spfile_util_init_magic(&su->file, data, size, SPFILE_HEADER_SPANIM);
+}
+
+bool spanim_decode_strings_to(spanim_util *su, char *buffer) { return spfile_decode_strings_index_to(&su->file, SPANIM_STRINGS, buffer); }
+bool spanim_decode_bones_to(spanim_util *su, spanim_bone *buffer) { return spfile_decode_index_to(&su->file, SPANIM_BONES, SPFILE_SECTION_BONES, buffer); }
+bool spanim_decode_animation_to(spanim_util *su, char *buffer) { return spfile_decode_index_to(&su->file, SPANIM_ANIMATION, SPFILE_SECTION_ANIMATION, buffer); }
+
+spanim_header spanim_decode_header(spanim_util *su)
+{
+	spanim_header header;
+	spfile_decode_header_to(&su->file, &header, sizeof(header), sizeof(spanim_info));
+	return header;
+}
+
+char *spanim_decode_strings(spanim_util *su) { return spfile_decode_strings_index(&su->file, SPANIM_STRINGS); }
+spanim_bone *spanim_decode_bones(spanim_util *su) { return (spanim_bone*)spfile_decode_index(&su->file, SPANIM_BONES, SPFILE_SECTION_BONES); }
+char *spanim_decode_animation(spanim_util *su) { return (char*)spfile_decode_index(&su->file, SPANIM_ANIMATION, SPFILE_SECTION_ANIMATION); }
+
+// -- spmdl_util
+
+// Section indices, matching the order in `spmdl_header`
+enum {
+	SPMDL_NODES, SPMDL_BONES, SPMDL_MATERIALS, SPMDL_MESHES, SPMDL_BVH_NODES,
+	SPMDL_BVH_TRIS, SPMDL_STRINGS, SPMDL_VERTEX, SPMDL_INDEX, SPMDL_MESHLETS,
+	SPMDL_MESHLET_BOUNDS, SPMDL_MESHLET_VERTICES, SPMDL_MESHLET_TRIANGLES,
+};
+
+bool spmdl_util_init(spmdl_util *su, const void *data, size_t size)
+{
+	if (!spfile_util_init_magic(&su->file, data, size, SPFILE_HEADER_SPMDL)) return false;
+	if (spfile_get_header(&su->file).version != SPMDL_VERSION) {
+		su->file.data = NULL;
+		su->file.size = 0;
+		return spfile_fail(&su->file);
+	}
+	return true;
+}
+
+bool spmdl_decode_strings_to(spmdl_util *su, char *buffer) { return spfile_decode_strings_index_to(&su->file, SPMDL_STRINGS, buffer); }
+bool spmdl_decode_nodes_to(spmdl_util *su, spmdl_node *buffer) { return spfile_decode_index_to(&su->file, SPMDL_NODES, SPFILE_SECTION_NODES, buffer); }
+bool spmdl_decode_bones_to(spmdl_util *su, spmdl_bone *buffer) { return spfile_decode_index_to(&su->file, SPMDL_BONES, SPFILE_SECTION_BONES, buffer); }
+bool spmdl_decode_materials_to(spmdl_util *su, spmdl_material *buffer) { return spfile_decode_index_to(&su->file, SPMDL_MATERIALS, SPFILE_SECTION_MATERIALS, buffer); }
+bool spmdl_decode_meshes_to(spmdl_util *su, spmdl_mesh *buffer) { return spfile_decode_index_to(&su->file, SPMDL_MESHES, SPFILE_SECTION_MESHES, buffer); }
+bool spmdl_decode_vertex_to(spmdl_util *su, char *buffer) { return spfile_decode_index_to(&su->file, SPMDL_VERTEX, SPFILE_SECTION_VERTEX, buffer); }
+bool spmdl_decode_index_to(spmdl_util *su, char *buffer) { return spfile_decode_index_to(&su->file, SPMDL_INDEX, SPFILE_SECTION_INDEX, buffer); }
+bool spmdl_decode_bvh_nodes_to(spmdl_util *su, spmdl_bvh_node *buffer) { return spfile_decode_index_to(&su->file, SPMDL_BVH_NODES, SPFILE_SECTION_BVH_NODES, buffer); }
+bool spmdl_decode_bvh4_nodes_to(spmdl_util *su, spmdl_bvh4_node *buffer) { return spfile_decode_index_to(&su->file, SPMDL_BVH_NODES, SPFILE_SECTION_BVH4_NODES, buffer); }
+bool spmdl_decode_bvh8_nodes_to(spmdl_util *su, spmdl_bvh8_node *buffer) { return spfile_decode_index_to(&su->file, SPMDL_BVH_NODES, SPFILE_SECTION_BVH8_NODES, buffer); }
+bool spmdl_decode_bvh_qnodes_to(spmdl_util *su, spmdl_bvh_qnode *buffer) { return spfile_decode_index_to(&su->file, SPMDL_BVH_NODES, SPFILE_SECTION_BVHQ_NODES, buffer); }
+bool spmdl_decode_bvh_tris_to(spmdl_util *su, uint32_t *buffer) { return spfile_decode_index_to(&su->file, SPMDL_BVH_TRIS, SPFILE_SECTION_BVH_TRIS, buffer); }
+bool spmdl_decode_meshlets_to(spmdl_util *su, spmdl_meshlet *buffer) { return spfile_decode_index_to(&su->file, SPMDL_MESHLETS, SPFILE_SECTION_MESHLETS, buffer); }
+bool spmdl_decode_meshlet_bounds_to(spmdl_util *su, spmdl_meshlet_bounds *buffer) { return spfile_decode_index_to(&su->file, SPMDL_MESHLET_BOUNDS, SPFILE_SECTION_MESHLET_BOUNDS, buffer); }
+bool spmdl_decode_meshlet_vertices_to(spmdl_util *su, uint32_t *buffer) { return spfile_decode_index_to(&su->file, SPMDL_MESHLET_VERTICES, SPFILE_SECTION_MESHLET_VERTICES, buffer); }
+bool spmdl_decode_meshlet_triangles_to(spmdl_util *su, uint8_t *buffer) { return spfile_decode_index_to(&su->file, SPMDL_MESHLET_TRIANGLES, SPFILE_SECTION_MESHLET_TRIANGLES, buffer); }
+
+spmdl_header spmdl_decode_header(spmdl_util *su)
+{
+	spmdl_header header;
+	spfile_decode_header_to(&su->file, &header, sizeof(header), sizeof(spmdl_info));
+	return header;
+}
+
+bool spmdl_decode_vertex_buffer_to(const spmdl_header *header, const spmdl_mesh *mesh, uint32_t stream, const char *vertex_section, void *buffer, size_t buffer_size)
+{
+	if (stream >= mesh->num_vertex_buffers || stream >= SPMDL_MAX_VERTEX_BUFFERS) return false;
+	const spmdl_buffer *buf = &mesh->vertex_buffers[stream];
+	uint64_t size = (uint64_t)mesh->num_vertices * buf->stride;
+	if (size > buffer_size) return false;
+	if ((uint64_t)buf->offset + buf->encoded_size > header->s_vertex.uncompressed_size) return false;
+	const char *src = vertex_section + buf->offset;
+
+	if (header->info.geometry_encoding == SPMDL_GEOMETRY_MESHOPT && buf->stride % 4 == 0) {
+		if (buf->stride == 0 || buf->stride > 256) return false;
+		return meshopt_decodeVertexBuffer(buffer, mesh->num_vertices, buf->stride, (const unsigned char*)src, buf->encoded_size) == 0;
+	} else {
+		if (buf->encoded_size != size) return false;
+		memcpy(buffer, src, (size_t)size);
+		return true;
+	}
+}
+
+bool spmdl_decode_index_buffer_to(const spmdl_header *header, const spmdl_mesh *mesh, uint32_t lod, const char *index_section, void *buffer, size_t buffer_size)
+{
+	if (lod > mesh->num_lods || lod > SPMDL_MAX_LODS) return false;
+	const spmdl_buffer *buf = lod > 0 ? &mesh->lods[lod - 1].index_buffer : &mesh->index_buffer;
+	uint32_t num_indices = lod > 0 ? mesh->lods[lod - 1].num_indices : mesh->num_indices;
+	uint64_t size = (uint64_t)num_indices * buf->stride;
+	if (size > buffer_size) return false;
+	if ((uint64_t)buf->offset + buf->encoded_size > header->s_index.uncompressed_size) return false;
+	const char *src = index_section + buf->offset;
+
+	if (header->info.geometry_encoding == SPMDL_GEOMETRY_MESHOPT) {
+		if (buf->stride != 2 && buf->stride != 4) return false;
+		if (num_indices % 3 != 0) return false;
+		return meshopt_decodeIndexBuffer(buffer, num_indices, buf->stride, (const unsigned char*)src, buf->encoded_size) == 0;
+	} else {
+		if (buf->encoded_size != size) return false;
+		memcpy(buffer, src, (size_t)size);
+		return true;
+	}
+}
+
+char *spmdl_decode_strings(spmdl_util *su) { return spfile_decode_strings_index(&su->file, SPMDL_STRINGS); }
+spmdl_node *spmdl_decode_nodes(spmdl_util *su) { return (spmdl_node*)spfile_decode_index(&su->file, SPMDL_NODES, SPFILE_SECTION_NODES); }
+spmdl_bone *spmdl_decode_bones(spmdl_util *su) { return (spmdl_bone*)spfile_decode_index(&su->file, SPMDL_BONES, SPFILE_SECTION_BONES); }
+spmdl_material *spmdl_decode_materials(spmdl_util *su) { return (spmdl_material*)spfile_decode_index(&su->file, SPMDL_MATERIALS, SPFILE_SECTION_MATERIALS); }
+spmdl_mesh *spmdl_decode_meshes(spmdl_util *su) { return (spmdl_mesh*)spfile_decode_index(&su->file, SPMDL_MESHES, SPFILE_SECTION_MESHES); }
+char *spmdl_decode_vertex(spmdl_util *su) { return (char*)spfile_decode_index(&su->file, SPMDL_VERTEX, SPFILE_SECTION_VERTEX); }
+char *spmdl_decode_index(spmdl_util *su) { return (char*)spfile_decode_index(&su->file, SPMDL_INDEX, SPFILE_SECTION_INDEX); }
+spmdl_bvh_node *spmdl_decode_bvh_nodes(spmdl_util *su) { return (spmdl_bvh_node*)spfile_decode_index(&su->file, SPMDL_BVH_NODES, SPFILE_SECTION_BVH_NODES); }
+spmdl_bvh4_node *spmdl_decode_bvh4_nodes(spmdl_util *su) { return (spmdl_bvh4_node*)spfile_decode_index(&su->file, SPMDL_BVH_NODES, SPFILE_SECTION_BVH4_NODES); }
+spmdl_bvh8_node *spmdl_decode_bvh8_nodes(spmdl_util *su) { return (spmdl_bvh8_node*)spfile_decode_index(&su->file, SPMDL_BVH_NODES, SPFILE_SECTION_BVH8_NODES); }
+spmdl_bvh_qnode *spmdl_decode_bvh_qnodes(spmdl_util *su) { return (spmdl_bvh_qnode*)spfile_decode_index(&su->file, SPMDL_BVH_NODES, SPFILE_SECTION_BVHQ_NODES); }
+uint32_t *spmdl_decode_bvh_tris(spmdl_util *su) { return (uint32_t*)spfile_decode_index(&su->file, SPMDL_BVH_TRIS, SPFILE_SECTION_BVH_TRIS); }
+spmdl_meshlet *spmdl_decode_meshlets(spmdl_util *su) { return (spmdl_meshlet*)spfile_decode_index(&su->file, SPMDL_MESHLETS, SPFILE_SECTION_MESHLETS); }
+spmdl_meshlet_bounds *spmdl_decode_meshlet_bounds(spmdl_util *su) { return (spmdl_meshlet_bounds*)spfile_decode_index(&su->file, SPMDL_MESHLET_BOUNDS, SPFILE_SECTION_MESHLET_BOUNDS); }
+uint32_t *spmdl_decode_meshlet_vertices(spmdl_util *su) { return (uint32_t*)spfile_decode_index(&su->file, SPMDL_MESHLET_VERTICES, SPFILE_SECTION_MESHLET_VERTICES); }
+uint8_t *spmdl_decode_meshlet_triangles(spmdl_util *su) { return (uint8_t*)spfile_decode_index(&su->file, SPMDL_MESHLET_TRIANGLES, SPFILE_SECTION_MESHLET_TRIANGLES); }
+
+// -- sptex_util
+
+bool sptex_util_init(sptex_util *su, const void *data, size_t size)
+{
+	return spfile_util_init_magic(&su->file, data, size, SPFILE_HEADER_SPTEX);
+}
+
+static bool sptex_get_info(sptex_util *su, sptex_info *info)
+{
+	memset(info, 0, sizeof(sptex_info));
+	if (!su->file.data) return spfile_fail(&su->file);
+	spfile_header header = spfile_get_header(&su->file);
+	size_t info_size = header.header_info_size < sizeof(sptex_info) ? header.header_info_size : sizeof(sptex_info);
+	memcpy(info, (const char*)su->file.data + sizeof(spfile_header), info_size);
+	if (info->num_tail_mips > info->num_mips || info->num_tail_mips > SPTEX_MAX_TAIL_MIPS) return spfile_fail(&su->file);
+	return true;
+}
+
+// Find the section and uncompressed range containing mip `index`
+static bool sptex_find_mip(sptex_util *su, uint32_t index, spfile_section *s, size_t *offset, size_t *size)
+{
+	sptex_info info;
+	if (!sptex_get_info(su, &info)) return false;
+	if (index >= info.num_mips) return spfile_fail(&su->file);
+
+	uint32_t num_section_mips = info.num_mips - info.num_tail_mips;
+	if (index < num_section_mips) {
+		if (!spfile_get_section_magic(&su->file, index, SPFILE_SECTION_MIP, s)) return false;
+		*offset = 0;
+		*size = s->uncompressed_size;
+		return true;
+	}
+
+	if (!spfile_get_section_magic(&su->file, num_section_mips, SPFILE_SECTION_MIP_TAIL, s)) return false;
+	uint32_t tail_index = index - num_section_mips;
+	size_t begin = info.tail_mip_offsets[tail_index];
+	size_t end = tail_index + 1 < info.num_tail_mips ? info.tail_mip_offsets[tail_index + 1] : s->uncompressed_size;
+	if (begin > end || end > s->uncompressed_size) return spfile_fail(&su->file);
+	*offset = begin;
+	*size = end - begin;
+	return true;
+}
+
+bool sptex_decode_mip_to(sptex_util *su, uint32_t index, char *buffer)
+{
+	spfile_section s;
+	size_t offset, size;
+	if (!sptex_find_mip(su, index, &s, &offset, &size)) return false;
+	return spfile_decode_range_to(&su->file, &s, buffer, offset, size);
+}
+
+bool sptex_decode_mip_chunk_to(sptex_util *su, uint32_t index, uint32_t chunk, char *buffer)
+{
+	spfile_section s;
+	size_t offset, size;
+	if (!sptex_find_mip(su, index, &s, &offset, &size)) return false;
+
+	// Mips in the tail consist of a single chunk
+	if (s.magic == SPFILE_SECTION_MIP_TAIL) {
+		if (chunk != 0) return spfile_fail(&su->file);
+		return spfile_decode_range_to(&su->file, &s, buffer, offset, size);
+	}
+	return spfile_decode_chunk_to(&su->file, &s, chunk, buffer);
+}
+
+bool sptex_decode_mip_tail_to(sptex_util *su, char *buffer)
+{
+	sptex_info info;
+	if (!sptex_get_info(su, &info)) return false;
+	if (info.num_tail_mips == 0) return spfile_fail(&su->file);
+	return spfile_decode_index_to(&su->file, info.num_mips - info.num_tail_mips, SPFILE_SECTION_MIP_TAIL, buffer);
+}
+
+sptex_header sptex_decode_header(sptex_util *su)
+{
+	sptex_header header;
+	spfile_decode_header_to(&su->file, &header, sizeof(header), sizeof(sptex_info));
+	return header;
+}
+
+char *sptex_decode_mip(sptex_util *su, uint32_t index)
+{
+	spfile_section s;
+	size_t offset, size;
+	if (!sptex_find_mip(su, index, &s, &offset, &size)) return NULL;
+	return (char*)spfile_decode_range(&su->file, &s, offset, size);
+}
+
+char *sptex_decode_mip_tail(sptex_util *su)
+{
+	sptex_info info;
+	if (!sptex_get_info(su, &info)) return NULL;
+	if (info.num_tail_mips == 0) {
+		spfile_fail(&su->file);
+		return NULL;
+	}
+	return (char*)spfile_decode_index(&su->file, info.num_mips - info.num_tail_mips, SPFILE_SECTION_MIP_TAIL);
+}
+
+bool sptex_get_mip_tiles(sptex_util *su, uint32_t mip, uint32_t *tiles_x, uint32_t *tiles_y)
+{
+	sptex_info info;
+	if (!sptex_get_info(su, &info)) return false;
+	if (info.tile_width == 0 || info.tile_height == 0) return spfile_fail(&su->file);
+	if (mip >= info.num_mips - info.num_tail_mips) return spfile_fail(&su->file);
+
+	uint32_t width = (uint32_t)info.width >> mip, height = (uint32_t)info.height >> mip;
+	if (width == 0) width = 1;
+	if (height == 0) height = 1;
+	*tiles_x = (width + info.tile_width - 1) / info.tile_width;
+	*tiles_y = (height + info.tile_height - 1) / info.tile_height;
+	return true;
+}
+
+bool sptex_get_tile_page(sptex_util *su, uint32_t mip, uint32_t tile_x, uint32_t tile_y, sptex_page *page)
+{
+	sptex_info info;
+	if (!sptex_get_info(su, &info)) return false;
+
+	// Pages of the previous mips come first
+	uint32_t page_index = 0;
+	for (uint32_t i = 0; i <= mip; i++) {
+		uint32_t tiles_x, tiles_y;
+		if (!sptex_get_mip_tiles(su, i, &tiles_x, &tiles_y)) return false;
+		if (i < mip) {
+			page_index += tiles_x * tiles_y;
+		} else {
+			if (tile_x >= tiles_x || tile_y >= tiles_y) return spfile_fail(&su->file);
+			page_index += tile_y * tiles_x + tile_x;
+		}
+	}
+
+	uint32_t section_index = info.num_mips - info.num_tail_mips + (info.num_tail_mips > 0 ? 1 : 0);
+	spfile_section s;
+	if (!spfile_get_section_magic(&su->file, section_index, SPFILE_SECTION_PAGES, &s)) return false;
+	if (s.compression_type != SP_COMPRESSION_NONE) return spfile_fail(&su->file);
+	if (!spfile_check_section(&su->file, &s)) return false;
+	if (((uint64_t)page_index + 1) * sizeof(sptex_page) > s.uncompressed_size) return spfile_fail(&su->file);
+	memcpy(page, (const char*)su->file.data + s.offset + page_index * sizeof(sptex_page), sizeof(sptex_page));
+	return true;
+}
+
+// View a tile page as a standalone section
+static bool sptex_get_tile_section(sptex_util *su, uint32_t mip, uint32_t tile_x, uint32_t tile_y, spfile_section *s)
+{
+	sptex_page page;
+	if (!sptex_get_tile_page(su, mip, tile_x, tile_y, &page)) return false;
+	if (page.compression_type == SP_COMPRESSION_CHUNKED) return spfile_fail(&su->file);
+	s->magic = SPFILE_SECTION_MIP;
+	s->compression_type = page.compression_type;
+	s->index = mip;
+	s->offset = page.offset;
+	s->uncompressed_size = page.uncompressed_size;
+	s->compressed_size = page.compressed_size;
+	return true;
+}
+
+bool sptex_decode_tile_to(sptex_util *su, uint32_t mip, uint32_t tile_x, uint32_t tile_y, char *buffer)
+{
+	spfile_section s;
+	if (!sptex_get_tile_section(su, mip, tile_x, tile_y, &s)) return false;
+	return spfile_decode_section_to(&su->file, &s, buffer);
+}
+
+char *sptex_decode_tile(sptex_util *su, uint32_t mip, uint32_t tile_x, uint32_t tile_y)
+{
+	spfile_section s;
+	if (!sptex_get_tile_section(su, mip, tile_x, tile_y, &s)) return NULL;
+	return (char*)spfile_decode_section(&su->file, &s);
+}
+
+// -- spsound_util
+
+enum { SPSOUND_TAKES, SPSOUND_AUDIO };
+
+bool spsound_util_init(spsound_util *su, const void *data, size_t size)
+{
+	su->takes = NULL;
+	return spfile_util_init_magic(&su->file, data, size, SPFILE_HEADER_SPSOUND);
+}
+
+static bool spsound_get_take(spsound_util *su, uint32_t index, spsound_take *take, spfile_section *s_audio)
+{
+	spsound_info info = { 0 };
+	spfile_header header = spfile_get_header(&su->file);
+	if (su->file.data && header.header_info_size >= sizeof(spsound_info)) {
+		memcpy(&info, (const char*)su->file.data + sizeof(spfile_header), sizeof(spsound_info));
+	}
+	if (index >= info.num_takes) return spfile_fail(&su->file);
+	if (!su->takes && !spsound_decode_takes(su)) return false;
+	*take = su->takes[index];
+
+	if (!spfile_get_section(&su->file, SPSOUND_AUDIO, s_audio)) return false;
+	// Older versions of sp-sound tagged the audio section as 'take'
+	if (s_audio->magic != SPFILE_SECTION_AUDIO && s_audio->magic != SPFILE_SECTION_TAKES) return spfile_fail(&su->file);
+	return true;
+}
+
+bool spsound_decode_takes_to(spsound_util *su, spsound_take *buffer)
+{
+	if (!spfile_decode_index_to(&su->file, SPSOUND_TAKES, SPFILE_SECTION_TAKES, buffer)) return false;
+	su->takes = buffer;
+	return true;
+}
+
+bool spsound_decode_audio_to(spsound_util *su, uint32_t index, void *buffer)
+{
+	spsound_take take;
+	spfile_section s_audio;
+	if (!spsound_get_take(su, index, &take, &s_audio)) return false;
+	return spfile_decode_range_to(&su->file, &s_audio, buffer, take.file_offset, take.file_size);
+}
+
+spsound_header spsound_decode_header(spsound_util *su)
+{
+	spsound_header header;
+	spfile_decode_header_to(&su->file, &header, sizeof(header), sizeof(spsound_info));
+	return header;
+}
+
+spsound_take *spsound_decode_takes(spsound_util *su)
+{
+	spsound_take *takes = (spsound_take*)spfile_decode_index(&su->file, SPSOUND_TAKES, SPFILE_SECTION_TAKES);
+	if (takes) su->takes = takes;
+	return takes;
+}
+
+void *spsound_decode_audio(spsound_util *su, uint32_t index)
+{
+	spsound_take take;
+	spfile_section s_audio;
+	if (!spsound_get_take(su, index, &take, &s_audio)) return NULL;
+	return spfile_decode_range(&su->file, &s_audio, take.file_offset, take.file_size);
+}
@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -11,9 +12,12 @@ extern "C" {
 typedef enum {
 	SP_COMPRESSION_NONE = 0,
 	SP_COMPRESSION_ZSTD = 1,
+	SP_COMPRESSION_CHUNKED = 2, // `spfile_chunk_table` followed by independently compressed chunks
+	SP_COMPRESSION_ZSTD_DICT = 3, // `uint32_t dict_id` followed by zstd data compressed with `spfile_dict`
+	SP_COMPRESSION_BLOCK_SPLIT = 4, // `sp_block_split` followed by zstd data of the block byte planes
 
 	SP_COMPRESSION_TYPE_FIRST = SP_COMPRESSION_NONE,
-	SP_COMPRESSION_TYPE_LAST = SP_COMPRESSION_ZSTD,
+	SP_COMPRESSION_TYPE_LAST = SP_COMPRESSION_BLOCK_SPLIT,
 	SP_COMPRESSION_FORCE_U32 = 0x7fffffff,
 } sp_compression_type;
 
@@ -74,6 +78,22 @@ typedef enum sp_format {
 	SP_FORMAT_ASTC12X10_UNORM, SP_FORMAT_ASTC12X10_SRGB,
 	SP_FORMAT_ASTC12X12_UNORM, SP_FORMAT_ASTC12X12_SRGB,
 
+	// ASTC HDR compression (2D)
+	SP_FORMAT_ASTC4X4_FLOAT,
+	SP_FORMAT_ASTC5X4_FLOAT,
+	SP_FORMAT_ASTC5X5_FLOAT,
+	SP_FORMAT_ASTC6X5_FLOAT,
+	SP_FORMAT_ASTC6X6_FLOAT,
+	SP_FORMAT_ASTC8X5_FLOAT,
+	SP_FORMAT_ASTC8X6_FLOAT,
+	SP_FORMAT_ASTC10X5_FLOAT,
+	SP_FORMAT_ASTC10X6_FLOAT,
+	SP_FORMAT_ASTC8X8_FLOAT,
+	SP_FORMAT_ASTC10X8_FLOAT,
+	SP_FORMAT_ASTC10X10_FLOAT,
+	SP_FORMAT_ASTC12X10_FLOAT,
+	SP_FORMAT_ASTC12X12_FLOAT,
+
 	// Special footer
 	SP_FORMAT_COUNT,
 	SP_FORMAT_FORCE_U32 = 0x7fffffff,
@@ -91,6 +111,21 @@ typedef enum sp_vertex_attrib {
 	SP_VERTEX_ATTRIB_BONE_WEIGHT,
 	SP_VERTEX_ATTRIB_PADDING,
 
+	// Octahedral normal `oct.xy` in RG8/RG16 SNORM. RGBA8/RGBA16 SNORM store
+	// Z = 1.0 and the tangent sign in W, decodable with `meshopt_decodeFilterOct()`
+	// if the attribute fills the whole vertex stream.
+	SP_VERTEX_ATTRIB_NORMAL_OCT,
+
+	// Packed normal, tangent and tangent sign.
+	// RGBA8 SNORM: octahedral normal `n` in XY, tangent angle `a` in Z and the
+	// tangent sign in W. The tangent is `cos(a*pi) * b1 + sin(a*pi) * b2`, where
+	// `b1 = normalize(abs(n.x) > abs(n.z) ? (-n.y, n.x, 0) : (0, -n.z, n.y))`
+	// and `b2 = cross(n, b1)`.
+	// RGBA16 SNORM: quaternion rotating (X, Y, Z) to (tangent, cross(normal,
+	// tangent), normal), decodable with `meshopt_decodeFilterQuat()`. The
+	// tangent sign is not stored, add a separate `SP_VERTEX_ATTRIB_TANGENT_SIGN`.
+	SP_VERTEX_ATTRIB_TANGENT_FRAME,
+
 	SP_VERTEX_ATTRIB_COUNT,
 	SP_VERTEX_ATTRIB_FORCE_U32 = 0x7fffffff,
 } sp_vertex_attrib;
@@ -122,14 +157,30 @@ sp_format sp_find_format(uint32_t num_components, uint32_t component_size, sp_fo
 extern const sp_format_info sp_format_infos[SP_FORMAT_COUNT];
 
 size_t sp_get_compression_bound(sp_compression_type type, size_t src_size);
-size_t sp_compress_buffer(sp_compression_type type, void *dst, size_t dst_size, const void *src, size_t src_size, int level);
+
+// Large buffers are compressed with up to `num_workers` threads, pass 1 to
+// compress on the calling thread only
+size_t sp_compress_buffer(sp_compression_type type, void *dst, size_t dst_size, const void *src, size_t src_size, int level, int num_workers);
 size_t sp_decompress_buffer(sp_compression_type type, void *dst, size_t dst_size, const void *src, size_t src_size);
 
+// Reversible prefilter for compressed texture blocks: byte `i` of every
+// `block_size` byte block is stored contiguously in plane `i`, separating
+// endpoints from indices. Planes in `delta_mask` (bit `i` for plane `i`) are
+// delta coded along the blocks. Bytes past the last full block follow the
+// planes unchanged.
+typedef struct sp_block_split {
+	uint32_t block_size; // 1-32 bytes
+	uint32_t delta_mask;
+} sp_block_split;
+
+size_t sp_compress_buffer_block_split(const sp_block_split *split, void *dst, size_t dst_size, const void *src, size_t src_size, int level, int num_workers);
+
 typedef enum spfile_header_magic {
 	SPFILE_HEADER_SPTEX   = 0x78747073, // 'sptx'
 	SPFILE_HEADER_SPMDL   = 0x646d7073, // 'spmd'
 	SPFILE_HEADER_SPANIM  = 0x6e617073, // 'span'
 	SPFILE_HEADER_SPSOUND = 0x646e7373, // 'ssnd'
+	SPFILE_HEADER_SPDICT  = 0x63647073, // 'spdc'
 
 	SPFILE_HEADER_FORCE_U32 = 0x7fffffff,
 } spfile_header_magic;
@@ -149,6 +200,17 @@ typedef enum spfile_section_magic {
 	SPFILE_SECTION_ANIMATION = 0x6d696e61, // 'anim'
 	SPFILE_SECTION_AUDIO     = 0x6f696461, // 'adio'
 	SPFILE_SECTION_TAKES     = 0x656b6174, // 'take'
+	SPFILE_SECTION_MIP_DROP  = 0x7072646d, // 'mdrp'
+	SPFILE_SECTION_DICT      = 0x74636964, // 'dict'
+	SPFILE_SECTION_MIP_TAIL  = 0x6c61746d, // 'mtal'
+	SPFILE_SECTION_PAGES     = 0x73656770, // 'pges'
+	SPFILE_SECTION_BVH4_NODES = 0x34687662, // 'bvh4'
+	SPFILE_SECTION_BVH8_NODES = 0x38687662, // 'bvh8'
+	SPFILE_SECTION_BVHQ_NODES = 0x71687662, // 'bvhq'
+	SPFILE_SECTION_MESHLETS = 0x74656c6d, // 'mlet'
+	SPFILE_SECTION_MESHLET_BOUNDS = 0x62656c6d, // 'mleb'
+	SPFILE_SECTION_MESHLET_VERTICES = 0x76656c6d, // 'mlev'
+	SPFILE_SECTION_MESHLET_TRIANGLES = 0x74696c6d, // 'mlit'
 
 	SPFILE_SECTION_FORCE_U32 = 0x7fffffff,
 } spfile_section_magic;
@@ -163,6 +225,26 @@ typedef struct spfile_section
 	uint32_t compressed_size;
 } spfile_section;
 
+// Data of `SP_COMPRESSION_CHUNKED` sections starts with a chunk table, the
+// chunks are compressed independently so they can be decoded in parallel
+// or one at a time. Chunk data is 16-byte aligned within the section.
+typedef struct spfile_chunk_table
+{
+	uint32_t num_chunks;
+	uint32_t rows_per_chunk; // sptex: Number of block rows in each chunk
+	uint32_t reserved[2];
+	// Followed by `spfile_chunk chunks[num_chunks]`
+} spfile_chunk_table;
+
+typedef struct spfile_chunk
+{
+	sp_compression_type compression_type;
+	uint32_t offset; // Relative to the start of the section data
+	uint32_t compressed_size;
+	uint32_t uncompressed_offset;
+	uint32_t uncompressed_size;
+} spfile_chunk;
+
 typedef struct spfile_header
 {
 	spfile_header_magic magic;
@@ -199,6 +281,12 @@ typedef struct spanim_header {
 #define SPMDL_MAX_VERTEX_BUFFERS 4
 #define SPMDL_MAX_VERTEX_ATTRIBS 16
 #define SPMDL_BVH_TRIANGLES 16
+#define SPMDL_MAX_LODS 8
+
+// Version 2 extended `spmdl_mesh` with meshlets, LODs and the attribute
+// transform, earlier files are rejected by `spmdl_util_init()` as the mesh
+// records have a different size
+#define SPMDL_VERSION 2
 
 typedef struct spmdl_vec3
 {
@@ -232,6 +320,21 @@ typedef struct spmdl_bone
 	spmdl_matrix mesh_to_bone;
 } spmdl_bone;
 
+typedef enum spmdl_geometry_encoding {
+	SPMDL_GEOMETRY_RAW = 0,
+
+	// Vertex buffers are encoded with `meshopt_encodeVertexBuffer()` and index
+	// buffers with `meshopt_encodeIndexBuffer()`, before section compression.
+	// The index codec may rotate the vertices of a triangle, preserving the
+	// winding.
+	// NOTE: Vertex buffers whose `stride % 4 != 0` are not supported by the
+	// codec and stay raw even in this mode, `encoded_size` is then exactly
+	// `num_vertices * stride` and the data is copied as-is.
+	SPMDL_GEOMETRY_MESHOPT = 1,
+
+	SPMDL_GEOMETRY_FORCE_U32 = 0x7fffffff,
+} spmdl_geometry_encoding;
+
 typedef struct spmdl_buffer
 {
 	uint32_t offset;
@@ -252,6 +355,14 @@ typedef struct spmdl_material
 	spfile_string name;
 } spmdl_material;
 
+// Simplified index buffer of a mesh, referencing the same vertex buffers
+typedef struct spmdl_lod
+{
+	uint32_t num_indices;
+	float error; // Maximum distance from the full detail vertices in mesh units
+	spmdl_buffer index_buffer;
+} spmdl_lod;
+
 typedef struct spmdl_mesh
 {
 	uint32_t node;
@@ -268,8 +379,53 @@ typedef struct spmdl_mesh
 	spmdl_buffer vertex_buffers[SPMDL_MAX_VERTEX_BUFFERS];
 	spmdl_buffer index_buffer;
 	spmdl_attrib attribs[SPMDL_MAX_VERTEX_ATTRIBS];
+
+	// Version 2: Meshlets of the mesh in `s_meshlets`
+	uint32_t meshlet_offset;
+	uint32_t num_meshlets;
+
+	// Version 2: Progressively coarser levels after `index_buffer`
+	uint32_t num_lods;
+	spmdl_lod lods[SPMDL_MAX_LODS];
+
+	// Version 2: Transform from decoded position and UV attributes to mesh
+	// space, eg. `position = decoded * position_scale + position_offset`.
+	// Identity unless the attributes are quantized relative to the mesh bounds,
+	// version 1 files never quantize so their transform is always identity.
+	spmdl_vec3 position_scale;
+	spmdl_vec3 position_offset;
+	float uv_scale[2];
+	float uv_offset[2];
 } spmdl_mesh;
 
+// Cluster of up to 64 vertices and 126 triangles of a mesh. `vertex_offset`
+// points to `num_vertices` indices into the vertex buffers of the mesh,
+// `triangle_offset` to `num_triangles * 3` bytes of indices into the meshlet
+// vertices. Triangle data of each meshlet is padded to 4 bytes.
+typedef struct spmdl_meshlet
+{
+	uint32_t vertex_offset;
+	uint32_t triangle_offset;
+	uint32_t num_vertices;
+	uint32_t num_triangles;
+} spmdl_meshlet;
+
+// Culling bounds of a meshlet in mesh space, see `meshopt_Bounds`. The
+// meshlet can be skipped if `dot(normalize(apex - camera), axis) >= cutoff`,
+// or `dot(normalize(center - camera), axis) >= cutoff + radius / length(center - camera)`.
+typedef struct spmdl_meshlet_bounds
+{
+	spmdl_vec3 center;
+	float radius;
+	spmdl_vec3 cone_apex;
+	spmdl_vec3 cone_axis;
+	float cone_cutoff;
+
+	// Normal cone quantized to 8-bit SNORM, `cone_cutoff_s8` rounded up
+	int8_t cone_axis_s8[3];
+	int8_t cone_cutoff_s8;
+} spmdl_meshlet_bounds;
+
 typedef struct spmdl_bvh_split
 {
 	spmdl_vec3 aabb_min, aabb_max;
@@ -287,6 +443,48 @@ typedef struct spmdl_bvh_node
 	spmdl_bvh_split splits[2];
 } spmdl_bvh_node;
 
+// Wide BVH nodes with SoA child bounds, stored instead of `spmdl_bvh_node`
+// when the BVH section magic is `SPFILE_SECTION_BVH4_NODES` or `_BVH8_NODES`.
+// Unused children have `num_triangles == 0` and inverted bounds (min > max).
+typedef struct spmdl_bvh4_node
+{
+	float min_x[4], min_y[4], min_z[4];
+	float max_x[4], max_y[4], max_z[4];
+	int32_t num_triangles[4]; // Same as `spmdl_bvh_split.num_triangles`
+	uint32_t data_index[4];   // Same as `spmdl_bvh_split.data_index`
+} spmdl_bvh4_node;
+
+typedef struct spmdl_bvh8_node
+{
+	float min_x[8], min_y[8], min_z[8];
+	float max_x[8], max_y[8], max_z[8];
+	int32_t num_triangles[8];
+	uint32_t data_index[8];
+} spmdl_bvh8_node;
+
+#define SPMDL_BVH_QNODE_INTERIOR 0xffff
+
+// Compressed binary BVH node, stored instead of `spmdl_bvh_node` when the BVH
+// section magic is `SPFILE_SECTION_BVHQ_NODES`. Child bounds are quantized
+// within the bounds of the node: `min + (max - min) * (q / 255.0f)`, rounded
+// outwards. The bounds of the root node are the mesh AABB, other nodes use the
+// decoded child bounds of their parent. Leaf triangles are quantized relative
+// to the decoded leaf bounds.
+typedef struct spmdl_bvh_qnode
+{
+	uint8_t min_x[2], min_y[2], min_z[2];
+	uint8_t max_x[2], max_y[2], max_z[2];
+
+	// Number of triangles in a leaf child (including SIMD padding), or
+	// `SPMDL_BVH_QNODE_INTERIOR`
+	uint16_t num_triangles[2];
+
+	// Triangles of leaf children are stored consecutively from `data_index`.
+	// If both children are interior nodes `data_index` is the index of the
+	// second child, otherwise interior children directly follow this node.
+	uint32_t data_index;
+} spmdl_bvh_qnode;
+
 typedef struct spmdl_info {
 	uint32_t num_nodes;
 	uint32_t num_bones;
@@ -294,6 +492,9 @@ typedef struct spmdl_info {
 	uint32_t num_meshes;
 	uint32_t num_bvh_nodes;
 	uint32_t num_bvh_tris;
+	uint32_t num_meshlets;
+	uint32_t num_meshlet_vertices;
+	spmdl_geometry_encoding geometry_encoding;
 } spmdl_info;
 
 typedef struct spmdl_header {
@@ -303,11 +504,15 @@ typedef struct spmdl_header {
 	spfile_section s_bones;     // spmdl_bone[info.num_bones]
 	spfile_section s_materials; // spmdl_material[info.num_materials]
 	spfile_section s_meshes;    // spmdl_mesh[info.num_meshes]
-	spfile_section s_bvh_nodes; // spmdl_bvh_node[info.num_bvh_nodes]
+	spfile_section s_bvh_nodes; // spmdl_bvh_node/bvh4_node/bvh8_node/bvh_qnode[info.num_bvh_nodes] depending on magic
 	spfile_section s_bvh_tris;  // uint32_t[info.num_bvh_tris * 3]
 	spfile_section s_strings;   // char[uncompressed_size]
 	spfile_section s_vertex;    // char[uncompressed_size]
 	spfile_section s_index;     // char[uncompressed_size]
+	spfile_section s_meshlets;  // spmdl_meshlet[info.num_meshlets]
+	spfile_section s_meshlet_bounds;    // spmdl_meshlet_bounds[info.num_meshlets]
+	spfile_section s_meshlet_vertices;  // uint32_t[info.num_meshlet_vertices]
+	spfile_section s_meshlet_triangles; // uint8_t[uncompressed_size]
 } spmdl_header;
 
 typedef struct sptex_mip {
@@ -318,6 +523,8 @@ typedef struct sptex_mip {
 	sp_compression_type compression_type;
 } sptex_mip;
 
+#define SPTEX_MAX_TAIL_MIPS 16
+
 typedef struct sptex_info {
 	sp_format format;
 	uint16_t width, height;
@@ -326,14 +533,50 @@ typedef struct sptex_info {
 	uint16_t crop_max_x, crop_max_y;
 	uint32_t num_mips;
 	uint32_t num_slices;
+
+	// Version 2: The last `num_tail_mips` of `num_mips` are packed in a single
+	// `s_mip_tail` section at `tail_mip_offsets[]` of the uncompressed data
+	uint32_t num_tail_mips;
+	uint32_t tail_mip_offsets[SPTEX_MAX_TAIL_MIPS];
+
+	// Version 3: If `tile_width > 0` the mips outside of the tail are split
+	// into tiles of `tile_width x tile_height` texels, see `sptex_page`
+	uint16_t tile_width, tile_height;
+	uint32_t tile_border; // Texels of neighboring data on each side of a tile
 } sptex_info;
 
 typedef struct sptex_header {
 	spfile_header header;
 	sptex_info info;
-	spfile_section s_mips[16];
+	spfile_section s_mips[16]; // Version 2: Large mips may be `SP_COMPRESSION_CHUNKED`
+	// Sections for `info.num_mips - info.num_tail_mips` mips, followed by
+	// `spfile_section s_mip_tail` if `info.num_tail_mips > 0`,
+	// `spfile_section s_pages` (sptex_page[]) if `info.tile_width > 0` and optionally
+	// `spfile_section s_mip_drops` (sptex_mip_drop[]) if there are sections left
 } sptex_header;
 
+// Tiled mips are `SP_COMPRESSION_CHUNKED` with a chunk per tile in row-major
+// order. Each tile is `tile_width + 2*tile_border` by `tile_height + 2*tile_border`
+// texels of blocks, tiles past the edges of the mip are clamped to the edge blocks.
+// `s_pages` lists the tiles of all tiled mips in order so a single tile can be
+// read and decompressed without touching the rest of the file.
+typedef struct sptex_page {
+	sp_compression_type compression_type;
+	uint32_t offset; // Absolute offset in the file
+	uint32_t compressed_size;
+	uint32_t uncompressed_size;
+} sptex_page;
+
+// Texture with the top `index` mips dropped: uses sections `s_mips[index..]`
+// (and `s_mip_tail`) which are stored contiguously in `[data_offset, data_offset + data_size)`
+typedef struct sptex_mip_drop {
+	uint16_t width, height;
+	uint16_t uncropped_width, uncropped_height;
+	uint32_t num_mips;
+	uint32_t data_offset;
+	uint32_t data_size;
+} sptex_mip_drop;
+
 typedef enum {
 	SPSOUND_FORMAT_NONE = 0,
 	SPSOUND_FORMAT_PCM16 = 1,
@@ -365,12 +608,83 @@ typedef struct spsound_header {
 	spfile_section s_audio;
 } spsound_header;
 
+typedef struct spdict_info {
+	uint32_t dict_id;
+	uint32_t num_samples;
+} spdict_info;
+
+// Shared zstd dictionary for `SP_COMPRESSION_ZSTD_DICT` sections, trained by sp-dict
+typedef struct spdict_header {
+	spfile_header header;
+	spdict_info info;
+	spfile_section s_dict; // char[uncompressed_size], raw content dictionary, always uncompressed
+} spdict_header;
+
+typedef struct spfile_dict {
+	uint32_t id;
+	const void *data;
+	size_t size;
+	void *ddict;
+} spfile_dict;
+
+// Load a dictionary from the contents of a .spdict file, refers to `data`
+// without copying so it must stay valid until `spfile_dict_free()`
+bool spfile_dict_init(spfile_dict *dict, const void *data, size_t size);
+void spfile_dict_free(spfile_dict *dict);
+
+size_t sp_compress_buffer_dict(const spfile_dict *dict, void *dst, size_t dst_size, const void *src, size_t src_size, int level);
+size_t sp_decompress_buffer_dict(const spfile_dict *dict, void *dst, size_t dst_size, const void *src, size_t src_size);
+
+// Streaming writer for spfile containers: space for the header, info and
+// section table is reserved up front, section data is appended as soon as it
+// is ready and the header is patched in by `spfile_writer_finish()`.
+// With `write_block_size > 0` output is staged in a buffer and written to an
+// unbuffered file in whole blocks, so every write is large and block aligned.
+// Errors are sticky, check the result of `spfile_writer_finish()`.
+typedef struct spfile_writer {
+	FILE *file;
+	spfile_header header;
+	spfile_section *sections;
+	uint64_t offset;         // Total bytes written including the reserved header
+	uint64_t flushed_offset; // Bytes written to `file` so far
+	char *buffer_alloc;
+	char *buffer;
+	size_t buffer_pos;
+	size_t write_block_size;
+	bool failed;
+} spfile_writer;
+
+bool spfile_writer_init(spfile_writer *w, FILE *file, const spfile_header *header, size_t write_block_size);
+bool spfile_writer_write(spfile_writer *w, const void *data, size_t size);
+bool spfile_writer_pad(spfile_writer *w, size_t align);
+
+// Write the data of section `section_index`, `s->offset` is filled in
+bool spfile_writer_add_section(spfile_writer *w, uint32_t section_index, const spfile_section *s, const void *data);
+
+// Patch the header, `w->header` may be modified before calling this
+bool spfile_writer_finish(spfile_writer *w, const void *info);
+void spfile_writer_free(spfile_writer *w);
+
+// Runtime loader for spfile containers. `data` is typically a memory-mapped
+// file that must stay valid as long as the util is used.
+// Sections stored with `SP_COMPRESSION_NONE` are returned in-place from `data`
+// without copying, compressed sections are decoded into memory owned by the
+// util (freed by `spfile_util_free()`). The `_to` variants always decode
+// into a caller provided buffer of `uncompressed_size` bytes.
+// Errors are sticky: after any failure `spfile_util_failed()` returns true.
+// A util is not thread-safe, to decode chunks in parallel initialize one util
+// per thread over the same data.
+// `SP_COMPRESSION_ZSTD_DICT` sections require the dictionary to be registered
+// with `spfile_util_set_dicts()` after initialization.
 typedef struct spfile_util {
 	const void *data;
 	size_t size;
 	char *strings;
 	size_t strings_size;
 	void *page_to_free;
+	void *dctx;
+	const spfile_dict *dicts;
+	size_t num_dicts;
 	bool failed;
 } spfile_util;
 
@@ -380,6 +694,19 @@ void *spfile_decode_section(spfile_util *su, const spfile_section *s);
 bool spfile_decode_strings_to(spfile_util *su, const spfile_section *s, char *buffer);
 char *spfile_decode_strings(spfile_util *su, const spfile_section *s);
 bool spfile_util_failed(spfile_util *su);
+void spfile_util_set_dicts(spfile_util *su, const spfile_dict *dicts, size_t num_dicts);
+
+// Sections that are not `SP_COMPRESSION_CHUNKED` consist of a single chunk
+uint32_t spfile_get_num_chunks(spfile_util *su, const spfile_section *s);
+bool spfile_get_chunk(spfile_util *su, const spfile_section *s, uint32_t index, spfile_chunk *chunk);
+bool spfile_decode_chunk_to(spfile_util *su, const spfile_section *s, uint32_t index, void *buffer);
+void *spfile_decode_chunk(spfile_util *su, const spfile_section *s, uint32_t index);
+
+// Decode a section whose compressed data was read separately into `data`,
+// eg. by a loader that only reads parts of the file, `s->offset` is ignored.
+// `su` may be zero-initialized if it's only used for these.
+bool spfile_decode_section_data_to(spfile_util *su, const spfile_section *s, const void *data, void *buffer);
+
 void spfile_util_free(spfile_util *su);
 
 typedef struct spanim_util {
@@ -410,8 +737,28 @@ bool spmdl_decode_materials_to(spmdl_util *su, spmdl_material *buffer);
 bool spmdl_decode_meshes_to(spmdl_util *su, spmdl_mesh *buffer);
 bool spmdl_decode_vertex_to(spmdl_util *su, char *buffer);
 bool spmdl_decode_index_to(spmdl_util *su, char *buffer);
+bool spmdl_decode_bvh_nodes_to(spmdl_util *su, spmdl_bvh_node *buffer);
+bool spmdl_decode_bvh4_nodes_to(spmdl_util *su, spmdl_bvh4_node *buffer);
+bool spmdl_decode_bvh8_nodes_to(spmdl_util *su, spmdl_bvh8_node *buffer);
+bool spmdl_decode_bvh_qnodes_to(spmdl_util *su, spmdl_bvh_qnode *buffer);
+bool spmdl_decode_bvh_tris_to(spmdl_util *su, uint32_t *buffer);
+bool spmdl_decode_meshlets_to(spmdl_util *su, spmdl_meshlet *buffer);
+bool spmdl_decode_meshlet_bounds_to(spmdl_util *su, spmdl_meshlet_bounds *buffer);
+bool spmdl_decode_meshlet_vertices_to(spmdl_util *su, uint32_t *buffer);
+bool spmdl_decode_meshlet_triangles_to(spmdl_util *su, uint8_t *buffer);
 
 spmdl_header spmdl_decode_header(spmdl_util *su);
+
+// Decode vertex buffer `stream` of `mesh` from the decoded vertex section to
+// `buffer` of at least `num_vertices * stride` bytes. Fails if the buffer does
+// not fit in the section or `buffer_size`.
+bool spmdl_decode_vertex_buffer_to(const spmdl_header *header, const spmdl_mesh *mesh, uint32_t stream, const char *vertex_section, void *buffer, size_t buffer_size);
+
+// Decode the index buffer of `mesh` (`lod == 0`) or `mesh->lods[lod - 1]` from
+// the decoded index section to `buffer` of at least `num_indices * stride`
+// bytes. Fails if the buffer does not fit in the section or `buffer_size`.
+bool spmdl_decode_index_buffer_to(const spmdl_header *header, const spmdl_mesh *mesh, uint32_t lod, const char *index_section, void *buffer, size_t buffer_size);
+
 char *spmdl_decode_strings(spmdl_util *su);
 spmdl_node *spmdl_decode_nodes(spmdl_util *su);
 spmdl_bone *spmdl_decode_bones(spmdl_util *su);
@@ -419,6 +766,15 @@ spmdl_material *spmdl_decode_materials(spmdl_util *su);
 spmdl_mesh *spmdl_decode_meshes(spmdl_util *su);
 char *spmdl_decode_vertex(spmdl_util *su);
 char *spmdl_decode_index(spmdl_util *su);
+spmdl_bvh_node *spmdl_decode_bvh_nodes(spmdl_util *su);
+spmdl_bvh4_node *spmdl_decode_bvh4_nodes(spmdl_util *su);
+spmdl_bvh8_node *spmdl_decode_bvh8_nodes(spmdl_util *su);
+spmdl_bvh_qnode *spmdl_decode_bvh_qnodes(spmdl_util *su);
+uint32_t *spmdl_decode_bvh_tris(spmdl_util *su);
+spmdl_meshlet *spmdl_decode_meshlets(spmdl_util *su);
+spmdl_meshlet_bounds *spmdl_decode_meshlet_bounds(spmdl_util *su);
+uint32_t *spmdl_decode_meshlet_vertices(spmdl_util *su);
+uint8_t *spmdl_decode_meshlet_triangles(spmdl_util *su);
 
 typedef struct sptex_util {
 	spfile_util file;
@@ -427,19 +783,31 @@ typedef struct sptex_util {
 bool sptex_util_init(sptex_util *su, const void *data, size_t size);
 
 bool sptex_decode_mip_to(sptex_util *su, uint32_t index, char *buffer);
+bool sptex_decode_mip_chunk_to(sptex_util *su, uint32_t index, uint32_t chunk, char *buffer);
+bool sptex_decode_mip_tail_to(sptex_util *su, char *buffer);
 
 sptex_header sptex_decode_header(sptex_util *su);
 char *sptex_decode_mip(sptex_util *su, uint32_t index);
+char *sptex_decode_mip_tail(sptex_util *su);
+
+// Tiled textures (`sptex_info.tile_width > 0`), tiles are indexed per mip
+bool sptex_get_mip_tiles(sptex_util *su, uint32_t mip, uint32_t *tiles_x, uint32_t *tiles_y);
+bool sptex_get_tile_page(sptex_util *su, uint32_t mip, uint32_t tile_x, uint32_t tile_y, sptex_page *page);
+bool sptex_decode_tile_to(sptex_util *su, uint32_t mip, uint32_t tile_x, uint32_t tile_y, char *buffer);
+char *sptex_decode_tile(sptex_util *su, uint32_t mip, uint32_t tile_x, uint32_t tile_y);
 
 typedef struct spsound_util {
 	spfile_util file;
+	spsound_take *takes;
 } spsound_util;
 
 bool spsound_util_init(spsound_util *su, const void *data, size_t size);
 
+bool spsound_decode_takes_to(spsound_util *su, spsound_take *buffer);
 bool spsound_decode_audio_to(spsound_util *su, uint32_t index, void *buffer);
 
 spsound_header spsound_decode_header(spsound_util *su);
+spsound_take *spsound_decode_takes(spsound_util *su);
 void *spsound_decode_audio(spsound_util *su, uint32_t index);
 
 
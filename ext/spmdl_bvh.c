@@ -0,0 +1,389 @@
+#include "spmdl_bvh.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define SP_SSE2 1
+	#include <emmintrin.h>
+#endif
+
+#define SPMDL_BVH_STACK_SIZE 512
+
+typedef struct spmdl_bvh_ray {
+	float origin[3];
+	float direction[3];
+	float inv_direction[3];
+	bool negative[3];
+	float max_t;
+} spmdl_bvh_ray;
+
+// Pending child on the traversal stack, `min/max` are the bounds of leaves
+// and the node bounds of compressed nodes
+typedef struct spmdl_bvh_entry {
+	float t;
+	int32_t num_triangles; // Negative for interior nodes
+	uint32_t index;        // Node or first triangle index
+	float min[3], max[3];
+} spmdl_bvh_entry;
+
+typedef struct spmdl_bvh_stack {
+	spmdl_bvh_entry entries[SPMDL_BVH_STACK_SIZE];
+	uint32_t size;
+} spmdl_bvh_stack;
+
+bool spmdl_bvh_init(spmdl_bvh *bvh, const spmdl_header *header, const void *nodes, const uint32_t *triangles)
+{
+	memset(bvh, 0, sizeof(spmdl_bvh));
+	uint32_t magic = header->s_bvh_nodes.magic;
+	if (magic != SPFILE_SECTION_BVH_NODES && magic != SPFILE_SECTION_BVH4_NODES
+		&& magic != SPFILE_SECTION_BVH8_NODES && magic != SPFILE_SECTION_BVHQ_NODES) return false;
+	bvh->node_magic = magic;
+	bvh->nodes = nodes;
+	bvh->num_nodes = header->info.num_bvh_nodes;
+	bvh->triangles = triangles;
+	bvh->num_triangles = header->info.num_bvh_tris;
+	return true;
+}
+
+void spmdl_bvh_decode_triangle(const spmdl_bvh *bvh, uint32_t index, spmdl_vec3 aabb_min, spmdl_vec3 aabb_max, spmdl_vec3 verts[3])
+{
+	float sx = (aabb_max.x - aabb_min.x) * (1.0f / 1023.0f);
+	float sy = (aabb_max.y - aabb_min.y) * (1.0f / 1023.0f);
+	float sz = (aabb_max.z - aabb_min.z) * (1.0f / 1023.0f);
+	for (uint32_t i = 0; i < 3; i++) {
+		uint32_t packed = bvh->triangles[index * 3 + i];
+		verts[i].x = aabb_min.x + (float)(packed & 0x3ff) * sx;
+		verts[i].y = aabb_min.y + (float)(packed >> 10 & 0x3ff) * sy;
+		verts[i].z = aabb_min.z + (float)(packed >> 20 & 0x3ff) * sz;
+	}
+}
+
+// Slab test using the near plane by ray direction sign, so boxes with
+// inverted bounds (empty wide node children) are always rejected
+static bool spmdl_bvh_ray_box(const spmdl_bvh_ray *r, const float min[3], const float max[3], float *t_enter)
+{
+	float t_min = 0.0f, t_max = r->max_t;
+	for (uint32_t a = 0; a < 3; a++) {
+		float near_plane = r->negative[a] ? max[a] : min[a];
+		float far_plane = r->negative[a] ? min[a] : max[a];
+		float t0 = (near_plane - r->origin[a]) * r->inv_direction[a];
+		float t1 = (far_plane - r->origin[a]) * r->inv_direction[a];
+		if (t0 > t_min) t_min = t0;
+		if (t1 < t_max) t_max = t1;
+	}
+	*t_enter = t_min;
+	return t_min <= t_max;
+}
+
+// Test the SoA child bounds of a wide node, writes the entry distances to
+// `t_enter` and returns a mask of the children that are hit
+static uint32_t spmdl_bvh_ray_wide(const spmdl_bvh_ray *r, const float *min_x, const float *min_y, const float *min_z,
+	const float *max_x, const float *max_y, const float *max_z, uint32_t num, float *t_enter)
+{
+	const float *near_x = r->negative[0] ? max_x : min_x, *far_x = r->negative[0] ? min_x : max_x;
+	const float *near_y = r->negative[1] ? max_y : min_y, *far_y = r->negative[1] ? min_y : max_y;
+	const float *near_z = r->negative[2] ? max_z : min_z, *far_z = r->negative[2] ? min_z : max_z;
+
+	uint32_t mask = 0;
+	uint32_t i = 0;
+#if SP_SSE2
+	__m128 ox = _mm_set1_ps(r->origin[0]), oy = _mm_set1_ps(r->origin[1]), oz = _mm_set1_ps(r->origin[2]);
+	__m128 ix = _mm_set1_ps(r->inv_direction[0]), iy = _mm_set1_ps(r->inv_direction[1]), iz = _mm_set1_ps(r->inv_direction[2]);
+	for (; i + 4 <= num; i += 4) {
+		__m128 t_min = _mm_setzero_ps(), t_max = _mm_set1_ps(r->max_t);
+		t_min = _mm_max_ps(t_min, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_x + i), ox), ix));
+		t_min = _mm_max_ps(t_min, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_y + i), oy), iy));
+		t_min = _mm_max_ps(t_min, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(near_z + i), oz), iz));
+		t_max = _mm_min_ps(t_max, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_x + i), ox), ix));
+		t_max = _mm_min_ps(t_max, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_y + i), oy), iy));
+		t_max = _mm_min_ps(t_max, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(far_z + i), oz), iz));
+		_mm_storeu_ps(t_enter + i, t_min);
+		mask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t_min, t_max)) << i;
+	}
+#endif
+	for (; i < num; i++) {
+		float mn[3] = { min_x[i], min_y[i], min_z[i] };
+		float mx[3] = { max_x[i], max_y[i], max_z[i] };
+		if (spmdl_bvh_ray_box(r, mn, mx, &t_enter[i])) mask |= 1u << i;
+	}
+	return mask;
+}
+
+// Intersect 4 triangles in SoA layout `v[vertex][axis][lane]` (two-sided
+// Moller-Trumbore), returns the lane of the closest hit closer than `hit->t`
+static int spmdl_bvh_ray_triangles4(const spmdl_bvh_ray *r, float v[3][3][4], spmdl_ray_hit *hit)
+{
+	int best_lane = -1;
+#if SP_SSE2
+	__m128 v0x = _mm_loadu_ps(v[0][0]), v0y = _mm_loadu_ps(v[0][1]), v0z = _mm_loadu_ps(v[0][2]);
+	__m128 e1x = _mm_sub_ps(_mm_loadu_ps(v[1][0]), v0x);
+	__m128 e1y = _mm_sub_ps(_mm_loadu_ps(v[1][1]), v0y);
+	__m128 e1z = _mm_sub_ps(_mm_loadu_ps(v[1][2]), v0z);
+	__m128 e2x = _mm_sub_ps(_mm_loadu_ps(v[2][0]), v0x);
+	__m128 e2y = _mm_sub_ps(_mm_loadu_ps(v[2][1]), v0y);
+	__m128 e2z = _mm_sub_ps(_mm_loadu_ps(v[2][2]), v0z);
+	__m128 dx = _mm_set1_ps(r->direction[0]), dy = _mm_set1_ps(r->direction[1]), dz = _mm_set1_ps(r->direction[2]);
+
+	// p = d x e2, det = e1 . p
+	__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	__m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+	// s = o - v0, u = (s . p) / det
+	__m128 sx = _mm_sub_ps(_mm_set1_ps(r->origin[0]), v0x);
+	__m128 sy = _mm_sub_ps(_mm_set1_ps(r->origin[1]), v0y);
+	__m128 sz = _mm_sub_ps(_mm_set1_ps(r->origin[2]), v0z);
+	__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv_det);
+
+	// q = s x e1, v = (d . q) / det, t = (e2 . q) / det
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+	__m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 ok = _mm_cmpneq_ps(det, zero);
+	ok = _mm_and_ps(ok, _mm_cmpge_ps(u, zero));
+	ok = _mm_and_ps(ok, _mm_cmpge_ps(vv, zero));
+	ok = _mm_and_ps(ok, _mm_cmple_ps(_mm_add_ps(u, vv), _mm_set1_ps(1.0f)));
+	ok = _mm_and_ps(ok, _mm_cmpge_ps(t, zero));
+	ok = _mm_and_ps(ok, _mm_cmplt_ps(t, _mm_set1_ps(hit->t)));
+
+	uint32_t mask = (uint32_t)_mm_movemask_ps(ok);
+	if (mask == 0) return -1;
+
+	float ts[4], us[4], vs[4];
+	_mm_storeu_ps(ts, t);
+	_mm_storeu_ps(us, u);
+	_mm_storeu_ps(vs, vv);
+	for (int lane = 0; lane < 4; lane++) {
+		if ((mask & (1u << lane)) && ts[lane] < hit->t) {
+			hit->t = ts[lane];
+			hit->u = us[lane];
+			hit->v = vs[lane];
+			best_lane = lane;
+		}
+	}
+#else
+	for (int lane = 0; lane < 4; lane++) {
+		float e1[3], e2[3], s[3], p[3], q[3];
+		for (int a = 0; a < 3; a++) {
+			e1[a] = v[1][a][lane] - v[0][a][lane];
+			e2[a] = v[2][a][lane] - v[0][a][lane];
+			s[a] = r->origin[a] - v[0][a][lane];
+		}
+		const float *d = r->direction;
+		p[0] = d[1]*e2[2] - d[2]*e2[1];
+		p[1] = d[2]*e2[0] - d[0]*e2[2];
+		p[2] = d[0]*e2[1] - d[1]*e2[0];
+		float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+		if (det == 0.0f) continue;
+		float inv_det = 1.0f / det;
+		float u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * inv_det;
+		q[0] = s[1]*e1[2] - s[2]*e1[1];
+		q[1] = s[2]*e1[0] - s[0]*e1[2];
+		q[2] = s[0]*e1[1] - s[1]*e1[0];
+		float vv = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2]) * inv_det;
+		float t = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) * inv_det;
+		if (u >= 0.0f && vv >= 0.0f && u + vv <= 1.0f && t >= 0.0f && t < hit->t) {
+			hit->t = t;
+			hit->u = u;
+			hit->v = vv;
+			best_lane = lane;
+		}
+	}
+#endif
+	return best_lane;
+}
+
+// Intersect the triangles of a leaf in batches of 4, the last batch repeats
+// the final triangle if the leaf is not padded
+static bool spmdl_bvh_ray_leaf(const spmdl_bvh_ray *r, const spmdl_bvh *bvh, const spmdl_bvh_entry *leaf, spmdl_ray_hit *hit, spmdl_bvh_stats *stats)
+{
+	float scale[3];
+	for (uint32_t a = 0; a < 3; a++) {
+		scale[a] = (leaf->max[a] - leaf->min[a]) * (1.0f / 1023.0f);
+	}
+
+	uint32_t num = (uint32_t)leaf->num_triangles;
+	if (leaf->index > bvh->num_triangles || num > bvh->num_triangles - leaf->index) return false;
+
+	bool found = false;
+	for (uint32_t base = 0; base < num; base += 4) {
+		float v[3][3][4];
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			uint32_t ix = base + lane < num ? base + lane : num - 1;
+			const uint32_t *packed = bvh->triangles + (size_t)(leaf->index + ix) * 3;
+			for (uint32_t vi = 0; vi < 3; vi++) {
+				uint32_t p = packed[vi];
+				v[vi][0][lane] = leaf->min[0] + (float)(p & 0x3ff) * scale[0];
+				v[vi][1][lane] = leaf->min[1] + (float)(p >> 10 & 0x3ff) * scale[1];
+				v[vi][2][lane] = leaf->min[2] + (float)(p >> 20 & 0x3ff) * scale[2];
+			}
+		}
+
+		int lane = spmdl_bvh_ray_triangles4(r, v, hit);
+		if (lane >= 0) {
+			uint32_t ix = base + (uint32_t)lane < num ? base + (uint32_t)lane : num - 1;
+			hit->triangle = leaf->index + ix;
+			found = true;
+		}
+	}
+
+	if (stats) stats->triangle_tests += num;
+	return found;
+}
+
+static void spmdl_bvh_push(spmdl_bvh_stack *stack, const spmdl_bvh_entry *children, uint32_t num)
+{
+	// Sort by distance so that the closest child is popped first
+	uint32_t order[8];
+	for (uint32_t i = 0; i < num; i++) {
+		uint32_t j = i;
+		for (; j > 0 && children[order[j - 1]].t < children[i].t; j--) {
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+	}
+	for (uint32_t i = 0; i < num; i++) {
+		if (stack->size < SPMDL_BVH_STACK_SIZE) {
+			stack->entries[stack->size++] = children[order[i]];
+		}
+	}
+}
+
+static float spmdl_bvh_dequantize(float min, float max, uint32_t q)
+{
+	return min + (max - min) * ((float)q / 255.0f);
+}
+
+// Find the children of `node` hit by the ray
+static uint32_t spmdl_bvh_visit(const spmdl_bvh_ray *r, const spmdl_bvh *bvh, const spmdl_bvh_entry *node, spmdl_bvh_entry *children)
+{
+	uint32_t num = 0;
+	if (bvh->node_magic == SPFILE_SECTION_BVH_NODES) {
+		const spmdl_bvh_node *n = (const spmdl_bvh_node*)bvh->nodes + node->index;
+		for (uint32_t i = 0; i < 2; i++) {
+			const spmdl_bvh_split *split = &n->splits[i];
+			if (split->num_triangles == 0) continue;
+			spmdl_bvh_entry *c = &children[num];
+			c->min[0] = split->aabb_min.x; c->min[1] = split->aabb_min.y; c->min[2] = split->aabb_min.z;
+			c->max[0] = split->aabb_max.x; c->max[1] = split->aabb_max.y; c->max[2] = split->aabb_max.z;
+			if (!spmdl_bvh_ray_box(r, c->min, c->max, &c->t)) continue;
+			c->num_triangles = split->num_triangles;
+			c->index = split->data_index;
+			num++;
+		}
+	} else if (bvh->node_magic == SPFILE_SECTION_BVHQ_NODES) {
+		const spmdl_bvh_qnode *n = (const spmdl_bvh_qnode*)bvh->nodes + node->index;
+		bool both_interior = n->num_triangles[0] == SPMDL_BVH_QNODE_INTERIOR && n->num_triangles[1] == SPMDL_BVH_QNODE_INTERIOR;
+		uint32_t triangle_index = n->data_index;
+		for (uint32_t i = 0; i < 2; i++) {
+			uint16_t num_triangles = n->num_triangles[i];
+			if (num_triangles == 0) continue;
+
+			spmdl_bvh_entry *c = &children[num];
+			const uint8_t q_min[3] = { n->min_x[i], n->min_y[i], n->min_z[i] };
+			const uint8_t q_max[3] = { n->max_x[i], n->max_y[i], n->max_z[i] };
+			for (uint32_t a = 0; a < 3; a++) {
+				c->min[a] = spmdl_bvh_dequantize(node->min[a], node->max[a], q_min[a]);
+				c->max[a] = spmdl_bvh_dequantize(node->min[a], node->max[a], q_max[a]);
+			}
+
+			if (num_triangles == SPMDL_BVH_QNODE_INTERIOR) {
+				c->num_triangles = -1;
+				c->index = both_interior && i == 1 ? n->data_index : node->index + 1;
+			} else {
+				c->num_triangles = (int32_t)num_triangles;
+				c->index = triangle_index;
+				triangle_index += num_triangles;
+			}
+
+			if (spmdl_bvh_ray_box(r, c->min, c->max, &c->t)) num++;
+		}
+	} else {
+		bool wide8 = bvh->node_magic == SPFILE_SECTION_BVH8_NODES;
+		uint32_t width = wide8 ? 8 : 4;
+		const float *min_x, *min_y, *min_z, *max_x, *max_y, *max_z;
+		const int32_t *num_triangles;
+		const uint32_t *data_index;
+		if (wide8) {
+			const spmdl_bvh8_node *n = (const spmdl_bvh8_node*)bvh->nodes + node->index;
+			min_x = n->min_x; min_y = n->min_y; min_z = n->min_z;
+			max_x = n->max_x; max_y = n->max_y; max_z = n->max_z;
+			num_triangles = n->num_triangles;
+			data_index = n->data_index;
+		} else {
+			const spmdl_bvh4_node *n = (const spmdl_bvh4_node*)bvh->nodes + node->index;
+			min_x = n->min_x; min_y = n->min_y; min_z = n->min_z;
+			max_x = n->max_x; max_y = n->max_y; max_z = n->max_z;
+			num_triangles = n->num_triangles;
+			data_index = n->data_index;
+		}
+
+		float t_enter[8];
+		uint32_t mask = spmdl_bvh_ray_wide(r, min_x, min_y, min_z, max_x, max_y, max_z, width, t_enter);
+		for (uint32_t i = 0; i < width; i++) {
+			if (!(mask & (1u << i)) || num_triangles[i] == 0) continue;
+			spmdl_bvh_entry *c = &children[num++];
+			c->t = t_enter[i];
+			c->num_triangles = num_triangles[i];
+			c->index = data_index[i];
+			c->min[0] = min_x[i]; c->min[1] = min_y[i]; c->min[2] = min_z[i];
+			c->max[0] = max_x[i]; c->max[1] = max_y[i]; c->max[2] = max_z[i];
+		}
+	}
+	return num;
+}
+
+bool spmdl_bvh_raycast(const spmdl_bvh *bvh, const spmdl_mesh *mesh, const spmdl_ray *ray, spmdl_ray_hit *hit, spmdl_bvh_stats *stats)
+{
+	hit->t = ray->max_t;
+	hit->u = hit->v = 0.0f;
+	hit->triangle = ~0u;
+	if (mesh->bvh_index == ~0u || mesh->bvh_index >= bvh->num_nodes) return false;
+
+	spmdl_bvh_ray r;
+	const float origin[3] = { ray->origin.x, ray->origin.y, ray->origin.z };
+	const float direction[3] = { ray->direction.x, ray->direction.y, ray->direction.z };
+	for (uint32_t a = 0; a < 3; a++) {
+		r.origin[a] = origin[a];
+		r.direction[a] = direction[a];
+		r.inv_direction[a] = 1.0f / direction[a];
+		r.negative[a] = direction[a] < 0.0f;
+	}
+	r.max_t = ray->max_t;
+
+	spmdl_bvh_stack stack;
+	spmdl_bvh_entry *root = &stack.entries[0];
+	stack.size = 1;
+	root->t = 0.0f;
+	root->num_triangles = -1;
+	root->index = mesh->bvh_index;
+	root->min[0] = mesh->aabb_min.x; root->min[1] = mesh->aabb_min.y; root->min[2] = mesh->aabb_min.z;
+	root->max[0] = mesh->aabb_max.x; root->max[1] = mesh->aabb_max.y; root->max[2] = mesh->aabb_max.z;
+
+	bool found = false;
+	while (stack.size > 0) {
+		spmdl_bvh_entry entry = stack.entries[--stack.size];
+		if (entry.t > r.max_t) continue;
+
+		if (entry.num_triangles > 0) {
+			if (spmdl_bvh_ray_leaf(&r, bvh, &entry, hit, stats)) {
+				r.max_t = hit->t;
+				found = true;
+			}
+		} else {
+			if (entry.index >= bvh->num_nodes) continue;
+			if (stats) stats->node_visits++;
+			spmdl_bvh_entry children[8];
+			uint32_t num = spmdl_bvh_visit(&r, bvh, &entry, children);
+			spmdl_bvh_push(&stack, children, num);
+		}
+	}
+
+	return found;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sp_tools_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Ray queries against the BVH sections of .spmdl files. Supports all node
+// layouts written by sp-model: binary (`SPFILE_SECTION_BVH_NODES`), wide
+// (`_BVH4_NODES`, `_BVH8_NODES`) and compressed (`_BVHQ_NODES`) nodes.
+// Leaf triangles are tested 4 at a time using SSE2 when available, leaves
+// padded by `--bvh-simd` fill every batch.
+typedef struct spmdl_bvh {
+	uint32_t node_magic;        // Magic of the BVH node section
+	const void *nodes;          // Decoded BVH node section
+	uint32_t num_nodes;
+	const uint32_t *triangles;  // Packed vertices `ix | iy << 10 | iz << 20` relative to the leaf bounds
+	uint32_t num_triangles;
+} spmdl_bvh;
+
+typedef struct spmdl_ray {
+	spmdl_vec3 origin;
+	spmdl_vec3 direction;
+	float max_t;
+} spmdl_ray;
+
+typedef struct spmdl_ray_hit {
+	float t;            // Distance along the ray in units of `direction`
+	float u, v;         // Barycentric coordinates of the hit
+	uint32_t triangle;  // Index of the triangle in `spmdl_bvh.triangles`
+} spmdl_ray_hit;
+
+typedef struct spmdl_bvh_stats {
+	uint64_t node_visits;
+	uint64_t triangle_tests;
+} spmdl_bvh_stats;
+
+// Initialize `bvh` from the decoded node and triangle sections of `header`,
+// returns false for an unknown node layout
+bool spmdl_bvh_init(spmdl_bvh *bvh, const spmdl_header *header, const void *nodes, const uint32_t *triangles);
+
+// Find the closest intersection of `ray` with the BVH of `mesh` within
+// `ray->max_t`, returns false if nothing was hit. `stats` is optional and
+// accumulated into.
+bool spmdl_bvh_raycast(const spmdl_bvh *bvh, const spmdl_mesh *mesh, const spmdl_ray *ray, spmdl_ray_hit *hit, spmdl_bvh_stats *stats);
+
+// Decode triangle `index` of a leaf with bounds `aabb_min` to `aabb_max`
+void spmdl_bvh_decode_triangle(const spmdl_bvh *bvh, uint32_t index, spmdl_vec3 aabb_min, spmdl_vec3 aabb_max, spmdl_vec3 verts[3]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,455 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "sptex_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Headers are read before any mips regardless of priority
+#define SPTEX_STREAM_HEADER_KEY -1024.0f
+#define SPTEX_STREAM_HEADER_READ_SIZE 4096
+
+// A section of the file delivering one or more mips (the mip tail)
+struct sptex_stream_unit
+{
+	spfile_section section;
+	uint32_t first_mip;
+	uint32_t num_mips;
+	float extent_log2;
+};
+
+struct sptex_stream_texture
+{
+	char *path;
+	float priority;
+	uint32_t min_mip;
+	uint32_t version;
+	bool has_header;
+	bool in_flight;
+	bool done;
+	sptex_info info;
+	std::vector<sptex_stream_unit> units; // Smallest first
+	size_t next_unit;
+};
+
+struct sptex_stream_entry
+{
+	float key;
+	uint32_t texture;
+	uint32_t version;
+};
+
+// Min-heap on `key`, ties broken by texture index for a deterministic order
+static bool sptex_stream_entry_after(const sptex_stream_entry &a, const sptex_stream_entry &b)
+{
+	if (a.key != b.key) return a.key > b.key;
+	return a.texture > b.texture;
+}
+
+struct sptex_stream_job
+{
+	uint32_t texture;
+	char *data;
+	uint64_t offset; // File offset of `data[0]`
+	size_t size;
+	size_t first_unit;
+	size_t num_units;
+};
+
+struct sptex_stream
+{
+	sptex_stream_opts opts;
+
+	std::mutex mutex;
+	std::condition_variable io_cv;   // Wakes the I/O thread
+	std::condition_variable work_cv; // Wakes the workers
+	std::condition_variable done_cv; // Wakes `sptex_stream_wait()`
+
+	std::vector<sptex_stream_texture*> textures;
+	std::vector<sptex_stream_entry> heap;
+	std::deque<sptex_stream_job> jobs;
+	size_t pending_size = 0;
+	uint32_t num_active = 0;
+	bool stopping = false;
+	sptex_stream_stats stats = { };
+
+	std::thread io_thread;
+	std::vector<std::thread> workers;
+};
+
+static size_t sptex_stream_read(const char *path, uint64_t offset, void *dst, size_t size)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) return 0;
+	size_t num = 0;
+	if (fseek(f, (long)offset, SEEK_SET) == 0) {
+		num = fread(dst, 1, size, f);
+	}
+	fclose(f);
+	return num;
+}
+
+static bool sptex_stream_get_section(const char *data, const spfile_header *header, uint32_t index, spfile_section_magic magic, spfile_section *s)
+{
+	if (index >= header->num_sections) return false;
+	memcpy(s, data + sizeof(spfile_header) + header->header_info_size + index * sizeof(spfile_section), sizeof(spfile_section));
+	return s->magic == magic;
+}
+
+static float sptex_stream_extent_log2(const sptex_info *info, uint32_t mip)
+{
+	uint32_t width = (uint32_t)info->width >> mip, height = (uint32_t)info->height >> mip;
+	uint32_t extent = width > height ? width : height;
+	return log2f(extent > 1 ? (float)extent : 1.0f);
+}
+
+// Find the mip sections to load, `data` must contain the whole header
+static bool sptex_stream_parse_header(sptex_stream_texture *tex, const char *data, size_t size)
+{
+	sptex_util su;
+	if (!sptex_util_init(&su, data, size)) return false;
+	sptex_header header = sptex_decode_header(&su);
+	spfile_util_free(&su.file);
+
+	sptex_info *info = &tex->info;
+	*info = header.info;
+	if (info->num_mips == 0 || info->num_tail_mips > info->num_mips || info->num_tail_mips > SPTEX_MAX_TAIL_MIPS) return false;
+	uint32_t num_section_mips = info->num_mips - info->num_tail_mips;
+	if (tex->min_mip >= info->num_mips) tex->min_mip = info->num_mips - 1;
+
+	if (info->num_tail_mips > 0) {
+		sptex_stream_unit unit;
+		if (!sptex_stream_get_section(data, &header.header, num_section_mips, SPFILE_SECTION_MIP_TAIL, &unit.section)) return false;
+		for (uint32_t i = 0; i < info->num_tail_mips; i++) {
+			uint32_t end = i + 1 < info->num_tail_mips ? info->tail_mip_offsets[i + 1] : unit.section.uncompressed_size;
+			if (info->tail_mip_offsets[i] > end || end > unit.section.uncompressed_size) return false;
+		}
+		unit.first_mip = num_section_mips;
+		unit.num_mips = info->num_tail_mips;
+		unit.extent_log2 = sptex_stream_extent_log2(info, num_section_mips);
+		tex->units.push_back(unit);
+	}
+
+	for (uint32_t mip = num_section_mips; mip-- > tex->min_mip; ) {
+		sptex_stream_unit unit;
+		if (!sptex_stream_get_section(data, &header.header, mip, SPFILE_SECTION_MIP, &unit.section)) return false;
+		unit.first_mip = mip;
+		unit.num_mips = 1;
+		unit.extent_log2 = sptex_stream_extent_log2(info, mip);
+		tex->units.push_back(unit);
+	}
+
+	return true;
+}
+
+static bool sptex_stream_read_header(sptex_stream_texture *tex, uint64_t *bytes_read)
+{
+	char buf[SPTEX_STREAM_HEADER_READ_SIZE];
+	size_t size = sptex_stream_read(tex->path, 0, buf, sizeof(buf));
+	*bytes_read += size;
+	if (size < sizeof(spfile_header)) return false;
+
+	spfile_header header;
+	memcpy(&header, buf, sizeof(spfile_header));
+	uint64_t header_size = sizeof(spfile_header) + (uint64_t)header.header_info_size + (uint64_t)header.num_sections * sizeof(spfile_section);
+	if (header_size <= size) return sptex_stream_parse_header(tex, buf, size);
+
+	// Unusually large header, read it fully
+	if (header_size > 16 * 1024 * 1024) return false;
+	char *data = (char*)malloc((size_t)header_size);
+	if (!data) return false;
+	size = sptex_stream_read(tex->path, 0, data, (size_t)header_size);
+	*bytes_read += size;
+	bool ok = size == header_size && sptex_stream_parse_header(tex, data, size);
+	free(data);
+	return ok;
+}
+
+static void sptex_stream_push(sptex_stream *s, uint32_t index)
+{
+	sptex_stream_texture *tex = s->textures[index];
+	sptex_stream_entry entry;
+	entry.key = tex->has_header ? tex->units[tex->next_unit].extent_log2 - tex->priority : SPTEX_STREAM_HEADER_KEY - tex->priority;
+	entry.texture = index;
+	entry.version = tex->version;
+	s->heap.push_back(entry);
+	std::push_heap(s->heap.begin(), s->heap.end(), sptex_stream_entry_after);
+}
+
+// Report `tex` as done, the callback is called without holding the lock
+static void sptex_stream_finish(sptex_stream *s, std::unique_lock<std::mutex> &lock, uint32_t index, bool ok)
+{
+	sptex_stream_texture *tex = s->textures[index];
+	tex->done = true;
+	if (!ok) s->stats.num_failed++;
+
+	if (s->opts.done_fn) {
+		lock.unlock();
+		s->opts.done_fn(s->opts.user, index, ok);
+		lock.lock();
+	}
+
+	s->num_active--;
+	s->done_cv.notify_all();
+}
+
+static void sptex_stream_io_thread(sptex_stream *s)
+{
+	std::unique_lock<std::mutex> lock(s->mutex);
+	for (;;) {
+		// Drop entries made stale by priority changes
+		while (!s->heap.empty()) {
+			const sptex_stream_entry &top = s->heap.front();
+			const sptex_stream_texture *tex = s->textures[top.texture];
+			if (top.version == tex->version && !tex->in_flight && !tex->done) break;
+			std::pop_heap(s->heap.begin(), s->heap.end(), sptex_stream_entry_after);
+			s->heap.pop_back();
+		}
+
+		if (s->stopping) break;
+		if (s->heap.empty() || s->pending_size >= s->opts.max_pending_size) {
+			s->io_cv.wait(lock);
+			continue;
+		}
+
+		uint32_t index = s->heap.front().texture;
+		std::pop_heap(s->heap.begin(), s->heap.end(), sptex_stream_entry_after);
+		s->heap.pop_back();
+		sptex_stream_texture *tex = s->textures[index];
+		tex->in_flight = true;
+
+		if (!tex->has_header) {
+			uint64_t bytes_read = 0;
+			lock.unlock();
+			bool ok = sptex_stream_read_header(tex, &bytes_read);
+			lock.lock();
+
+			s->stats.num_reads++;
+			s->stats.bytes_read += bytes_read;
+			tex->in_flight = false;
+			tex->has_header = true;
+			if (!ok || tex->units.empty()) {
+				sptex_stream_finish(s, lock, index, ok);
+			} else {
+				sptex_stream_push(s, index);
+			}
+			continue;
+		}
+
+		// Coalesce the following (larger) sections while the read is small or
+		// they would be read next anyway
+		float next_key = s->heap.empty() ? INFINITY : s->heap.front().key;
+		size_t first_unit = tex->next_unit, end_unit = first_unit + 1;
+		const spfile_section *first = &tex->units[first_unit].section;
+		uint64_t begin = first->offset, end = (uint64_t)first->offset + first->compressed_size;
+		while (end_unit < tex->units.size()) {
+			const sptex_stream_unit *next = &tex->units[end_unit];
+			uint64_t next_begin = next->section.offset < begin ? next->section.offset : begin;
+			uint64_t next_end = (uint64_t)next->section.offset + next->section.compressed_size;
+			if (next_end < end) next_end = end;
+			bool in_order = next->extent_log2 - tex->priority <= next_key;
+			if (next_end - next_begin > s->opts.max_read_size && !in_order) break;
+			begin = next_begin;
+			end = next_end;
+			end_unit++;
+		}
+
+		sptex_stream_job job;
+		job.texture = index;
+		job.offset = begin;
+		job.size = (size_t)(end - begin);
+		job.first_unit = first_unit;
+		job.num_units = end_unit - first_unit;
+		tex->next_unit = end_unit;
+		s->pending_size += job.size;
+
+		lock.unlock();
+		job.data = (char*)malloc(job.size > 0 ? job.size : 1);
+		bool ok = job.data && sptex_stream_read(tex->path, job.offset, job.data, job.size) == job.size;
+		lock.lock();
+
+		s->stats.num_reads++;
+		if (!ok) {
+			free(job.data);
+			s->pending_size -= job.size;
+			tex->in_flight = false;
+			sptex_stream_finish(s, lock, index, false);
+			continue;
+		}
+
+		s->stats.bytes_read += job.size;
+		s->jobs.push_back(job);
+		s->work_cv.notify_one();
+	}
+}
+
+static void sptex_stream_worker(sptex_stream *s)
+{
+	spfile_util su;
+	memset(&su, 0, sizeof(su));
+	char *buffer = NULL;
+	size_t buffer_size = 0;
+
+	std::unique_lock<std::mutex> lock(s->mutex);
+	for (;;) {
+		while (s->jobs.empty() && !s->stopping) {
+			s->work_cv.wait(lock);
+		}
+		if (s->stopping) break;
+
+		sptex_stream_job job = s->jobs.front();
+		s->jobs.pop_front();
+		sptex_stream_texture *tex = s->textures[job.texture];
+		lock.unlock();
+
+		bool ok = true;
+		uint64_t num_mips = 0;
+		for (size_t ui = 0; ok && ui < job.num_units; ui++) {
+			const sptex_stream_unit *unit = &tex->units[job.first_unit + ui];
+			const spfile_section *sec = &unit->section;
+			const char *src = job.data + (size_t)(sec->offset - job.offset);
+
+			const char *data = src;
+			if (sec->compression_type != SP_COMPRESSION_NONE) {
+				if (buffer_size < sec->uncompressed_size) {
+					free(buffer);
+					buffer_size = sec->uncompressed_size;
+					buffer = (char*)malloc(buffer_size);
+					if (!buffer) {
+						buffer_size = 0;
+						ok = false;
+						break;
+					}
+				}
+				su.failed = false;
+				ok = spfile_decode_section_data_to(&su, sec, src, buffer);
+				data = buffer;
+			} else if (sec->compressed_size != sec->uncompressed_size) {
+				ok = false;
+			}
+			if (!ok) break;
+
+			// Deliver the mips of the tail from the smallest
+			for (uint32_t mip = unit->first_mip + unit->num_mips; mip-- > unit->first_mip; ) {
+				if (mip < tex->min_mip) continue;
+				size_t offset = 0, size = sec->uncompressed_size;
+				if (unit->num_mips > 1) {
+					uint32_t tail_index = mip - unit->first_mip;
+					offset = tex->info.tail_mip_offsets[tail_index];
+					size = (tail_index + 1 < unit->num_mips ? tex->info.tail_mip_offsets[tail_index + 1] : sec->uncompressed_size) - offset;
+				}
+				if (s->opts.mip_fn) s->opts.mip_fn(s->opts.user, job.texture, mip, &tex->info, data + offset, size);
+				num_mips++;
+			}
+		}
+		free(job.data);
+
+		lock.lock();
+		s->pending_size -= job.size;
+		s->stats.num_mips += num_mips;
+		tex->in_flight = false;
+		if (!ok || tex->next_unit >= tex->units.size()) {
+			sptex_stream_finish(s, lock, job.texture, ok);
+		} else {
+			sptex_stream_push(s, job.texture);
+		}
+		s->io_cv.notify_one();
+	}
+	lock.unlock();
+
+	free(buffer);
+	spfile_util_free(&su);
+}
+
+sptex_stream *sptex_stream_create(const sptex_stream_opts *opts)
+{
+	sptex_stream *s = new sptex_stream();
+	s->opts = *opts;
+	if (s->opts.num_threads == 0) s->opts.num_threads = 1;
+	if (s->opts.max_read_size == 0) s->opts.max_read_size = 64 * 1024;
+	if (s->opts.max_pending_size == 0) s->opts.max_pending_size = 64 * 1024 * 1024;
+
+	s->io_thread = std::thread(sptex_stream_io_thread, s);
+	for (uint32_t i = 0; i < s->opts.num_threads; i++) {
+		s->workers.emplace_back(sptex_stream_worker, s);
+	}
+	return s;
+}
+
+uint32_t sptex_stream_add(sptex_stream *s, const char *path, float priority, uint32_t min_mip)
+{
+	sptex_stream_texture *tex = new sptex_stream_texture();
+	size_t path_len = strlen(path);
+	tex->path = (char*)malloc(path_len + 1);
+	memcpy(tex->path, path, path_len + 1);
+	tex->priority = priority;
+	tex->min_mip = min_mip;
+
+	std::lock_guard<std::mutex> lock(s->mutex);
+	uint32_t index = (uint32_t)s->textures.size();
+	s->textures.push_back(tex);
+	s->num_active++;
+	s->stats.num_textures++;
+	sptex_stream_push(s, index);
+	s->io_cv.notify_one();
+	return index;
+}
+
+void sptex_stream_set_priority(sptex_stream *s, uint32_t texture, float priority)
+{
+	std::lock_guard<std::mutex> lock(s->mutex);
+	if (texture >= s->textures.size()) return;
+	sptex_stream_texture *tex = s->textures[texture];
+	tex->priority = priority;
+	tex->version++;
+	if (!tex->in_flight && !tex->done) {
+		sptex_stream_push(s, texture);
+		s->io_cv.notify_one();
+	}
+}
+
+void sptex_stream_wait(sptex_stream *s)
+{
+	std::unique_lock<std::mutex> lock(s->mutex);
+	while (s->num_active > 0) {
+		s->done_cv.wait(lock);
+	}
+}
+
+sptex_stream_stats sptex_stream_get_stats(sptex_stream *s)
+{
+	std::lock_guard<std::mutex> lock(s->mutex);
+	return s->stats;
+}
+
+void sptex_stream_free(sptex_stream *s)
+{
+	{
+		std::lock_guard<std::mutex> lock(s->mutex);
+		s->stopping = true;
+		s->io_cv.notify_all();
+		s->work_cv.notify_all();
+	}
+
+	s->io_thread.join();
+	for (std::thread &thread : s->workers) {
+		thread.join();
+	}
+
+	for (sptex_stream_job &job : s->jobs) {
+		free(job.data);
+	}
+	for (sptex_stream_texture *tex : s->textures) {
+		free(tex->path);
+		delete tex;
+	}
+	delete s;
+}
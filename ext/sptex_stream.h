@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sp_tools_common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Asynchronous progressive loader for .sptex files. Headers of all added
+// textures are read first, after which mips are read smallest first across
+// all textures. Each texture has a priority measured in mip levels: a texture
+// with priority 1 loads its mips as if they were half the size.
+// Adjacent sections of a texture are coalesced into reads of up to
+// `max_read_size` bytes, or further if they are next in priority order anyway.
+// Reads are issued from a single I/O thread and decoded on `num_threads`
+// worker threads. Mips of a texture are always delivered in order from the
+// smallest to the largest.
+typedef struct sptex_stream sptex_stream;
+
+// Called on a worker thread when `mip` of `texture` is decoded, `data` is only
+// valid during the call
+typedef void sptex_stream_mip_fn(void *user, uint32_t texture, uint32_t mip, const sptex_info *info, const void *data, size_t size);
+
+// Called on a worker (or the I/O) thread when all requested mips of `texture`
+// have been delivered, or when loading it fails
+typedef void sptex_stream_done_fn(void *user, uint32_t texture, bool ok);
+
+typedef struct sptex_stream_opts {
+	uint32_t num_threads;     // Decoding threads (default 1)
+	size_t max_read_size;     // Coalesce adjacent sections up to this size (default 64kB)
+	size_t max_pending_size;  // Limit for data read but not decoded yet (default 64MB)
+	sptex_stream_mip_fn *mip_fn;
+	sptex_stream_done_fn *done_fn;
+	void *user;
+} sptex_stream_opts;
+
+typedef struct sptex_stream_stats {
+	uint64_t num_reads;
+	uint64_t bytes_read;
+	uint64_t num_mips;
+	uint32_t num_textures;
+	uint32_t num_failed;
+} sptex_stream_stats;
+
+sptex_stream *sptex_stream_create(const sptex_stream_opts *opts);
+
+// Queue `path` for loading mips `min_mip` and smaller, returns the texture
+// index passed to the callbacks. `path` is copied.
+uint32_t sptex_stream_add(sptex_stream *s, const char *path, float priority, uint32_t min_mip);
+
+// Change the priority of mips not yet read
+void sptex_stream_set_priority(sptex_stream *s, uint32_t texture, float priority);
+
+// Block until all added textures are done
+void sptex_stream_wait(sptex_stream *s);
+sptex_stream_stats sptex_stream_get_stats(sptex_stream *s);
+
+// Stops reading and waits for the pending decodes, remaining textures are not
+// reported as done
+void sptex_stream_free(sptex_stream *s);
+
+#ifdef __cplusplus
+}
+#endif
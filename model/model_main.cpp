@@ -10,6 +10,9 @@
 #include <assert.h>
 #include <string.h>
 #include <limits>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include "ufbx.h"
 #include "meshoptimizer/meshoptimizer.h"
 #include "acl/core/ansi_allocator.h"
@@ -35,6 +38,39 @@ void failf(const char *fmt, ...)
 	exit(1);
 }
 
+template <typename F>
+static void parallel_for(int num_threads, int num, F f) {
+	if (num_threads > num) num_threads = num;
+	if (num_threads <= 1 || num <= 1) {
+		for (int i = 0; i < num; i++) {
+			f(i);
+		}
+	} else {
+		std::vector<std::thread> threads;
+		threads.reserve(num_threads - 1);
+		std::atomic_int a_index { 0 };
+		for (int thread_i = 0; thread_i < num_threads - 1; thread_i++) {
+			threads.emplace_back([&]() {
+				for (;;) {
+					int index = a_index.fetch_add(1, std::memory_order_relaxed);
+					if (index >= num) return;
+					f(index);
+				}
+			});
+		}
+
+		for (;;) {
+			int index = a_index.fetch_add(1, std::memory_order_relaxed);
+			if (index >= num) break;
+			f(index);
+		}
+
+		for (std::thread &thread : threads) {
+			thread.join();
+		}
+	}
+}
+
 struct attrib_info {
 	const char *code;
 	const char *name;
@@ -51,6 +87,8 @@ attrib_info attrib_list[] = {
 	{ "bonei", "bone-index", SP_VERTEX_ATTRIB_BONE_INDEX },
 	{ "bonew", "bone-weight", SP_VERTEX_ATTRIB_BONE_WEIGHT },
 	{ "pad", "padding", SP_VERTEX_ATTRIB_PADDING },
+	{ "noct", "normal-oct", SP_VERTEX_ATTRIB_NORMAL_OCT },
+	{ "tfrm", "tangent-frame", SP_VERTEX_ATTRIB_TANGENT_FRAME },
 };
 
 struct vertex_format {
@@ -187,14 +225,20 @@ struct mesh_part_source
 
 struct split_part
 {
-	rh::hash_map<int32_t, uint32_t> bone_refs;
-	rh::hash_map<uint32_t, uint32_t> vertex_refs;
-
 	rh::array<uint32_t> vertex_indices;
 	rh::array<uint32_t> bone_indices;
 	rh::array<uint32_t> indices;
 };
 
+struct split_state
+{
+	uint32_t part_id = 0;
+	rh::array<uint32_t> vertex_part;  // Last part referencing each source vertex
+	rh::array<uint32_t> vertex_local; // Index of the vertex within that part
+	rh::array<uint32_t> bone_part;
+	rh::array<uint32_t> bone_local;
+};
+
 struct mesh_limits
 {
 	uint32_t max_vertices;
@@ -221,6 +265,14 @@ struct attrib_bounds
 #define BVH_MAX_DEPTH 32
 #define BVH_BUILD_SPLITS 64
 #define BVH_SPLIT_MIN_TRIANGLES 16
+
+// Nodes with at least this many triangles are binned using multiple threads,
+// smaller subtrees are built as independent tasks
+#define BVH_PARALLEL_MIN_TRIANGLES 65536
+
+// Temporary `spmdl_bvh_split::num_triangles` value for splits pointing to
+// a subtree task, `data_index` is the index of the task
+#define BVH_SPLIT_TASK -2
 #define BVH_NODE_COST 1.0f
 #define BVH_TRI_COST 1.0f
 
@@ -277,10 +329,31 @@ struct bvh_build_triangle
 	}
 };
 
+struct bvh_build_node
+{
+	uint32_t node_index;
+	uint32_t node_split;
+	bvh_bounds bounds;
+	uint32_t triangle_begin;
+	uint32_t num_triangles;
+};
+
+struct bvh_build_task
+{
+	bvh_build_node node;
+	int depth;
+	rh::array<spmdl_bvh_node> nodes;
+};
+
 struct bvh_build_ctx
 {
 	rh::slice<bvh_build_triangle> triangles;
 	rh::array<spmdl_bvh_node> nodes;
+
+	// Top-level builds only: threads used for binning and subtrees deferred
+	// into tasks, otherwise `tasks == nullptr`
+	int num_threads = 1;
+	rh::array<bvh_build_task> *tasks = nullptr;
 };
 
 struct bvh_build_bucket {
@@ -289,13 +362,18 @@ struct bvh_build_bucket {
 	uint32_t num;            // < Number of items in the bucket
 };
 
-struct bvh_build_node
+struct bvh_build_bins
 {
-	uint32_t node_index;
-	uint32_t node_split;
-	bvh_bounds bounds;
-	uint32_t triangle_begin;
-	uint32_t num_triangles;
+	bvh_build_bucket buckets[3][BVH_BUILD_SPLITS];
+};
+
+struct bvh_build_split
+{
+	float cost;
+	int axis;
+	int bucket;
+	bvh_bounds left_bounds;
+	bvh_bounds right_bounds;
 };
 
 static void bvh_build_leaf(bvh_build_ctx &ctx, const bvh_build_node &parent)
@@ -307,41 +385,75 @@ static void bvh_build_leaf(bvh_build_ctx &ctx, const bvh_build_node &parent)
 	}
 }
 
-static void bvh_build_sah(bvh_build_ctx &ctx, const bvh_build_node &parent, int depth)
+static void bvh_bin_triangles(bvh_build_bins &bins, const bvh_build_ctx &ctx, const bvh_bounds &bounds, uint32_t begin, uint32_t end)
 {
-	bvh_build_bucket buckets[BVH_BUILD_SPLITS];
-
-	bvh_build_node left, right;
-
-	float best_cost = HUGE_VALF;
-	int best_axis = -1;
-	int best_bucket = -1;
-	float parent_area = parent.bounds.area();
-
+	float min[3], rcp_scale[3];
 	for (int axis = 0; axis < 3; axis++) {
-
-		// Reset all buckets for the axis
 		for (int i = 0; i < BVH_BUILD_SPLITS; i++) {
-			buckets[i].bounds.reset();
-			buckets[i].num = 0;
+			bins.buckets[axis][i].bounds.reset();
+			bins.buckets[axis][i].num = 0;
 		}
+		min[axis] = bounds.min[axis];
+		rcp_scale[axis] = (float)BVH_BUILD_SPLITS / (bounds.max[axis] - bounds.min[axis]);
+	}
 
-		float min = parent.bounds.min[axis];
-		float max = parent.bounds.max[axis];
-		float rcp_scale = (float)BVH_BUILD_SPLITS / (max - min);
-
-		// Insert items into buckets
-		for (uint32_t i = 0; i < parent.num_triangles; i++) {
-			bvh_build_triangle &tri = ctx.triangles.data[parent.triangle_begin + i];
+	for (uint32_t i = begin; i < end; i++) {
+		bvh_build_triangle &tri = ctx.triangles.data[i];
+		for (int axis = 0; axis < 3; axis++) {
 			float mid = tri.axis_midpoint(axis);
-			int bucket = (int)((mid - min) * rcp_scale);
+			int bucket = (int)((mid - min[axis]) * rcp_scale[axis]);
 			if (bucket < 0) bucket = 0;
 			if (bucket >= BVH_BUILD_SPLITS) bucket = BVH_BUILD_SPLITS - 1;
-			buckets[bucket].bounds.extend(tri.v[0]);
-			buckets[bucket].bounds.extend(tri.v[1]);
-			buckets[bucket].bounds.extend(tri.v[2]);
-			buckets[bucket].num++;
+			bvh_build_bucket &b = bins.buckets[axis][bucket];
+			b.bounds.extend(tri.v[0]);
+			b.bounds.extend(tri.v[1]);
+			b.bounds.extend(tri.v[2]);
+			b.num++;
 		}
+	}
+}
+
+// Find the lowest SAH cost split, min/max and counts are exact so binning in
+// parallel chunks results in the same split as binning serially
+static bvh_build_split bvh_find_split(const bvh_build_ctx &ctx, const bvh_build_node &parent)
+{
+	bvh_build_bins bins;
+
+	if (ctx.num_threads > 1 && parent.num_triangles >= BVH_PARALLEL_MIN_TRIANGLES) {
+		int num_chunks = ctx.num_threads;
+		uint32_t chunk_size = (parent.num_triangles + (uint32_t)num_chunks - 1) / (uint32_t)num_chunks;
+
+		rh::array<bvh_build_bins> chunk_bins;
+		chunk_bins.resize_uninit((size_t)num_chunks);
+		parallel_for(ctx.num_threads, num_chunks, [&](int i) {
+			uint32_t begin = (uint32_t)i * chunk_size;
+			uint32_t end = begin + chunk_size;
+			if (end > parent.num_triangles) end = parent.num_triangles;
+			if (begin > end) begin = end;
+			bvh_bin_triangles(chunk_bins[i], ctx, parent.bounds, parent.triangle_begin + begin, parent.triangle_begin + end);
+		});
+
+		bins = chunk_bins[0];
+		for (int ci = 1; ci < num_chunks; ci++) {
+			for (int axis = 0; axis < 3; axis++) {
+				for (int i = 0; i < BVH_BUILD_SPLITS; i++) {
+					bins.buckets[axis][i].bounds.extend(chunk_bins[ci].buckets[axis][i].bounds);
+					bins.buckets[axis][i].num += chunk_bins[ci].buckets[axis][i].num;
+				}
+			}
+		}
+	} else {
+		bvh_bin_triangles(bins, ctx, parent.bounds, parent.triangle_begin, parent.triangle_begin + parent.num_triangles);
+	}
+
+	bvh_build_split best;
+	best.cost = HUGE_VALF;
+	best.axis = -1;
+	best.bucket = -1;
+	float parent_area = parent.bounds.area();
+
+	for (int axis = 0; axis < 3; axis++) {
+		bvh_build_bucket *buckets = bins.buckets[axis];
 
 		// Scan backwards to get `bounds_right`
 		buckets[BVH_BUILD_SPLITS - 1].bounds_right = buckets[BVH_BUILD_SPLITS - 1].bounds;
@@ -370,18 +482,50 @@ static void bvh_build_sah(bvh_build_ctx &ctx, const bvh_build_node &parent, int
 			float cost_right = (float)num_right * BVH_TRI_COST;
 			float cost_split = BVH_NODE_COST + (area_left*cost_left + area_right*cost_right) / parent_area;
 
-			if (cost_split < best_cost) {
-				left.bounds = bounds_left;
-				right.bounds = bucket_right.bounds_right;
-				best_cost = cost_split;
-				best_axis = axis;
-				best_bucket = i;
+			if (cost_split < best.cost) {
+				best.left_bounds = bounds_left;
+				best.right_bounds = bucket_right.bounds_right;
+				best.cost = cost_split;
+				best.axis = axis;
+				best.bucket = i;
 			}
 		}
 	}
 
+	return best;
+}
+
+static void bvh_build_sah(bvh_build_ctx &ctx, const bvh_build_node &parent, int depth);
+
+static void bvh_build_child(bvh_build_ctx &ctx, const bvh_build_node &child, int depth)
+{
+	if (ctx.tasks && child.num_triangles < BVH_PARALLEL_MIN_TRIANGLES) {
+		spmdl_bvh_split &split = ctx.nodes[child.node_index].splits[child.node_split];
+		split.num_triangles = BVH_SPLIT_TASK;
+		split.data_index = (uint32_t)ctx.tasks->size();
+
+		bvh_build_task task;
+		task.node = child;
+		task.node.node_index = ~0u;
+		task.depth = depth;
+		ctx.tasks->push_back(std::move(task));
+	} else {
+		bvh_build_sah(ctx, child, depth);
+	}
+}
+
+static void bvh_build_sah(bvh_build_ctx &ctx, const bvh_build_node &parent, int depth)
+{
+	bvh_build_node left, right;
+
+	bvh_build_split best = bvh_find_split(ctx, parent);
+
 	float leaf_cost = (float)parent.num_triangles * BVH_TRI_COST;
-	if ((depth < BVH_MAX_DEPTH && best_cost < leaf_cost && parent.num_triangles > BVH_SPLIT_MIN_TRIANGLES) || (depth == 0 && best_axis >= 0)) {
+	if ((depth < BVH_MAX_DEPTH && best.cost < leaf_cost && parent.num_triangles > BVH_SPLIT_MIN_TRIANGLES) || (depth == 0 && best.axis >= 0)) {
+		int best_axis = best.axis;
+		int best_bucket = best.bucket;
+		left.bounds = best.left_bounds;
+		right.bounds = best.right_bounds;
 
 		float min = parent.bounds.min[best_axis];
 		float max = parent.bounds.max[best_axis];
@@ -427,24 +571,135 @@ static void bvh_build_sah(bvh_build_ctx &ctx, const bvh_build_node &parent, int
 
 		ctx.nodes.push_back(node);
 
-		bvh_build_sah(ctx, left, depth + 1);
-		bvh_build_sah(ctx, right, depth + 1);
+		bvh_build_child(ctx, left, depth + 1);
+		bvh_build_child(ctx, right, depth + 1);
 	} else {
 		bvh_build_leaf(ctx, parent);
 	}
 }
 
+// Copy the top-level nodes and finished subtree tasks to `dst` in the same
+// depth-first order as a serial build, returns the index of `node_index`
+static uint32_t bvh_gather_nodes(rh::array<spmdl_bvh_node> &dst, const bvh_build_ctx &ctx, uint32_t node_index)
+{
+	uint32_t dst_index = (uint32_t)dst.size();
+	dst.push_back(ctx.nodes[node_index]);
+
+	for (uint32_t i = 0; i < 2; i++) {
+		spmdl_bvh_split split = ctx.nodes[node_index].splits[i];
+		if (split.num_triangles == -1) {
+			split.data_index = bvh_gather_nodes(dst, ctx, split.data_index);
+		} else if (split.num_triangles == BVH_SPLIT_TASK) {
+			const bvh_build_task &task = (*ctx.tasks)[split.data_index];
+			if (task.nodes.size() == 0) {
+				split.num_triangles = (int32_t)task.node.num_triangles;
+				split.data_index = task.node.triangle_begin;
+			} else {
+				uint32_t base = (uint32_t)dst.size();
+				for (spmdl_bvh_node node : task.nodes) {
+					for (spmdl_bvh_split &child : node.splits) {
+						if (child.num_triangles < 0) child.data_index += base;
+					}
+					dst.push_back(node);
+				}
+				split.num_triangles = -1;
+				split.data_index = base;
+			}
+		}
+		dst[dst_index].splits[i] = split;
+	}
+
+	return dst_index;
+}
+
 struct bvh_build_result
 {
 	rh::array<spmdl_bvh_node> nodes;
+	rh::array<spmdl_bvh_qnode> qnodes; // Only if built with `qframe`
 	rh::array<uint32_t> triangles;
 };
 
-static uint32_t build_bvh(bvh_build_result &result, rh::slice<bvh_build_triangle> triangles, bool simd)
+static float bvh_dequantize(float min, float max, uint32_t q)
+{
+	return min + (max - min) * ((float)q / 255.0f);
+}
+
+// Quantize `child` to 8 bits within `frame`, rounding outwards so that the
+// decoded bounds returned in `decoded` contain `child`
+static void bvh_quantize_bounds(uint8_t q_min[3], uint8_t q_max[3], bvh_bounds &decoded, const bvh_bounds &frame, const bvh_bounds &child)
+{
+	for (int axis = 0; axis < 3; axis++) {
+		float min = frame.min[axis], max = frame.max[axis];
+		float extent = max - min;
+		int32_t lo = 0, hi = 255;
+		if (extent > 0.0f) {
+			lo = (int32_t)floorf((child.min[axis] - min) / extent * 255.0f);
+			hi = (int32_t)ceilf((child.max[axis] - min) / extent * 255.0f);
+			if (lo < 0) lo = 0;
+			if (lo > 255) lo = 255;
+			if (hi < lo) hi = lo;
+			if (hi > 255) hi = 255;
+			while (lo > 0 && bvh_dequantize(min, max, (uint32_t)lo) > child.min[axis]) lo--;
+			while (hi < 255 && bvh_dequantize(min, max, (uint32_t)hi) < child.max[axis]) hi++;
+		}
+		q_min[axis] = (uint8_t)lo;
+		q_max[axis] = (uint8_t)hi;
+		decoded.min[axis] = bvh_dequantize(min, max, (uint32_t)lo);
+		decoded.max[axis] = bvh_dequantize(min, max, (uint32_t)hi);
+	}
+}
+
+// Quantize the child bounds of `node_index` within `frame` and replace them
+// with the decoded bounds that the leaf triangles are quantized against
+static void bvh_quantize_node(rh::array<spmdl_bvh_node> &nodes, rh::array<spmdl_bvh_qnode> &qnodes, uint32_t node_index, const bvh_bounds &frame)
+{
+	for (uint32_t i = 0; i < 2; i++) {
+		spmdl_bvh_split &split = nodes[node_index].splits[i];
+		if (split.num_triangles == 0) continue;
+
+		bvh_bounds child;
+		child.min[0] = split.aabb_min.x;
+		child.min[1] = split.aabb_min.y;
+		child.min[2] = split.aabb_min.z;
+		child.max[0] = split.aabb_max.x;
+		child.max[1] = split.aabb_max.y;
+		child.max[2] = split.aabb_max.z;
+
+		uint8_t q_min[3], q_max[3];
+		bvh_bounds decoded;
+		bvh_quantize_bounds(q_min, q_max, decoded, frame, child);
+		decoded.to_spmdl(split.aabb_min, split.aabb_max);
+
+		spmdl_bvh_qnode &qnode = qnodes[node_index];
+		qnode.min_x[i] = q_min[0];
+		qnode.min_y[i] = q_min[1];
+		qnode.min_z[i] = q_min[2];
+		qnode.max_x[i] = q_max[0];
+		qnode.max_y[i] = q_max[1];
+		qnode.max_z[i] = q_max[2];
+
+		if (split.num_triangles < 0) {
+			bvh_quantize_node(nodes, qnodes, split.data_index, decoded);
+		}
+	}
+}
+
+// Large BVHs are built with `num_threads`: the top levels are split using
+// parallel binning and the remaining subtrees are built as independent tasks.
+// The result is identical to a single-threaded build.
+// If `qframe` is given compressed nodes are written to `result.qnodes` with
+// `qframe` as the bounds of the root node.
+static uint32_t build_bvh(bvh_build_result &result, rh::slice<bvh_build_triangle> triangles, bool simd, int num_threads, const bvh_bounds *qframe)
 {
 	bvh_build_ctx ctx;
 	ctx.triangles = triangles;
 
+	rh::array<bvh_build_task> tasks;
+	if (num_threads > 1 && triangles.size >= BVH_PARALLEL_MIN_TRIANGLES) {
+		ctx.num_threads = num_threads;
+		ctx.tasks = &tasks;
+	}
+
 	bvh_build_node root;
 	root.node_index = ~0u;
 	root.node_split = ~0u;
@@ -459,6 +714,21 @@ static uint32_t build_bvh(bvh_build_result &result, rh::slice<bvh_build_triangle
 
 	bvh_build_sah(ctx, root, 0);
 
+	if (tasks.size() > 0) {
+		parallel_for(num_threads, (int)tasks.size(), [&](int i) {
+			bvh_build_task &task = tasks[i];
+			bvh_build_ctx task_ctx;
+			task_ctx.triangles = triangles;
+			bvh_build_sah(task_ctx, task.node, task.depth);
+			task.nodes = std::move(task_ctx.nodes);
+		});
+
+		rh::array<spmdl_bvh_node> nodes;
+		nodes.reserve(ctx.nodes.size());
+		bvh_gather_nodes(nodes, ctx, 0);
+		ctx.nodes = std::move(nodes);
+	}
+
 	// Only one leaf node
 	if (ctx.nodes.size() == 0) {
 		spmdl_bvh_node node;
@@ -482,8 +752,15 @@ static uint32_t build_bvh(bvh_build_result &result, rh::slice<bvh_build_triangle
 
 	uint32_t root_index = (uint32_t)result.nodes.size();
 
+	rh::array<spmdl_bvh_qnode> qnodes;
+	if (qframe) {
+		qnodes.resize(ctx.nodes.size());
+		bvh_quantize_node(ctx.nodes, qnodes, 0, *qframe);
+	}
+
 	// Quantize vertices
-	for (spmdl_bvh_node &node : ctx.nodes) {
+	for (size_t node_ix = 0; node_ix < ctx.nodes.size(); node_ix++) {
+		spmdl_bvh_node &node = ctx.nodes[node_ix];
 		for (spmdl_bvh_split &split : node.splits) {
 			if (split.num_triangles < 0) {
 				split.data_index += root_index;
@@ -538,12 +815,147 @@ static uint32_t build_bvh(bvh_build_result &result, rh::slice<bvh_build_triangle
 			}
 		}
 
+		if (qframe) {
+			spmdl_bvh_qnode &qnode = qnodes[node_ix];
+			qnode.data_index = 0;
+			for (int32_t i = 1; i >= 0; i--) {
+				const spmdl_bvh_split &split = node.splits[i];
+				if (split.num_triangles < 0) {
+					qnode.num_triangles[i] = SPMDL_BVH_QNODE_INTERIOR;
+					if (i == 1) qnode.data_index = split.data_index;
+				} else if (split.num_triangles == 0) {
+					qnode.num_triangles[i] = 0;
+				} else {
+					// Include padding up to the next leaf or the end of the triangles
+					uint32_t end = (uint32_t)result.triangles.size() / 3;
+					if (i == 0 && node.splits[1].num_triangles > 0) end = node.splits[1].data_index;
+					uint32_t num_triangles = end - split.data_index;
+					if (num_triangles >= SPMDL_BVH_QNODE_INTERIOR) failf("Too many triangles in a BVH leaf for compressed nodes: %u", num_triangles);
+					qnode.num_triangles[i] = (uint16_t)num_triangles;
+					qnode.data_index = split.data_index;
+				}
+			}
+			result.qnodes.push_back(qnode);
+		}
+
 		result.nodes.push_back(node);
 	}
 
 	return root_index;
 }
 
+static float bvh_split_area(const spmdl_bvh_split &split)
+{
+	float x = split.aabb_max.x - split.aabb_min.x;
+	float y = split.aabb_max.y - split.aabb_min.y;
+	float z = split.aabb_max.z - split.aabb_min.z;
+	return 2.0f * (x*y + y*z + z*x);
+}
+
+// Collapse the binary BVH rooted at `node_index` into `N`-wide nodes by
+// repeatedly opening the interior child with the largest surface area.
+// Wide nodes are stored depth-first, returns the index of the root node.
+template <typename T, uint32_t N>
+static uint32_t collapse_bvh(rh::array<T> &dst, const rh::array<spmdl_bvh_node> &src, uint32_t node_index)
+{
+	spmdl_bvh_split children[N];
+	uint32_t num_children = 0;
+	for (const spmdl_bvh_split &split : src[node_index].splits) {
+		if (split.num_triangles != 0) children[num_children++] = split;
+	}
+
+	while (num_children < N) {
+		int32_t best_child = -1;
+		float best_area = -1.0f;
+		for (uint32_t i = 0; i < num_children; i++) {
+			if (children[i].num_triangles >= 0) continue;
+			float area = bvh_split_area(children[i]);
+			if (area > best_area) {
+				best_area = area;
+				best_child = (int32_t)i;
+			}
+		}
+		if (best_child < 0) break;
+
+		// Replace the child with its splits, keeping the spatial order
+		const spmdl_bvh_node &node = src[children[best_child].data_index];
+		for (uint32_t i = num_children; i > (uint32_t)best_child + 1; i--) {
+			children[i] = children[i - 1];
+		}
+		children[best_child] = node.splits[0];
+		children[best_child + 1] = node.splits[1];
+		num_children++;
+	}
+
+	uint32_t dst_index = (uint32_t)dst.size();
+	dst.push_back(T{ });
+
+	uint32_t data_index[N];
+	for (uint32_t i = 0; i < num_children; i++) {
+		if (children[i].num_triangles < 0) {
+			data_index[i] = collapse_bvh<T, N>(dst, src, children[i].data_index);
+		} else {
+			data_index[i] = children[i].data_index;
+		}
+	}
+
+	T &node = dst[dst_index];
+	for (uint32_t i = 0; i < N; i++) {
+		if (i < num_children) {
+			const spmdl_bvh_split &child = children[i];
+			node.min_x[i] = child.aabb_min.x;
+			node.min_y[i] = child.aabb_min.y;
+			node.min_z[i] = child.aabb_min.z;
+			node.max_x[i] = child.aabb_max.x;
+			node.max_y[i] = child.aabb_max.y;
+			node.max_z[i] = child.aabb_max.z;
+			node.num_triangles[i] = child.num_triangles < 0 ? -1 : child.num_triangles;
+			node.data_index[i] = data_index[i];
+		} else {
+			node.min_x[i] = node.min_y[i] = node.min_z[i] = +HUGE_VALF;
+			node.max_x[i] = node.max_y[i] = node.max_z[i] = -HUGE_VALF;
+			node.num_triangles[i] = 0;
+			node.data_index[i] = 0;
+		}
+	}
+
+	return dst_index;
+}
+
+// Append a BVH built separately into `dst`, returns the index of the root node
+static uint32_t append_bvh(bvh_build_result &dst, const bvh_build_result &src)
+{
+	uint32_t node_base = (uint32_t)dst.nodes.size();
+	uint32_t triangle_base = (uint32_t)dst.triangles.size() / 3;
+
+	for (spmdl_bvh_node node : src.nodes) {
+		for (spmdl_bvh_split &split : node.splits) {
+			if (split.num_triangles < 0) {
+				split.data_index += node_base;
+			} else if (split.num_triangles > 0) {
+				split.data_index += triangle_base;
+			}
+		}
+		dst.nodes.push_back(node);
+	}
+	for (spmdl_bvh_qnode qnode : src.qnodes) {
+		bool has_leaf = false, has_interior = false;
+		for (uint16_t num_triangles : qnode.num_triangles) {
+			if (num_triangles == SPMDL_BVH_QNODE_INTERIOR) has_interior = true;
+			else if (num_triangles > 0) has_leaf = true;
+		}
+		if (has_leaf) {
+			qnode.data_index += triangle_base;
+		} else if (has_interior) {
+			qnode.data_index += node_base;
+		}
+		dst.qnodes.push_back(qnode);
+	}
+	dst.triangles.insert_back(src.triangles);
+
+	return node_base;
+}
+
 static uint32_t hash(const merge_key &key) { return rh::hash_buffer_align4(&key, sizeof(key)); }
 
 mesh_data_format create_mesh_data_format(const vertex_format &format)
@@ -575,6 +987,19 @@ mesh_data_format create_mesh_data_format(const vertex_format &format)
 			}
 			break;
 		case SP_VERTEX_ATTRIB_PADDING: attrib_size_in_floats = 0; break;
+		case SP_VERTEX_ATTRIB_NORMAL_OCT:
+			if (attrib.format != SP_FORMAT_RG8_SNORM && attrib.format != SP_FORMAT_RG16_SNORM
+				&& attrib.format != SP_FORMAT_RGBA8_SNORM && attrib.format != SP_FORMAT_RGBA16_SNORM) {
+				failf("Octahedral normals must be rg8sn, rg16sn, rgba8sn or rgba16sn");
+			}
+			attrib_size_in_floats = 4;
+			break;
+		case SP_VERTEX_ATTRIB_TANGENT_FRAME:
+			if (attrib.format != SP_FORMAT_RGBA8_SNORM && attrib.format != SP_FORMAT_RGBA16_SNORM) {
+				failf("Tangent frames must be rgba8sn or rgba16sn");
+			}
+			attrib_size_in_floats = 7;
+			break;
 		}
 
 		fmt.attrib_size_in_floats[i] = (uint8_t)attrib_size_in_floats;
@@ -592,8 +1017,7 @@ struct tangent_generator
 	uint32_t position_offset = ~0u;
 	uint32_t normal_offset = ~0u;
 	uint32_t uv_offset = ~0u;
-	uint32_t tangent_offset = ~0u;
-	uint32_t tangent_sign_offset = ~0u;
+	float *tangent_data = nullptr; // Tangent and sign per triangle corner
 };
 
 int tangent_getNumFaces(const SMikkTSpaceContext * pContext)
@@ -631,13 +1055,8 @@ void tangent_getTexCoord(const SMikkTSpaceContext * pContext, float fvTexcOut[],
 void tangent_setTSpaceBasic(const SMikkTSpaceContext * pContext, const float fvTangent[], const float fSign, const int iFace, const int iVert)
 {
 	tangent_generator *tg = (tangent_generator*)pContext->m_pUserData;
-	float* dst = tg->vertex_data + (iFace * 3 + iVert) * tg->vertex_stride + tg->tangent_offset;
+	float* dst = tg->tangent_data + (iFace * 3 + iVert) * 4;
 	dst[0] = fvTangent[0]; dst[1] = fvTangent[1]; dst[2] = fvTangent[2]; dst[3] = fSign;
-
-	if (tg->tangent_sign_offset != ~0u) {
-		float* sdst = tg->vertex_data + (iFace * 3 + iVert) * tg->vertex_stride + tg->tangent_sign_offset;
-		sdst[0] = fSign;
-	}
 }
 
 SMikkTSpaceInterface tangent_interface = {
@@ -671,8 +1090,7 @@ mesh_part process_mesh_part(ufbx_mesh *mesh, const mesh_data_format &fmt, const
 
 	uint32_t normal_offset_in_floats = ~0u;
 	uint32_t uv_offset_in_floats = ~0u;
-	uint32_t tangent_offset_in_floats = ~0u;
-	uint32_t tangent_sign_offset_in_floats = ~0u;
+	bool needs_tangents = false;
 	size_t stride_in_floats = fmt.vertex_size_in_floats;
 
 	uint32_t attrib_offset_in_floats = 0;
@@ -693,7 +1111,11 @@ mesh_part process_mesh_part(ufbx_mesh *mesh, const mesh_data_format &fmt, const
 			break;
 
 		case SP_VERTEX_ATTRIB_NORMAL:
-			normal_offset_in_floats = attrib_offset_in_floats;
+		case SP_VERTEX_ATTRIB_NORMAL_OCT:
+		case SP_VERTEX_ATTRIB_TANGENT_FRAME:
+			if (attrib.attrib == SP_VERTEX_ATTRIB_TANGENT_FRAME) needs_tangents = true;
+			if (attrib.attrib == SP_VERTEX_ATTRIB_NORMAL_OCT && sp_format_infos[attrib.format].num_components == 4) needs_tangents = true;
+			if (normal_offset_in_floats == ~0u) normal_offset_in_floats = attrib_offset_in_floats;
 			if (src.normals) {
 				for (size_t i : src.indices) {
 					ufbx_vec3 v = src.normals[mesh->vertex_normal.indices[i]];
@@ -704,11 +1126,8 @@ mesh_part process_mesh_part(ufbx_mesh *mesh, const mesh_data_format &fmt, const
 			break;
 
 		case SP_VERTEX_ATTRIB_TANGENT:
-			tangent_offset_in_floats = attrib_offset_in_floats;
-			break;
-
 		case SP_VERTEX_ATTRIB_TANGENT_SIGN:
-			tangent_sign_offset_in_floats = attrib_offset_in_floats;
+			needs_tangents = true;
 			break;
 
 		case SP_VERTEX_ATTRIB_UV:
@@ -765,7 +1184,10 @@ mesh_part process_mesh_part(ufbx_mesh *mesh, const mesh_data_format &fmt, const
 		attrib_offset_in_floats += (uint32_t)fmt.attrib_size_in_floats[i];
 	}
 
-	if (normal_offset_in_floats != ~0u && uv_offset_in_floats != ~0u && tangent_offset_in_floats != ~0u) {
+	if (normal_offset_in_floats != ~0u && uv_offset_in_floats != ~0u && needs_tangents) {
+		rh::array<float> tangent_data;
+		tangent_data.resize(src.indices.size() * 4);
+
 		tangent_generator tg;
 		tg.vertex_data = vertex_data.data();
 		tg.num_triangles = (uint32_t)src.indices.size() / 3;
@@ -773,13 +1195,35 @@ mesh_part process_mesh_part(ufbx_mesh *mesh, const mesh_data_format &fmt, const
 		tg.position_offset = fmt.position_offset_in_floats;
 		tg.normal_offset = normal_offset_in_floats;
 		tg.uv_offset = uv_offset_in_floats;
-		tg.tangent_offset = tangent_offset_in_floats;
-		tg.tangent_sign_offset = tangent_sign_offset_in_floats;
+		tg.tangent_data = tangent_data.data();
 
 		SMikkTSpaceContext ctx;
 		ctx.m_pInterface = &tangent_interface;
 		ctx.m_pUserData = &tg;
 		genTangSpaceDefault(&ctx);
+
+		// Scatter the tangents to every attribute that contains them
+		attrib_offset_in_floats = 0;
+		for (uint32_t i = 0; i < opts.format.num_attribs; i++) {
+			sp_vertex_attrib attrib = opts.format.attribs[i].attrib;
+			uint32_t offset = 0, count = 0, first = 0;
+			switch (attrib) {
+			case SP_VERTEX_ATTRIB_TANGENT: offset = 0; first = 0; count = 4; break;
+			case SP_VERTEX_ATTRIB_TANGENT_SIGN: offset = 0; first = 3; count = 1; break;
+			case SP_VERTEX_ATTRIB_NORMAL_OCT: offset = 3; first = 3; count = 1; break;
+			case SP_VERTEX_ATTRIB_TANGENT_FRAME: offset = 3; first = 0; count = 4; break;
+			}
+
+			float *dst = vertex_data.data() + attrib_offset_in_floats + offset;
+			const float *tan = tangent_data.data() + first;
+			for (size_t vi = 0; vi < src.indices.size() && count > 0; vi++) {
+				for (uint32_t c = 0; c < count; c++) dst[c] = tan[c];
+				dst += stride_in_floats;
+				tan += 4;
+			}
+
+			attrib_offset_in_floats += (uint32_t)fmt.attrib_size_in_floats[i];
+		}
 	}
 
 	if (src.indices.size() > 0 && fmt.vertex_size_in_floats > 0) {
@@ -872,7 +1316,9 @@ void merge_mesh_part(mesh_part &dst, const mesh_part &src)
 	dst.num_indices += src.num_indices;
 }
 
-bool add_triangle(split_part &part, const uint32_t *indices, const int32_t *bone_indices, uint32_t weights_per_vertex, const mesh_limits &limits)
+// Tentatively add a triangle to `part`, vertices and bones already in the
+// part are found through `state` which is stamped with the current part id
+bool add_triangle(split_part &part, split_state &state, const uint32_t *indices, const int32_t *bone_indices, uint32_t weights_per_vertex, const mesh_limits &limits)
 {
 	size_t prev_num_vertices = part.vertex_indices.size();
 	size_t prev_num_bones = part.bone_indices.size();
@@ -880,41 +1326,39 @@ bool add_triangle(split_part &part, const uint32_t *indices, const int32_t *bone
 	for (uint32_t ci = 0; ci < 3; ci++) {
 		uint32_t vertex_ix = indices[ci];
 
-		{
-			auto res = part.vertex_refs.emplace(vertex_ix, (uint32_t)part.vertex_indices.size());
-			if (res.inserted) {
-				part.vertex_indices.push_back(vertex_ix);
-			}
-			part.indices.push_back(res.entry->value);
+		if (state.vertex_part[vertex_ix] != state.part_id) {
+			state.vertex_part[vertex_ix] = state.part_id;
+			state.vertex_local[vertex_ix] = (uint32_t)part.vertex_indices.size();
+			part.vertex_indices.push_back(vertex_ix);
 		}
+		part.indices.push_back(state.vertex_local[vertex_ix]);
+
+		if (state.bone_part.empty()) continue;
 
 		const int32_t *bone_index_base = bone_indices + vertex_ix * weights_per_vertex;
 		for (uint32_t bi = 0; bi < weights_per_vertex; bi++) {
-			auto res = part.bone_refs.emplace(bone_index_base[bi], (uint32_t)part.bone_indices.size());
-			if (res.inserted) {
-				part.bone_indices.push_back(bone_index_base[bi]);
+			int32_t bone_ix = bone_index_base[bi];
+			assert(bone_ix >= 0 && (size_t)bone_ix < state.bone_part.size());
+			if (state.bone_part[bone_ix] != state.part_id) {
+				state.bone_part[bone_ix] = state.part_id;
+				state.bone_local[bone_ix] = (uint32_t)part.bone_indices.size();
+				part.bone_indices.push_back((uint32_t)bone_ix);
 			}
 		}
 	}
 
-	assert(part.vertex_refs.size() <= part.vertex_indices.size());
-	assert(part.bone_refs.size() <= part.bone_indices.size());
-
 	if (part.vertex_indices.size() <= limits.max_vertices && part.bone_indices.size() <= limits.max_bones) {
 		return true;
 	}
 
 	for (size_t i = prev_num_vertices; i < part.vertex_indices.size(); i++) {
-		part.vertex_refs.remove(part.vertex_indices[i]);
+		state.vertex_part[part.vertex_indices[i]] = 0;
 	}
 
 	for (size_t i = prev_num_bones; i < part.bone_indices.size(); i++) {
-		part.bone_refs.remove(part.bone_indices[i]);
+		state.bone_part[part.bone_indices[i]] = 0;
 	}
 
-	assert(part.vertex_refs.size() <= limits.max_vertices);
-	assert(part.bone_refs.size() <= limits.max_bones);
-
 	part.indices.resize(part.indices.size() - 3);
 	part.vertex_indices.resize(prev_num_vertices);
 	part.bone_indices.resize(prev_num_bones);
@@ -922,37 +1366,50 @@ bool add_triangle(split_part &part, const uint32_t *indices, const int32_t *bone
 	return false;
 }
 
-rh::array<mesh_part> split_mesh(mesh_part src, const mesh_limits &limits)
+mesh_part create_split_mesh_part(const mesh_part &src, const split_part &split, const split_state &state)
 {
-	rh::array<mesh_part> parts;
+	mesh_part part;
+	part.mesh = src.mesh;
+	part.format = src.format;
+	part.data_format = src.data_format;
+	part.material = src.material;
+	part.root_bone = src.root_bone;
 
-	if (src.num_vertices <= limits.max_vertices && src.bones.size() <= limits.max_bones) {
-		parts.push_back(std::move(src));
-		return parts;
+	part.vertex_data.reserve(split.vertex_indices.size() * src.data_format.vertex_size_in_floats);
+	part.bones.reserve(split.bone_indices.size());
+
+	for (uint32_t bone_ix : split.bone_indices) {
+		part.bones.push_back(src.bones[bone_ix]);
 	}
 
-	rh::array<split_part> splits;
-	splits.emplace_back();
+	for (uint32_t vertex_ix : split.vertex_indices) {
+		const float *vert = src.vertex_data.data() + vertex_ix * src.data_format.vertex_size_in_floats;
+		part.vertex_data.insert_back(vert, src.data_format.vertex_size_in_floats);
+	}
 
-	rh::array<int32_t> bone_indices;
-	bone_indices.reserve(src.num_vertices * src.data_format.weights_per_vertex);
+	part.num_indices = split.indices.size();
+	part.num_vertices = split.vertex_indices.size();
 
-	{
+	part.index_data = split.indices;
+
+	if (!state.bone_local.empty()) {
 		uint32_t attrib_offset_in_floats = 0;
 		for (uint32_t i = 0; i < src.format.num_attribs; i++) {
 			const spmdl_attrib &attrib = src.format.attribs[i];
 
 			size_t stride_in_floats = src.data_format.vertex_size_in_floats;
-			float *src_data = src.vertex_data.data() + attrib_offset_in_floats;
+			float *part_data = part.vertex_data.data() + attrib_offset_in_floats;
 			switch (attrib.attrib) {
 
 			case SP_VERTEX_ATTRIB_BONE_INDEX:
 				{
-					for (size_t vi = 0; vi < src.num_vertices; vi++) {
-						for (size_t j = 0; j < src.data_format.weights_per_vertex; j++) {
-							bone_indices.push_back((int32_t)src_data[j]);
+					for (size_t vi = 0; vi < part.num_vertices; vi++) {
+						for (size_t j = 0; j < part.data_format.weights_per_vertex; j++) {
+							int32_t bone_ix = (int32_t)part_data[j];
+							assert(state.bone_part[bone_ix] == state.part_id);
+							part_data[j] = (float)state.bone_local[bone_ix];
 						}
-						src_data += stride_in_floats;
+						part_data += stride_in_floats;
 					}
 				}
 				break;
@@ -963,83 +1420,150 @@ rh::array<mesh_part> split_mesh(mesh_part src, const mesh_limits &limits)
 		}
 	}
 
-	for (uint32_t tri_base = 0; tri_base < src.num_indices; tri_base += 3) {
-
-		uint32_t *indices = src.index_data.data() + tri_base;
-		bool inserted = false;
-		for (split_part &split : splits) {
-			if (add_triangle(split, indices, bone_indices.data(), src.data_format.weights_per_vertex, limits)) {
-				inserted = true;
-				break;
-			}
-		}
-
-		if (!inserted) {
-			splits.emplace_back();
-			inserted = add_triangle(splits.back(), indices, bone_indices.data(), src.data_format.weights_per_vertex, limits);
-			if (!inserted) failf("Failed to split mesh, limits too tight for a single triangle");
-		}
+	return part;
+}
 
+// Order triangles along a Z-order curve of their centroids using a radix sort
+rh::array<uint32_t> get_spatial_triangle_order(const mesh_part &src)
+{
+	uint32_t num_triangles = (uint32_t)(src.num_indices / 3);
+	rh::array<uint32_t> order;
+	order.resize_uninit(num_triangles);
+	for (uint32_t i = 0; i < num_triangles; i++) {
+		order[i] = i;
 	}
 
-	parts.reserve(splits.size());
+	if (src.data_format.position_offset_in_floats == ~0u) return order;
 
-	for (split_part &split : splits) {
-		mesh_part part;
-		part.mesh = src.mesh;
-		part.format = src.format;
-		part.data_format = src.data_format;
-		part.material = src.material;
-		part.root_bone = src.root_bone;
+	const float *positions = src.vertex_data.data() + src.data_format.position_offset_in_floats;
+	uint32_t stride = src.data_format.vertex_size_in_floats;
 
-		part.vertex_data.reserve(split.vertex_indices.size() * src.data_format.vertex_size_in_floats);
-		part.bones.reserve(split.bone_indices.size());
+	float min[3] = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+	float max[3] = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+	for (size_t vi = 0; vi < src.num_vertices; vi++) {
+		const float *p = positions + vi * stride;
+		for (uint32_t i = 0; i < 3; i++) {
+			min[i] = std::min(min[i], p[i]);
+			max[i] = std::max(max[i], p[i]);
+		}
+	}
 
-		if (src.bones.size() > 0) {
-			for (uint32_t bone_ix : split.bone_indices) {
-				part.bones.push_back(src.bones[bone_ix]);
-			}
+	float scale[3];
+	for (uint32_t i = 0; i < 3; i++) {
+		float extent = max[i] - min[i];
+		scale[i] = extent > 0.0f ? 1023.0f / (3.0f * extent) : 0.0f;
+	}
+
+	rh::array<uint32_t> keys;
+	keys.resize_uninit(num_triangles);
+	for (uint32_t ti = 0; ti < num_triangles; ti++) {
+		const uint32_t *tri = src.index_data.data() + ti * 3;
+		uint32_t key = 0;
+		for (uint32_t i = 0; i < 3; i++) {
+			float sum = positions[tri[0] * stride + i] + positions[tri[1] * stride + i] + positions[tri[2] * stride + i];
+			uint32_t v = (uint32_t)std::min(std::max((sum - 3.0f * min[i]) * scale[i], 0.0f), 1023.0f);
+			v = (v | v << 16) & 0x030000ff;
+			v = (v | v << 8) & 0x0300f00f;
+			v = (v | v << 4) & 0x030c30c3;
+			v = (v | v << 2) & 0x09249249;
+			key |= v << i;
 		}
+		keys[ti] = key;
+	}
 
-		for (uint32_t vertex_ix : split.vertex_indices) {
-			const float *vert = src.vertex_data.data() + vertex_ix * src.data_format.vertex_size_in_floats;
-			part.vertex_data.insert_back(vert, src.data_format.vertex_size_in_floats);
+	rh::array<uint32_t> tmp;
+	tmp.resize_uninit(num_triangles);
+	for (uint32_t shift = 0; shift < 30; shift += 10) {
+		uint32_t offsets[1024] = { };
+		for (uint32_t ti : order) {
+			offsets[keys[ti] >> shift & 1023]++;
+		}
+		uint32_t offset = 0;
+		for (uint32_t &count : offsets) {
+			uint32_t begin = offset;
+			offset += count;
+			count = begin;
+		}
+		for (uint32_t ti : order) {
+			tmp[offsets[keys[ti] >> shift & 1023]++] = ti;
 		}
+		std::swap(order, tmp);
+	}
 
-		part.num_indices = split.indices.size();
-		part.num_vertices = split.vertex_indices.size();
+	return order;
+}
 
-		part.index_data = std::move(split.indices);
+// Split `src` into parts within `limits`. Triangles are visited once in
+// spatial order, filling one part at a time until the next triangle does not
+// fit, which keeps the parts compact for culling.
+rh::array<mesh_part> split_mesh(mesh_part src, const mesh_limits &limits)
+{
+	rh::array<mesh_part> parts;
 
-		{
-			uint32_t attrib_offset_in_floats = 0;
-			for (uint32_t i = 0; i < src.format.num_attribs; i++) {
-				const spmdl_attrib &attrib = src.format.attribs[i];
+	if (src.num_vertices <= limits.max_vertices && src.bones.size() <= limits.max_bones) {
+		parts.push_back(std::move(src));
+		return parts;
+	}
 
-				size_t stride_in_floats = src.data_format.vertex_size_in_floats;
-				float *part_data = part.vertex_data.data() + attrib_offset_in_floats;
-				switch (attrib.attrib) {
+	rh::array<int32_t> bone_indices;
+	bone_indices.reserve(src.num_vertices * src.data_format.weights_per_vertex);
+
+	{
+		uint32_t attrib_offset_in_floats = 0;
+		for (uint32_t i = 0; i < src.format.num_attribs; i++) {
+			const spmdl_attrib &attrib = src.format.attribs[i];
+
+			size_t stride_in_floats = src.data_format.vertex_size_in_floats;
+			float *src_data = src.vertex_data.data() + attrib_offset_in_floats;
+			switch (attrib.attrib) {
 
-				case SP_VERTEX_ATTRIB_BONE_INDEX:
-					{
-						for (size_t vi = 0; vi < part.num_vertices; vi++) {
-							for (size_t j = 0; j < part.data_format.weights_per_vertex; j++) {
-								auto it = split.bone_refs.find((int32_t)part_data[j]);
-								assert(it != split.bone_refs.end());
-								part_data[j] = (float)it->value;
-							}
-							part_data += stride_in_floats;
+			case SP_VERTEX_ATTRIB_BONE_INDEX:
+				{
+					for (size_t vi = 0; vi < src.num_vertices; vi++) {
+						for (size_t j = 0; j < src.data_format.weights_per_vertex; j++) {
+							bone_indices.push_back((int32_t)src_data[j]);
 						}
+						src_data += stride_in_floats;
 					}
-					break;
-
 				}
+				break;
 
-				attrib_offset_in_floats += (uint32_t)src.data_format.attrib_size_in_floats[i];
 			}
+
+			attrib_offset_in_floats += (uint32_t)src.data_format.attrib_size_in_floats[i];
 		}
+	}
 
-		parts.push_back(std::move(part));
+	rh::array<uint32_t> order = get_spatial_triangle_order(src);
+
+	split_state state;
+	state.part_id = 1;
+	state.vertex_part.resize(src.num_vertices);
+	state.vertex_local.resize_uninit(src.num_vertices);
+	if (!src.bones.empty()) {
+		state.bone_part.resize(src.bones.size());
+		state.bone_local.resize_uninit(src.bones.size());
+	}
+
+	split_part split;
+	for (uint32_t tri_ix : order) {
+		const uint32_t *indices = src.index_data.data() + tri_ix * 3;
+		if (add_triangle(split, state, indices, bone_indices.data(), src.data_format.weights_per_vertex, limits)) continue;
+
+		parts.push_back(create_split_mesh_part(src, split, state));
+
+		split.vertex_indices.clear();
+		split.bone_indices.clear();
+		split.indices.clear();
+		state.part_id++;
+
+		if (!add_triangle(split, state, indices, bone_indices.data(), src.data_format.weights_per_vertex, limits)) {
+			failf("Failed to split mesh, limits too tight for a single triangle");
+		}
+	}
+
+	if (!split.indices.empty()) {
+		parts.push_back(create_split_mesh_part(src, split, state));
 	}
 
 	return parts;
@@ -1194,6 +1718,298 @@ void optimize_mesh_part(mesh_part &part, const optimize_opts &opts)
 		part.data_format.vertex_size_in_floats * sizeof(float));
 }
 
+struct meshlet_opts
+{
+	uint32_t max_vertices = 64;
+	uint32_t max_triangles = 124;
+};
+
+struct meshlet_build_result
+{
+	rh::array<spmdl_meshlet> meshlets;
+	rh::array<spmdl_meshlet_bounds> bounds;
+	rh::array<uint32_t> vertices;
+	rh::array<uint8_t> triangles;
+};
+
+// Split the optimized index buffer of `part` into meshlets, offsets in the
+// result are relative to the part
+void build_meshlets(meshlet_build_result &result, const mesh_part &part, const meshlet_opts &opts)
+{
+	rh::array<meshopt_Meshlet> meshlets;
+	meshlets.resize_uninit(meshopt_buildMeshletsBound(part.num_indices, opts.max_vertices, opts.max_triangles));
+	size_t num_meshlets = meshopt_buildMeshlets(meshlets.data(), part.index_data.data(), part.num_indices,
+		part.num_vertices, opts.max_vertices, opts.max_triangles);
+
+	bool has_position = part.data_format.position_offset_in_floats != ~0u;
+
+	result.meshlets.reserve(num_meshlets);
+	result.bounds.reserve(num_meshlets);
+	for (size_t i = 0; i < num_meshlets; i++) {
+		const meshopt_Meshlet &src = meshlets[i];
+
+		spmdl_meshlet meshlet;
+		meshlet.vertex_offset = (uint32_t)result.vertices.size();
+		meshlet.triangle_offset = (uint32_t)result.triangles.size();
+		meshlet.num_vertices = src.vertex_count;
+		meshlet.num_triangles = src.triangle_count;
+		result.meshlets.push_back(meshlet);
+
+		result.vertices.insert_back(src.vertices, src.vertex_count);
+		result.triangles.insert_back(&src.indices[0][0], src.triangle_count * 3);
+
+		// Pad triangles to 4 bytes
+		while (result.triangles.size() % 4 != 0) result.triangles.push_back(0);
+
+		spmdl_meshlet_bounds bounds = { };
+		if (has_position) {
+			meshopt_Bounds mb = meshopt_computeMeshletBounds(&src,
+				part.vertex_data.data() + part.data_format.position_offset_in_floats,
+				part.num_vertices, part.data_format.vertex_size_in_floats * sizeof(float));
+			bounds.center = { mb.center[0], mb.center[1], mb.center[2] };
+			bounds.radius = mb.radius;
+			bounds.cone_apex = { mb.cone_apex[0], mb.cone_apex[1], mb.cone_apex[2] };
+			bounds.cone_axis = { mb.cone_axis[0], mb.cone_axis[1], mb.cone_axis[2] };
+			bounds.cone_cutoff = mb.cone_cutoff;
+			for (int axis = 0; axis < 3; axis++) {
+				bounds.cone_axis_s8[axis] = (int8_t)mb.cone_axis_s8[axis];
+			}
+			bounds.cone_cutoff_s8 = (int8_t)mb.cone_cutoff_s8;
+		}
+		result.bounds.push_back(bounds);
+	}
+}
+
+// Append meshlets built separately into `dst`, returns the index of the first meshlet
+static uint32_t append_meshlets(meshlet_build_result &dst, const meshlet_build_result &src)
+{
+	uint32_t meshlet_base = (uint32_t)dst.meshlets.size();
+	uint32_t vertex_base = (uint32_t)dst.vertices.size();
+	uint32_t triangle_base = (uint32_t)dst.triangles.size();
+
+	for (spmdl_meshlet meshlet : src.meshlets) {
+		meshlet.vertex_offset += vertex_base;
+		meshlet.triangle_offset += triangle_base;
+		dst.meshlets.push_back(meshlet);
+	}
+	dst.bounds.insert_back(src.bounds);
+	dst.vertices.insert_back(src.vertices);
+	dst.triangles.insert_back(src.triangles);
+
+	return meshlet_base;
+}
+
+struct lod_opts
+{
+	rh::array<float> ratios;
+	float target_error = 0.01f;
+};
+
+struct lod_level
+{
+	rh::array<uint32_t> indices;
+	float error = 0.0f; // Distance in mesh units
+};
+
+static float lod_point_triangle_distance_sq(const float *p, const float *a, const float *b, const float *c)
+{
+	// Closest point on triangle, see Real-Time Collision Detection 5.1.5
+	float ab[3], ac[3], ap[3], q[3];
+	for (int i = 0; i < 3; i++) {
+		ab[i] = b[i] - a[i];
+		ac[i] = c[i] - a[i];
+		ap[i] = p[i] - a[i];
+	}
+
+	float d1 = ab[0]*ap[0] + ab[1]*ap[1] + ab[2]*ap[2];
+	float d2 = ac[0]*ap[0] + ac[1]*ap[1] + ac[2]*ap[2];
+	float bp[3] = { p[0] - b[0], p[1] - b[1], p[2] - b[2] };
+	float d3 = ab[0]*bp[0] + ab[1]*bp[1] + ab[2]*bp[2];
+	float d4 = ac[0]*bp[0] + ac[1]*bp[1] + ac[2]*bp[2];
+	float cp[3] = { p[0] - c[0], p[1] - c[1], p[2] - c[2] };
+	float d5 = ab[0]*cp[0] + ab[1]*cp[1] + ab[2]*cp[2];
+	float d6 = ac[0]*cp[0] + ac[1]*cp[1] + ac[2]*cp[2];
+
+	float va = d3*d6 - d5*d4;
+	float vb = d5*d2 - d1*d6;
+	float vc = d1*d4 - d3*d2;
+
+	if (d1 <= 0.0f && d2 <= 0.0f) {
+		for (int i = 0; i < 3; i++) q[i] = a[i];
+	} else if (d3 >= 0.0f && d4 <= d3) {
+		for (int i = 0; i < 3; i++) q[i] = b[i];
+	} else if (d6 >= 0.0f && d5 <= d6) {
+		for (int i = 0; i < 3; i++) q[i] = c[i];
+	} else if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		float v = d1 / (d1 - d3);
+		for (int i = 0; i < 3; i++) q[i] = a[i] + ab[i] * v;
+	} else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		float w = d2 / (d2 - d6);
+		for (int i = 0; i < 3; i++) q[i] = a[i] + ac[i] * w;
+	} else if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+		float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		for (int i = 0; i < 3; i++) q[i] = b[i] + (c[i] - b[i]) * w;
+	} else {
+		float denom = va + vb + vc;
+		float v = denom != 0.0f ? vb / denom : 0.0f;
+		float w = denom != 0.0f ? vc / denom : 0.0f;
+		for (int i = 0; i < 3; i++) q[i] = a[i] + ab[i] * v + ac[i] * w;
+	}
+
+	float dx = p[0] - q[0], dy = p[1] - q[1], dz = p[2] - q[2];
+	return dx*dx + dy*dy + dz*dz;
+}
+
+// Measure the largest distance from the vertices referenced by `part` to the
+// simplified surface `indices`, triangles are bucketed into a uniform grid
+static float measure_lod_error(const mesh_part &part, const attrib_bounds &bounds, rh::slice<const uint32_t> indices)
+{
+	const float *positions = part.vertex_data.data() + part.data_format.position_offset_in_floats;
+	uint32_t stride = part.data_format.vertex_size_in_floats;
+	uint32_t num_triangles = (uint32_t)(indices.size / 3);
+
+	float extent = 0.0f;
+	for (int axis = 0; axis < 3; axis++) {
+		extent = std::max(extent, bounds.max[axis] - bounds.min[axis]);
+	}
+	if (num_triangles == 0 || !(extent > 0.0f)) return extent;
+
+	// Size the cells for roughly a constant number of triangles per cell on a surface
+	const uint32_t max_resolution = 128;
+	float cell_size = extent / std::min(max_resolution, (uint32_t)ceilf(sqrtf((float)num_triangles)));
+	uint32_t res[3];
+	for (int axis = 0; axis < 3; axis++) {
+		res[axis] = (uint32_t)((bounds.max[axis] - bounds.min[axis]) / cell_size) + 1;
+	}
+
+	auto cell_coord = [&](float v, int axis) {
+		float f = (v - bounds.min[axis]) / cell_size;
+		if (!(f > 0.0f)) return 0u;
+		return std::min((uint32_t)f, res[axis] - 1);
+	};
+
+	// Counting sort the triangles into every cell their bounds overlap
+	rh::array<uint32_t> cell_offsets;
+	cell_offsets.resize(res[0] * res[1] * res[2] + 1);
+	rh::array<uint32_t> cell_triangles;
+	for (uint32_t pass = 0; pass < 2; pass++) {
+		for (uint32_t ti = 0; ti < num_triangles; ti++) {
+			uint32_t lo[3], hi[3];
+			for (int axis = 0; axis < 3; axis++) {
+				float tmin = +HUGE_VALF, tmax = -HUGE_VALF;
+				for (uint32_t j = 0; j < 3; j++) {
+					float v = positions[indices.data[ti * 3 + j] * stride + axis];
+					tmin = std::min(tmin, v);
+					tmax = std::max(tmax, v);
+				}
+				lo[axis] = cell_coord(tmin, axis);
+				hi[axis] = cell_coord(tmax, axis);
+			}
+			for (uint32_t z = lo[2]; z <= hi[2]; z++)
+			for (uint32_t y = lo[1]; y <= hi[1]; y++)
+			for (uint32_t x = lo[0]; x <= hi[0]; x++) {
+				uint32_t cell = (z * res[1] + y) * res[0] + x;
+				if (pass == 0) {
+					cell_offsets[cell + 1]++;
+				} else {
+					cell_triangles[cell_offsets[cell]++] = ti;
+				}
+			}
+		}
+
+		if (pass == 0) {
+			for (size_t i = 1; i < cell_offsets.size(); i++) {
+				cell_offsets[i] += cell_offsets[i - 1];
+			}
+			cell_triangles.resize_uninit(cell_offsets[cell_offsets.size() - 1]);
+		} else {
+			for (size_t i = cell_offsets.size() - 1; i > 0; i--) {
+				cell_offsets[i] = cell_offsets[i - 1];
+			}
+			cell_offsets[0] = 0;
+		}
+	}
+
+	// Vertices kept in the simplified mesh lie on its surface
+	rh::array<bool> referenced;
+	referenced.resize(part.num_vertices);
+	for (uint32_t ix : part.index_data) referenced[ix] = true;
+	for (uint32_t ix : indices) referenced[ix] = false;
+
+	// Search shells of cells around each vertex until no closer triangle can exist
+	float max_dist_sq = 0.0f;
+	uint32_t max_radius = std::max(std::max(res[0], res[1]), res[2]);
+	for (size_t vi = 0; vi < part.num_vertices; vi++) {
+		if (!referenced[vi]) continue;
+		const float *p = positions + vi * stride;
+		uint32_t c[3] = { cell_coord(p[0], 0), cell_coord(p[1], 1), cell_coord(p[2], 2) };
+
+		// Distance from the vertex to the sides of its cell
+		float margin = HUGE_VALF;
+		for (int axis = 0; axis < 3; axis++) {
+			float lo = bounds.min[axis] + (float)c[axis] * cell_size;
+			margin = std::min(margin, std::min(p[axis] - lo, lo + cell_size - p[axis]));
+		}
+		margin = std::max(margin, 0.0f);
+
+		float best = HUGE_VALF;
+		for (uint32_t r = 0; r < max_radius; r++) {
+			int32_t lo[3], hi[3];
+			for (int axis = 0; axis < 3; axis++) {
+				lo[axis] = std::max((int32_t)c[axis] - (int32_t)r, 0);
+				hi[axis] = std::min((int32_t)c[axis] + (int32_t)r, (int32_t)res[axis] - 1);
+			}
+			for (int32_t z = lo[2]; z <= hi[2]; z++)
+			for (int32_t y = lo[1]; y <= hi[1]; y++)
+			for (int32_t x = lo[0]; x <= hi[0]; x++) {
+				uint32_t dist = (uint32_t)std::max(std::max(abs(x - (int32_t)c[0]), abs(y - (int32_t)c[1])), abs(z - (int32_t)c[2]));
+				if (dist != r) continue;
+				uint32_t cell = (z * res[1] + y) * res[0] + x;
+				for (uint32_t i = cell_offsets[cell]; i < cell_offsets[cell + 1]; i++) {
+					const uint32_t *tri = indices.data + cell_triangles[i] * 3;
+					float d = lod_point_triangle_distance_sq(p, positions + tri[0] * stride,
+						positions + tri[1] * stride, positions + tri[2] * stride);
+					best = std::min(best, d);
+				}
+			}
+			float reach = (float)r * cell_size + margin;
+			if (best <= reach * reach) break;
+		}
+
+		max_dist_sq = std::max(max_dist_sq, best);
+	}
+
+	return sqrtf(max_dist_sq);
+}
+
+// Simplify `part` to each ratio of `opts.ratios`, stops early if the error
+// limit prevents any further reduction
+void build_lods(rh::array<lod_level> &lods, const mesh_part &part, const attrib_bounds &bounds, const lod_opts &opts)
+{
+	if (part.data_format.position_offset_in_floats == ~0u) return;
+
+	const float *positions = part.vertex_data.data() + part.data_format.position_offset_in_floats;
+	size_t stride = part.data_format.vertex_size_in_floats * sizeof(float);
+
+	size_t prev_indices = part.num_indices;
+	for (float ratio : opts.ratios) {
+		size_t target_indices = (size_t)((double)part.num_indices * ratio) / 3 * 3;
+
+		lod_level lod;
+		lod.indices.resize_uninit(part.num_indices);
+		size_t num_indices = meshopt_simplify(lod.indices.data(), part.index_data.data(), part.num_indices,
+			positions, part.num_vertices, stride, target_indices, opts.target_error);
+		if (num_indices == 0 || num_indices >= prev_indices) break;
+		lod.indices.resize(num_indices);
+
+		meshopt_optimizeVertexCache(lod.indices.data(), lod.indices.data(), num_indices, part.num_vertices);
+		lod.error = measure_lod_error(part, bounds, lod.indices.slice());
+
+		lods.push_back(std::move(lod));
+		prev_indices = num_indices;
+	}
+}
+
 template <typename T>
 T clamp_float(float f)
 {
@@ -1418,6 +2234,162 @@ void encode_uint10(const encode_args &args)
 	}
 }
 
+static void normalize3(float v[3])
+{
+	float len = sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+	if (len > 0.0f) {
+		v[0] /= len; v[1] /= len; v[2] /= len;
+	} else {
+		v[0] = 0.0f; v[1] = 0.0f; v[2] = 1.0f;
+	}
+}
+
+// Octahedral encoding of a unit vector to [-1, 1]
+static void encode_oct(float dst[2], const float n[3])
+{
+	float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+	float x = l1 > 0.0f ? n[0] / l1 : 0.0f;
+	float y = l1 > 0.0f ? n[1] / l1 : 0.0f;
+	if (n[2] < 0.0f) {
+		float ox = x, oy = y;
+		x = (1.0f - fabsf(oy)) * (ox >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabsf(ox)) * (oy >= 0.0f ? 1.0f : -1.0f);
+	}
+	dst[0] = x;
+	dst[1] = y;
+}
+
+static void decode_oct(float dst[3], float x, float y)
+{
+	float z = 1.0f - fabsf(x) - fabsf(y);
+	float t = z < 0.0f ? -z : 0.0f;
+	dst[0] = x + (x >= 0.0f ? -t : t);
+	dst[1] = y + (y >= 0.0f ? -t : t);
+	dst[2] = z;
+	normalize3(dst);
+}
+
+// Arbitrary but fixed tangent basis `b1`, `b2` around the normal `n`, see
+// `SP_VERTEX_ATTRIB_TANGENT_FRAME`
+static void tangent_frame_basis(float b1[3], float b2[3], const float n[3])
+{
+	if (fabsf(n[0]) > fabsf(n[2])) {
+		b1[0] = -n[1]; b1[1] = n[0]; b1[2] = 0.0f;
+	} else {
+		b1[0] = 0.0f; b1[1] = -n[2]; b1[2] = n[1];
+	}
+	normalize3(b1);
+	b2[0] = n[1]*b1[2] - n[2]*b1[1];
+	b2[1] = n[2]*b1[0] - n[0]*b1[2];
+	b2[2] = n[0]*b1[1] - n[1]*b1[0];
+}
+
+// Source data is the normal and tangent sign, the sign is stored in W of
+// four component formats with Z set to 1.0 for `meshopt_decodeFilterOct()`
+template <typename T>
+void encode_normal_oct(const encode_args &args, size_t dst_components)
+{
+	const int bits = sizeof(T) * 8;
+	size_t src_stride_in_floats = args.src_stride_in_floats;
+	size_t dst_stride_in_bytes = args.dst_stride_in_bytes;
+	T *dst = (T*)args.dst;
+	const float *src = args.src, *src_end = src + args.src_stride_in_floats*args.num_elements;
+	while (src != src_end) {
+		float n[3] = { src[0], src[1], src[2] }, oct[2];
+		normalize3(n);
+		encode_oct(oct, n);
+		dst[0] = (T)meshopt_quantizeSnorm(oct[0], bits);
+		dst[1] = (T)meshopt_quantizeSnorm(oct[1], bits);
+		if (dst_components == 4) {
+			dst[2] = (T)meshopt_quantizeSnorm(1.0f, bits);
+			dst[3] = (T)meshopt_quantizeSnorm(src[3] < 0.0f ? -1.0f : 1.0f, bits);
+		}
+
+		src += src_stride_in_floats;
+		dst = (T*)((char*)dst + dst_stride_in_bytes);
+	}
+}
+
+// Source data is the normal, tangent and tangent sign
+void encode_tangent_frame(const encode_args &args)
+{
+	size_t src_stride_in_floats = args.src_stride_in_floats;
+	size_t dst_stride_in_bytes = args.dst_stride_in_bytes;
+	char *dst = (char*)args.dst;
+	const float *src = args.src, *src_end = src + args.src_stride_in_floats*args.num_elements;
+	while (src != src_end) {
+		float n[3] = { src[0], src[1], src[2] };
+		normalize3(n);
+
+		float b1[3], b2[3];
+		if (args.format == SP_FORMAT_RGBA8_SNORM) {
+			// Quantize the normal first so the decoder reconstructs the same basis
+			float oct[2];
+			encode_oct(oct, n);
+			int8_t *d = (int8_t*)dst;
+			d[0] = (int8_t)meshopt_quantizeSnorm(oct[0], 8);
+			d[1] = (int8_t)meshopt_quantizeSnorm(oct[1], 8);
+			decode_oct(n, (float)d[0] / 127.0f, (float)d[1] / 127.0f);
+			tangent_frame_basis(b1, b2, n);
+		} else {
+			tangent_frame_basis(b1, b2, n);
+		}
+
+		// Orthonormalize the tangent, falling back to the basis for degenerate UVs
+		float t[3] = { src[3], src[4], src[5] };
+		float tn = t[0]*n[0] + t[1]*n[1] + t[2]*n[2];
+		t[0] -= n[0] * tn; t[1] -= n[1] * tn; t[2] -= n[2] * tn;
+		if (t[0]*t[0] + t[1]*t[1] + t[2]*t[2] < 1e-12f) {
+			t[0] = b1[0]; t[1] = b1[1]; t[2] = b1[2];
+		}
+		normalize3(t);
+		float sign = src[6] < 0.0f ? -1.0f : 1.0f;
+
+		if (args.format == SP_FORMAT_RGBA8_SNORM) {
+			float angle = atan2f(t[0]*b2[0] + t[1]*b2[1] + t[2]*b2[2], t[0]*b1[0] + t[1]*b1[1] + t[2]*b1[2]);
+			int8_t *d = (int8_t*)dst;
+			d[2] = (int8_t)meshopt_quantizeSnorm(angle * (float)(1.0 / 3.14159265358979323846), 8);
+			d[3] = (int8_t)meshopt_quantizeSnorm(sign, 8);
+		} else if (args.format == SP_FORMAT_RGBA16_SNORM) {
+			// Rotation from the tangent space (t, cross(n, t), n)
+			float b[3] = { n[1]*t[2] - n[2]*t[1], n[2]*t[0] - n[0]*t[2], n[0]*t[1] - n[1]*t[0] };
+			float m00 = t[0], m10 = t[1], m20 = t[2];
+			float m01 = b[0], m11 = b[1], m21 = b[2];
+			float m02 = n[0], m12 = n[1], m22 = n[2];
+			float q[4]; // x, y, z, w
+			float trace = m00 + m11 + m22;
+			if (trace > 0.0f) {
+				float r = sqrtf(1.0f + trace) * 2.0f;
+				q[0] = (m21 - m12) / r; q[1] = (m02 - m20) / r; q[2] = (m10 - m01) / r; q[3] = 0.25f * r;
+			} else if (m00 > m11 && m00 > m22) {
+				float r = sqrtf(1.0f + m00 - m11 - m22) * 2.0f;
+				q[0] = 0.25f * r; q[1] = (m01 + m10) / r; q[2] = (m02 + m20) / r; q[3] = (m21 - m12) / r;
+			} else if (m11 > m22) {
+				float r = sqrtf(1.0f + m11 - m00 - m22) * 2.0f;
+				q[0] = (m01 + m10) / r; q[1] = 0.25f * r; q[2] = (m12 + m21) / r; q[3] = (m02 - m20) / r;
+			} else {
+				float r = sqrtf(1.0f + m22 - m00 - m11) * 2.0f;
+				q[0] = (m02 + m20) / r; q[1] = (m12 + m21) / r; q[2] = 0.25f * r; q[3] = (m10 - m01) / r;
+			}
+
+			// Drop the largest component, it is reconstructed as positive
+			int qc = 0;
+			for (int i = 1; i < 4; i++) {
+				if (fabsf(q[i]) > fabsf(q[qc])) qc = i;
+			}
+			float scale = (q[qc] < 0.0f ? -1.0f : 1.0f) * sqrtf(2.0f);
+			int16_t *d = (int16_t*)dst;
+			for (int i = 0; i < 3; i++) {
+				d[i] = (int16_t)meshopt_quantizeSnorm(q[(qc + 1 + i) & 3] * scale, 16);
+			}
+			d[3] = (int16_t)((32767 & ~3) | qc);
+		}
+
+		src += src_stride_in_floats;
+		dst += dst_stride_in_bytes;
+	}
+}
+
 void encode_format(const encode_args &args)
 {
 	switch (args.format) {
@@ -1483,7 +2455,14 @@ void encode_format(const encode_args &args)
 	}
 }
 
-void encode_vertex_stream(rh::array<char> &dst, const mesh_part &part, size_t stream_ix)
+// Attributes stored relative to their bounds, remapped to [0, 1] before encoding
+struct attrib_remap
+{
+	bool enabled[SPMDL_MAX_VERTEX_ATTRIBS] = { };
+	attrib_bounds bounds[SPMDL_MAX_VERTEX_ATTRIBS];
+};
+
+void encode_vertex_stream(rh::array<char> &dst, const mesh_part &part, size_t stream_ix, const attrib_remap &remap)
 {
 	encode_args args;
 	args.dst_stride_in_bytes = part.format.stream_stride[stream_ix];
@@ -1502,7 +2481,37 @@ void encode_vertex_stream(rh::array<char> &dst, const mesh_part &part, size_t st
 			args.src = src;
 			args.dst = dst.data() + attrib.offset;
 			args.src_components = src_components;
-			encode_format(args);
+			args.src_stride_in_floats = part.data_format.vertex_size_in_floats;
+
+			rh::array<float> remapped;
+			if (remap.enabled[attrib_ix]) {
+				const attrib_bounds &bounds = remap.bounds[attrib_ix];
+				remapped.resize_uninit(part.num_vertices * src_components);
+				float *out = remapped.data();
+				const float *vsrc = src;
+				for (size_t vi = 0; vi < part.num_vertices; vi++) {
+					for (size_t i = 0; i < src_components; i++) {
+						float extent = bounds.max[i] - bounds.min[i];
+						*out++ = extent > 0.0f ? (vsrc[i] - bounds.min[i]) / extent : 0.0f;
+					}
+					vsrc += part.data_format.vertex_size_in_floats;
+				}
+				args.src = remapped.data();
+				args.src_stride_in_floats = src_components;
+			}
+
+			if (attrib.attrib == SP_VERTEX_ATTRIB_NORMAL_OCT) {
+				switch (attrib.format) {
+				case SP_FORMAT_RG8_SNORM: encode_normal_oct<int8_t>(args, 2); break;
+				case SP_FORMAT_RG16_SNORM: encode_normal_oct<int16_t>(args, 2); break;
+				case SP_FORMAT_RGBA8_SNORM: encode_normal_oct<int8_t>(args, 4); break;
+				case SP_FORMAT_RGBA16_SNORM: encode_normal_oct<int16_t>(args, 4); break;
+				}
+			} else if (attrib.attrib == SP_VERTEX_ATTRIB_TANGENT_FRAME) {
+				encode_tangent_frame(args);
+			} else {
+				encode_format(args);
+			}
 
 			if (attrib.attrib == SP_VERTEX_ATTRIB_BONE_WEIGHT) {
 				switch (attrib.format) {
@@ -1530,9 +2539,7 @@ attrib_bounds get_attrib_bounds(const mesh_part &part, size_t attrib_ix)
 {
 	const float *src = part.vertex_data.data();
 	for (size_t ref_ix = 0; ref_ix < part.format.num_attribs; ref_ix++) {
-		const spmdl_attrib &attrib = part.format.attribs[attrib_ix];
-		uint32_t src_components = part.data_format.attrib_size_in_floats[attrib_ix];
-		uint32_t stride = part.data_format.vertex_size_in_floats;
+		uint32_t src_components = part.data_format.attrib_size_in_floats[ref_ix];
 
 		if (ref_ix == attrib_ix) {
 			attrib_bounds bounds;
@@ -1794,7 +2801,7 @@ gltf_file convert_to_gltf(const model &mod, rh::slice<mesh_part> parts)
 		}
 
 		for (uint32_t si = 0; si < part.format.num_streams; si++) {
-			encode_vertex_stream(buffer, part, si);
+			encode_vertex_stream(buffer, part, si, attrib_remap());
 
 			HackVertex *verts = (HackVertex*)buffer.data();
 
@@ -1951,18 +2958,6 @@ static void write_data(FILE *f, const void *data, size_t size)
 	}
 }
 
-template <typename T>
-static void write_pod(FILE *f, T &t)
-{
-	write_data(f, &t, sizeof(T));
-}
-
-template <typename T>
-static void write_pod(FILE *f, rh::slice<T> slice)
-{
-	write_data(f, slice.data, sizeof(T) * slice.size);
-}
-
 struct glb_header
 {
 	uint32_t magic;
@@ -2354,7 +3349,13 @@ struct compress_opts
 {
 	sp_compression_type type = SP_COMPRESSION_ZSTD;
 	int level = 10;
+	int num_workers = 1;
 	double uncompressed_threshold = 0.95;
+
+	// Use `SP_COMPRESSION_ZSTD_DICT` for sections up to `max_dict_size` bytes
+	// if it compresses better than `type`
+	const spfile_dict *dict = nullptr;
+	size_t max_dict_size = 64 * 1024;
 };
 
 struct compress_result
@@ -2363,46 +3364,67 @@ struct compress_result
 	sp_compression_type type;
 };
 
-compress_result compress(rh::slice<const char> data, const compress_opts &opts, uint32_t pre_padding=0)
+compress_result compress(rh::slice<const char> data, const compress_opts &opts)
 {
 	compress_result result;
-	result.data.resize_uninit(sp_get_compression_bound(opts.type, data.size) + pre_padding);
+	result.data.resize_uninit(sp_get_compression_bound(opts.type, data.size));
 	result.type = opts.type;
 
-	size_t compressed_size = sp_compress_buffer(opts.type, result.data.data() + pre_padding, result.data.size() - pre_padding, data.data, data.size, opts.level);
+	size_t compressed_size = sp_compress_buffer(opts.type, result.data.data(), result.data.size(), data.data, data.size, opts.level, opts.num_workers);
 	if (compressed_size >= (size_t)(data.size * opts.uncompressed_threshold)) {
 		if (opts.type != SP_COMPRESSION_NONE) {
-			result.data.resize_uninit(pre_padding + data.size);
-			memcpy(result.data.data() + pre_padding, data.data, data.size);
+			result.data.resize_uninit(data.size);
+			memcpy(result.data.data(), data.data, data.size);
 			result.type = SP_COMPRESSION_NONE;
 		}
 	} else {
-		result.data.resize_uninit(pre_padding + compressed_size);
+		result.data.resize_uninit(compressed_size);
 	}
 
-	if (pre_padding > 0) {
-		memset(result.data.data(), 0, pre_padding);
+	if (opts.dict && data.size <= opts.max_dict_size) {
+		rh::array<char> dict_data;
+		dict_data.resize_uninit(sp_get_compression_bound(SP_COMPRESSION_ZSTD_DICT, data.size));
+		size_t dict_size = sp_compress_buffer_dict(opts.dict, dict_data.data(), dict_data.size(), data.data, data.size, opts.level);
+		size_t best_size = result.data.size();
+		if (result.type == SP_COMPRESSION_NONE) best_size = (size_t)(data.size * opts.uncompressed_threshold);
+		if (dict_size < best_size) {
+			result.data.resize_uninit(dict_size);
+			memcpy(result.data.data(), dict_data.data(), dict_size);
+			result.type = SP_COMPRESSION_ZSTD_DICT;
+		}
 	}
 
 	return result;
 }
 
+// Compress and stream a section to the output, only one compressed section
+// is alive at a time
 template <typename T>
-void init_section(uint32_t &offset, spfile_section &section, compress_result &res, rh::slice<T> data, const compress_opts &opts, spfile_section_magic magic, uint32_t index=0)
+void write_section(spfile_writer &writer, uint32_t section_index, rh::slice<T> data, const compress_opts &opts, spfile_section_magic magic, uint32_t index=0)
 {
-	uint32_t pre_padding = 0;
-	while (offset % 16 != 0) {
-		offset++;
-		pre_padding++;
-	}
-	res = compress(rh::slice<const char>((char*)data.data, data.size * sizeof(T)), opts, pre_padding);
+	compress_result res = compress(rh::slice<const char>((char*)data.data, data.size * sizeof(T)), opts);
+	spfile_section section = { };
 	section.magic = magic;
 	section.compression_type = res.type;
 	section.index = index;
-	section.offset = offset;
 	section.uncompressed_size = (uint32_t)data.size * sizeof(T);
-	section.compressed_size = (uint32_t)res.data.size() - pre_padding;
-	offset += section.compressed_size;
+	section.compressed_size = (uint32_t)res.data.size();
+	spfile_writer_add_section(&writer, section_index, &section, res.data.data());
+}
+
+static void open_writer(spfile_writer &writer, const char *output_file, const spfile_header &header, size_t write_block_size)
+{
+	FILE *f = fopen(output_file, "wb");
+	if (!f) failf("Failed to open output file: %s", output_file);
+	spfile_writer_init(&writer, f, &header, write_block_size);
+}
+
+static void finish_writer(spfile_writer &writer, const void *info)
+{
+	bool ok = spfile_writer_finish(&writer, info);
+	fclose(writer.file);
+	spfile_writer_free(&writer);
+	if (!ok) failf("Failed to write output data");
 }
 
 template <typename T>
@@ -2416,6 +3438,56 @@ spmdl_buffer sp_push_buffer(rh::array<char> &geometry, rh::slice<T> data, uint32
 	return buf;
 }
 
+// Push 16-bit indices if possible, padded to 4 bytes. With `encode` the
+// indices are stored with `meshopt_encodeIndexBuffer()`.
+spmdl_buffer sp_push_indices(rh::array<char> &geometry, rh::slice<const uint32_t> indices, size_t num_vertices, bool encode)
+{
+	spmdl_buffer buf;
+	if (encode) {
+		rh::array<char> encoded;
+		encoded.resize_uninit(meshopt_encodeIndexBufferBound(indices.size, num_vertices));
+		size_t size = meshopt_encodeIndexBuffer((unsigned char*)encoded.data(), encoded.size(), indices.data, indices.size);
+		if (size == 0) failf("Failed to encode index buffer");
+		buf = sp_push_buffer(geometry, rh::slice<char>(encoded.data(), size));
+		buf.stride = num_vertices < UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+	} else if (num_vertices < UINT16_MAX) {
+		rh::array<uint16_t> indices16;
+		indices16.resize_uninit(indices.size);
+		uint16_t *dst = indices16.data();
+		for (uint32_t ix : indices) {
+			*dst++ = (uint16_t)ix;
+		}
+		buf = sp_push_buffer(geometry, indices16.slice());
+	} else {
+		buf = sp_push_buffer(geometry, indices);
+	}
+
+	while (geometry.size() % 4 != 0) geometry.push_back(0);
+	return buf;
+}
+
+// Push a vertex stream, encoded with `meshopt_encodeVertexBuffer()` if
+// `encode` is set and the stride is divisible by 4
+spmdl_buffer sp_push_vertices(rh::array<char> &geometry, rh::slice<char> vertices, uint32_t stride, bool encode)
+{
+	if (!encode || stride % 4 != 0) {
+		// Pre-pad vertices to stride bytes
+		while (geometry.size() % stride != 0) geometry.push_back(0);
+		return sp_push_buffer(geometry, vertices, stride);
+	}
+
+	size_t num_vertices = vertices.size / stride;
+	rh::array<char> encoded;
+	encoded.resize_uninit(meshopt_encodeVertexBufferBound(num_vertices, stride));
+	size_t size = meshopt_encodeVertexBuffer((unsigned char*)encoded.data(), encoded.size(), vertices.data, num_vertices, stride);
+	if (size == 0) failf("Failed to encode vertex buffer");
+
+	while (geometry.size() % 4 != 0) geometry.push_back(0);
+	spmdl_buffer buf = sp_push_buffer(geometry, rh::slice<char>(encoded.data(), size));
+	buf.stride = stride;
+	return buf;
+}
+
 int main(int argc, char **argv)
 {
 	const char *input_file = NULL;
@@ -2431,8 +3503,18 @@ int main(int argc, char **argv)
 	bool do_anim = false;
 	bool do_bvh = false;
 	bool bvh_simd = false;
+	int bvh_width = 2;
+	bool bvh_compress = false;
+	bool do_meshlets = false;
+	meshlet_opts meshlet_opts;
+	lod_opts lod_opts;
+	bool meshopt_codec = false;
+	bool quantize_positions = false;
+	bool quantize_uvs = false;
 	bool remove_namespaces = false;
 	const char *format_spec = "";
+	const char *dict_file = NULL;
+	size_t write_block_size = 0;
 	rh::array<const char*> retained_prefixes;
 
 	// -- Parse arguments
@@ -2462,6 +3544,14 @@ int main(int argc, char **argv)
 			do_bvh = true;
 		} else if (!strcmp(arg, "--bvh-simd")) {
 			bvh_simd = true;
+		} else if (!strcmp(arg, "--bvh-compress")) {
+			bvh_compress = true;
+		} else if (!strcmp(arg, "--meshopt-codec")) {
+			meshopt_codec = true;
+		} else if (!strcmp(arg, "--quantize-positions")) {
+			quantize_positions = true;
+		} else if (!strcmp(arg, "--quantize-uvs")) {
+			quantize_uvs = true;
 		} else if (left >= 1) {
 			if (!strcmp(arg, "-i") || !strcmp(arg, "--input")) {
 				input_file = argv[++argi];
@@ -2479,6 +3569,40 @@ int main(int argc, char **argv)
 				if (num_threads <= 0 || num_threads > 10000) failf("Bad number of threads: %d");
 			} else if (!strcmp(arg, "--vertex")) {
 				format_spec = argv[++argi];
+			} else if (!strcmp(arg, "--bvh-width")) {
+				bvh_width = atoi(argv[++argi]);
+				if (bvh_width != 2 && bvh_width != 4 && bvh_width != 8) failf("Bad BVH width %d, must be 2, 4 or 8", bvh_width);
+			} else if (left >= 2 && !strcmp(arg, "--meshlets")) {
+				do_meshlets = true;
+				int max_vertices = atoi(argv[++argi]);
+				int max_triangles = atoi(argv[++argi]);
+				if (max_vertices < 3 || max_vertices > 64) failf("Bad meshlet vertex limit %d, must be between 3-64", max_vertices);
+				if (max_triangles < 1 || max_triangles > 126) failf("Bad meshlet triangle limit %d, must be between 1-126", max_triangles);
+				meshlet_opts.max_vertices = (uint32_t)max_vertices;
+				meshlet_opts.max_triangles = (uint32_t)max_triangles;
+			} else if (!strcmp(arg, "--lods")) {
+				const char *ptr = argv[++argi];
+				lod_opts.ratios.clear();
+				for (;;) {
+					char *end;
+					float ratio = strtof(ptr, &end);
+					if (end == ptr || !(ratio > 0.0f && ratio < 1.0f)) failf("Bad LOD ratio list '%s', expected eg. '0.5,0.25'", argv[argi]);
+					if (lod_opts.ratios.size() > 0 && ratio >= lod_opts.ratios.back()) failf("LOD ratios must be decreasing: '%s'", argv[argi]);
+					if (lod_opts.ratios.size() >= SPMDL_MAX_LODS) failf("Too many LODs, max %d", SPMDL_MAX_LODS);
+					lod_opts.ratios.push_back(ratio);
+					if (*end == '\0') break;
+					if (*end != ',') failf("Bad LOD ratio list '%s', expected eg. '0.5,0.25'", argv[argi]);
+					ptr = end + 1;
+				}
+			} else if (!strcmp(arg, "--lod-error")) {
+				lod_opts.target_error = (float)atof(argv[++argi]);
+				if (!(lod_opts.target_error > 0.0f)) failf("Bad LOD error: %s", argv[argi]);
+			} else if (!strcmp(arg, "--dict")) {
+				dict_file = argv[++argi];
+			} else if (!strcmp(arg, "--write-block-size")) {
+				int size = atoi(argv[++argi]);
+				if (size < 0) failf("Bad write block size: %d", size);
+				write_block_size = (size_t)size;
 			}
 		}
 	}
@@ -2490,6 +3614,16 @@ int main(int argc, char **argv)
 			"    -o / --output <path>: Destination filename\n"
 			"    -j / --threads <num>: Number of threads to use\n"
 			"    -v / --verbose: Verbose output\n"
+			"    --bvh-width <2|4|8>: Store the BVH as binary (default) or 4/8-wide nodes\n"
+			"    --bvh-compress: Store binary BVH nodes with 8-bit child bounds\n"
+			"    --meshlets <max_verts> <max_tris>: Split meshes into meshlets with culling bounds (max 64 and 126)\n"
+			"    --lods <ratios>: Generate simplified LOD index buffers, eg. '0.5,0.25,0.125'\n"
+			"    --lod-error <error>: Maximum LOD simplification error relative to the mesh size (default 0.01)\n"
+			"    --meshopt-codec: Encode vertex and index buffers with the meshoptimizer codecs before compression\n"
+			"    --quantize-positions: Store unorm positions relative to the mesh bounds, eg. 'pos_rgb16'\n"
+			"    --quantize-uvs: Store unorm UVs relative to the mesh UV bounds, eg. 'uv_rg16'\n"
+			"    --dict <path>: Compress small sections with a .spdict dictionary trained by sp-dict\n"
+			"    --write-block-size <bytes>: Write the output unbuffered in aligned blocks of this size\n"
 		);
 
 		return 0;
@@ -2500,6 +3634,13 @@ int main(int argc, char **argv)
 	if (!input_file) failf("Input file required: -i <input>");
 	if (!output_file) failf("Output file required: -o <output>");
 	mesh_format = parse_attribs(format_spec);
+	if (bvh_compress && bvh_width != 2) failf("--bvh-compress only supports --bvh-width 2");
+	for (uint32_t i = 0; i < mesh_format.num_attribs; i++) {
+		const spmdl_attrib &attrib = mesh_format.attribs[i];
+		bool unorm = (sp_format_infos[attrib.format].flags & (SP_FORMAT_FLAG_NORMALIZED|SP_FORMAT_FLAG_SIGNED)) == SP_FORMAT_FLAG_NORMALIZED;
+		if (quantize_positions && attrib.attrib == SP_VERTEX_ATTRIB_POSITION && !unorm) failf("--quantize-positions requires an unorm position format, eg. 'pos_rgb16'");
+		if (quantize_uvs && attrib.attrib == SP_VERTEX_ATTRIB_UV && !unorm) failf("--quantize-uvs requires an unorm UV format, eg. 'uv_rg16'");
+	}
 
 	// -- Load input FBX
 
@@ -2532,6 +3673,22 @@ int main(int argc, char **argv)
 
 	compress_opts compress_opts;
 	compress_opts.level = level;
+	compress_opts.num_workers = num_threads;
+
+	rh::array<char> dict_data;
+	spfile_dict dict;
+	if (dict_file) {
+		FILE *f = fopen(dict_file, "rb");
+		if (!f) failf("Failed to open dictionary file: %s", dict_file);
+		fseek(f, 0, SEEK_END);
+		dict_data.resize_uninit((size_t)ftell(f));
+		fseek(f, 0, SEEK_SET);
+		size_t num_read = fread(dict_data.data(), 1, dict_data.size(), f);
+		fclose(f);
+		if (num_read != dict_data.size()) failf("Failed to read dictionary file: %s", dict_file);
+		if (!spfile_dict_init(&dict, dict_data.data(), dict_data.size())) failf("Invalid dictionary file: %s", dict_file);
+		compress_opts.dict = &dict;
+	}
 
 	mesh_opts.format = mesh_format;
 	mesh_data_format fmt = create_mesh_data_format(mesh_opts.format);
@@ -2559,8 +3716,22 @@ int main(int argc, char **argv)
 
 	rh::array<mesh_part> parts;
 
-	for (ufbx_mesh &mesh : scene->meshes) {
-		parts.insert_back(process_mesh(&mesh, fmt, mesh_opts));
+	// Meshes and parts are processed in parallel, results are concatenated in
+	// order so the output does not depend on the number of threads
+	{
+		rh::array<rh::array<mesh_part>> mesh_parts;
+		mesh_parts.reserve(scene->meshes.size);
+		for (size_t i = 0; i < scene->meshes.size; i++) {
+			mesh_parts.emplace_back();
+		}
+
+		parallel_for(num_threads, (int)scene->meshes.size, [&](int i) {
+			mesh_parts[i] = process_mesh(&scene->meshes.data[i], fmt, mesh_opts);
+		});
+
+		for (rh::array<mesh_part> &src : mesh_parts) {
+			parts.insert_back(std::move(src));
+		}
 	}
 
 	// Retain nodes
@@ -2613,18 +3784,102 @@ int main(int argc, char **argv)
 		}
 
 		{
-			rh::array<mesh_part> split_parts;
+			rh::array<rh::array<mesh_part>> split_parts;
 			split_parts.reserve(parts.size());
+			for (size_t i = 0; i < parts.size(); i++) {
+				split_parts.emplace_back();
+			}
 
-			for (mesh_part &part : parts) {
-				split_parts.insert_back(split_mesh(std::move(part), limits));
+			parallel_for(num_threads, (int)parts.size(), [&](int i) {
+				split_parts[i] = split_mesh(std::move(parts[i]), limits);
+			});
+
+			parts.clear();
+			for (rh::array<mesh_part> &src : split_parts) {
+				parts.insert_back(std::move(src));
 			}
+		}
 
-			parts = std::move(split_parts);
+		// Build the per-part BVHs and vertex streams in parallel, they are
+		// appended to the sections in order below
+		struct part_result
+		{
+			attrib_bounds bounds;
+			attrib_bounds uv_bounds;
+			bvh_bounds qframe;
+			bvh_build_result bvh;
+			meshlet_build_result meshlets;
+			rh::array<lod_level> lods;
+			rh::array<char> vertex_streams[SPMDL_MAX_VERTEX_BUFFERS];
+		};
+
+		rh::array<part_result> part_results;
+		part_results.reserve(parts.size());
+		for (size_t i = 0; i < parts.size(); i++) {
+			part_results.emplace_back();
 		}
 
-		for (mesh_part &part : parts) {
+		parallel_for(num_threads, (int)parts.size(), [&](int i) {
+			mesh_part &part = parts[i];
+			part_result &result = part_results[i];
+
 			optimize_mesh_part(part, optimize_opts);
+
+			if (do_meshlets) {
+				build_meshlets(result.meshlets, part, meshlet_opts);
+			}
+
+			// Compressed BVH nodes use the mesh AABB as the root bounds
+			result.bounds = get_attrib_bounds(part, part.data_format.position_attrib_index);
+			for (int axis = 0; axis < 3; axis++) {
+				result.qframe.min[axis] = result.bounds.min[axis];
+				result.qframe.max[axis] = result.bounds.max[axis];
+			}
+
+			build_lods(result.lods, part, result.bounds, lod_opts);
+
+			// Large BVHs are built below using all the threads
+			if (do_bvh && part.num_indices / 3 < BVH_PARALLEL_MIN_TRIANGLES) {
+				rh::array<bvh_build_triangle> tris = get_mesh_part_bvh_triangles(part);
+				build_bvh(result.bvh, tris.slice(), bvh_simd, 1, bvh_compress ? &result.qframe : nullptr);
+			}
+
+			// Quantized positions and UVs share one transform per mesh, all
+			// UV sets are remapped using their combined bounds
+			attrib_remap remap;
+			result.uv_bounds = { { +HUGE_VALF, +HUGE_VALF }, { -HUGE_VALF, -HUGE_VALF }, 2 };
+			for (uint32_t ai = 0; ai < part.format.num_attribs; ai++) {
+				if (part.format.attribs[ai].attrib != SP_VERTEX_ATTRIB_UV) continue;
+				attrib_bounds bounds = get_attrib_bounds(part, ai);
+				for (int i = 0; i < 2; i++) {
+					result.uv_bounds.min[i] = std::min(result.uv_bounds.min[i], bounds.min[i]);
+					result.uv_bounds.max[i] = std::max(result.uv_bounds.max[i], bounds.max[i]);
+				}
+			}
+			for (uint32_t ai = 0; ai < part.format.num_attribs; ai++) {
+				sp_vertex_attrib attrib = part.format.attribs[ai].attrib;
+				if (quantize_positions && attrib == SP_VERTEX_ATTRIB_POSITION) {
+					remap.enabled[ai] = true;
+					remap.bounds[ai] = result.bounds;
+				} else if (quantize_uvs && attrib == SP_VERTEX_ATTRIB_UV) {
+					remap.enabled[ai] = true;
+					remap.bounds[ai] = result.uv_bounds;
+				}
+			}
+
+			for (uint32_t si = 0; si < part.format.num_streams; si++) {
+				encode_vertex_stream(result.vertex_streams[si], part, si, remap);
+			}
+		});
+
+		if (do_bvh) {
+			for (size_t i = 0; i < parts.size(); i++) {
+				mesh_part &part = parts[i];
+				if (part.num_indices / 3 < BVH_PARALLEL_MIN_TRIANGLES) continue;
+				rh::array<bvh_build_triangle> tris = get_mesh_part_bvh_triangles(part);
+				part_result &result = part_results[i];
+				build_bvh(result.bvh, tris.slice(), bvh_simd, num_threads, bvh_compress ? &result.qframe : nullptr);
+			}
 		}
 
 		rh::array<spmdl_node> sp_nodes;
@@ -2635,6 +3890,7 @@ int main(int argc, char **argv)
 		rh::array<char> sp_index;
 		rh::hash_map<ufbx_material*, uint32_t> material_map;
 		bvh_build_result bvh_result;
+		meshlet_build_result meshlet_result;
 
 		sp_nodes.reserve(model.nodes.size());
 		sp_meshes.reserve(parts.size());
@@ -2649,7 +3905,10 @@ int main(int argc, char **argv)
 			sp_nodes.push_back(std::move(sp_node));
 		}
 
-		for (mesh_part &part : parts) {
+		for (size_t part_ix = 0; part_ix < parts.size(); part_ix++) {
+			mesh_part &part = parts[part_ix];
+			part_result &result = part_results[part_ix];
+
 			spmdl_mesh sp_mesh = { };
 			sp_mesh.node = find_node(model, &part.mesh->node);
 			sp_mesh.num_attribs = part.format.num_attribs;
@@ -2658,7 +3917,7 @@ int main(int argc, char **argv)
 			sp_mesh.num_vertices = (uint32_t)part.num_vertices;
 			sp_mesh.bvh_index = ~0u;
 
-			attrib_bounds bounds = get_attrib_bounds(part, part.data_format.position_attrib_index);
+			const attrib_bounds &bounds = result.bounds;
 			sp_mesh.aabb_min.x = bounds.min[0];
 			sp_mesh.aabb_min.y = bounds.min[1];
 			sp_mesh.aabb_min.z = bounds.min[2];
@@ -2666,9 +3925,26 @@ int main(int argc, char **argv)
 			sp_mesh.aabb_max.y = bounds.max[1];
 			sp_mesh.aabb_max.z = bounds.max[2];
 
+			sp_mesh.position_scale = { 1.0f, 1.0f, 1.0f };
+			sp_mesh.uv_scale[0] = sp_mesh.uv_scale[1] = 1.0f;
+			if (quantize_positions) {
+				sp_mesh.position_scale = { bounds.max[0] - bounds.min[0], bounds.max[1] - bounds.min[1], bounds.max[2] - bounds.min[2] };
+				sp_mesh.position_offset = sp_mesh.aabb_min;
+			}
+			if (quantize_uvs && result.uv_bounds.min[0] <= result.uv_bounds.max[0]) {
+				for (int i = 0; i < 2; i++) {
+					sp_mesh.uv_scale[i] = result.uv_bounds.max[i] - result.uv_bounds.min[i];
+					sp_mesh.uv_offset[i] = result.uv_bounds.min[i];
+				}
+			}
+
 			if (do_bvh) {
-				rh::array<bvh_build_triangle> tris = get_mesh_part_bvh_triangles(part);
-				sp_mesh.bvh_index = build_bvh(bvh_result, tris.slice(), bvh_simd);
+				sp_mesh.bvh_index = append_bvh(bvh_result, result.bvh);
+			}
+
+			if (do_meshlets) {
+				sp_mesh.meshlet_offset = append_meshlets(meshlet_result, result.meshlets);
+				sp_mesh.num_meshlets = (uint32_t)result.meshlets.meshlets.size();
 			}
 
 			if (part.bones.size() > 0) {
@@ -2682,30 +3958,20 @@ int main(int argc, char **argv)
 				}
 			}
 
-			if (part.num_vertices < UINT16_MAX) {
-				rh::array<uint16_t> indices16;
-				indices16.resize_uninit(part.index_data.size());
-				uint16_t *dst = indices16.data();
-				for (uint32_t ix : part.index_data) {
-					*dst++ = (uint16_t)ix;
-				}
-				sp_mesh.index_buffer = sp_push_buffer(sp_index, indices16.slice());
-			} else {
-				sp_mesh.index_buffer = sp_push_buffer(sp_index, part.index_data.slice());
-			}
+			sp_mesh.index_buffer = sp_push_indices(sp_index, part.index_data.slice(), part.num_vertices, meshopt_codec);
 
-			// Pad indices to 4 bytes
-			while (sp_index.size() % 4 != 0) sp_index.push_back(0);
+			sp_mesh.num_lods = (uint32_t)result.lods.size();
+			for (size_t i = 0; i < result.lods.size(); i++) {
+				const lod_level &lod = result.lods[i];
+				spmdl_lod &sp_lod = sp_mesh.lods[i];
+				sp_lod.num_indices = (uint32_t)lod.indices.size();
+				sp_lod.error = lod.error;
+				sp_lod.index_buffer = sp_push_indices(sp_index, lod.indices.slice(), part.num_vertices, meshopt_codec);
+			}
 
-			rh::array<char> vertex_data;
 			for (uint32_t i = 0; i < part.format.num_streams; i++) {
 				uint32_t stride = part.format.stream_stride[i];
-				encode_vertex_stream(vertex_data, part, i);
-
-				// Pre-pad vertices to stride bytes
-				while (sp_vertex.size() % stride != 0) sp_vertex.push_back(0);
-
-				sp_mesh.vertex_buffers[i] = sp_push_buffer(sp_vertex, vertex_data.slice(), stride);
+				sp_mesh.vertex_buffers[i] = sp_push_vertices(sp_vertex, result.vertex_streams[i].slice(), stride, meshopt_codec);
 			}
 
 			memcpy(sp_mesh.attribs, part.format.attribs, sizeof(sp_mesh.attribs));
@@ -2728,47 +3994,62 @@ int main(int argc, char **argv)
 			sp_meshes.push_back(std::move(sp_mesh));
 		}
 
+		// Collapse the binary BVHs of all meshes into wide nodes
+		rh::array<spmdl_bvh4_node> bvh4_nodes;
+		rh::array<spmdl_bvh8_node> bvh8_nodes;
+		uint32_t num_bvh_nodes = (uint32_t)(bvh_compress ? bvh_result.qnodes.size() : bvh_result.nodes.size());
+		if (bvh_width > 2) {
+			for (spmdl_mesh &sp_mesh : sp_meshes) {
+				if (sp_mesh.bvh_index == ~0u) continue;
+				if (bvh_width == 4) {
+					sp_mesh.bvh_index = collapse_bvh<spmdl_bvh4_node, 4>(bvh4_nodes, bvh_result.nodes, sp_mesh.bvh_index);
+				} else {
+					sp_mesh.bvh_index = collapse_bvh<spmdl_bvh8_node, 8>(bvh8_nodes, bvh_result.nodes, sp_mesh.bvh_index);
+				}
+			}
+			num_bvh_nodes = (uint32_t)(bvh_width == 4 ? bvh4_nodes.size() : bvh8_nodes.size());
+		}
+
 		spmdl_header header = { };
 		header.header.magic = SPFILE_HEADER_SPMDL;
 		header.header.header_info_size = sizeof(spmdl_info);
-		header.header.num_sections = 5;
-		header.header.version = 1;
+		header.header.num_sections = 13;
+		header.header.version = SPMDL_VERSION;
 		header.info.num_nodes = (uint32_t)sp_nodes.size();
 		header.info.num_bones = (uint32_t)sp_bones.size();
 		header.info.num_materials = (uint32_t)sp_materials.size();
 		header.info.num_meshes = (uint32_t)sp_meshes.size();
-		header.info.num_bvh_nodes = (uint32_t)bvh_result.nodes.size();
+		header.info.num_bvh_nodes = num_bvh_nodes;
 		header.info.num_bvh_tris = (uint32_t)bvh_result.triangles.size() / 3;
-
-		compress_result c_nodes, c_bones, c_materials, c_meshes, c_bvh_nodes, c_bvh_tris, c_strings, c_vertex, c_index;
-
-		uint32_t offset = sizeof(header);
-		init_section(offset, header.s_nodes, c_nodes, sp_nodes.slice(), compress_opts, SPFILE_SECTION_NODES);
-		init_section(offset, header.s_bones, c_bones, sp_bones.slice(), compress_opts, SPFILE_SECTION_BONES);
-		init_section(offset, header.s_materials, c_materials, sp_materials.slice(), compress_opts, SPFILE_SECTION_MATERIALS);
-		init_section(offset, header.s_meshes, c_meshes, sp_meshes.slice(), compress_opts, SPFILE_SECTION_MESHES);
-		init_section(offset, header.s_bvh_nodes, c_bvh_nodes, bvh_result.nodes.slice(), compress_opts, SPFILE_SECTION_BVH_NODES);
-		init_section(offset, header.s_bvh_tris, c_bvh_tris, bvh_result.triangles.slice(), compress_opts, SPFILE_SECTION_BVH_TRIS);
-		init_section(offset, header.s_strings, c_strings, str_pool.data.slice(), compress_opts, SPFILE_SECTION_STRINGS);
-		init_section(offset, header.s_vertex, c_vertex, sp_vertex.slice(), compress_opts, SPFILE_SECTION_VERTEX);
-		init_section(offset, header.s_index, c_index, sp_index.slice(), compress_opts, SPFILE_SECTION_INDEX);
-
-		{
-			FILE *f = fopen(output_file, "wb");
-
-			write_pod(f, header);
-			write_pod(f, c_nodes.data.slice());
-			write_pod(f, c_bones.data.slice());
-			write_pod(f, c_materials.data.slice());
-			write_pod(f, c_meshes.data.slice());
-			write_pod(f, c_bvh_nodes.data.slice());
-			write_pod(f, c_bvh_tris.data.slice());
-			write_pod(f, c_strings.data.slice());
-			write_pod(f, c_vertex.data.slice());
-			write_pod(f, c_index.data.slice());
-
-			fclose(f);
+		header.info.num_meshlets = (uint32_t)meshlet_result.meshlets.size();
+		header.info.num_meshlet_vertices = (uint32_t)meshlet_result.vertices.size();
+		header.info.geometry_encoding = meshopt_codec ? SPMDL_GEOMETRY_MESHOPT : SPMDL_GEOMETRY_RAW;
+
+		// Section indices match the order in `spmdl_header`
+		spfile_writer writer;
+		open_writer(writer, output_file, header.header, write_block_size);
+		write_section(writer, 0, sp_nodes.slice(), compress_opts, SPFILE_SECTION_NODES);
+		write_section(writer, 1, sp_bones.slice(), compress_opts, SPFILE_SECTION_BONES);
+		write_section(writer, 2, sp_materials.slice(), compress_opts, SPFILE_SECTION_MATERIALS);
+		write_section(writer, 3, sp_meshes.slice(), compress_opts, SPFILE_SECTION_MESHES);
+		if (bvh_width == 4) {
+			write_section(writer, 4, bvh4_nodes.slice(), compress_opts, SPFILE_SECTION_BVH4_NODES);
+		} else if (bvh_width == 8) {
+			write_section(writer, 4, bvh8_nodes.slice(), compress_opts, SPFILE_SECTION_BVH8_NODES);
+		} else if (bvh_compress) {
+			write_section(writer, 4, bvh_result.qnodes.slice(), compress_opts, SPFILE_SECTION_BVHQ_NODES);
+		} else {
+			write_section(writer, 4, bvh_result.nodes.slice(), compress_opts, SPFILE_SECTION_BVH_NODES);
 		}
+		write_section(writer, 5, bvh_result.triangles.slice(), compress_opts, SPFILE_SECTION_BVH_TRIS);
+		write_section(writer, 6, str_pool.data.slice(), compress_opts, SPFILE_SECTION_STRINGS);
+		write_section(writer, 7, sp_vertex.slice(), compress_opts, SPFILE_SECTION_VERTEX);
+		write_section(writer, 8, sp_index.slice(), compress_opts, SPFILE_SECTION_INDEX);
+		write_section(writer, 9, meshlet_result.meshlets.slice(), compress_opts, SPFILE_SECTION_MESHLETS);
+		write_section(writer, 10, meshlet_result.bounds.slice(), compress_opts, SPFILE_SECTION_MESHLET_BOUNDS);
+		write_section(writer, 11, meshlet_result.vertices.slice(), compress_opts, SPFILE_SECTION_MESHLET_VERTICES);
+		write_section(writer, 12, meshlet_result.triangles.slice(), compress_opts, SPFILE_SECTION_MESHLET_TRIANGLES);
+		finish_writer(writer, &header.info);
 
 #if 0
 		{
@@ -2808,8 +4089,6 @@ int main(int argc, char **argv)
 		double duration;
 		anim_data = compress_animation(model, scene, anim_opts, duration);
 
-		compress_result c_bones, c_strings, c_animation;
-
 		spanim_header header = { };
 		header.header.magic = SPFILE_HEADER_SPANIM;
 		header.header.version = 1;
@@ -2818,21 +4097,13 @@ int main(int argc, char **argv)
 		header.info.duration = duration;
 		header.info.num_bones = (uint32_t)bones.size();
 
-		uint32_t offset = sizeof(header);
-		init_section(offset, header.s_bones, c_bones, bones.slice(), compress_opts, SPFILE_SECTION_BONES);
-		init_section(offset, header.s_strings, c_strings, str_pool.data.slice(), compress_opts, SPFILE_SECTION_STRINGS);
-		init_section(offset, header.s_animation, c_animation, anim_data.slice(), compress_opts, SPFILE_SECTION_ANIMATION);
-
-		{
-			FILE *f = fopen(output_file, "wb");
-
-			write_pod(f, header);
-			write_pod(f, c_bones.data.slice());
-			write_pod(f, c_strings.data.slice());
-			write_pod(f, c_animation.data.slice());
-
-			fclose(f);
-		}
+		// Section indices match the order in `spanim_header`
+		spfile_writer writer;
+		open_writer(writer, output_file, header.header, write_block_size);
+		write_section(writer, 0, bones.slice(), compress_opts, SPFILE_SECTION_BONES);
+		write_section(writer, 1, str_pool.data.slice(), compress_opts, SPFILE_SECTION_STRINGS);
+		write_section(writer, 2, anim_data.slice(), compress_opts, SPFILE_SECTION_ANIMATION);
+		finish_writer(writer, &header.info);
 	}
 
 	ufbx_free_scene(scene);
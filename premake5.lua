@@ -96,7 +96,23 @@ project "sp-envmap"
 	language "C++"
     files { "envmap/**.h", "envmap/**.c", "envmap/**.cpp" }
     files { "ext/**.h", "ext/**.c", "ext/**.cpp" }
+    files { "texcomp/astcenc.h", "texcomp/astcenc.cpp", "texcomp/astc/**.h", "texcomp/astc/**.cpp" }
+    includedirs { "texcomp" }
     files { "misc/*.natvis" }
 	debugdir "."
 
+project "sp-dict"
+	kind "ConsoleApp"
+	language "C++"
+    files { "dict/**.h", "dict/**.c", "dict/**.cpp" }
+    files { "ext/**.h", "ext/**.c", "ext/**.cpp" }
+    files { "misc/*.natvis" }
+	debugdir "."
 
+project "sp-loader-bench"
+	kind "ConsoleApp"
+	language "C++"
+    files { "bench/**.h", "bench/**.c", "bench/**.cpp" }
+    files { "ext/**.h", "ext/**.c", "ext/**.cpp" }
+    files { "misc/*.natvis" }
+	debugdir "."
@@ -41,48 +41,44 @@ void failf(const char *fmt, ...)
 	exit(1);
 }
 
-const char zero_buf[64] = { 0 };
+// Sections up to this size are compressed with the dictionary if given
+static const size_t max_dict_section_size = 64 * 1024;
 
-static void write_pad(FILE *f, size_t num)
-{
-	fwrite(zero_buf, 1, num, f);
-}
-
-static void write_data(FILE *f, const void *data, size_t size)
-{
-	size_t num = fwrite(data, 1, size, f);
-	if (num != size) {
-		fclose(f);
-		failf("Failed to write output data");
-	}
-}
-
-void *compress_section(spfile_section *section, uint32_t *file_offset, uint32_t *pad, const void *data, size_t size, int level, sp_compression_type compression_type, spfile_section_magic magic)
+void *compress_section(spfile_section *section, const void *data, size_t size, int level, int num_workers, sp_compression_type compression_type, spfile_section_magic magic, const spfile_dict *dict)
 {
 	size_t bound = sp_get_compression_bound(compression_type, size);
+	if (dict && size <= max_dict_section_size) {
+		size_t dict_bound = sp_get_compression_bound(SP_COMPRESSION_ZSTD_DICT, size);
+		if (dict_bound > bound) bound = dict_bound;
+	}
 	void *result = malloc(bound);
 	double no_compress_ratio = 1.1;
 
-	size_t compressed_size = sp_compress_buffer(compression_type, result, bound, data, size, level);
-	sp_compression_type mip_type = compression_type;
+	size_t compressed_size = sp_compress_buffer(compression_type, result, bound, data, size, level, num_workers);
+	if (dict && size <= max_dict_section_size) {
+		void *dict_result = malloc(bound);
+		size_t dict_size = sp_compress_buffer_dict(dict, dict_result, bound, data, size, level);
+		if (dict_size < compressed_size) {
+			free(result);
+			result = dict_result;
+			compressed_size = dict_size;
+			compression_type = SP_COMPRESSION_ZSTD_DICT;
+		} else {
+			free(dict_result);
+		}
+	}
+
 	if ((double)size / (double)compressed_size < no_compress_ratio && compression_type != SP_COMPRESSION_NONE) {
 		compression_type = SP_COMPRESSION_NONE;
 		memcpy(result, data, size);
 		compressed_size = size;
 	}
 
-	while (*file_offset % 16 != 0) {
-		++*pad;
-		++*file_offset;
-	}
-
 	section->magic = magic;
 	section->index = 0;
 	section->compressed_size = (uint32_t)compressed_size;
 	section->compression_type = compression_type;
 	section->uncompressed_size = (uint32_t)size;
-	section->offset = *file_offset;
-	*file_offset += section->compressed_size;
 
 	return result;
 }
@@ -121,8 +117,11 @@ void push_audio(const void *data, size_t size)
 int main(int argc, char **argv)
 {
 	const char *output_file = NULL;
+	const char *dict_file = NULL;
 	bool show_help = false;
 	int level = 10;
+	int num_threads = 1;
+	size_t write_block_size = 0;
 	uint32_t num_takes = 0;
 
 	// -- Parse arguments
@@ -149,6 +148,15 @@ int main(int argc, char **argv)
 				if (level <= 0 || level > 20) {
 					failf("Invalid level %d, must be between 1-20", level);
 				}
+			} else if (!strcmp(arg, "-j") || !strcmp(arg, "--threads")) {
+				num_threads = atoi(argv[++argi]);
+				if (num_threads <= 0 || num_threads > 10000) failf("Bad number of threads: %d", num_threads);
+			} else if (!strcmp(arg, "--dict")) {
+				dict_file = argv[++argi];
+			} else if (!strcmp(arg, "--write-block-size")) {
+				int size = atoi(argv[++argi]);
+				if (size < 0) failf("Bad write block size: %d", size);
+				write_block_size = (size_t)size;
 			}
 		}
 	}
@@ -158,7 +166,10 @@ int main(int argc, char **argv)
 			"Usage: sp-sound -i <input> -o <output>\n"
 			"    -i / --input <path>: Input filename in any format stb_image supports\n"
 			"    -o / --output <path>: Destination filename\n"
+			"    -j / --threads <num>: Number of threads to use\n"
 			"    -v / --verbose: Verbose output\n"
+			"    --dict <path>: Compress small sections with a .spdict dictionary trained by sp-dict\n"
+			"    --write-block-size <bytes>: Write the output unbuffered in aligned blocks of this size\n"
 		);
 
 		return 0;
@@ -265,24 +276,42 @@ int main(int argc, char **argv)
 	header.info.num_takes = num_takes;
 	header.info.temp = 0;
 
-	uint32_t file_offset = sizeof(spsound_header);
-	uint32_t take_pad = 0, audio_pad = 0;
+	spfile_dict dict_storage, *dict = NULL;
+	if (dict_file) {
+		FILE *f = fopen(dict_file, "rb");
+		if (!f) failf("Failed to open dictionary file: %s", dict_file);
 
-	void *take_comp = compress_section(&header.s_takes, &file_offset, &take_pad, sp_takes, num_takes * sizeof(spsound_take), level, SP_COMPRESSION_ZSTD, SPFILE_SECTION_TAKES);
-	void *audio_comp = compress_section(&header.s_audio, &file_offset, &audio_pad, audio_data, audio_size, level, SP_COMPRESSION_ZSTD, SPFILE_SECTION_TAKES);
+		fseek(f, 0, SEEK_END);
+		size_t dict_size = ftell(f);
+		fseek(f, 0, SEEK_SET);
+
+		void *dict_data = malloc(dict_size);
+		size_t num_read = fread(dict_data, 1, dict_size, f);
+		fclose(f);
+		if (num_read != dict_size) failf("Failed to read dictionary file: %s", dict_file);
+		if (!spfile_dict_init(&dict_storage, dict_data, dict_size)) failf("Invalid dictionary file: %s", dict_file);
+		dict = &dict_storage;
+	}
 
 	FILE *f = fopen(output_file, "wb");
 	if (!f) failf("Failed to open output file: %s", output_file);
 
-	write_data(f, &header, sizeof(header));
+	spfile_writer writer;
+	spfile_writer_init(&writer, f, &header.header, write_block_size);
 
-	write_pad(f, take_pad);
-	write_data(f, take_comp, header.s_takes.compressed_size);
+	// Stream each section as soon as it's compressed
+	void *take_comp = compress_section(&header.s_takes, sp_takes, num_takes * sizeof(spsound_take), level, num_threads, SP_COMPRESSION_ZSTD, SPFILE_SECTION_TAKES, dict);
+	spfile_writer_add_section(&writer, 0, &header.s_takes, take_comp);
+	free(take_comp);
 
-	write_pad(f, audio_pad);
-	write_data(f, audio_comp, header.s_audio.compressed_size);
+	void *audio_comp = compress_section(&header.s_audio, audio_data, audio_size, level, num_threads, SP_COMPRESSION_ZSTD, SPFILE_SECTION_AUDIO, dict);
+	spfile_writer_add_section(&writer, 1, &header.s_audio, audio_comp);
+	free(audio_comp);
 
+	bool ok = spfile_writer_finish(&writer, &header.info);
 	fclose(f);
+	spfile_writer_free(&writer);
+	if (!ok) failf("Failed to write output data");
 
 	return 0;
 }
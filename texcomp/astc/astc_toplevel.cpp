@@ -310,12 +310,11 @@ static void encode_astc_image_threadfunc(
 	delete   temp_buffers.ewb;
 }
 
-void encode_astc_image(
+// sp modification: allow sharing the block size descriptor between calls
+void encode_astc_image_bsd(
+	const block_size_descriptor* bsd,
 	const astc_codec_image* input_image,
 	astc_codec_image* output_image,
-	int xdim,
-	int ydim,
-	int zdim,
 	const error_weighting_params* ewp,
 	astc_decode_mode decode_mode,
 	swizzlepattern swz_encode,
@@ -326,12 +325,6 @@ void encode_astc_image(
 	astcenc_progress_fn progress_fn,
 	void *progress_user
 ) {
-	// before entering into the multi-threaded routine, ensure that the block size descriptors
-	// and the partition table descriptors needed actually exist.
-	block_size_descriptor* bsd = new block_size_descriptor;
-	init_block_size_descriptor(xdim, ydim, zdim, bsd);
-	get_partition_table(bsd, 0);
-
 	encode_astc_image_info ai;
 	ai.bsd = bsd;
 	ai.buffer = buffer;
@@ -346,6 +339,32 @@ void encode_astc_image(
 	ai.progress_user = progress_user;
 
 	launch_threads(threadcount, encode_astc_image_threadfunc, &ai);
+}
+
+void encode_astc_image(
+	const astc_codec_image* input_image,
+	astc_codec_image* output_image,
+	int xdim,
+	int ydim,
+	int zdim,
+	const error_weighting_params* ewp,
+	astc_decode_mode decode_mode,
+	swizzlepattern swz_encode,
+	swizzlepattern swz_decode,
+	uint8_t* buffer,
+	int pack_and_unpack,
+	int threadcount,
+	astcenc_progress_fn progress_fn,
+	void *progress_user
+) {
+	// before entering into the multi-threaded routine, ensure that the block size descriptors
+	// and the partition table descriptors needed actually exist.
+	block_size_descriptor* bsd = new block_size_descriptor;
+	init_block_size_descriptor(xdim, ydim, zdim, bsd);
+	get_partition_table(bsd, 0);
+
+	encode_astc_image_bsd(bsd, input_image, output_image, ewp, decode_mode,
+		swz_encode, swz_decode, buffer, pack_and_unpack, threadcount, progress_fn, progress_user);
 
 	term_block_size_descriptor(bsd);
 	delete bsd;
@@ -1,13 +1,12 @@
 #include "astcenc.h"
 #include "astc/astc_codec_internals.h"
 #include <math.h>
+#include <string.h>
 
-void encode_astc_image(
+void encode_astc_image_bsd(
+	const block_size_descriptor* bsd,
 	const astc_codec_image* input_image,
 	astc_codec_image* output_image,
-	int xdim,
-	int ydim,
-	int zdim,
 	const error_weighting_params* ewp,
 	astc_decode_mode decode_mode,
 	swizzlepattern swz_encode,
@@ -25,20 +24,49 @@ void astcenc_init()
 	build_quantization_mode_table();
 }
 
-bool astcenc_encode_image(const astcenc_opts *opts, uint8_t *dst, const uint8_t *src, int width, int height)
+static const astcenc_quality level_to_astcenc_quality[] = {
+	{ 0 }, // 0 (invalid)
+	{ 4, 1.0f, 0.5f, 30.0f, 50, 1 }, // 1
+	{ 5, 1.05f, 0.5f, 32.0f, 50, 1 }, // 2
+	{ 6, 1.1f, 0.5f, 34.0f, 55, 1 }, // 3
+	{ 7, 1.3f, 0.55f, 36.0f, 55, 1 }, // 4
+	{ 8, 1.1f, 0.55f, 38.0f, 60, 1 }, // 5
+	{ 9, 1.15f, 0.55f, 40.0f, 60, 1 }, // 6
+	{ 10, 1.15f, 0.55f, 42.0f, 65, 1 }, // 7
+	{ 15, 1.2f, 0.6f, 44.0f, 65, 2 }, // 8
+	{ 20, 1.2f, 0.65f, 56.0f, 75, 2 }, // 9
+	{ 25, 1.2f, 0.75f, 50.0f, 75, 2 }, // 10
+	{ 30, 1.3f, 0.85f, 55.0f, 80, 2 }, // 11
+	{ 45, 1.4f, 0.9f, 60.0f, 80, 2 }, // 12
+	{ 50, 1.5f, 0.9f, 65.0f, 85, 2 }, // 13
+	{ 60, 1.6f, 0.95f, 70.0f, 90, 4 }, // 14
+	{ 80, 2.0f, 0.96f, 80.0f, 95, 4 }, // 15
+	{ 100, 2.5f, 0.97f, 90.0f, 95, 4 }, // 16
+	{ 200, 3.0f, 0.97f, 100.0f, 90, 4 }, // 17
+	{ 300, 4.0f, 0.97f, 120.0f, 100, 4 }, // 18
+	{ 400, 5.0f, 0.98f, 140.0f, 100, 4 }, // 19
+	{ (1<<10), 1000.0f, 0.99f, 999.0f, 100, 4 }, // 20
+};
+
+astcenc_quality astcenc_quality_for_level(int level)
 {
-	int xdim = opts->block_width;
-	int ydim = opts->block_height;
-	int zdim = 1;
+	if (level < 1) level = 1;
+	if (level > 20) level = 20;
+	return level_to_astcenc_quality[level];
+}
 
+static swizzlepattern get_encode_swizzle(const astcenc_opts *opts)
+{
 	swizzlepattern swz_encode = { 0,1,2,3 };
 	if (opts->swizzle[0] != ASTCENC_SWIZZLE_IDENTITY) swz_encode.r = (uint8_t)((int)opts->swizzle[0] - 1);
 	if (opts->swizzle[1] != ASTCENC_SWIZZLE_IDENTITY) swz_encode.g = (uint8_t)((int)opts->swizzle[1] - 1);
 	if (opts->swizzle[2] != ASTCENC_SWIZZLE_IDENTITY) swz_encode.b = (uint8_t)((int)opts->swizzle[2] - 1);
 	if (opts->swizzle[3] != ASTCENC_SWIZZLE_IDENTITY) swz_encode.a = (uint8_t)((int)opts->swizzle[3] - 1);
+	return swz_encode;
+}
 
-	swizzlepattern swz_decode = { 0,1,2,3 };
-
+static void init_error_weighting(error_weighting_params *p_ewp, const astcenc_opts *opts, astc_decode_mode mode)
+{
 	error_weighting_params ewp = { 0 };
 
 	ewp.rgb_power = 1.0f;
@@ -62,6 +90,20 @@ bool astcenc_encode_image(const astcenc_opts *opts, uint8_t *dst, const uint8_t
 	ewp.rgba_weights[3] = 1.0f;
 	ewp.ra_normal_angular_scale = 0;
 
+	// Same defaults as `astcenc -ch` / `astcenc -cH`
+	if (mode == DECODE_HDR || mode == DECODE_HDRA) {
+		ewp.rgb_power = 0.75f;
+		ewp.rgb_base_weight = 0.0f;
+		ewp.rgb_mean_weight = 1.0f;
+		if (mode == DECODE_HDRA) {
+			ewp.alpha_power = 0.75f;
+			ewp.alpha_base_weight = 0.0f;
+			ewp.alpha_mean_weight = 1.0f;
+		} else {
+			ewp.alpha_base_weight = 0.05f;
+		}
+	}
+
 	if (opts->rgba_weights[0] != 0.0f || opts->rgba_weights[1] != 0.0f || opts->rgba_weights[2] != 0.0f || opts->rgba_weights[3] != 0.0f) {
 		ewp.rgba_weights[0] = opts->rgba_weights[0];
 		ewp.rgba_weights[1] = opts->rgba_weights[1];
@@ -82,8 +124,13 @@ bool astcenc_encode_image(const astcenc_opts *opts, uint8_t *dst, const uint8_t
 		ewp.lowest_correlation_cutoff = 0.99f;
 	}
 
-	float avg_texel_error = powf(0.1f, opts->quality.dblimit * 0.1f) * 65535.0f * 65535.0f;
-	ewp.texel_avg_error_limit = avg_texel_error;
+	// The PSNR limit is meaningless for HDR data, never exit early
+	if (mode == DECODE_HDR || mode == DECODE_HDRA) {
+		ewp.texel_avg_error_limit = 0.0f;
+	} else {
+		float avg_texel_error = powf(0.1f, opts->quality.dblimit * 0.1f) * 65535.0f * 65535.0f;
+		ewp.texel_avg_error_limit = avg_texel_error;
+	}
 
 	float max_color_component_weight = MAX(MAX(ewp.rgba_weights[0], ewp.rgba_weights[1]),
 										   MAX(ewp.rgba_weights[2], ewp.rgba_weights[3]));
@@ -92,48 +139,48 @@ bool astcenc_encode_image(const astcenc_opts *opts, uint8_t *dst, const uint8_t
 	ewp.rgba_weights[2] = MAX(ewp.rgba_weights[2], max_color_component_weight / 1000.0f);
 	ewp.rgba_weights[3] = MAX(ewp.rgba_weights[3], max_color_component_weight / 1000.0f);
 
-	int padding = MAX(ewp.mean_stdev_radius, ewp.alpha_radius);
-
-	astc_codec_image *input_image = astc_img_from_unorm8x4_array(src, width, height, padding, 0);
-	if (!input_image) return false;
+	*p_ewp = ewp;
+}
 
-	int xsize = input_image->xsize;
-	int ysize = input_image->ysize;
-	int zsize = input_image->zsize;
+static int get_image_padding(const error_weighting_params *ewp)
+{
+	return MAX(ewp->mean_stdev_radius, ewp->alpha_radius);
+}
 
-	int xblocks = (xsize + xdim - 1) / xdim;
-	int yblocks = (ysize + ydim - 1) / ydim;
-	int zblocks = (zsize + zdim - 1) / zdim;
+struct astcenc_encoder {
+	astcenc_opts opts;
+	astc_decode_mode mode;
+	error_weighting_params ewp;
+	swizzlepattern swz_encode;
+	block_size_descriptor *bsd;
+};
 
-	expand_block_artifact_suppression(xdim, ydim, zdim, &ewp);
+static astcenc_encoder *create_encoder(const astcenc_opts *opts, astc_decode_mode mode)
+{
+	astcenc_encoder *enc = new astcenc_encoder;
+	enc->opts = *opts;
+	enc->mode = mode;
 
-	int linearize_srgb = 0;
+	int xdim = opts->block_width;
+	int ydim = opts->block_height;
+	int zdim = 1;
 
-	if (padding > 0 ||
-		ewp.rgb_mean_weight != 0.0f || ewp.rgb_stdev_weight != 0.0f ||
-		ewp.alpha_mean_weight != 0.0f || ewp.alpha_stdev_weight != 0.0f)
-	{
-		// Clamp texels outside the actual image area.
-	fill_image_padding_area(input_image);
+	error_weighting_params &ewp = enc->ewp;
+	init_error_weighting(&ewp, opts, mode);
+	expand_block_artifact_suppression(xdim, ydim, zdim, &ewp);
 
-	compute_averages_and_variances(
-		input_image,
-		ewp.rgb_power,
-		ewp.alpha_power,
-		ewp.mean_stdev_radius,
-		ewp.alpha_radius,
-		linearize_srgb,
-		swz_encode,
-		opts->num_threads);
-	}
+	enc->swz_encode = get_encode_swizzle(opts);
 
-	astc_decode_mode mode = DECODE_LDR_SRGB;
-	if (opts->linear) mode = DECODE_LDR;
+	// Building the partition tables is expensive so share them between images
+	enc->bsd = new block_size_descriptor;
+	init_block_size_descriptor(xdim, ydim, zdim, enc->bsd);
+	get_partition_table(enc->bsd, 0);
 
 	// print all encoding settings unless specifically told otherwise.
 	if (opts->verbose)
 	{
 		printf("ASTC Encoding settings:\n");
+		printf("  Decode mode: %s\n", mode == DECODE_HDRA ? "HDR+A" : mode == DECODE_HDR ? "HDR" : mode == DECODE_LDR ? "LDR" : "LDR sRGB");
 		printf("  3D Block size: %dx%dx%d (%.2f bpp)\n", xdim, ydim, zdim, 128.0 / (xdim* ydim* zdim));
 		printf("  Radius for mean-and-stdev calculations: %d texels\n", ewp.mean_stdev_radius);
 		printf("  RGB power: %g\n", (double)ewp.rgb_power);
@@ -160,10 +207,161 @@ bool astcenc_encode_image(const astcenc_opts *opts, uint8_t *dst, const uint8_t
 		printf("  Max refinement iterations: %d\n", ewp.max_refinement_iters);
 	}
 
-	encode_astc_image(input_image, NULL, xdim, ydim, zdim, &ewp, mode,
-		swz_encode, swz_decode, dst, 0, opts->num_threads, opts->progress_fn, opts->progress_user);
+	return enc;
+}
+
+static astc_decode_mode get_decode_mode(const astcenc_opts *opts, bool hdr)
+{
+	if (hdr) return opts->hdr_alpha ? DECODE_HDRA : DECODE_HDR;
+	return opts->linear ? DECODE_LDR : DECODE_LDR_SRGB;
+}
+
+static void encode_image(const astcenc_encoder *enc, uint8_t *dst, astc_codec_image *input_image, int num_threads, astcenc_progress_fn progress_fn, void *progress_user)
+{
+	const error_weighting_params &ewp = enc->ewp;
+	astc_decode_mode mode = enc->mode;
+	swizzlepattern swz_decode = { 0,1,2,3 };
+
+	int padding = get_image_padding(&ewp);
+
+	if (mode == DECODE_HDR || mode == DECODE_HDRA) {
+		input_image->rgb_force_use_of_hdr = 1;
+		input_image->alpha_force_use_of_hdr = mode == DECODE_HDRA ? 1 : 0;
+	}
+
+	int linearize_srgb = 0;
+
+	if (padding > 0 ||
+		ewp.rgb_mean_weight != 0.0f || ewp.rgb_stdev_weight != 0.0f ||
+		ewp.alpha_mean_weight != 0.0f || ewp.alpha_stdev_weight != 0.0f)
+	{
+		// Clamp texels outside the actual image area.
+	fill_image_padding_area(input_image);
+
+	compute_averages_and_variances(
+		input_image,
+		ewp.rgb_power,
+		ewp.alpha_power,
+		ewp.mean_stdev_radius,
+		ewp.alpha_radius,
+		linearize_srgb,
+		enc->swz_encode,
+		num_threads);
+	}
+
+	encode_astc_image_bsd(enc->bsd, input_image, NULL, &ewp, mode,
+		enc->swz_encode, swz_decode, dst, 0, num_threads, progress_fn, progress_user);
 
 	free_image(input_image);
+}
+
+astcenc_encoder *astcenc_encoder_create(const astcenc_opts *opts, bool hdr)
+{
+	return create_encoder(opts, get_decode_mode(opts, hdr));
+}
+
+void astcenc_encoder_free(astcenc_encoder *enc)
+{
+	if (!enc) return;
+	term_block_size_descriptor(enc->bsd);
+	delete enc->bsd;
+	delete enc;
+}
+
+// Rows can be encoded separately as long as the error weighting doesn't
+// look at neighboring texels (`get_image_padding()` is zero)
+static void get_row_range(const astcenc_encoder *enc, int height, int min_block_y, int max_block_y, int *p_min_y, int *p_max_y)
+{
+	int ydim = enc->opts.block_height;
+	int min_y = min_block_y * ydim;
+	int max_y = max_block_y * ydim;
+	if (max_y > height) max_y = height;
+	*p_min_y = min_y;
+	*p_max_y = max_y;
+}
+
+bool astcenc_encode_rows(const astcenc_encoder *enc, uint8_t *dst, const uint8_t *src, int width, int height, int min_block_y, int max_block_y)
+{
+	int min_y, max_y;
+	get_row_range(enc, height, min_block_y, max_block_y, &min_y, &max_y);
+
+	int padding = get_image_padding(&enc->ewp);
+	astc_codec_image *input_image = astc_img_from_unorm8x4_array(src + (size_t)min_y * width * 4, width, max_y - min_y, padding, 0);
+	if (!input_image) return false;
+
+	size_t blocks_x = (size_t)((width + enc->opts.block_width - 1) / enc->opts.block_width);
+	encode_image(enc, dst + (size_t)min_block_y * blocks_x * 16, input_image, 1, NULL, NULL);
+	return true;
+}
+
+// The codec stores 16-bit images as IEEE half-floats so the rows are copied as-is
+static astc_codec_image *img_from_halfx4_array(const uint16_t *src, int width, int height, int padding)
+{
+	astc_codec_image *input_image = alloc_image(16, width, height, 1, padding);
+	if (!input_image) return NULL;
+
+	for (int y = 0; y < height; y++) {
+		memcpy(&input_image->data16[0][y + padding][4 * padding], src + (size_t)y * width * 4, (size_t)width * 4 * sizeof(uint16_t));
+	}
+	fill_image_padding_area(input_image);
+	return input_image;
+}
+
+bool astcenc_encode_rows_hdr_half(const astcenc_encoder *enc, uint8_t *dst, const uint16_t *src, int width, int height, int min_block_y, int max_block_y)
+{
+	int min_y, max_y;
+	get_row_range(enc, height, min_block_y, max_block_y, &min_y, &max_y);
+
+	int padding = get_image_padding(&enc->ewp);
+	astc_codec_image *input_image = img_from_halfx4_array(src + (size_t)min_y * width * 4, width, max_y - min_y, padding);
+	if (!input_image) return false;
+
+	size_t blocks_x = (size_t)((width + enc->opts.block_width - 1) / enc->opts.block_width);
+	encode_image(enc, dst + (size_t)min_block_y * blocks_x * 16, input_image, 1, NULL, NULL);
+	return true;
+}
+
+bool astcenc_encode_image(const astcenc_opts *opts, uint8_t *dst, const uint8_t *src, int width, int height)
+{
+	astcenc_encoder *enc = astcenc_encoder_create(opts, false);
+
+	astc_codec_image *input_image = astc_img_from_unorm8x4_array(src, width, height, get_image_padding(&enc->ewp), 0);
+	if (!input_image) {
+		astcenc_encoder_free(enc);
+		return false;
+	}
+
+	encode_image(enc, dst, input_image, opts->num_threads, opts->progress_fn, opts->progress_user);
+	astcenc_encoder_free(enc);
+	return true;
+}
+
+bool astcenc_encode_image_hdr(const astcenc_opts *opts, uint8_t *dst, const float *src, int width, int height)
+{
+	astcenc_encoder *enc = astcenc_encoder_create(opts, true);
+
+	astc_codec_image *input_image = astc_img_from_floatx4_array(src, width, height, get_image_padding(&enc->ewp), 0);
+	if (!input_image) {
+		astcenc_encoder_free(enc);
+		return false;
+	}
+
+	encode_image(enc, dst, input_image, opts->num_threads, opts->progress_fn, opts->progress_user);
+	astcenc_encoder_free(enc);
+	return true;
+}
+
+bool astcenc_encode_image_hdr_half(const astcenc_opts *opts, uint8_t *dst, const uint16_t *src, int width, int height)
+{
+	astcenc_encoder *enc = astcenc_encoder_create(opts, true);
+
+	astc_codec_image *input_image = img_from_halfx4_array(src, width, height, get_image_padding(&enc->ewp));
+	if (!input_image) {
+		astcenc_encoder_free(enc);
+		return false;
+	}
 
+	encode_image(enc, dst, input_image, opts->num_threads, opts->progress_fn, opts->progress_user);
+	astcenc_encoder_free(enc);
 	return true;
 }
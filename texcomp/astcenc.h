@@ -36,7 +36,26 @@ typedef struct astcenc_opts {
 	astcenc_swizzle swizzle[4];
 	float rgba_weights[4];
 	bool normal_map;
+	bool hdr_alpha;
 } astcenc_opts;
 
 void astcenc_init();
+
+// Encoder search parameters for compression levels 1-20
+astcenc_quality astcenc_quality_for_level(int level);
 bool astcenc_encode_image(const astcenc_opts *opts, uint8_t *dst, const uint8_t *src, int width, int height);
+
+// HDR variants: `src` is linear RGBA as 32-bit floats or IEEE half-floats.
+// Alpha is encoded as LDR unless `opts->hdr_alpha` is set.
+bool astcenc_encode_image_hdr(const astcenc_opts *opts, uint8_t *dst, const float *src, int width, int height);
+bool astcenc_encode_image_hdr_half(const astcenc_opts *opts, uint8_t *dst, const uint16_t *src, int width, int height);
+
+// Reusable encoder for images with the same options, `hdr` selects between the
+// LDR and HDR variants below. Different block rows of an image can be encoded
+// in parallel, `dst` always points to the first block of the whole image.
+typedef struct astcenc_encoder astcenc_encoder;
+
+astcenc_encoder *astcenc_encoder_create(const astcenc_opts *opts, bool hdr);
+void astcenc_encoder_free(astcenc_encoder *enc);
+bool astcenc_encode_rows(const astcenc_encoder *enc, uint8_t *dst, const uint8_t *src, int width, int height, int min_block_y, int max_block_y);
+bool astcenc_encode_rows_hdr_half(const astcenc_encoder *enc, uint8_t *dst, const uint16_t *src, int width, int height, int min_block_y, int max_block_y);
@@ -2,10 +2,97 @@
 
 #include <string.h>
 
-void premultiply_alpha(uint8_t *data, int width, int height)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define IMAGE_SSE2 1
+	#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+	#define IMAGE_AVX2 1
+	#include <immintrin.h>
+#endif
+
+// -- Row kernels
+// All kernels operate on `num` RGBA8 pixels in-place, channels are stored
+// in little-endian order in 32-bit words (R in the lowest byte).
+
+static void row_xor(uint8_t *data, int num, uint32_t mask)
+{
+	int i = 0;
+#if IMAGE_AVX2
+	__m256i mask8 = _mm256_set1_epi32((int)mask);
+	for (; i + 8 <= num; i += 8) {
+		__m256i *p = (__m256i*)(data + i * 4);
+		_mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), mask8));
+	}
+#endif
+#if IMAGE_SSE2
+	__m128i mask4 = _mm_set1_epi32((int)mask);
+	for (; i + 4 <= num; i += 4) {
+		__m128i *p = (__m128i*)(data + i * 4);
+		_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), mask4));
+	}
+#endif
+	for (; i < num; i++) {
+		uint32_t v;
+		memcpy(&v, data + i * 4, 4);
+		v ^= mask;
+		memcpy(data + i * 4, &v, 4);
+	}
+}
+
+// `x * a / 255` exactly for 16-bit products of 8-bit values
+#define DIV255_EPI16(pre, v) pre##_srli_epi16(pre##_add_epi16(pre##_add_epi16((v), pre##_srli_epi16((v), 8)), one), 8)
+
+static void row_premultiply(uint8_t *data, int num)
 {
-	size_t num_pixels = (size_t)width * (size_t)height;
-	for (uint8_t *p = data, *e = p + num_pixels*4; p != e; p += 4) {
+	int i = 0;
+#if IMAGE_AVX2
+	{
+		__m256i zero = _mm256_setzero_si256();
+		__m256i one = _mm256_set1_epi16(1);
+		__m256i alpha_mask = _mm256_set1_epi32((int)0xff000000u);
+		for (; i + 8 <= num; i += 8) {
+			__m256i *p = (__m256i*)(data + i * 4);
+			__m256i v = _mm256_loadu_si256(p);
+			__m256i lo = _mm256_unpacklo_epi8(v, zero);
+			__m256i hi = _mm256_unpackhi_epi8(v, zero);
+			__m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, 0xff), 0xff);
+			__m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, 0xff), 0xff);
+			lo = _mm256_mullo_epi16(lo, alo);
+			hi = _mm256_mullo_epi16(hi, ahi);
+			lo = DIV255_EPI16(_mm256, lo);
+			hi = DIV255_EPI16(_mm256, hi);
+			__m256i r = _mm256_packus_epi16(lo, hi);
+			r = _mm256_or_si256(_mm256_andnot_si256(alpha_mask, r), _mm256_and_si256(alpha_mask, v));
+			_mm256_storeu_si256(p, r);
+		}
+	}
+#endif
+#if IMAGE_SSE2
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i one = _mm_set1_epi16(1);
+		__m128i alpha_mask = _mm_set1_epi32((int)0xff000000u);
+		for (; i + 4 <= num; i += 4) {
+			__m128i *p = (__m128i*)(data + i * 4);
+			__m128i v = _mm_loadu_si128(p);
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+			__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+			lo = _mm_mullo_epi16(lo, alo);
+			hi = _mm_mullo_epi16(hi, ahi);
+			lo = DIV255_EPI16(_mm, lo);
+			hi = DIV255_EPI16(_mm, hi);
+			__m128i r = _mm_packus_epi16(lo, hi);
+			r = _mm_or_si128(_mm_andnot_si128(alpha_mask, r), _mm_and_si128(alpha_mask, v));
+			_mm_storeu_si128(p, r);
+		}
+	}
+#endif
+	for (; i < num; i++) {
+		uint8_t *p = data + i * 4;
 		unsigned a = p[3];
 		p[0] = (uint8_t)((unsigned)p[0] * a / 255);
 		p[1] = (uint8_t)((unsigned)p[1] * a / 255);
@@ -13,160 +100,341 @@ void premultiply_alpha(uint8_t *data, int width, int height)
 	}
 }
 
-void invert_channel(uint8_t *data, int width, int height)
+#undef DIV255_EPI16
+
+static void row_insert_channel(uint8_t *data, int num, const uint8_t *chan_data, int chan)
 {
-	size_t num_pixels = (size_t)width * (size_t)height;
-	for (uint8_t *p = data, *e = p + num_pixels*4; p != e; p += 4) {
-		p[0] = 255 - p[0];
+	int i = 0;
+#if IMAGE_AVX2
+	{
+		__m256i mask = _mm256_set1_epi32((int)(0xffu << (chan * 8)));
+		__m128i shift = _mm_cvtsi32_si128(chan * 8);
+		for (; i + 8 <= num; i += 8) {
+			__m256i *p = (__m256i*)(data + i * 4);
+			__m256i c = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(chan_data + i)));
+			c = _mm256_sll_epi32(c, shift);
+			_mm256_storeu_si256(p, _mm256_or_si256(_mm256_andnot_si256(mask, _mm256_loadu_si256(p)), c));
+		}
+	}
+#endif
+#if IMAGE_SSE2
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i mask = _mm_set1_epi32((int)(0xffu << (chan * 8)));
+		__m128i shift = _mm_cvtsi32_si128(chan * 8);
+		for (; i + 4 <= num; i += 4) {
+			__m128i *p = (__m128i*)(data + i * 4);
+			int32_t c4;
+			memcpy(&c4, chan_data + i, 4);
+			__m128i c = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(c4), zero), zero);
+			c = _mm_sll_epi32(c, shift);
+			_mm_storeu_si128(p, _mm_or_si128(_mm_andnot_si128(mask, _mm_loadu_si128(p)), c));
+		}
+	}
+#endif
+	for (; i < num; i++) {
+		data[i * 4 + chan] = chan_data[i];
 	}
 }
 
-void move_x(uint8_t *data, int width, int height, int amount)
+static void row_swizzle_rg_to_ga(uint8_t *data, int num)
 {
-	for (int y = 0; y < height; y++) {
-		uint8_t *p = data + y * width * 4;
-		for (int ix = 0; ix < width; ix++) {
-			int x = ix;
-			if (amount < 0) x = width - x - 1;
-
-			int dx = x + amount;
-			if (dx < 0) dx = 0;
-			if (dx >= width - 1) dx = width - 1;
-			p[x*4 + 0] = p[dx*4 + 0];
-			p[x*4 + 1] = p[dx*4 + 1];
-			p[x*4 + 2] = p[dx*4 + 2];
-			p[x*4 + 3] = p[dx*4 + 3];
+	int i = 0;
+#if IMAGE_AVX2
+	{
+		__m256i r_mask = _mm256_set1_epi32(0x000000ff);
+		__m256i g_mask = _mm256_set1_epi32(0x0000ff00);
+		for (; i + 8 <= num; i += 8) {
+			__m256i *p = (__m256i*)(data + i * 4);
+			__m256i v = _mm256_loadu_si256(p);
+			__m256i r = _mm256_slli_epi32(_mm256_and_si256(v, r_mask), 8);
+			__m256i g = _mm256_slli_epi32(_mm256_and_si256(v, g_mask), 16);
+			_mm256_storeu_si256(p, _mm256_or_si256(r, g));
+		}
+	}
+#endif
+#if IMAGE_SSE2
+	{
+		__m128i r_mask = _mm_set1_epi32(0x000000ff);
+		__m128i g_mask = _mm_set1_epi32(0x0000ff00);
+		for (; i + 4 <= num; i += 4) {
+			__m128i *p = (__m128i*)(data + i * 4);
+			__m128i v = _mm_loadu_si128(p);
+			__m128i r = _mm_slli_epi32(_mm_and_si128(v, r_mask), 8);
+			__m128i g = _mm_slli_epi32(_mm_and_si128(v, g_mask), 16);
+			_mm_storeu_si128(p, _mm_or_si128(r, g));
 		}
 	}
+#endif
+	for (; i < num; i++) {
+		uint8_t *p = data + i * 4;
+		p[3] = p[1];
+		p[1] = p[0];
+		p[0] = 0;
+		p[2] = 0;
+	}
 }
 
-void move_y(uint8_t *data, int width, int height, int amount)
+// Returns a bitmask of pixels with non-zero alpha in `data[0..4]`
+static unsigned alpha_mask_4(const uint8_t *data)
 {
-	for (int iy = 0; iy < height; iy++) {
-		int y = iy;
-		if (amount < 0) y = height - y - 1;
+#if IMAGE_SSE2
+	__m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)data), _mm_set1_epi32((int)0xff000000u));
+	__m128i z = _mm_cmpeq_epi32(v, _mm_setzero_si128());
+	return (unsigned)_mm_movemask_ps(_mm_castsi128_ps(z)) ^ 0xfu;
+#else
+	return (data[3] ? 1u : 0u) | (data[7] ? 2u : 0u) | (data[11] ? 4u : 0u) | (data[15] ? 8u : 0u);
+#endif
+}
 
-		int dy = y + amount;
-		if (dy < 0) dy = 0;
-		if (dy >= height - 1) dy = height - 1;
-		if (dy != y) {
-			uint8_t *p = data + y * width * 4;
-			uint8_t *dp = data + dy * width * 4;
-			memcpy(p, dp, width * 4);
-		}
+// Find the first pixel with non-zero alpha in `[begin, end)`, returns `end` if none
+static int find_alpha_forward(const uint8_t *row, int begin, int end)
+{
+	int x = begin;
+	for (; x + 4 <= end; x += 4) {
+		if (alpha_mask_4(row + x * 4)) break;
 	}
+	for (; x < end; x++) {
+		if (row[x * 4 + 3] != 0) return x;
+	}
+	return end;
 }
 
-void swizzle_rg_to_ga(uint8_t *data, int width, int height)
+// Find the last pixel with non-zero alpha in `[begin, end)`, returns `begin - 1` if none
+static int find_alpha_backward(const uint8_t *row, int begin, int end)
 {
-	size_t num_pixels = (size_t)width * (size_t)height;
-	for (uint8_t *p = data, *e = p + num_pixels*4; p != e; p += 4) {
-		p[3] = p[1];
-		p[1] = p[0];
-		p[0] = 0;
-		p[2] = 0;
+	int x = end;
+	for (; x - 4 >= begin; x -= 4) {
+		if (alpha_mask_4(row + (x - 4) * 4)) break;
 	}
+	for (x = x - 1; x >= begin; x--) {
+		if (row[x * 4 + 3] != 0) return x;
+	}
+	return begin - 1;
 }
 
-void insert_channel(uint8_t *data, const uint8_t *chan_data, int chan, int width, int height)
+// -- Op lists
+
+void image_ops_push(image_ops *ops, image_op_type type, int channel, const uint8_t *chan_data)
 {
-	size_t num_pixels = (size_t)width * (size_t)height;
-	const uint8_t *s = chan_data;
-	for (uint8_t *p = data, *e = p + num_pixels*4; p != e; p += 4) {
-		p[chan] = *s++;
+	if (ops->num_ops >= IMAGE_MAX_OPS) {
+		// Should never happen with the fixed set of options texcomp has
+		return;
 	}
+
+	image_op *op = &ops->ops[ops->num_ops++];
+	op->type = type;
+	op->channel = channel;
+	op->chan_data = chan_data;
 }
 
-crop_rect get_crop_rect(uint8_t *data, int width, int height)
+bool image_ops_empty(const image_ops *ops)
 {
-	crop_rect rect;
+	return ops->num_ops == 0 && ops->offset_x == 0 && ops->offset_y == 0 && !ops->has_rect;
+}
 
-	const uint8_t *alpha = data + 3;
-	int32_t x, y;
-	int32_t w = (int32_t)width;
-	int32_t h = (int32_t)height;
-	uint32_t stride = 4 * width;
-
-	for (y = 0; y < h; y++) {
-		const uint8_t *a = alpha + y * w * 4;
-		for (x = 0; x < w; x++) {
-			if (*a != 0) {
-				rect.min_y = (uint32_t)y;
-				y = h;
-				break;
-			}
-			a += 4;
-		}
+void image_ops_get_size(const image_ops *ops, int src_width, int src_height, int *p_width, int *p_height)
+{
+	if (ops->has_rect) {
+		*p_width = ops->rect.max_x - ops->rect.min_x;
+		*p_height = ops->rect.max_y - ops->rect.min_y;
+	} else {
+		*p_width = src_width;
+		*p_height = src_height;
 	}
+}
 
-	if (y == h) {
-		// Empty rectangle
-		rect.min_y = 0;
-		rect.min_x = 0;
-		rect.max_x = 1;
-		rect.max_y = 1;
-		rect.empty = true;
-		rect.cropped = true;
-		return rect;
+static int clamp_int(int v, int min, int max)
+{
+	if (v < min) return min;
+	if (v > max) return max;
+	return v;
+}
+
+void image_ops_apply_rows(const image_ops *ops, uint8_t *dst, const uint8_t *src, int src_width, int src_height, int min_y, int max_y)
+{
+	int width, height;
+	image_ops_get_size(ops, src_width, src_height, &width, &height);
+
+	int base_x = ops->offset_x, base_y = ops->offset_y;
+	if (ops->has_rect) {
+		base_x += ops->rect.min_x;
+		base_y += ops->rect.min_y;
 	}
 
-	rect.empty = false;
+	// Source pixels `[x0, x1)` are in bounds, the rest are clamped to the edges
+	int x0 = clamp_int(-base_x, 0, width);
+	int x1 = clamp_int(src_width - base_x, x0, width);
 
-	for (y = h - 1; y >= 0; y--) {
-		const uint8_t *a = alpha + y * w * 4;
-		for (x = 0; x < w; x++) {
-			if (*a != 0) {
-				rect.max_y = (uint32_t)(y + 1);
-				y = 0;
-				break;
-			}
-			a += 4;
+	for (int y = min_y; y < max_y; y++) {
+		uint8_t *d = dst + (size_t)y * (size_t)width * 4;
+		int sy = clamp_int(base_y + y, 0, src_height - 1);
+		const uint8_t *s = src + (size_t)sy * (size_t)src_width * 4;
+
+		for (int x = 0; x < x0; x++) {
+			memcpy(d + x * 4, s, 4);
+		}
+		memcpy(d + x0 * 4, s + (base_x + x0) * 4, (size_t)(x1 - x0) * 4);
+		for (int x = x1; x < width; x++) {
+			memcpy(d + x * 4, s + (src_width - 1) * 4, 4);
 		}
-	}
 
-	for (x = 0; x < w; x++) {
-		const uint8_t *a = alpha + x * 4;
-		for (y = 0; y < h; y++) {
-			if (*a != 0) {
-				rect.min_x = (uint32_t)x;
-				x = w;
+		// Apply all the operations while the row is still in cache
+		for (int i = 0; i < ops->num_ops; i++) {
+			const image_op *op = &ops->ops[i];
+			switch (op->type) {
+
+			case IMAGE_OP_INVERT: {
+				// Merge consecutive inversions to a single pass
+				uint32_t mask = 0xffu << (op->channel * 8);
+				while (i + 1 < ops->num_ops && ops->ops[i + 1].type == IMAGE_OP_INVERT) {
+					mask |= 0xffu << (ops->ops[++i].channel * 8);
+				}
+				row_xor(d, width, mask);
+			} break;
+
+			case IMAGE_OP_PREMULTIPLY:
+				row_premultiply(d, width);
+				break;
+
+			case IMAGE_OP_INSERT_CHANNEL:
+				row_insert_channel(d, width, op->chan_data + (size_t)y * (size_t)width, op->channel);
 				break;
+
+			case IMAGE_OP_SWIZZLE_RG_TO_GA:
+				row_swizzle_rg_to_ga(d, width);
+				break;
+
 			}
-			a += stride;
 		}
 	}
+}
 
-	for (x = w - 1; x >= 0; x--) {
-		const uint8_t *a = alpha + x * 4;
-		for (y = 0; y < h; y++) {
-			if (*a != 0) {
-				rect.max_x = (uint32_t)(x + 1);
-				x = 0;
-				break;
-			}
-			a += stride;
+// -- Crop rectangle
+
+crop_rect get_crop_rect_rows(const uint8_t *data, int width, int min_y, int max_y)
+{
+	crop_rect rect;
+	rect.min_x = width;
+	rect.max_x = 0;
+	rect.min_y = max_y;
+	rect.max_y = min_y;
+	rect.empty = true;
+	rect.cropped = false;
+
+	for (int y = min_y; y < max_y; y++) {
+		const uint8_t *row = data + (size_t)y * (size_t)width * 4;
+
+		// Only the parts outside of the current bounds can extend them
+		bool found = false;
+		int left = find_alpha_forward(row, 0, rect.min_x);
+		if (left < rect.min_x) {
+			rect.min_x = left;
+			found = true;
+		}
+
+		int right = find_alpha_backward(row, rect.max_x, width);
+		if (right >= rect.max_x) {
+			rect.max_x = right + 1;
+			found = true;
+		}
+
+		if (!found && rect.min_x < rect.max_x) {
+			found = find_alpha_forward(row, rect.min_x, rect.max_x) < rect.max_x;
+		}
+
+		if (found) {
+			if (y < rect.min_y) rect.min_y = y;
+			rect.max_y = y + 1;
+			rect.empty = false;
 		}
 	}
 
-	rect.cropped = (rect.min_x > 0 || rect.min_y > 0 || rect.max_x < width || rect.max_y < height); 
+	return rect;
+}
+
+crop_rect crop_rect_merge(crop_rect a, crop_rect b)
+{
+	if (a.empty) return b;
+	if (b.empty) return a;
 
+	crop_rect rect;
+	rect.min_x = a.min_x < b.min_x ? a.min_x : b.min_x;
+	rect.min_y = a.min_y < b.min_y ? a.min_y : b.min_y;
+	rect.max_x = a.max_x > b.max_x ? a.max_x : b.max_x;
+	rect.max_y = a.max_y > b.max_y ? a.max_y : b.max_y;
+	rect.empty = false;
+	rect.cropped = false;
 	return rect;
 }
 
-void apply_crop_rect(uint8_t *data, int *p_width, int *p_height, crop_rect rect)
+crop_rect crop_rect_finish(crop_rect rect, int width, int height)
 {
-	int width = *p_width, height = *p_height;
-	uint8_t *dst = data;
-	uint8_t *src = data + (size_t)width*(size_t)rect.min_y*4 + (size_t)rect.min_x*4;
-	size_t line_size = (size_t)(rect.max_x - rect.min_x) * 4;
-	size_t pitch = (size_t)width * 4;
-	uint8_t *dst_end = dst + line_size * (rect.max_y - rect.min_y);
-	while (dst != dst_end) {
-		memmove(dst, src, line_size);
-		dst += line_size;
-		src += pitch;
+	if (rect.empty) {
+		// Empty rectangle
+		rect.min_y = 0;
+		rect.min_x = 0;
+		rect.max_x = 1;
+		rect.max_y = 1;
+		rect.cropped = true;
+		return rect;
 	}
-	*p_width = rect.max_x - rect.min_x;
-	*p_height = rect.max_y - rect.min_y;
+
+	rect.cropped = (rect.min_x > 0 || rect.min_y > 0 || rect.max_x < width || rect.max_y < height);
+	return rect;
+}
+
+crop_rect get_crop_rect(const uint8_t *data, int width, int height)
+{
+	crop_rect rect = get_crop_rect_rows(data, width, 0, height);
+	return crop_rect_finish(rect, width, height);
 }
 
+uint16_t image_float_to_half(float v)
+{
+	uint32_t f;
+	memcpy(&f, &v, sizeof(f));
+	uint32_t sign = (f >> 16) & 0x8000;
+	f &= 0x7fffffff;
+
+	uint32_t h;
+	if (f >= 0x47800000) {
+		// Overflow to infinity, NaN stays quiet NaN
+		h = f > 0x7f800000 ? 0x7e00 : 0x7c00;
+	} else if (f < 0x38800000) {
+		// Denormal or zero: adding 0.5 aligns the mantissa so the FPU does the rounding
+		float d;
+		memcpy(&d, &f, sizeof(d));
+		d += 0.5f;
+		memcpy(&h, &d, sizeof(h));
+		h -= 0x3f000000;
+	} else {
+		uint32_t mant_odd = (f >> 13) & 1;
+		f += ((uint32_t)(15 - 127) << 23) + 0xfff + mant_odd;
+		h = f >> 13;
+	}
+	return (uint16_t)(h | sign);
+}
+
+float image_half_to_float(uint16_t v)
+{
+	uint32_t f = ((uint32_t)v & 0x7fff) << 13;
+	uint32_t exp = f & 0x0f800000;
+	f += (uint32_t)(127 - 15) << 23;
+
+	float r;
+	if (exp == 0x0f800000) {
+		// Infinity or NaN
+		f += (uint32_t)(128 - 16) << 23;
+		memcpy(&r, &f, sizeof(r));
+	} else if (exp == 0) {
+		// Denormal, renormalize with a float subtraction
+		f += 1 << 23;
+		memcpy(&r, &f, sizeof(r));
+		r -= 6.103515625e-05f;
+	} else {
+		memcpy(&r, &f, sizeof(r));
+	}
+	if (v & 0x8000) r = -r;
+	return r;
+}
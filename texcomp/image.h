@@ -3,13 +3,6 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-void premultiply_alpha(uint8_t *data, int width, int height);
-void invert_channel(uint8_t *data, int width, int height);
-void swizzle_rg_to_ga(uint8_t *data, int width, int height);
-void insert_channel(uint8_t *data, const uint8_t *chan_data, int chan, int width, int height);
-void move_x(uint8_t *data, int width, int height, int amount);
-void move_y(uint8_t *data, int width, int height, int amount);
-
 typedef struct crop_rect {
 	int min_x, min_y;
 	int max_x, max_y;
@@ -17,5 +10,45 @@ typedef struct crop_rect {
 	bool cropped;
 } crop_rect;
 
-crop_rect get_crop_rect(uint8_t *data, int width, int height);
-void apply_crop_rect(uint8_t *data, int *p_width, int *p_height, crop_rect rect);
+typedef enum image_op_type {
+	IMAGE_OP_INVERT,           // Invert `channel`
+	IMAGE_OP_PREMULTIPLY,      // Multiply RGB by alpha
+	IMAGE_OP_INSERT_CHANNEL,   // Replace `channel` with `chan_data`
+	IMAGE_OP_SWIZZLE_RG_TO_GA, // Move RG to GA, zero RB
+} image_op_type;
+
+typedef struct image_op {
+	image_op_type type;
+	int channel;
+	const uint8_t *chan_data; // One byte per destination pixel
+} image_op;
+
+#define IMAGE_MAX_OPS 16
+
+// List of per-pixel operations applied in order during a single pass.
+// Destination pixel (x, y) is fetched from source pixel
+// (rect.min_x + x + offset_x, rect.min_y + y + offset_y) with clamping.
+typedef struct image_ops {
+	image_op ops[IMAGE_MAX_OPS];
+	int num_ops;
+	int offset_x, offset_y;
+	crop_rect rect;
+	bool has_rect;
+} image_ops;
+
+void image_ops_push(image_ops *ops, image_op_type type, int channel, const uint8_t *chan_data);
+bool image_ops_empty(const image_ops *ops);
+void image_ops_get_size(const image_ops *ops, int src_width, int src_height, int *p_width, int *p_height);
+
+// Process destination rows `[min_y, max_y)`, `dst` and `src` may not overlap.
+void image_ops_apply_rows(const image_ops *ops, uint8_t *dst, const uint8_t *src, int src_width, int src_height, int min_y, int max_y);
+
+// Alpha bounds of rows `[min_y, max_y)`, merge partial results with `crop_rect_merge()`.
+crop_rect get_crop_rect_rows(const uint8_t *data, int width, int min_y, int max_y);
+crop_rect crop_rect_merge(crop_rect a, crop_rect b);
+crop_rect crop_rect_finish(crop_rect rect, int width, int height);
+crop_rect get_crop_rect(const uint8_t *data, int width, int height);
+
+// IEEE half-float conversion, rounds to nearest even and keeps infinities and NaNs
+uint16_t image_float_to_half(float v);
+float image_half_to_float(uint16_t v);
@@ -0,0 +1,649 @@
+#include "resample.h"
+#include "image.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define RESAMPLE_SSE2 1
+	#include <emmintrin.h>
+#endif
+
+// Destination rows per block, the horizontally filtered source rows of a
+// block should fit in L2 for typical texture sizes.
+#define RESAMPLE_BLOCK_ROWS 8
+
+// Maximum kernel width for the specialized 2:1 path
+#define RESAMPLE_MAX_HALF_TAPS 16
+
+// Same as `STBIR_ALPHA_EPSILON`, keeps color of transparent 8-bit pixels
+#define RESAMPLE_ALPHA_EPSILON ((float)1 / (1 << 20) / (1 << 20) / (1 << 20) / (1 << 20))
+
+// -- Vector helpers, one RGBA pixel per vector
+
+#if RESAMPLE_SSE2
+
+typedef __m128 v4;
+static inline v4 v4_zero() { return _mm_setzero_ps(); }
+static inline v4 v4_set1(float v) { return _mm_set1_ps(v); }
+static inline v4 v4_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void v4_store(float *p, v4 v) { _mm_storeu_ps(p, v); }
+static inline v4 v4_mad(v4 acc, v4 a, v4 b) { return _mm_add_ps(acc, _mm_mul_ps(a, b)); }
+
+#else
+
+typedef struct v4 { float v[4]; } v4;
+static inline v4 v4_zero() { v4 r = { { 0.0f, 0.0f, 0.0f, 0.0f } }; return r; }
+static inline v4 v4_set1(float v) { v4 r = { { v, v, v, v } }; return r; }
+static inline v4 v4_load(const float *p) { v4 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+static inline void v4_store(float *p, v4 v) { memcpy(p, v.v, sizeof(v.v)); }
+static inline v4 v4_mad(v4 acc, v4 a, v4 b) {
+	for (int i = 0; i < 4; i++) acc.v[i] += a.v[i] * b.v[i];
+	return acc;
+}
+
+#endif
+
+// -- Filters, definitions match stb_image_resize
+
+static float filter_box(float x, float scale)
+{
+	// Trapezoid to antialias non-integer ratios
+	float t = 0.5f + scale * 0.5f;
+	x = fabsf(x);
+	if (x >= t) return 0.0f;
+	float r = 0.5f - scale * 0.5f;
+	if (x <= r) return 1.0f;
+	return (t - x) / scale;
+}
+
+static float filter_triangle(float x, float scale)
+{
+	x = fabsf(x);
+	return x <= 1.0f ? 1.0f - x : 0.0f;
+}
+
+static float filter_cubic_bspline(float x, float scale)
+{
+	x = fabsf(x);
+	if (x < 1.0f) return (4 + x*x*(3*x - 6))/6;
+	if (x < 2.0f) return (8 + x*(-12 + x*(6 - x)))/6;
+	return 0.0f;
+}
+
+static float filter_catmull_rom(float x, float scale)
+{
+	x = fabsf(x);
+	if (x < 1.0f) return 1 - x*x*(2.5f - 1.5f*x);
+	if (x < 2.0f) return 2 - x*(4 + x*(0.5f*x - 2.5f));
+	return 0.0f;
+}
+
+static float filter_mitchell(float x, float scale)
+{
+	x = fabsf(x);
+	if (x < 1.0f) return (16 + x*x*(21 * x - 36))/18;
+	if (x < 2.0f) return (32 + x*(-60 + x*(36 - 7*x)))/18;
+	return 0.0f;
+}
+
+typedef float (*filter_fn)(float x, float scale);
+
+static const struct {
+	filter_fn fn;
+	float support;
+} filter_infos[] = {
+	{ NULL, 0.0f },
+	{ &filter_box, 0.5f },
+	{ &filter_triangle, 1.0f },
+	{ &filter_cubic_bspline, 2.0f },
+	{ &filter_catmull_rom, 2.0f },
+	{ &filter_mitchell, 2.0f },
+};
+
+static int edge_index(resample_edge edge, int n, int max)
+{
+	if (n >= 0 && n < max) return n;
+
+	switch (edge) {
+
+	case RESAMPLE_EDGE_CLAMP:
+	case RESAMPLE_EDGE_ZERO:
+		return n < 0 ? 0 : max - 1;
+
+	case RESAMPLE_EDGE_REFLECT:
+		if (n < 0) return -n < max ? -n : max - 1;
+		return n < max * 2 ? max * 2 - n - 1 : 0;
+
+	case RESAMPLE_EDGE_WRAP: {
+		int m = n % max;
+		return m < 0 ? m + max : m;
+	}
+
+	}
+
+	return 0;
+}
+
+// -- Kernels
+
+typedef struct resample_kernel {
+	int num_taps;
+	int *indices;   // [dst_size * num_taps] Edge-resolved source indices
+	float *weights; // [dst_size * num_taps]
+
+	// 2:1 reduction: destination pixels `i` in `[half_begin, half_end)` use
+	// `half_weights` for source pixels starting from `2*i + half_offset`
+	bool half;
+	float half_weights[RESAMPLE_MAX_HALF_TAPS];
+	int half_offset;
+	int half_begin, half_end;
+} resample_kernel;
+
+static bool kernel_init(resample_kernel *k, resample_filter filter, resample_edge edge, int dst_size, int src_size)
+{
+	memset(k, 0, sizeof(resample_kernel));
+
+	float scale = (float)dst_size / (float)src_size;
+	bool upsample = scale > 1.0f;
+	if (filter == RESAMPLE_FILTER_DEFAULT) {
+		filter = upsample ? RESAMPLE_FILTER_CATMULL_ROM : RESAMPLE_FILTER_MITCHELL;
+	}
+
+	filter_fn fn = filter_infos[filter].fn;
+	float filter_scale = upsample ? 1.0f / scale : scale;
+	float support = filter_infos[filter].support;
+	if (filter == RESAMPLE_FILTER_BOX) support = 0.5f + filter_scale * 0.5f;
+	float radius = upsample ? support : support / scale;
+
+	int max_taps = (int)ceilf(radius * 2.0f) + 2;
+	int *first = (int*)malloc(sizeof(int) * dst_size);
+	int *counts = (int*)malloc(sizeof(int) * dst_size);
+	float *raw = (float*)malloc(sizeof(float) * dst_size * max_taps);
+	if (!first || !counts || !raw) {
+		free(first);
+		free(counts);
+		free(raw);
+		return false;
+	}
+
+	// Evaluate and normalize the weights, dropping zero taps at the ends
+	k->num_taps = 1;
+	for (int i = 0; i < dst_size; i++) {
+		float center = ((float)i + 0.5f) / scale;
+		int j0 = (int)floorf(center - radius);
+		float *w = raw + i * max_taps;
+
+		int begin = -1, end = 0;
+		float total = 0.0f;
+		for (int t = 0; t < max_taps; t++) {
+			float x = (float)(j0 + t) + 0.5f - center;
+			float v = upsample ? fn(x, filter_scale) : fn(x * scale, filter_scale) * scale;
+			w[t] = v;
+			total += v;
+			if (v != 0.0f) {
+				if (begin < 0) begin = t;
+				end = t + 1;
+			}
+		}
+		if (begin < 0) begin = end = 0;
+
+		if (total != 0.0f) {
+			for (int t = begin; t < end; t++) w[t] /= total;
+		}
+
+		first[i] = j0 + begin;
+		counts[i] = end - begin;
+		memmove(w, w + begin, sizeof(float) * (end - begin));
+		if (counts[i] > k->num_taps) k->num_taps = counts[i];
+	}
+
+	int num_taps = k->num_taps;
+	k->indices = (int*)malloc(sizeof(int) * dst_size * num_taps);
+	k->weights = (float*)malloc(sizeof(float) * dst_size * num_taps);
+	if (!k->indices || !k->weights) {
+		free(first);
+		free(counts);
+		free(raw);
+		return false;
+	}
+
+	for (int i = 0; i < dst_size; i++) {
+		const float *w = raw + i * max_taps;
+		int *dst_ix = k->indices + i * num_taps;
+		float *dst_w = k->weights + i * num_taps;
+		for (int t = 0; t < num_taps; t++) {
+			int n = first[i] + t;
+			if (t < counts[i]) {
+				dst_ix[t] = edge_index(edge, n, src_size);
+				dst_w[t] = w[t];
+				if (edge == RESAMPLE_EDGE_ZERO && (n < 0 || n >= src_size)) dst_w[t] = 0.0f;
+			} else {
+				dst_ix[t] = dst_ix[0];
+				dst_w[t] = 0.0f;
+			}
+		}
+	}
+
+	// Detect 2:1 reduction where all the pixels share the same weights
+	if (src_size == dst_size * 2 && num_taps <= RESAMPLE_MAX_HALF_TAPS) {
+		int mid = dst_size / 2;
+		k->half = true;
+		k->half_offset = first[mid] - 2 * mid;
+		memcpy(k->half_weights, raw + mid * max_taps, sizeof(float) * counts[mid]);
+
+		// Interior pixels whose taps are all in bounds
+		int begin = 0, end = dst_size;
+		while (begin < dst_size && 2 * begin + k->half_offset < 0) begin++;
+		while (end > begin && 2 * (end - 1) + k->half_offset + num_taps > src_size) end--;
+		k->half_begin = begin;
+		k->half_end = end;
+	}
+
+	free(first);
+	free(counts);
+	free(raw);
+	return true;
+}
+
+static void kernel_free(resample_kernel *k)
+{
+	free(k->indices);
+	free(k->weights);
+}
+
+// -- Color conversion
+
+static float g_srgb_to_linear[256];
+static float g_srgb_thresholds[255];
+
+// Buckets of floats in [2^-13, 1) by exponent and top 4 bits of mantissa
+#define SRGB_BUCKET_SHIFT 19
+#define SRGB_BUCKET_MIN (114u << 4) // (127 - 13) << (23 - SRGB_BUCKET_SHIFT)
+#define SRGB_NUM_BUCKETS (13 * 16)
+static uint8_t g_srgb_bucket_start[SRGB_NUM_BUCKETS];
+static bool g_color_tables_init;
+
+static double srgb_to_linear(double v)
+{
+	return v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+}
+
+static uint32_t float_bits(float f)
+{
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+static uint8_t linear_to_srgb8(float v)
+{
+	if (!(v > 0.0f)) return 0;
+	if (v >= 1.0f) return 255;
+
+	// Start from the first code of the bucket and step to the rounded
+	// sRGB value using the exact decision thresholds
+	uint32_t bucket = (float_bits(v) >> SRGB_BUCKET_SHIFT);
+	unsigned code = 0;
+	if (bucket >= SRGB_BUCKET_MIN) code = g_srgb_bucket_start[bucket - SRGB_BUCKET_MIN];
+	while (code < 255 && v >= g_srgb_thresholds[code]) code++;
+	return (uint8_t)code;
+}
+
+static void init_color_tables()
+{
+	if (g_color_tables_init) return;
+
+	for (int i = 0; i < 256; i++) {
+		g_srgb_to_linear[i] = (float)srgb_to_linear((double)i / 255.0);
+	}
+	for (int i = 0; i < 255; i++) {
+		g_srgb_thresholds[i] = (float)srgb_to_linear(((double)i + 0.5) / 255.0);
+	}
+
+	for (uint32_t i = 0; i < SRGB_NUM_BUCKETS; i++) {
+		uint32_t bits = (SRGB_BUCKET_MIN + i) << SRGB_BUCKET_SHIFT;
+		float v;
+		memcpy(&v, &bits, sizeof(v));
+		unsigned code = 0;
+		while (code < 255 && v >= g_srgb_thresholds[code]) code++;
+		g_srgb_bucket_start[i] = (uint8_t)code;
+	}
+
+	g_color_tables_init = true;
+}
+
+// Convert a source row to the working format
+static void decode_row(const resample_opts *opts, float *dst, const resample_image *src, int y)
+{
+	int width = src->width;
+	bool weight_alpha = !opts->premultiplied;
+
+	if (src->format == RESAMPLE_FORMAT_RGBA8) {
+		const uint8_t *s = (const uint8_t*)src->data + (size_t)y * (size_t)width * 4;
+		const float *lut = g_srgb_to_linear;
+		const float rcp = 1.0f / 255.0f;
+		for (int x = 0; x < width; x++) {
+			float r, g, b;
+			if (opts->linear) {
+				r = (float)s[0] * rcp;
+				g = (float)s[1] * rcp;
+				b = (float)s[2] * rcp;
+			} else {
+				r = lut[s[0]];
+				g = lut[s[1]];
+				b = lut[s[2]];
+			}
+			float a = (float)s[3] * rcp;
+			if (weight_alpha) {
+				a += RESAMPLE_ALPHA_EPSILON;
+				r *= a;
+				g *= a;
+				b *= a;
+			}
+			dst[0] = r;
+			dst[1] = g;
+			dst[2] = b;
+			dst[3] = a;
+			dst += 4;
+			s += 4;
+		}
+	} else if (src->format == RESAMPLE_FORMAT_RGBA32F) {
+		const float *s = (const float*)src->data + (size_t)y * (size_t)width * 4;
+		if (weight_alpha) {
+			for (int x = 0; x < width; x++) {
+				float a = s[3];
+				dst[0] = s[0] * a;
+				dst[1] = s[1] * a;
+				dst[2] = s[2] * a;
+				dst[3] = a;
+				dst += 4;
+				s += 4;
+			}
+		} else {
+			memcpy(dst, s, sizeof(float) * 4 * width);
+		}
+	} else if (src->format == RESAMPLE_FORMAT_RGBA16F) {
+		const uint16_t *s = (const uint16_t*)src->data + (size_t)y * (size_t)width * 4;
+		for (int x = 0; x < width; x++) {
+			float a = image_half_to_float(s[3]);
+			float scale = weight_alpha ? a : 1.0f;
+			dst[0] = image_half_to_float(s[0]) * scale;
+			dst[1] = image_half_to_float(s[1]) * scale;
+			dst[2] = image_half_to_float(s[2]) * scale;
+			dst[3] = a;
+			dst += 4;
+			s += 4;
+		}
+	}
+}
+
+// Convert a working format row to the destination
+static void encode_row(const resample_opts *opts, const resample_image *dst, int y, const float *src)
+{
+	int width = dst->width;
+	bool weight_alpha = !opts->premultiplied;
+
+	if (dst->format == RESAMPLE_FORMAT_WORK) {
+		float *d = (float*)dst->data + (size_t)y * (size_t)width * 4;
+		memcpy(d, src, sizeof(float) * 4 * width);
+	} else if (dst->format == RESAMPLE_FORMAT_RGBA32F) {
+		float *d = (float*)dst->data + (size_t)y * (size_t)width * 4;
+		for (int x = 0; x < width; x++) {
+			float a = src[3];
+			float rcp = 1.0f;
+			if (weight_alpha) rcp = a != 0.0f ? 1.0f / a : 0.0f;
+			d[0] = src[0] * rcp;
+			d[1] = src[1] * rcp;
+			d[2] = src[2] * rcp;
+			d[3] = a;
+			d += 4;
+			src += 4;
+		}
+	} else if (dst->format == RESAMPLE_FORMAT_RGBA16F) {
+		uint16_t *d = (uint16_t*)dst->data + (size_t)y * (size_t)width * 4;
+		for (int x = 0; x < width; x++) {
+			float a = src[3];
+			float rcp = 1.0f;
+			if (weight_alpha) rcp = a != 0.0f ? 1.0f / a : 0.0f;
+			d[0] = image_float_to_half(src[0] * rcp);
+			d[1] = image_float_to_half(src[1] * rcp);
+			d[2] = image_float_to_half(src[2] * rcp);
+			d[3] = image_float_to_half(a);
+			d += 4;
+			src += 4;
+		}
+	} else if (dst->format == RESAMPLE_FORMAT_RGBA8) {
+		uint8_t *d = (uint8_t*)dst->data + (size_t)y * (size_t)width * 4;
+		for (int x = 0; x < width; x++) {
+			float a = src[3];
+			float rcp = 1.0f;
+			if (weight_alpha) {
+				rcp = a != 0.0f ? 1.0f / a : 0.0f;
+				a -= RESAMPLE_ALPHA_EPSILON;
+			}
+			float r = src[0] * rcp, g = src[1] * rcp, b = src[2] * rcp;
+			if (opts->linear) {
+				d[0] = (uint8_t)(int)((r > 0.0f ? (r < 1.0f ? r : 1.0f) : 0.0f) * 255.0f + 0.5f);
+				d[1] = (uint8_t)(int)((g > 0.0f ? (g < 1.0f ? g : 1.0f) : 0.0f) * 255.0f + 0.5f);
+				d[2] = (uint8_t)(int)((b > 0.0f ? (b < 1.0f ? b : 1.0f) : 0.0f) * 255.0f + 0.5f);
+			} else {
+				d[0] = linear_to_srgb8(r);
+				d[1] = linear_to_srgb8(g);
+				d[2] = linear_to_srgb8(b);
+			}
+			d[3] = (uint8_t)(int)((a > 0.0f ? (a < 1.0f ? a : 1.0f) : 0.0f) * 255.0f + 0.5f);
+			d += 4;
+			src += 4;
+		}
+	}
+}
+
+// -- Filter passes
+
+static void filter_h_general(const resample_kernel *k, float *dst, const float *src, int begin, int end)
+{
+	int num_taps = k->num_taps;
+	for (int i = begin; i < end; i++) {
+		const int *ix = k->indices + i * num_taps;
+		const float *w = k->weights + i * num_taps;
+		v4 acc = v4_zero();
+		for (int t = 0; t < num_taps; t++) {
+			acc = v4_mad(acc, v4_set1(w[t]), v4_load(src + ix[t] * 4));
+		}
+		v4_store(dst + i * 4, acc);
+	}
+}
+
+static void filter_h(const resample_kernel *k, float *dst, const float *src, int dst_width)
+{
+	if (!k->half) {
+		filter_h_general(k, dst, src, 0, dst_width);
+		return;
+	}
+
+	filter_h_general(k, dst, src, 0, k->half_begin);
+	filter_h_general(k, dst, src, k->half_end, dst_width);
+
+	int num_taps = k->num_taps;
+	const float *s = src + (2 * k->half_begin + k->half_offset) * 4;
+	float *d = dst + k->half_begin * 4;
+	int num = k->half_end - k->half_begin;
+
+	if (num_taps == 2) {
+		// Box filter
+		v4 w0 = v4_set1(k->half_weights[0]), w1 = v4_set1(k->half_weights[1]);
+		for (int i = 0; i < num; i++) {
+			v4 acc = v4_zero();
+			acc = v4_mad(acc, w0, v4_load(s + 0));
+			acc = v4_mad(acc, w1, v4_load(s + 4));
+			v4_store(d, acc);
+			s += 8;
+			d += 4;
+		}
+	} else {
+		v4 w[RESAMPLE_MAX_HALF_TAPS];
+		for (int t = 0; t < num_taps; t++) w[t] = v4_set1(k->half_weights[t]);
+
+		for (int i = 0; i < num; i++) {
+			v4 acc = v4_zero();
+			for (int t = 0; t < num_taps; t++) {
+				acc = v4_mad(acc, w[t], v4_load(s + t * 4));
+			}
+			v4_store(d, acc);
+			s += 8;
+			d += 4;
+		}
+	}
+}
+
+static void filter_v(float *dst, const float *const *rows, const float *weights, int num_taps, int width)
+{
+	int num = width * 4;
+	int x = 0;
+	for (; x + 8 <= num; x += 8) {
+		v4 acc0 = v4_zero(), acc1 = v4_zero();
+		for (int t = 0; t < num_taps; t++) {
+			v4 w = v4_set1(weights[t]);
+			acc0 = v4_mad(acc0, w, v4_load(rows[t] + x));
+			acc1 = v4_mad(acc1, w, v4_load(rows[t] + x + 4));
+		}
+		v4_store(dst + x, acc0);
+		v4_store(dst + x + 4, acc1);
+	}
+	for (; x < num; x += 4) {
+		v4 acc = v4_zero();
+		for (int t = 0; t < num_taps; t++) {
+			acc = v4_mad(acc, v4_set1(weights[t]), v4_load(rows[t] + x));
+		}
+		v4_store(dst + x, acc);
+	}
+}
+
+// -- API
+
+struct resampler {
+	resample_opts opts;
+	int dst_width, dst_height;
+	int src_width, src_height;
+	resample_kernel kernel_h;
+	resample_kernel kernel_v;
+	int num_blocks;
+};
+
+resampler *resampler_create(const resample_opts *opts, int dst_width, int dst_height, int src_width, int src_height)
+{
+	if (dst_width <= 0 || dst_height <= 0 || src_width <= 0 || src_height <= 0) return NULL;
+
+	init_color_tables();
+
+	resampler *r = (resampler*)malloc(sizeof(resampler));
+	if (!r) return NULL;
+	memset(r, 0, sizeof(resampler));
+
+	r->opts = *opts;
+	r->dst_width = dst_width;
+	r->dst_height = dst_height;
+	r->src_width = src_width;
+	r->src_height = src_height;
+	r->num_blocks = (dst_height + RESAMPLE_BLOCK_ROWS - 1) / RESAMPLE_BLOCK_ROWS;
+
+	if (!kernel_init(&r->kernel_h, opts->filter, opts->edge_h, dst_width, src_width)
+		|| !kernel_init(&r->kernel_v, opts->filter, opts->edge_v, dst_height, src_height)) {
+		resampler_free(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+void resampler_free(resampler *r)
+{
+	if (!r) return;
+	kernel_free(&r->kernel_h);
+	kernel_free(&r->kernel_v);
+	free(r);
+}
+
+int resampler_num_blocks(const resampler *r)
+{
+	return r->num_blocks;
+}
+
+bool resampler_run_block(const resampler *r, int block, const resample_image *dsts, int num_dsts, const resample_image *src)
+{
+	const resample_kernel *kv = &r->kernel_v;
+	int num_taps = kv->num_taps;
+	int min_y = block * RESAMPLE_BLOCK_ROWS;
+	int max_y = min_y + RESAMPLE_BLOCK_ROWS < r->dst_height ? min_y + RESAMPLE_BLOCK_ROWS : r->dst_height;
+
+	// Gather the unique source rows used by this block
+	int max_rows = (max_y - min_y) * num_taps;
+	int *src_rows = (int*)malloc(sizeof(int) * max_rows);
+	int *tap_slots = (int*)malloc(sizeof(int) * max_rows);
+	if (!src_rows || !tap_slots) {
+		free(src_rows);
+		free(tap_slots);
+		return false;
+	}
+
+	int num_rows = 0;
+	for (int y = min_y; y < max_y; y++) {
+		for (int t = 0; t < num_taps; t++) {
+			int sy = kv->indices[y * num_taps + t];
+			int slot = num_rows - 1;
+			while (slot >= 0 && src_rows[slot] != sy) slot--;
+			if (slot < 0) {
+				slot = num_rows++;
+				src_rows[slot] = sy;
+			}
+			tap_slots[(y - min_y) * num_taps + t] = slot;
+		}
+	}
+
+	size_t row_floats = (size_t)r->dst_width * 4;
+	size_t decode_floats = src->format != RESAMPLE_FORMAT_WORK ? (size_t)r->src_width * 4 : 0;
+	float *temp = (float*)malloc(sizeof(float) * (row_floats * (num_rows + 1) + decode_floats));
+	const float **rows = (const float**)malloc(sizeof(float*) * num_taps);
+	if (!temp || !rows) {
+		free(src_rows);
+		free(tap_slots);
+		free(temp);
+		free(rows);
+		return false;
+	}
+
+	float *out_row = temp + row_floats * num_rows;
+	float *decoded = out_row + row_floats;
+
+	// Horizontal pass
+	for (int i = 0; i < num_rows; i++) {
+		const float *src_row;
+		if (src->format == RESAMPLE_FORMAT_WORK) {
+			src_row = (const float*)src->data + (size_t)src_rows[i] * (size_t)r->src_width * 4;
+		} else {
+			decode_row(&r->opts, decoded, src, src_rows[i]);
+			src_row = decoded;
+		}
+		filter_h(&r->kernel_h, temp + row_floats * i, src_row, r->dst_width);
+	}
+
+	// Vertical pass
+	for (int y = min_y; y < max_y; y++) {
+		for (int t = 0; t < num_taps; t++) {
+			rows[t] = temp + row_floats * tap_slots[(y - min_y) * num_taps + t];
+		}
+		filter_v(out_row, rows, kv->weights + y * num_taps, num_taps, r->dst_width);
+
+		for (int i = 0; i < num_dsts; i++) {
+			encode_row(&r->opts, &dsts[i], y, out_row);
+		}
+	}
+
+	free(src_rows);
+	free(tap_slots);
+	free(temp);
+	free(rows);
+	return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Values match `stbir_filter`
+typedef enum resample_filter {
+	RESAMPLE_FILTER_DEFAULT,
+	RESAMPLE_FILTER_BOX,
+	RESAMPLE_FILTER_TRIANGLE,
+	RESAMPLE_FILTER_CUBIC_BSPLINE,
+	RESAMPLE_FILTER_CATMULL_ROM,
+	RESAMPLE_FILTER_MITCHELL,
+} resample_filter;
+
+// Values match `stbir_edge`
+typedef enum resample_edge {
+	RESAMPLE_EDGE_CLAMP = 1,
+	RESAMPLE_EDGE_REFLECT,
+	RESAMPLE_EDGE_WRAP,
+	RESAMPLE_EDGE_ZERO,
+} resample_edge;
+
+typedef enum resample_format {
+	RESAMPLE_FORMAT_RGBA8,   // 8-bit RGBA, sRGB color unless `resample_opts.linear`
+	RESAMPLE_FORMAT_RGBA32F, // Linear 32-bit float RGBA
+	RESAMPLE_FORMAT_RGBA16F, // Linear IEEE half-float RGBA
+	RESAMPLE_FORMAT_WORK,    // Internal linear float RGBA with alpha applied, for chaining resamples
+} resample_format;
+
+typedef struct resample_opts {
+	resample_filter filter;
+	resample_edge edge_h, edge_v;
+	bool linear;        // RGBA8 color is linear instead of sRGB
+	bool premultiplied; // Input is premultiplied, don't weight color by alpha
+} resample_opts;
+
+typedef struct resample_image {
+	resample_format format;
+	void *data;
+	int width, height;
+} resample_image;
+
+typedef struct resampler resampler;
+
+resampler *resampler_create(const resample_opts *opts, int dst_width, int dst_height, int src_width, int src_height);
+void resampler_free(resampler *r);
+
+// Resampling is split into independent blocks of destination rows,
+// `resampler_run_block()` can be called for different blocks in parallel.
+// All `dsts` receive the same pixels in their own formats.
+int resampler_num_blocks(const resampler *r);
+bool resampler_run_block(const resampler *r, int block, const resample_image *dsts, int num_dsts, const resample_image *src);
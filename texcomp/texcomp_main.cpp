@@ -9,6 +9,7 @@
 #include "rgbcx.h"
 #include "astcenc.h"
 #include "image.h"
+#include "resample.h"
 #include "sp_tools_common.h"
 #include <string.h>
 #include <stdlib.h>
@@ -45,6 +46,8 @@ typedef enum format_enum {
 	FORMAT_BC7,
 	FORMAT_ASTC_4X4,
 	FORMAT_ASTC_8X8,
+	FORMAT_ASTC_4X4_HDR,
+	FORMAT_ASTC_8X8_HDR,
 
 	FORMAT_COUNT,
 	FORMAT_ERROR = 0x7fffffff,
@@ -71,6 +74,8 @@ const pixel_format format_list[] = {
 	{ "bc7 ", FORMAT_BC7, SP_FORMAT_BC7_UNORM, SP_FORMAT_BC7_SRGB, 4,4,16, "bc7", "RGB(+A) Direct3D Block Compression" },
 	{ "as44", FORMAT_ASTC_4X4, SP_FORMAT_ASTC4X4_UNORM, SP_FORMAT_ASTC4X4_SRGB, 4,4,16, "astc4x4", "RGB(+A) ASTC Compression (4x4 blocks)" },
 	{ "as88", FORMAT_ASTC_8X8, SP_FORMAT_ASTC8X8_UNORM, SP_FORMAT_ASTC8X8_SRGB, 8,8,16, "astc8x8", "RGB(+A) ASTC Compression (8x8 blocks)" },
+	{ "ah44", FORMAT_ASTC_4X4_HDR, SP_FORMAT_ASTC4X4_FLOAT, SP_FORMAT_ASTC4X4_FLOAT, 4,4,16, "astc4x4_hdr", "HDR RGB(+A) ASTC Compression (4x4 blocks)" },
+	{ "ah88", FORMAT_ASTC_8X8_HDR, SP_FORMAT_ASTC8X8_FLOAT, SP_FORMAT_ASTC8X8_FLOAT, 8,8,16, "astc8x8_hdr", "HDR RGB(+A) ASTC Compression (8x8 blocks)" },
 };
 
 typedef enum container_enum {
@@ -146,6 +151,29 @@ format_enum parse_format(const char *name)
 	return FORMAT_ERROR;
 }
 
+#define MAX_OUTPUTS 16
+
+// Parse a comma separated list of formats, eg. `bc7,astc4x4`
+int parse_format_list(format_enum *formats, int num_formats, const char *list)
+{
+	char name[64];
+	const char *p = list;
+	for (;;) {
+		const char *end = strchr(p, ',');
+		size_t len = end ? (size_t)(end - p) : strlen(p);
+		if (len >= sizeof(name)) failf("Unsupported format: %s", list);
+		memcpy(name, p, len);
+		name[len] = '\0';
+
+		if (num_formats >= MAX_OUTPUTS) failf("Too many formats, maximum is %d", MAX_OUTPUTS);
+		formats[num_formats++] = parse_format(name);
+
+		if (!end) break;
+		p = end + 1;
+	}
+	return num_formats;
+}
+
 container_enum parse_container(const char *name)
 {
 	for (size_t i = 0; i < array_size(format_list); i++) {
@@ -157,6 +185,24 @@ container_enum parse_container(const char *name)
 	return CONTAINER_ERROR;
 }
 
+// Find the rightmost matching extension
+container_enum guess_container(const char *output_file)
+{
+	container_enum container = CONTAINER_ERROR;
+	const char *best_pos = NULL;
+	for (size_t i = 0; i < array_size(container_list); i++) {
+		const char *ext = container_list[i].extension;
+		if (!ext) continue;
+		for (const char *pos = output_file; (pos = strstr(pos, ext)) != NULL; pos++) {
+			if (pos > best_pos) {
+				best_pos = pos;
+				container = (container_enum)i;
+			}
+		}
+	}
+	return container;
+}
+
 stbir_edge parse_edge(const char *name)
 {
 	for (size_t i = 1; i < array_size(edge_list); i++) {
@@ -179,17 +225,9 @@ stbir_filter parse_filter(const char *name)
 	return STBIR_FILTER_DEFAULT;
 }
 
-static void image_resize(resize_opts opts, uint8_t *dst, int dst_width, int dst_height, const uint8_t *src, int src_width, int src_height)
+static bool is_hdr_format(format_enum format)
 {
-	stbir_resize(
-		src, src_width, src_height, 0,
-		dst, dst_width, dst_height, 0,
-		STBIR_TYPE_UINT8, opts.channels, opts.alpha_channel, opts.flags,
-		opts.edge_h, opts.edge_v,
-		opts.filter, opts.filter,
-		opts.linear ? STBIR_COLORSPACE_LINEAR : STBIR_COLORSPACE_SRGB,
-		NULL);
-
+	return format == FORMAT_ASTC_4X4_HDR || format == FORMAT_ASTC_8X8_HDR;
 }
 
 typedef struct mip_data {
@@ -202,6 +240,51 @@ typedef struct mip_data {
 	int blocks_y;
 } mip_data;
 
+// Losslessly compressed mip data, shared by all the .sptex copies of a target
+typedef struct compressed_mip {
+	char *data;
+	size_t size;
+	size_t uncompressed_size;
+	sp_compression_type compression_type;
+} compressed_mip;
+
+// Tiles of `tile_blocks` surrounded by `border_blocks` on each side, see `sptex_page`
+typedef struct tile_layout {
+	int tile_blocks_x, tile_blocks_y;
+	int border_blocks_x, border_blocks_y;
+	int block_size;
+} tile_layout;
+
+// Preprocessed source pixels of a single mip level, shared by all output formats
+typedef struct mip_level {
+	uint8_t *pixels;
+	uint16_t *hdr_pixels; // RGBA16F
+	int width;
+	int height;
+} mip_level;
+
+typedef struct output_target {
+	format_enum format;
+	const char *output_file;
+	container_enum container;
+	int num_mips;
+	mip_data mips[32];
+	compressed_mip compressed[32];
+	int num_tail_mips;
+	compressed_mip tail;
+} output_target;
+
+// Range of block rows `[min_block_y, max_block_y)` of a single target mip
+typedef struct encode_job {
+	int target;
+	int mip;
+	int min_block_y;
+	int max_block_y;
+} encode_job;
+
+// Minimum number of blocks per ASTC job, each job allocates its own encoder buffers
+#define ASTC_JOB_MIN_BLOCKS 64
+
 static const uint32_t level_to_rgbcx[] = {
 	~0u,
 	0,1,2,3,4,5,6,7,8,9,10,
@@ -232,30 +315,6 @@ bc7enc_compress_block_params level_to_bc7_params[] = {
 	{ 64, {0,0,0,0}, 4, 0, 0, 1, 1, 1, }, // 20
 };
 
-astcenc_quality level_to_astcenc_quality[] = {
-	{ 0 }, // 0 (invalid)
-	{ 4, 1.0f, 0.5f, 30.0f, 50, 1 }, // 1
-	{ 5, 1.05f, 0.5f, 32.0f, 50, 1 }, // 2
-	{ 6, 1.1f, 0.5f, 34.0f, 55, 1 }, // 3
-	{ 7, 1.3f, 0.55f, 36.0f, 55, 1 }, // 4
-	{ 8, 1.1f, 0.55f, 38.0f, 60, 1 }, // 5
-	{ 9, 1.15f, 0.55f, 40.0f, 60, 1 }, // 6
-	{ 10, 1.15f, 0.55f, 42.0f, 65, 1 }, // 7
-	{ 15, 1.2f, 0.6f, 44.0f, 65, 2 }, // 8
-	{ 20, 1.2f, 0.65f, 56.0f, 75, 2 }, // 9
-	{ 25, 1.2f, 0.75f, 50.0f, 75, 2 }, // 10
-	{ 30, 1.3f, 0.85f, 55.0f, 80, 2 }, // 11
-	{ 45, 1.4f, 0.9f, 60.0f, 80, 2 }, // 12
-	{ 50, 1.5f, 0.9f, 65.0f, 85, 2 }, // 13
-	{ 60, 1.6f, 0.95f, 70.0f, 90, 4 }, // 14
-	{ 80, 2.0f, 0.96f, 80.0f, 95, 4 }, // 15
-	{ 100, 2.5f, 0.97f, 90.0f, 95, 4 }, // 16
-	{ 200, 3.0f, 0.97f, 100.0f, 90, 4 }, // 17
-	{ 300, 4.0f, 0.97f, 120.0f, 100, 4 }, // 18
-	{ 400, 5.0f, 0.98f, 140.0f, 100, 4 }, // 19
-	{ (1<<10), 1000.0f, 0.99f, 999.0f, 100, 4 }, // 20
-};
-
 static void fetch_4x4(uint8_t dst[4*4*4], const uint8_t *src, int width, int height, int block_x, int block_y)
 {
 	int x = block_x * 4, y = block_y * 4;
@@ -274,7 +333,8 @@ static void fetch_4x4(uint8_t dst[4*4*4], const uint8_t *src, int width, int hei
 			for (int col = 0; col < 4; col++) {
 				int si = x + col < width ? x + col : width - 1;
 				const uint8_t *s = line + si * 4;
-				d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = s[3];
+				uint8_t *p = d + col * 4;
+				p[0] = s[0]; p[1] = s[1]; p[2] = s[2]; p[3] = s[3];
 			}
 		}
 	}
@@ -324,6 +384,112 @@ static void parallel_for(int num_threads, int num, F f) {
 	}
 }
 
+static resample_opts get_resample_opts(const resize_opts &opts)
+{
+	resample_opts ro = { };
+	ro.filter = (resample_filter)opts.filter;
+	ro.edge_h = (resample_edge)opts.edge_h;
+	ro.edge_v = (resample_edge)opts.edge_v;
+	ro.linear = opts.linear;
+	ro.premultiplied = (opts.flags & STBIR_FLAG_ALPHA_PREMULTIPLIED) != 0;
+	return ro;
+}
+
+static void image_resample(const resize_opts &opts, const resample_image *dsts, int num_dsts, const resample_image *src, int num_threads)
+{
+	resample_opts ro = get_resample_opts(opts);
+	resampler *r = resampler_create(&ro, dsts[0].width, dsts[0].height, src->width, src->height);
+	if (!r) failf("Failed to allocate memory for resampling");
+
+	std::atomic_bool failed { false };
+	parallel_for(num_threads, resampler_num_blocks(r), [&](int block) {
+		if (!resampler_run_block(r, block, dsts, num_dsts, src)) {
+			failed.store(true, std::memory_order_relaxed);
+		}
+	});
+	if (failed.load()) failf("Failed to allocate memory for resampling");
+
+	resampler_free(r);
+}
+
+static void image_resize(resize_opts opts, uint8_t *dst, int dst_width, int dst_height, const uint8_t *src, int src_width, int src_height, int num_threads)
+{
+	if (opts.channels != 4) {
+		stbir_resize(
+			src, src_width, src_height, 0,
+			dst, dst_width, dst_height, 0,
+			STBIR_TYPE_UINT8, opts.channels, opts.alpha_channel, opts.flags,
+			opts.edge_h, opts.edge_v,
+			opts.filter, opts.filter,
+			opts.linear ? STBIR_COLORSPACE_LINEAR : STBIR_COLORSPACE_SRGB,
+			NULL);
+		return;
+	}
+
+	resample_image dst_image = { RESAMPLE_FORMAT_RGBA8, dst, dst_width, dst_height };
+	resample_image src_image = { RESAMPLE_FORMAT_RGBA8, (void*)src, src_width, src_height };
+	image_resample(opts, &dst_image, 1, &src_image, num_threads);
+}
+
+static void image_resize_half(resize_opts opts, uint16_t *dst, int dst_width, int dst_height, const uint16_t *src, int src_width, int src_height, int num_threads)
+{
+	resample_image dst_image = { RESAMPLE_FORMAT_RGBA16F, dst, dst_width, dst_height };
+	resample_image src_image = { RESAMPLE_FORMAT_RGBA16F, (void*)src, src_width, src_height };
+	image_resample(opts, &dst_image, 1, &src_image, num_threads);
+}
+
+// Rows per task in `apply_image_ops()`, small enough for a block of rows to stay in cache
+#define IMAGE_OPS_BLOCK_ROWS 16
+
+static void apply_image_ops(image_ops *ops, uint8_t **p_pixels, int *p_width, int *p_height, int num_threads)
+{
+	if (image_ops_empty(ops) || !*p_pixels) {
+		memset(ops, 0, sizeof(image_ops));
+		return;
+	}
+
+	int src_width = *p_width, src_height = *p_height;
+	int width, height;
+	image_ops_get_size(ops, src_width, src_height, &width, &height);
+
+	uint8_t *src = *p_pixels;
+	uint8_t *dst = (uint8_t*)malloc((size_t)width * (size_t)height * 4);
+	if (!dst) failf("Failed to allocate memory for image processing");
+
+	int num_blocks = (height + IMAGE_OPS_BLOCK_ROWS - 1) / IMAGE_OPS_BLOCK_ROWS;
+	parallel_for(num_threads, num_blocks, [&](int block) {
+		int min_y = block * IMAGE_OPS_BLOCK_ROWS;
+		int max_y = min_y + IMAGE_OPS_BLOCK_ROWS < height ? min_y + IMAGE_OPS_BLOCK_ROWS : height;
+		image_ops_apply_rows(ops, dst, src, src_width, src_height, min_y, max_y);
+	});
+
+	free(src);
+	*p_pixels = dst;
+	*p_width = width;
+	*p_height = height;
+	memset(ops, 0, sizeof(image_ops));
+}
+
+static crop_rect parallel_get_crop_rect(const uint8_t *pixels, int width, int height, int num_threads)
+{
+	int num_blocks = num_threads > 1 ? num_threads * 4 : 1;
+	if (num_blocks > height) num_blocks = height > 0 ? height : 1;
+
+	std::vector<crop_rect> rects;
+	rects.resize(num_blocks);
+	parallel_for(num_threads, num_blocks, [&](int block) {
+		int min_y = (int)((int64_t)height * block / num_blocks);
+		int max_y = (int)((int64_t)height * (block + 1) / num_blocks);
+		rects[block] = get_crop_rect_rows(pixels, width, min_y, max_y);
+	});
+
+	crop_rect rect = rects[0];
+	for (int i = 1; i < num_blocks; i++) {
+		rect = crop_rect_merge(rect, rects[i]);
+	}
+	return crop_rect_finish(rect, width, height);
+}
+
 static void write_data(FILE *f, const void *data, size_t size)
 {
 	size_t num = fwrite(data, 1, size, f);
@@ -340,6 +506,377 @@ static void write_mips(FILE *f, const mip_data *mips, int num_mips)
 	}
 }
 
+// Range of block rows `[min_block_y, max_block_y)` or a single tile of a mip
+// compressed independently
+typedef struct compress_job {
+	int mip;
+	int min_block_y, max_block_y;
+	int tile_x, tile_y;
+	size_t uncompressed_offset, uncompressed_size;
+	compressed_mip result;
+} compress_job;
+
+// Byte planes of the block endpoints to delta code for `SP_COMPRESSION_BLOCK_SPLIT`
+static sp_block_split get_block_split(const pixel_format &fmt)
+{
+	sp_block_split split = { };
+	split.block_size = (uint32_t)fmt.block_size;
+	switch (fmt.format) {
+	case FORMAT_RGBA8: split.delta_mask = 0xf; break;
+	case FORMAT_BC1: split.delta_mask = 0xf; break;
+	case FORMAT_BC3: split.delta_mask = 0xf03; break;
+	case FORMAT_BC4: split.delta_mask = 0x3; break;
+	case FORMAT_BC5: split.delta_mask = 0x303; break;
+	default: split.delta_mask = 0; break; // BC7 and ASTC endpoints are not byte aligned
+	}
+	return split;
+}
+
+// Compress with zstd, if `split` is given also try splitting the blocks into
+// byte planes with and without delta coding and keep the smallest
+static compressed_mip compress_data(const uint8_t *data, size_t size, int level, const sp_block_split *split, int num_workers)
+{
+	sp_compression_type compression_type = SP_COMPRESSION_ZSTD;
+	compressed_mip cm;
+	size_t bound = sp_get_compression_bound(split ? SP_COMPRESSION_BLOCK_SPLIT : compression_type, size);
+	cm.data = (char*)malloc(bound);
+	if (!cm.data) failf("Failed to allocate lossless compression buffer");
+
+	cm.size = sp_compress_buffer(compression_type, cm.data, bound, data, size, level, num_workers);
+	cm.uncompressed_size = size;
+	cm.compression_type = compression_type;
+
+	if (split) {
+		sp_block_split tries[2] = { *split, *split };
+		tries[1].delta_mask = 0;
+		int num_tries = split->delta_mask != 0 ? 2 : 1;
+
+		char *split_data = (char*)malloc(bound);
+		if (!split_data) failf("Failed to allocate lossless compression buffer");
+		for (int i = 0; i < num_tries; i++) {
+			size_t split_size = sp_compress_buffer_block_split(&tries[i], split_data, bound, data, size, level, num_workers);
+			if (split_size < cm.size) {
+				char *prev_data = cm.data;
+				cm.data = split_data;
+				split_data = prev_data;
+				cm.size = split_size;
+				cm.compression_type = SP_COMPRESSION_BLOCK_SPLIT;
+			}
+		}
+		free(split_data);
+	}
+
+	double no_compress_ratio = 1.05;
+	if ((double)size / (double)cm.size < no_compress_ratio) {
+		cm.compression_type = SP_COMPRESSION_NONE;
+		memcpy(cm.data, data, size);
+		cm.size = size;
+	}
+	return cm;
+}
+
+// Gather the blocks of a tile including the border, clamping to the edges of the mip
+static void gather_tile(uint8_t *dst, const mip_data *mip, const tile_layout *layout, int tile_x, int tile_y)
+{
+	int width = layout->tile_blocks_x + 2 * layout->border_blocks_x;
+	int height = layout->tile_blocks_y + 2 * layout->border_blocks_y;
+	int base_x = tile_x * layout->tile_blocks_x - layout->border_blocks_x;
+	int base_y = tile_y * layout->tile_blocks_y - layout->border_blocks_y;
+	size_t block_size = (size_t)layout->block_size;
+
+	for (int y = 0; y < height; y++) {
+		int src_y = base_y + y;
+		src_y = src_y < 0 ? 0 : src_y >= mip->blocks_y ? mip->blocks_y - 1 : src_y;
+		const uint8_t *src_row = mip->data + (size_t)src_y * (size_t)mip->blocks_x * block_size;
+		for (int x = 0; x < width; x++) {
+			int src_x = base_x + x;
+			src_x = src_x < 0 ? 0 : src_x >= mip->blocks_x ? mip->blocks_x - 1 : src_x;
+			memcpy(dst, src_row + (size_t)src_x * block_size, block_size);
+			dst += block_size;
+		}
+	}
+}
+
+// Mips with more than `chunk_rows` block rows are split into chunks of
+// `chunk_rows` rows that are compressed independently, see `spfile_chunk_table`.
+// If `tiles` is given every mip is split into tiles instead, one chunk per tile.
+static void compress_mips(compressed_mip *dst, const mip_data *mips, int num_mips, int level, int chunk_rows, const tile_layout *tiles,
+	const sp_block_split *split, int num_threads, bool verbose)
+{
+	size_t tile_size = 0;
+	if (tiles) {
+		tile_size = (size_t)(tiles->tile_blocks_x + 2 * tiles->border_blocks_x)
+			* (size_t)(tiles->tile_blocks_y + 2 * tiles->border_blocks_y) * (size_t)tiles->block_size;
+	}
+
+	std::vector<compress_job> jobs;
+	for (int i = 0; i < num_mips; i++) {
+		if (tiles) {
+			int tiles_x = (mips[i].blocks_x + tiles->tile_blocks_x - 1) / tiles->tile_blocks_x;
+			int tiles_y = (mips[i].blocks_y + tiles->tile_blocks_y - 1) / tiles->tile_blocks_y;
+			for (int y = 0; y < tiles_y; y++) {
+				for (int x = 0; x < tiles_x; x++) {
+					compress_job job = { };
+					job.mip = i;
+					job.tile_x = x;
+					job.tile_y = y;
+					job.uncompressed_offset = (size_t)(y * tiles_x + x) * tile_size;
+					job.uncompressed_size = tile_size;
+					jobs.push_back(job);
+				}
+			}
+			continue;
+		}
+
+		int rows = chunk_rows > 0 && mips[i].blocks_y > chunk_rows ? chunk_rows : mips[i].blocks_y;
+		size_t row_size = mips[i].data_size / (size_t)mips[i].blocks_y;
+		for (int y = 0; y < mips[i].blocks_y; y += rows) {
+			compress_job job = { };
+			job.mip = i;
+			job.min_block_y = y;
+			job.max_block_y = y + rows < mips[i].blocks_y ? y + rows : mips[i].blocks_y;
+			job.uncompressed_offset = row_size * job.min_block_y;
+			job.uncompressed_size = row_size * (job.max_block_y - job.min_block_y);
+			jobs.push_back(job);
+		}
+	}
+
+	// Jobs are compressed in parallel but a large mip can dominate the total
+	// time, so let zstd split each job using its share of the threads
+	size_t total_size = 0;
+	for (const compress_job &job : jobs) {
+		total_size += job.uncompressed_size;
+	}
+
+	parallel_for(num_threads, (int)jobs.size(), [&](int job_ix) {
+		compress_job &job = jobs[job_ix];
+		const mip_data *mip = &mips[job.mip];
+		int num_workers = total_size > 0 ? (int)((double)num_threads * (double)job.uncompressed_size / (double)total_size) : 1;
+		if (num_workers < 1) num_workers = 1;
+		if (tiles) {
+			uint8_t *tile = (uint8_t*)malloc(tile_size);
+			if (!tile) failf("Failed to allocate tile");
+			gather_tile(tile, mip, tiles, job.tile_x, job.tile_y);
+			job.result = compress_data(tile, tile_size, level, split, num_workers);
+			free(tile);
+		} else {
+			job.result = compress_data(mip->data + job.uncompressed_offset, job.uncompressed_size, level, split, num_workers);
+		}
+	});
+
+	size_t job_ix = 0;
+	for (int i = 0; i < num_mips; i++) {
+		size_t first_job = job_ix;
+		while (job_ix < jobs.size() && jobs[job_ix].mip == i) job_ix++;
+		size_t num_chunks = job_ix - first_job;
+
+		// Tiled mips are always chunked so every tile has a page
+		if (num_chunks == 1 && !tiles) {
+			dst[i] = jobs[first_job].result;
+			continue;
+		}
+
+		// Chunk table followed by 16-byte aligned chunk data
+		size_t size = sizeof(spfile_chunk_table) + sizeof(spfile_chunk) * num_chunks;
+		for (size_t c = 0; c < num_chunks; c++) {
+			size = (size + 15) & ~(size_t)15;
+			size += jobs[first_job + c].result.size;
+		}
+
+		compressed_mip *cm = &dst[i];
+		cm->data = (char*)calloc(size, 1);
+		if (!cm->data) failf("Failed to allocate lossless compression buffer");
+		cm->size = size;
+		cm->uncompressed_size = 0;
+		cm->compression_type = SP_COMPRESSION_CHUNKED;
+
+		spfile_chunk_table table = { };
+		table.num_chunks = (uint32_t)num_chunks;
+		table.rows_per_chunk = tiles ? 0 : (uint32_t)chunk_rows;
+		memcpy(cm->data, &table, sizeof(table));
+
+		size_t offset = sizeof(spfile_chunk_table) + sizeof(spfile_chunk) * num_chunks;
+		for (size_t c = 0; c < num_chunks; c++) {
+			const compress_job &job = jobs[first_job + c];
+			offset = (offset + 15) & ~(size_t)15;
+
+			spfile_chunk chunk = { };
+			chunk.compression_type = job.result.compression_type;
+			chunk.offset = (uint32_t)offset;
+			chunk.compressed_size = (uint32_t)job.result.size;
+			chunk.uncompressed_offset = (uint32_t)job.uncompressed_offset;
+			chunk.uncompressed_size = (uint32_t)job.uncompressed_size;
+			memcpy(cm->data + sizeof(spfile_chunk_table) + sizeof(spfile_chunk) * c, &chunk, sizeof(chunk));
+
+			memcpy(cm->data + offset, job.result.data, job.result.size);
+			offset += job.result.size;
+			cm->uncompressed_size += job.uncompressed_size;
+			free(job.result.data);
+		}
+	}
+
+	if (verbose) {
+		for (int i = 0; i < num_mips; i++) {
+			size_t compressed_size = dst[i].size;
+			size_t uncompressed_size = dst[i].uncompressed_size;
+			if (uncompressed_size > 1000) {
+				printf("Compressed mip %u from %.1fkB to %.1fkB, ratio %.2f\n",
+					i, (double)uncompressed_size / 1000.0, (double)compressed_size / 1000.0,
+					(double)uncompressed_size / (double)compressed_size);
+			} else {
+				printf("Compressed mip %d from %zub to %zub, ratio %.2f\n",
+					i, uncompressed_size, compressed_size,
+					(double)uncompressed_size / (double)compressed_size);
+			}
+		}
+	}
+}
+
+// Concatenate and compress the last `num_tail_mips` mips into a mip tail
+static compressed_mip compress_mip_tail(const mip_data *mips, int num_mips, int num_tail_mips, int level, const sp_block_split *split)
+{
+	const mip_data *tail = mips + (num_mips - num_tail_mips);
+	size_t size = 0;
+	for (int i = 0; i < num_tail_mips; i++) {
+		size += tail[i].data_size;
+	}
+
+	uint8_t *data = (uint8_t*)malloc(size);
+	if (!data) failf("Failed to allocate mip tail");
+	size_t offset = 0;
+	for (int i = 0; i < num_tail_mips; i++) {
+		memcpy(data + offset, tail[i].data, tail[i].data_size);
+		offset += tail[i].data_size;
+	}
+
+	compressed_mip cm = compress_data(data, size, level, split, 1);
+	free(data);
+	return cm;
+}
+
+// Write a .sptex file from pre-compressed mips, the last `num_tail_mips` are
+// stored in the pre-compressed `tail`. If `info->tile_width > 0` the mips are
+// tiled and a page table is written from their chunk tables. Optionally writes
+// an index of `num_drops` versions of the texture with top mips dropped.
+// Sections are streamed to `f` in aligned blocks if `write_block_size > 0`.
+static void write_sptex(FILE *f, const sptex_info *info, const mip_data *mips, const compressed_mip *cmips, int num_mips,
+	const compressed_mip *tail, int num_tail_mips, int num_drops, size_t write_block_size)
+{
+	int num_section_mips = num_mips - num_tail_mips;
+	bool tiled = info->tile_width > 0;
+
+	sptex_header header = { };
+	header.header.magic = SPFILE_HEADER_SPTEX;
+	header.header.version = tiled ? 3 : num_tail_mips > 0 ? 2 : 1;
+	header.header.header_info_size = sizeof(sptex_info);
+	header.header.num_sections = num_section_mips + (num_tail_mips > 0 ? 1 : 0) + (tiled ? 1 : 0) + (num_drops > 0 ? 1 : 0);
+	for (int i = 0; i < num_section_mips; i++) {
+		if (cmips[i].compression_type == SP_COMPRESSION_CHUNKED && header.header.version < 2) header.header.version = 2;
+	}
+	header.info = *info;
+	header.info.num_mips = num_mips;
+	header.info.num_tail_mips = num_tail_mips;
+
+	size_t tail_size = 0;
+	for (int i = 0; i < num_tail_mips; i++) {
+		header.info.tail_mip_offsets[i] = (uint32_t)tail_size;
+		tail_size += mips[num_section_mips + i].data_size;
+	}
+
+	// Sections in header order: mips, mip tail, pages, mip drops, data is
+	// streamed in the same order so the mips and tail are contiguous
+	spfile_writer writer;
+	spfile_writer_init(&writer, f, &header.header, write_block_size);
+
+	uint32_t mip_offsets[16];
+	for (int i = 0; i < num_section_mips; i++) {
+		spfile_section s_mip = { };
+		s_mip.magic = SPFILE_SECTION_MIP;
+		s_mip.index = i;
+		s_mip.compression_type = cmips[i].compression_type;
+		s_mip.uncompressed_size = (uint32_t)cmips[i].uncompressed_size;
+		s_mip.compressed_size = (uint32_t)cmips[i].size;
+		spfile_writer_add_section(&writer, i, &s_mip, cmips[i].data);
+		mip_offsets[i] = writer.sections[i].offset;
+	}
+
+	uint32_t section_ix = num_section_mips;
+	uint32_t tail_offset = 0;
+	if (num_tail_mips > 0) {
+		spfile_section s_mip_tail = { };
+		s_mip_tail.magic = SPFILE_SECTION_MIP_TAIL;
+		s_mip_tail.index = num_section_mips;
+		s_mip_tail.compression_type = tail->compression_type;
+		s_mip_tail.uncompressed_size = (uint32_t)tail_size;
+		s_mip_tail.compressed_size = (uint32_t)tail->size;
+		spfile_writer_add_section(&writer, section_ix, &s_mip_tail, tail->data);
+		tail_offset = writer.sections[section_ix++].offset;
+	}
+	uint64_t end_offset = writer.offset;
+
+	// Tiled mips have a chunk per page
+	if (tiled) {
+		std::vector<sptex_page> pages;
+		for (int i = 0; i < num_section_mips; i++) {
+			spfile_chunk_table table;
+			memcpy(&table, cmips[i].data, sizeof(spfile_chunk_table));
+			for (uint32_t c = 0; c < table.num_chunks; c++) {
+				spfile_chunk chunk;
+				memcpy(&chunk, cmips[i].data + sizeof(spfile_chunk_table) + sizeof(spfile_chunk) * c, sizeof(spfile_chunk));
+				sptex_page page;
+				page.compression_type = chunk.compression_type;
+				page.offset = mip_offsets[i] + chunk.offset;
+				page.compressed_size = chunk.compressed_size;
+				page.uncompressed_size = chunk.uncompressed_size;
+				pages.push_back(page);
+			}
+		}
+
+		size_t pages_size = sizeof(sptex_page) * pages.size();
+		spfile_section s_pages = { };
+		s_pages.magic = SPFILE_SECTION_PAGES;
+		s_pages.compression_type = SP_COMPRESSION_NONE;
+		s_pages.uncompressed_size = (uint32_t)pages_size;
+		s_pages.compressed_size = (uint32_t)pages_size;
+		spfile_writer_add_section(&writer, section_ix++, &s_pages, pages.data());
+	}
+
+	if (num_drops > 0) {
+		sptex_mip_drop drops[16];
+		for (int i = 0; i < num_drops; i++) {
+			sptex_mip_drop *drop = &drops[i];
+			uint32_t data_offset = i < num_section_mips ? mip_offsets[i] : tail_offset;
+			drop->width = (uint16_t)mips[i].width;
+			drop->height = (uint16_t)mips[i].height;
+			drop->uncropped_width = (uint16_t)(info->uncropped_width >> i);
+			drop->uncropped_height = (uint16_t)(info->uncropped_height >> i);
+			drop->num_mips = (uint32_t)(num_mips - i);
+			drop->data_offset = data_offset;
+			drop->data_size = (uint32_t)(end_offset - data_offset);
+		}
+
+		size_t drops_size = sizeof(sptex_mip_drop) * num_drops;
+		spfile_section s_mip_drops = { };
+		s_mip_drops.magic = SPFILE_SECTION_MIP_DROP;
+		s_mip_drops.compression_type = SP_COMPRESSION_NONE;
+		s_mip_drops.uncompressed_size = (uint32_t)drops_size;
+		s_mip_drops.compressed_size = (uint32_t)drops_size;
+		spfile_writer_add_section(&writer, section_ix++, &s_mip_drops, drops);
+	}
+
+	if (writer.offset < sizeof(sptex_header)) {
+		char zero_buf[sizeof(sptex_header)] = { };
+		spfile_writer_write(&writer, zero_buf, sizeof(sptex_header) - (size_t)writer.offset);
+	}
+
+	bool ok = spfile_writer_finish(&writer, &header.info);
+	spfile_writer_free(&writer);
+	if (!ok) {
+		fclose(f);
+		failf("Failed to write output data");
+	}
+}
+
 typedef struct {
 	const char *name;
 	char value[128];
@@ -431,23 +968,73 @@ typedef struct astc_header {
 	uint8_t depth[3];
 } astc_header;
 
+// Load the top level of a RGBA16F .dds file as-is, returns NULL if the file
+// is not a .dds file so it can be loaded with stb_image instead.
+static uint16_t *load_dds_rgba16f(const char *filename, int *p_width, int *p_height, bool flip_y)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f) return NULL;
+
+	dds_header header = { 0 };
+	size_t header_size = fread(&header, 1, sizeof(header), f);
+	if (header_size < 4 + 124 || memcmp(header.magic, "DDS ", 4) != 0) {
+		fclose(f);
+		return NULL;
+	}
+
+	// D3DFMT_A16B16G16R16F (113) and DXGI_FORMAT_R16G16B16A16_FLOAT (10) have the same layout
+	uint32_t fourcc = 0;
+	memcpy(&fourcc, header.pixelformat_fourcc, 4);
+	bool has_fourcc = (header.pixelformat_flags & 0x4) != 0;
+	bool dx10 = has_fourcc && !memcmp(header.pixelformat_fourcc, "DX10", 4);
+	if (dx10 && header_size < sizeof(header)) failf("Truncated .dds input file: %s", filename);
+	if (!has_fourcc || !(fourcc == 113 || (dx10 && header.dxgi_format == 10))) {
+		failf("Unsupported .dds input format, only RGBA16F is supported: %s", filename);
+	}
+	if (header.width == 0 || header.height == 0 || header.width > 65536 || header.height > 65536) {
+		failf("Bad .dds input resolution %ux%u: %s", header.width, header.height, filename);
+	}
+
+	int width = (int)header.width, height = (int)header.height;
+	size_t row_size = (size_t)width * 4 * sizeof(uint16_t);
+	uint16_t *pixels = (uint16_t*)malloc(row_size * (size_t)height);
+	if (!pixels) failf("Failed to allocate memory for input file: %s", filename);
+
+	fseek(f, dx10 ? (long)sizeof(header) : 4 + 124, SEEK_SET);
+	for (int y = 0; y < height; y++) {
+		int dst_y = flip_y ? height - 1 - y : y;
+		if (fread(pixels + (size_t)dst_y * width * 4, 1, row_size, f) != row_size) {
+			failf("Truncated .dds input file: %s", filename);
+		}
+	}
+	fclose(f);
+
+	*p_width = width;
+	*p_height = height;
+	return pixels;
+}
+
 int main(int argc, char **argv)
 {
 	int max_extent = -1;
 	int max_mips = -1;
 	const char *input_file = NULL;
 	const char *input_channel_file[4] = { NULL, NULL, NULL, NULL };
-	const char *output_file = NULL;
-	format_enum format = FORMAT_ERROR;
+	const char *output_files[MAX_OUTPUTS];
+	int num_output_files = 0;
+	format_enum formats[MAX_OUTPUTS];
+	int num_formats = 0;
 	bool verbose = false;
 	bool show_help = argc <= 1;
 	bool crop_alpha = false;
 	bool premultiply = false;
 	bool flip_y = false;
+	bool hdr_alpha = false;
 	bool output_ignores_alpha = false;
 	bool normal_map = false;
 	bool decorrelate_remap = false;
 	bool dds_d3d9 = false;
+	bool block_split = true;
 	int res_width = -1;
 	int res_height = -1;
 	int offset_x = 0;
@@ -455,9 +1042,14 @@ int main(int argc, char **argv)
 	int level = 10;
 	int num_threads = 1;
 	int mip_drop_copies = 0;
+	bool mip_drop_index = false;
+	int chunk_rows = 0;
+	int mip_tail_extent = 0;
+	int tile_size = 0;
+	int tile_border = 0;
+	size_t write_block_size = 0;
 	resize_opts res_opts = { STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT };
 	rgbcx::bc1_approx_mode bc1_approx = rgbcx::bc1_approx_mode::cBC1Ideal;
-	container_enum container = CONTAINER_ERROR;
 	bool invert_channels[4] = { };
 
 	res_opts.channels = 4;
@@ -492,6 +1084,12 @@ int main(int argc, char **argv)
 			res_opts.linear = true;
 		} else if (!strcmp(arg, "--decorrelate-remap")) {
 			decorrelate_remap = true;
+		} else if (!strcmp(arg, "--hdr-alpha")) {
+			hdr_alpha = true;
+		} else if (!strcmp(arg, "--mip-drop-index")) {
+			mip_drop_index = true;
+		} else if (!strcmp(arg, "--no-block-split")) {
+			block_split = false;
 		} else if (!strcmp(arg, "--dds-d3d9")) {
 			dds_d3d9 = true;
 		} else if (!strcmp(arg, "--invert-r")) {
@@ -520,9 +1118,10 @@ int main(int argc, char **argv)
 			} else if (!strcmp(arg, "--input-a")) {
 				input_channel_file[3] = argv[++argi];
 			} else if (!strcmp(arg, "-o") || !strcmp(arg, "--output")) {
-				output_file = argv[++argi];
+				if (num_output_files >= MAX_OUTPUTS) failf("Too many output files, maximum is %d", MAX_OUTPUTS);
+				output_files[num_output_files++] = argv[++argi];
 			} else if (!strcmp(arg, "-f") || !strcmp(arg, "--format")) {
-				format = parse_format(argv[++argi]);
+				num_formats = parse_format_list(formats, num_formats, argv[++argi]);
 			} else if (!strcmp(arg, "-l") || !strcmp(arg, "--level")) {
 				level = atoi(argv[++argi]);
 				if (level <= 0 || level > 20) {
@@ -553,6 +1152,22 @@ int main(int argc, char **argv)
 			} else if (!strcmp(arg, "-j") || !strcmp(arg, "--threads")) {
 				num_threads = atoi(argv[++argi]);
 				if (num_threads <= 0 || num_threads > 10000) failf("Bad number of threads: %d");
+			} else if (!strcmp(arg, "--mip-tail")) {
+				mip_tail_extent = atoi(argv[++argi]);
+				if (mip_tail_extent <= 1) failf("Bad mip tail extent: %d", mip_tail_extent);
+			} else if (!strcmp(arg, "--tile-size")) {
+				tile_size = atoi(argv[++argi]);
+				if (tile_size <= 0 || tile_size > 4096) failf("Bad tile size: %d", tile_size);
+			} else if (!strcmp(arg, "--tile-border")) {
+				tile_border = atoi(argv[++argi]);
+				if (tile_border < 0 || tile_border > 256) failf("Bad tile border: %d", tile_border);
+			} else if (!strcmp(arg, "--write-block-size")) {
+				int size = atoi(argv[++argi]);
+				if (size < 0) failf("Bad write block size: %d", size);
+				write_block_size = (size_t)size;
+			} else if (!strcmp(arg, "--chunk-rows")) {
+				chunk_rows = atoi(argv[++argi]);
+				if (chunk_rows <= 0) failf("Bad chunk rows: %d", chunk_rows);
 			} else if (!strcmp(arg, "--mip-drop-copies")) {
 				mip_drop_copies = atoi(argv[++argi]);
 				if (mip_drop_copies < 0 || mip_drop_copies > 128) failf("Bad mip drop copies: %d", mip_drop_copies);
@@ -563,9 +1178,11 @@ int main(int argc, char **argv)
 	if (show_help) {
 		printf("%s",
 			"Usage: sf-texcomp -i <input> -o <output> -f <format> [options]\n"
-			"    -i / --input <path>: Input filename in any format stb_image supports\n"
+			"    -i / --input <path>: Input filename in any format stb_image supports, HDR formats also accept RGBA16F .dds\n"
 			"    -o / --output <path>: Destination filename (use :pattern: to substitute variables (see below)\n"
+			"                          Can be repeated to give each format its own output\n"
 			"    -f / --format <format>: Compressed texture pixel format (see below)\n"
+			"                            Comma separated list or repeated to encode multiple formats\n"
 			"    -c / --container <type>: Output container format (detected from filename if absent, see below)\n"
 			"    -j / --threads <num>: Number of threads to use\n"
 			"    -v / --verbose: Verbose output\n"
@@ -591,8 +1208,19 @@ int main(int argc, char **argv)
 			"    --normal-map: Optimize the content as a tangent-space normal map in RG\n"
 			"    --decorrelate-remap: Remap RG to GA (other channels will be undefined)\n"
 			"                         This helps decorrelating the channels in BC3 and ASTC\n"
+			"    --hdr-alpha: Encode alpha as HDR too in HDR formats (default is LDR alpha)\n"
 			"    --dds-d3d9: Export Direct3D 9 compatible .dds files\n"
 			"    --mip-drop-copies <n>: Export copies with mips dropped up to <n> mips\n"
+			"    --mip-drop-index: Export a single .sptex with an index of the mip drops instead of copies\n"
+			"    --mip-tail <extent>: Pack .sptex mips smaller than <extent>x<extent> texels into a single\n"
+			"                         compressed mip tail section (sptex version 2)\n"
+			"    --chunk-rows <rows>: Split .sptex mips taller than <rows> block rows into independently\n"
+			"                         compressed chunks that can be decoded in parallel (sptex version 2)\n"
+			"    --tile-size <texels>: Split .sptex mips into <texels>x<texels> tiles that are compressed\n"
+			"                          independently and listed in a page table (sptex version 3)\n"
+			"    --tile-border <texels>: Texels of neighboring data to include on each side of a tile\n"
+			"    --no-block-split: Don't try splitting .sptex blocks into byte planes before lossless compression\n"
+			"    --write-block-size <bytes>: Write .sptex output unbuffered in aligned blocks of this size\n"
 		);
 
 		printf("Supported formats:\n");
@@ -614,6 +1242,7 @@ int main(int argc, char **argv)
 		var_info pattern_info[] = {
 			{ "width", "Width of the top-level mip" },
 			{ "height", "Height of the top-level mip" },
+			{ "format", "Name of the pixel format" },
 		};
 		printf("Supported patterns:\n");
 		for (size_t i = 0; i < array_size(pattern_info); i++) {
@@ -633,44 +1262,75 @@ int main(int argc, char **argv)
 	if (input_channel_file[3]) has_input = true;
 
 	if (!has_input) failf("Input file required: -i <input> or --input-(rgba) <input-channel>");
-	if (!output_file) failf("Output file required: -o <output>");
-	if (format == FORMAT_ERROR) failf("Format required: -f <format> (see --help for available formats)");
+	if (num_output_files == 0) failf("Output file required: -o <output>");
+	if (num_formats == 0) failf("Format required: -f <format> (see --help for available formats)");
+	if (num_output_files > 1 && num_output_files != num_formats) {
+		failf("Got %d output files for %d formats, use a single output with :format: or one per format",
+			num_output_files, num_formats);
+	}
+	if (num_output_files == 1 && num_formats > 1 && !strstr(output_files[0], ":format:")) {
+		failf("Output filename must contain :format: when encoding multiple formats");
+	}
 	if (max_extent == 0) failf("Maximum extent can't be zero, don't specify anything or use -1 to disable");
 	if (max_extent < 0) max_extent = -1;
 	if (max_mips == 0) failf("Maximum mipmap count can't be zero, don't specify anything or use -1 to disable");
 	if (max_mips < 0) max_mips = -1;
 	if (res_width == 0) failf("Output resolution width is zero");
 	if (res_height == 0) failf("Output resolution height is zero");
+	if (mip_drop_index && mip_drop_copies == 0) failf("--mip-drop-index requires --mip-drop-copies <n>");
+	if (tile_size > 0 && chunk_rows > 0) failf("--tile-size and --chunk-rows can't be used together");
+	if (tile_border > 0 && tile_size == 0) failf("--tile-border requires --tile-size <texels>");
 
-	if (premultiply) res_opts.flags |= STBIR_FLAG_ALPHA_PREMULTIPLIED;
-
-	// -- Guesstimate container from filename
+	bool hdr = is_hdr_format(formats[0]);
+	for (int i = 1; i < num_formats; i++) {
+		if (is_hdr_format(formats[i]) != hdr) failf("Can't encode HDR and LDR formats in the same run");
+	}
 
-	if (container == CONTAINER_ERROR) {
-		// Find the rightmost matching extension
-		const char *best_pos = NULL;
-		for (size_t i = 0; i < array_size(container_list); i++) {
-			const char *ext = container_list[i].extension;
-			if (!ext) continue;
-			for (const char *pos = output_file; (pos = strstr(pos, ext)) != NULL; pos++) {
-				if (pos > best_pos) {
-					best_pos = pos;
-					container = (container_enum)i;
-				}
-			}
+	if (hdr) {
+		if (!input_file) failf("HDR formats require a single input file: -i <input>");
+		for (int i = 0; i < 4; i++) {
+			if (input_channel_file[i]) failf("HDR formats don't support --input-%c", "rgba"[i]);
+			if (invert_channels[i]) failf("HDR formats don't support --invert-%c", "rgba"[i]);
 		}
+		if (offset_x != 0 || offset_y != 0) failf("HDR formats don't support --offset");
+		if (premultiply) failf("HDR formats don't support --premultiply");
+		if (crop_alpha) failf("HDR formats don't support --crop-alpha");
+		if (decorrelate_remap) failf("HDR formats don't support --decorrelate-remap");
+
+		// HDR data is always linear
+		res_opts.linear = true;
+	} else if (hdr_alpha) {
+		failf("--hdr-alpha requires a HDR format");
+	}
 
-		if (container == CONTAINER_ERROR) {
-			failf("Could not identify container format from output filename.\n"
-				"Specify one explicitly using --container <format>\n");
+	if (premultiply) res_opts.flags |= STBIR_FLAG_ALPHA_PREMULTIPLIED;
+
+	// -- Guesstimate containers from filenames
+
+	static output_target targets[MAX_OUTPUTS];
+	int num_targets = num_formats;
+	for (int i = 0; i < num_targets; i++) {
+		output_target *target = &targets[i];
+		target->format = formats[i];
+		target->output_file = output_files[num_output_files > 1 ? i : 0];
+		target->container = guess_container(target->output_file);
+		if (target->container == CONTAINER_ERROR) {
+			failf("Could not identify container format from output filename: %s\n"
+				"Specify one explicitly using --container <format>\n", target->output_file);
+		}
+		if (mip_drop_index && target->container != CONTAINER_SPTEX) {
+			failf("--mip-drop-index is only supported for .sptex outputs: %s", target->output_file);
 		}
 	}
 
 	if (verbose) {
 		printf("input_file: %s\n", input_file ? input_file : "(per channel)");
-		printf("output_file: %s\n", output_file);
-		printf("format: %s\n", format_list[format].name);
-		printf("container: %s\n", container_list[container].name);
+		for (int i = 0; i < num_targets; i++) {
+			const output_target *target = &targets[i];
+			printf("output_file: %s\n", target->output_file);
+			printf("format: %s\n", format_list[target->format].name);
+			printf("container: %s\n", container_list[target->container].name);
+		}
 		printf("level: %d\n", level);
 		printf("max_extent: %d\n", max_extent);
 		printf("crop_alpha: %s\n", crop_alpha ? "true" : "false");
@@ -688,12 +1348,32 @@ int main(int argc, char **argv)
 
 	int input_width = 0, input_height = 0;
 	uint8_t *pixels = NULL;
+	uint16_t *hdr_pixels = NULL;
 
 	if (flip_y) {
 		stbi_set_flip_vertically_on_load_thread(1);
 	}
 	
-	if (input_file) {
+	if (hdr) {
+		// HDR images are processed as RGBA16F like the ASTC codec stores them,
+		// RGBA16F .dds inputs are used directly without widening to 32-bit floats
+		hdr_pixels = load_dds_rgba16f(input_file, &input_width, &input_height, flip_y);
+		if (!hdr_pixels) {
+			float *float_pixels = stbi_loadf(input_file, &input_width, &input_height, NULL, 4);
+			if (!float_pixels) failf("Failed to load input file: %s", input_file);
+
+			size_t num_values = (size_t)input_width * (size_t)input_height * 4;
+			hdr_pixels = (uint16_t*)malloc(num_values * sizeof(uint16_t));
+			if (!hdr_pixels) failf("Failed to allocate memory for input file: %s", input_file);
+			for (size_t i = 0; i < num_values; i++) {
+				hdr_pixels[i] = image_float_to_half(float_pixels[i]);
+			}
+			stbi_image_free(float_pixels);
+		}
+		if (verbose) {
+			printf("Loaded HDR input file: %dx%d\n", input_width, input_height);
+		}
+	} else if (input_file) {
 		pixels = (uint8_t*)stbi_load(input_file, &input_width, &input_height, NULL, 4);
 		if (!pixels) failf("Failed to load input file: %s", input_file);
 		if (verbose) {
@@ -722,24 +1402,20 @@ int main(int argc, char **argv)
 		if (chan_height[i] > max_chan_height) max_chan_height = chan_height[i];
 	}
 
-	// -- Offset data
+	// -- Queue per-pixel operations
+	// These are executed in a single fused pass whenever the image is needed
 
-	if (offset_x != 0) {
-		move_x(pixels, input_width, input_height, -offset_x);
-	}
-	if (offset_y != 0) {
-		move_y(pixels, input_width, input_height, -offset_y);
-	}
-
-	// -- Premultiply input data if necessary
+	image_ops ops = { };
+	ops.offset_x = -offset_x;
+	ops.offset_y = -offset_y;
 
-	for (uint32_t channel = 0; channel < 4; channel++) {
+	for (int channel = 0; channel < 4; channel++) {
 		if (invert_channels[channel]) {
 			if (verbose) {
 				printf("Inverting channel '%c' (--invert-%c)\n", "RGBA"[channel], "rgba"[channel]);
 			}
 
-			invert_channel(pixels + channel, input_width, input_height);
+			image_ops_push(&ops, IMAGE_OP_INVERT, channel, NULL);
 		}
 	}
 
@@ -748,16 +1424,18 @@ int main(int argc, char **argv)
 			printf("Premultiplying input data (--premultiply)\n");
 		}
 
-		premultiply_alpha(pixels, input_width, input_height);
+		image_ops_push(&ops, IMAGE_OP_PREMULTIPLY, 0, NULL);
 	}
 
 	// -- Splice input channels
 
 	if (max_chan_width > input_width || max_chan_height > input_height) {
+		apply_image_ops(&ops, &pixels, &input_width, &input_height, num_threads);
+
 		uint8_t *new_pixels = (uint8_t*)malloc((size_t)max_chan_width * (size_t)max_chan_height * 4);
 		if (!new_pixels) failf("Failed to allocate memory for channel merge resize");
 		if (pixels) {
-			image_resize(res_opts, new_pixels, max_chan_width, max_chan_height, pixels, input_width, input_height);
+			image_resize(res_opts, new_pixels, max_chan_width, max_chan_height, pixels, input_width, input_height, num_threads);
 		} else {
 			memset(new_pixels, 0, (size_t)max_chan_width * (size_t)max_chan_height * 4);
 		}
@@ -771,7 +1449,7 @@ int main(int argc, char **argv)
 		if (!chan_pixels[i]) continue;
 		uint8_t *chan = chan_pixels[i];
 
-		if (chan_width[i] < max_chan_height || chan_height[i] < max_chan_height) {
+		if (chan_width[i] != input_width || chan_height[i] != input_height) {
 			resize_opts chan_opts = res_opts;
 			chan_opts.alpha_channel = 0;
 			chan_opts.channels = 1;
@@ -779,16 +1457,14 @@ int main(int argc, char **argv)
 			chan_opts.flags = 0;
 			uint8_t *new_chan = (uint8_t*)malloc((size_t)input_width * (size_t)input_height);
 			if (!new_chan) failf("Failed to allocate memory for channel resize");
-			image_resize(chan_opts, new_chan, input_width, input_height, chan, chan_width[i], chan_height[i]);
+			image_resize(chan_opts, new_chan, input_width, input_height, chan, chan_width[i], chan_height[i], num_threads);
 
 			free(chan);
 			chan = new_chan;
+			chan_pixels[i] = chan;
 		}
 
-		insert_channel(pixels, chan, i, input_width, input_height);
-
-		free(chan);
-		chan_pixels[i] = NULL;
+		image_ops_push(&ops, IMAGE_OP_INSERT_CHANNEL, i, chan);
 	}
 
 	// -- Resize input data
@@ -821,11 +1497,21 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (input_width != original_width || input_height != original_height) {
+	if (hdr && (input_width != original_width || input_height != original_height)) {
+		uint16_t *new_pixels = (uint16_t*)malloc((size_t)input_width * (size_t)input_height * 4 * sizeof(uint16_t));
+		if (!new_pixels) failf("Failed to allocate memory for resize target");
+
+		image_resize_half(res_opts, new_pixels, input_width, input_height, hdr_pixels, original_width, original_height, num_threads);
+
+		free(hdr_pixels);
+		hdr_pixels = new_pixels;
+	} else if (input_width != original_width || input_height != original_height) {
+		apply_image_ops(&ops, &pixels, &original_width, &original_height, num_threads);
+
 		uint8_t *new_pixels = (uint8_t*)malloc((size_t)input_width * (size_t)input_height * 4);
 		if (!new_pixels) failf("Failed to allocate memory for resize target");
 
-		image_resize(res_opts, new_pixels, input_width, input_height, pixels, original_width, original_height);
+		image_resize(res_opts, new_pixels, input_width, input_height, pixels, original_width, original_height, num_threads);
 		
 		free(pixels);
 		pixels = new_pixels;
@@ -839,433 +1525,555 @@ int main(int argc, char **argv)
 
 	int uncropped_width = input_width, uncropped_height = input_height;
 	if (crop_alpha) {
-		input_rect = get_crop_rect(pixels, input_width, input_height);
+		apply_image_ops(&ops, &pixels, &input_width, &input_height, num_threads);
+
+		input_rect = parallel_get_crop_rect(pixels, input_width, input_height, num_threads);
 		if (verbose) {
 			printf("Cropping to (%d,%d), (%d,%d) (--crop-alpha)\n",
 				input_rect.min_x, input_rect.min_y,
 				input_rect.max_x, input_rect.max_y);
 		}
 
-		apply_crop_rect(pixels, &input_width, &input_height, input_rect);
+		ops.rect = input_rect;
+		ops.has_rect = true;
 	}
 
 	// -- Remap input image if the encoder doesn't handle it
+	// ASTC has an internal swizzle so it only needs the remapped image if
+	// it's shared with other formats.
 
+	bool remap_swizzled = false;
 	if (decorrelate_remap) {
 		if (verbose) {
 			printf("Remapping input data for decorrelation (--decorrelate-remap)\n");
 		}
 
-		switch (format) {
+		for (int i = 0; i < num_targets; i++) {
+			switch (targets[i].format) {
 
-		case FORMAT_ASTC_4X4:
-		case FORMAT_ASTC_8X8:
-			// Nop, ASTC has internal swizzle
-			break;
+			case FORMAT_ASTC_4X4:
+			case FORMAT_ASTC_8X8:
+				break;
 
-		default:
-			swizzle_rg_to_ga(pixels, input_width, input_height);
-			break;
+			default:
+				remap_swizzled = true;
+				break;
 
+			}
+		}
+
+		if (remap_swizzled) {
+			image_ops_push(&ops, IMAGE_OP_SWIZZLE_RG_TO_GA, 0, NULL);
 		}
 	}
 
-	// -- Generate mips and compress
+	apply_image_ops(&ops, &pixels, &input_width, &input_height, num_threads);
+
+	for (int i = 0; i < 4; i++) {
+		free(chan_pixels[i]);
+		chan_pixels[i] = NULL;
+	}
 
-	uint8_t *mip_resize_pixels = NULL;
+	// -- Generate mips
+	// The pyramid is computed once and shared by all the output formats
 
-	pixel_format fmt = format_list[format];
-	assert(fmt.format == format);
+	float *mip_work[2] = { NULL, NULL };
+	float *prev_work = NULL;
 
 	int mip_width = input_width, mip_height = input_height;
-	int num_real_mips = 0;
-	mip_data real_mips[32];
+	int num_levels = 0;
+	mip_level levels[32];
+
+	while (max_mips <= 0 || num_levels < max_mips) {
+		int mip_ix = num_levels++;
+		mip_level *lv = &levels[mip_ix];
+		lv->pixels = NULL;
+		lv->hdr_pixels = NULL;
+		lv->width = mip_width;
+		lv->height = mip_height;
+
+		if (mip_ix == 0) {
+			lv->pixels = pixels;
+			lv->hdr_pixels = hdr_pixels;
+		} else {
+			if (verbose) {
+				printf("Resizing mip %d (%dx%d)\n", mip_ix, mip_width, mip_height);
+			}
 
-	switch (format) {
+			// The first resized mip is the largest one so allocate work buffers for it
+			size_t num_pixels = (size_t)mip_width * (size_t)mip_height;
+			if (!mip_work[0]) {
+				mip_work[0] = (float*)malloc(num_pixels * 4 * sizeof(float));
+				mip_work[1] = (float*)malloc(num_pixels * 4 * sizeof(float));
+				if (!mip_work[0] || !mip_work[1]) {
+					failf("Failed to allocate memory for mip resize target");
+				}
+			}
+			if (hdr) {
+				lv->hdr_pixels = (uint16_t*)malloc(num_pixels * 4 * sizeof(uint16_t));
+			} else {
+				lv->pixels = (uint8_t*)malloc(num_pixels * 4);
+			}
+			if (!lv->pixels && !lv->hdr_pixels) {
+				failf("Failed to allocate memory for mip resize target");
+			}
 
-	case FORMAT_BC1:
-	case FORMAT_BC3:
-	case FORMAT_BC4:
-	case FORMAT_BC5:
-		rgbcx::init(bc1_approx);
-		break;
+			// Resample each mip from the previous one in linear float, so that
+			// power-of-two chains only use the specialized 2:1 kernel
+			const mip_level *prev = &levels[mip_ix - 1];
+			resample_image src;
+			if (prev_work) {
+				src = { RESAMPLE_FORMAT_WORK, prev_work, prev->width, prev->height };
+			} else if (hdr) {
+				src = { RESAMPLE_FORMAT_RGBA16F, prev->hdr_pixels, prev->width, prev->height };
+			} else {
+				src = { RESAMPLE_FORMAT_RGBA8, prev->pixels, prev->width, prev->height };
+			}
 
-	case FORMAT_BC7:
-		bc7enc_compress_block_init();
-		break;
+			float *work = prev_work == mip_work[0] ? mip_work[1] : mip_work[0];
+			resample_image dsts[2];
+			if (hdr) {
+				dsts[0] = { RESAMPLE_FORMAT_RGBA16F, lv->hdr_pixels, mip_width, mip_height };
+			} else {
+				dsts[0] = { RESAMPLE_FORMAT_RGBA8, lv->pixels, mip_width, mip_height };
+			}
+			dsts[1] = { RESAMPLE_FORMAT_WORK, work, mip_width, mip_height };
 
-	case FORMAT_ASTC_4X4:
-	case FORMAT_ASTC_8X8:
-		astcenc_init();
-		break;
+			image_resample(res_opts, dsts, 2, &src, num_threads);
+			prev_work = work;
+		}
 
+		if (mip_width == 1 && mip_height == 1) break;
+		mip_width = mip_width > 1 ? mip_width / 2 : 1;
+		mip_height = mip_height > 1 ? mip_height / 2 : 1;
 	}
 
-	size_t mip_data_offset = 0;
-	while (max_mips <= 0 || num_real_mips < max_mips) {
-		int mip_ix = num_real_mips++;
+	free(mip_work[0]);
+	free(mip_work[1]);
 
-		uint8_t *mip_pixels;
-		if (mip_width != input_width || mip_height != input_height) {
-			if (verbose) {
-				printf("Resizing mip %d (%dx%d)\n", mip_ix, mip_width, mip_height);
-			}
+	// -- Compress
+	// Block rows of every format and mip are queued as jobs for a single pool
 
-			if (!mip_resize_pixels) {
-				mip_resize_pixels = (uint8_t*)malloc((size_t)mip_width * (size_t)mip_height * 4);
-				if (!mip_resize_pixels) failf("Failed to allocate memory for mip resize target");
-			}
+	bool init_rgbcx = false, init_bc7 = false, init_astc = false;
+	std::vector<encode_job> jobs;
 
-			image_resize(res_opts, mip_resize_pixels, mip_width, mip_height, pixels, input_width, input_height);
-			mip_pixels = mip_resize_pixels;
-		} else {
-			mip_pixels = pixels;
-		}
+	for (int target_ix = 0; target_ix < num_targets; target_ix++) {
+		output_target *target = &targets[target_ix];
+		pixel_format fmt = format_list[target->format];
+		assert(fmt.format == target->format);
 
-		mip_data *mip = &real_mips[mip_ix];
-		mip->width = mip_width;
-		mip->height = mip_height;
-		mip->blocks_x = (mip_width + fmt.block_width - 1) / fmt.block_width;
-		mip->blocks_y = (mip_height + fmt.block_height - 1) / fmt.block_height;
-		mip->data_offset = mip_data_offset;
-		mip->data_size = (size_t)mip->blocks_x * (size_t)mip->blocks_y * (size_t)fmt.block_size;
-		mip_data_offset += mip->data_size;
+		switch (target->format) {
 
-		if (verbose) {
-			printf("Compressing mip %d (%dx%d)\n", mip_ix, mip_width, mip_height);
-		}
+		case FORMAT_BC1:
+		case FORMAT_BC3:
+		case FORMAT_BC4:
+		case FORMAT_BC5:
+			if (!init_rgbcx) rgbcx::init(bc1_approx);
+			init_rgbcx = true;
+			break;
 
-		mip->data = (uint8_t*)malloc(mip->data_size);
-		if (!mip->data) failf("Failed to allocate memory for compressed data");
+		case FORMAT_BC7:
+			if (!init_bc7) bc7enc_compress_block_init();
+			init_bc7 = true;
+			break;
 
-		size_t block_stride = mip->blocks_x * fmt.block_size;
+		case FORMAT_ASTC_4X4:
+		case FORMAT_ASTC_8X8:
+		case FORMAT_ASTC_4X4_HDR:
+		case FORMAT_ASTC_8X8_HDR:
+			if (!init_astc) astcenc_init();
+			init_astc = true;
+			break;
 
-		int blocks_x = mip->blocks_x, blocks_y = mip->blocks_y;
-		switch (format) {
+		}
 
-		case FORMAT_RGBA8: {
-			memcpy(mip->data, mip_pixels, mip->data_size);
-		} break;
+		size_t mip_data_offset = 0;
+		target->num_mips = num_levels;
+		for (int mip_ix = 0; mip_ix < num_levels; mip_ix++) {
+			mip_data *mip = &target->mips[mip_ix];
+			mip->width = levels[mip_ix].width;
+			mip->height = levels[mip_ix].height;
+			mip->blocks_x = (mip->width + fmt.block_width - 1) / fmt.block_width;
+			mip->blocks_y = (mip->height + fmt.block_height - 1) / fmt.block_height;
+			mip->data_offset = mip_data_offset;
+			mip->data_size = (size_t)mip->blocks_x * (size_t)mip->blocks_y * (size_t)fmt.block_size;
+			mip_data_offset += mip->data_size;
+
+			mip->data = (uint8_t*)malloc(mip->data_size);
+			if (!mip->data) failf("Failed to allocate memory for compressed data");
+
+			int rows_per_job = 1;
+			switch (target->format) {
+
+			case FORMAT_RGBA8:
+				rows_per_job = mip->blocks_y;
+				break;
+
+			case FORMAT_ASTC_4X4:
+			case FORMAT_ASTC_8X8:
+			case FORMAT_ASTC_4X4_HDR:
+			case FORMAT_ASTC_8X8_HDR:
+				rows_per_job = (ASTC_JOB_MIN_BLOCKS + mip->blocks_x - 1) / mip->blocks_x;
+				break;
+
+			default:
+				break;
 
-		case FORMAT_BC1: {
-			uint32_t l = level_to_rgbcx[level];
-			parallel_for(num_threads, blocks_y, [&](int y) {
-				uint8_t *dst = mip->data + (size_t)y * block_stride;
-				for (int x = 0; x < blocks_x; x++) {
-					uint8_t src[4*4*4];
-					fetch_4x4(src, mip_pixels, mip_width, mip_height, x, y);
-					rgbcx::encode_bc1(l, dst, src, true, output_ignores_alpha);
-					dst += 8;
-				}
-			});
-		} break;
+			}
 
-		case FORMAT_BC3: {
-			uint32_t l = level_to_rgbcx[level];
-			parallel_for(num_threads, blocks_y, [&](int y) {
-				uint8_t *dst = mip->data + (size_t)y * block_stride;
-				for (int x = 0; x < blocks_x; x++) {
-					uint8_t src[4*4*4];
-					fetch_4x4(src, mip_pixels, mip_width, mip_height, x, y);
-					rgbcx::encode_bc3(l, dst, src);
-					dst += 16;
-				}
-			});
-		} break;
+			for (int y = 0; y < mip->blocks_y; y += rows_per_job) {
+				encode_job job;
+				job.target = target_ix;
+				job.mip = mip_ix;
+				job.min_block_y = y;
+				job.max_block_y = y + rows_per_job < mip->blocks_y ? y + rows_per_job : mip->blocks_y;
+				jobs.push_back(job);
+			}
+		}
+	}
 
-		case FORMAT_BC4: {
-			uint32_t l = level_to_rgbcx[level];
-			parallel_for(num_threads, blocks_y, [&](int y) {
-				uint8_t *dst = mip->data + (size_t)y * block_stride;
-				for (int x = 0; x < blocks_x; x++) {
-					uint8_t src[4*4*4];
-					fetch_4x4(src, mip_pixels, mip_width, mip_height, x, y);
-					rgbcx::encode_bc4(dst, src);
-					dst += 8;
-				}
-			});
-		} break;
+	if (verbose) {
+		printf("Compressing %d mips to %d formats (%zu jobs)\n", num_levels, num_targets, jobs.size());
+	}
 
-		case FORMAT_BC5: {
-			uint32_t l = level_to_rgbcx[level];
-			parallel_for(num_threads, blocks_y, [&](int y) {
-				uint8_t *dst = mip->data + (size_t)y * block_stride;
-				for (int x = 0; x < blocks_x; x++) {
-					uint8_t src[4*4*4];
-					fetch_4x4(src, mip_pixels, mip_width, mip_height, x, y);
-					rgbcx::encode_bc5(dst, src);
-					dst += 16;
-				}
-			});
-		} break;
+	bc7enc_compress_block_params bc7_params = level_to_bc7_params[level];
+	if (res_opts.linear) {
+		bc7enc_compress_block_params_init_linear_weights(&bc7_params);
+	} else {
+		bc7enc_compress_block_params_init_perceptual_weights(&bc7_params);
+	}
 
-		case FORMAT_BC7: {
-			bc7enc_compress_block_params bc7_params = level_to_bc7_params[level];
-			if (res_opts.linear) {
-				bc7enc_compress_block_params_init_linear_weights(&bc7_params);
-			} else {
-				bc7enc_compress_block_params_init_perceptual_weights(&bc7_params);
-			}
+	astcenc_encoder *astc_encoders[MAX_OUTPUTS] = { };
+	for (int target_ix = 0; target_ix < num_targets; target_ix++) {
+		const output_target *target = &targets[target_ix];
+		pixel_format fmt = format_list[target->format];
 
-			parallel_for(num_threads, blocks_y, [&](int y) {
-				uint8_t *dst = mip->data + (size_t)y * block_stride;
-				for (int x = 0; x < blocks_x; x++) {
-					uint8_t src[4*4*4];
-					fetch_4x4(src, mip_pixels, mip_width, mip_height, x, y);
-					bc7enc_compress_block(dst, src, &bc7_params);
-					dst += 16;
-				}
-			});
-		} break;
+		switch (target->format) {
 
 		case FORMAT_ASTC_4X4:
 		case FORMAT_ASTC_8X8: {
 			astcenc_opts opts = { 0 };
 			opts.linear = res_opts.linear;
-			opts.num_threads = num_threads;
 			opts.block_width = fmt.block_width;
 			opts.block_height = fmt.block_height;
-			opts.quality = level_to_astcenc_quality[level];
-			opts.verbose = verbose && mip_ix == 0;
-			opts.progress_fn = &progress_update;
+			opts.quality = astcenc_quality_for_level(level);
+			opts.verbose = verbose;
 			opts.normal_map = normal_map;
 
 			if (decorrelate_remap) {
-				opts.swizzle[0] = ASTCENC_SWIZZLE_R;
-				opts.swizzle[1] = ASTCENC_SWIZZLE_R;
-				opts.swizzle[2] = ASTCENC_SWIZZLE_R;
-				opts.swizzle[3] = ASTCENC_SWIZZLE_G;
+				// Encode the original RG as RRRG, if the pyramid is shared with
+				// other formats it has already been remapped to GA
+				astcenc_swizzle rg_r = remap_swizzled ? ASTCENC_SWIZZLE_G : ASTCENC_SWIZZLE_R;
+				astcenc_swizzle rg_g = remap_swizzled ? ASTCENC_SWIZZLE_A : ASTCENC_SWIZZLE_G;
+				opts.swizzle[0] = rg_r;
+				opts.swizzle[1] = rg_r;
+				opts.swizzle[2] = rg_r;
+				opts.swizzle[3] = rg_g;
 				opts.rgba_weights[0] = 1.0f;
 				opts.rgba_weights[1] = 0.0f;
 				opts.rgba_weights[2] = 0.0f;
 				opts.rgba_weights[3] = 1.0f;
 			}
 
-			if (!astcenc_encode_image(&opts, mip->data, mip_pixels, mip_width, mip_height)) {
-				failf("Failed to allocate memory for ASTC source image");
-			}
+			astc_encoders[target_ix] = astcenc_encoder_create(&opts, false);
 		} break;
 
-		}
-
-		if (mip_width == 1 && mip_height == 1) break;
-		mip_width = mip_width > 1 ? mip_width / 2 : 1;
-		mip_height = mip_height > 1 ? mip_height / 2 : 1;
-	}
+		case FORMAT_ASTC_4X4_HDR:
+		case FORMAT_ASTC_8X8_HDR: {
+			astcenc_opts opts = { 0 };
+			opts.linear = true;
+			opts.block_width = fmt.block_width;
+			opts.block_height = fmt.block_height;
+			opts.quality = astcenc_quality_for_level(level);
+			opts.verbose = verbose;
+			opts.hdr_alpha = hdr_alpha;
 
-	free(mip_resize_pixels);
-	free(pixels);
+			astc_encoders[target_ix] = astcenc_encoder_create(&opts, true);
+		} break;
 
-	static char output_expanded[4096];
+		default: break;
 
-	for (int mip_drop = 0; mip_drop <= mip_drop_copies; mip_drop++) {
+		}
+	}
 
-		if (mip_drop >= num_real_mips) break;
-		mip_data *mips = real_mips + mip_drop;
-		int num_mips = num_real_mips - mip_drop;
+	std::atomic_bool astc_failed { false };
+	parallel_for(num_threads, (int)jobs.size(), [&](int job_ix) {
+		const encode_job &job = jobs[job_ix];
+		const output_target *target = &targets[job.target];
+		const mip_level *lv = &levels[job.mip];
+		const mip_data *mip = &target->mips[job.mip];
+		pixel_format fmt = format_list[target->format];
 
-		expand_var vars[2], *p_var = vars;
-		push_var(p_var++, "width", "%d", mips[0].width);
-		push_var(p_var++, "height", "%d", mips[0].height);
-		size_t num_vars = p_var - vars;
-		assert(num_vars <= array_size(vars));
+		int blocks_x = mip->blocks_x;
+		size_t block_stride = (size_t)blocks_x * fmt.block_size;
+		uint32_t l = level_to_rgbcx[level];
 
-		expand_name(output_expanded, sizeof(output_expanded), output_file, vars, num_vars);
+		switch (target->format) {
 
-		// TODO: Windows UTF-16
-		FILE *f = fopen(output_expanded, "wb");
-		if (!f) failf("Failed to open output file: %s", output_expanded);
+		case FORMAT_RGBA8: {
+			size_t offset = (size_t)job.min_block_y * block_stride;
+			memcpy(mip->data + offset, lv->pixels + offset, (size_t)(job.max_block_y - job.min_block_y) * block_stride);
+		} break;
 
-		switch (container) {
+		case FORMAT_BC1:
+		case FORMAT_BC3:
+		case FORMAT_BC4:
+		case FORMAT_BC5:
+		case FORMAT_BC7: {
+			for (int y = job.min_block_y; y < job.max_block_y; y++) {
+				uint8_t *dst = mip->data + (size_t)y * block_stride;
+				for (int x = 0; x < blocks_x; x++) {
+					uint8_t src[4*4*4];
+					fetch_4x4(src, lv->pixels, lv->width, lv->height, x, y);
+					switch (target->format) {
+					case FORMAT_BC1: rgbcx::encode_bc1(l, dst, src, true, output_ignores_alpha); break;
+					case FORMAT_BC3: rgbcx::encode_bc3(l, dst, src); break;
+					case FORMAT_BC4: rgbcx::encode_bc4(dst, src); break;
+					case FORMAT_BC5: rgbcx::encode_bc5(dst, src); break;
+					case FORMAT_BC7: bc7enc_compress_block(dst, src, &bc7_params); break;
+					default: break;
+					}
+					dst += fmt.block_size;
+				}
+			}
+		} break;
 
-		case CONTAINER_NONE: {
-			write_mips(f, mips, num_mips);
+		case FORMAT_ASTC_4X4:
+		case FORMAT_ASTC_8X8: {
+			if (!astcenc_encode_rows(astc_encoders[job.target], mip->data, lv->pixels,
+				lv->width, lv->height, job.min_block_y, job.max_block_y)) {
+				astc_failed.store(true, std::memory_order_relaxed);
+			}
 		} break;
 
-		case CONTAINER_SPTEX: {
-			if (num_mips > 16) {
-				failf("sptex supports only up to 16 mip levels");
+		case FORMAT_ASTC_4X4_HDR:
+		case FORMAT_ASTC_8X8_HDR: {
+			if (!astcenc_encode_rows_hdr_half(astc_encoders[job.target], mip->data, lv->hdr_pixels,
+				lv->width, lv->height, job.min_block_y, job.max_block_y)) {
+				astc_failed.store(true, std::memory_order_relaxed);
 			}
+		} break;
 
-			sp_compression_type compression_type = SP_COMPRESSION_ZSTD;
-			size_t bound = 0;
-			for (int i = 0; i < num_mips; i++) {
-				// Padding
-				bound += 16;
+		default: break;
 
-				bound += sp_get_compression_bound(compression_type, mips[i].data_size);
-			}
-			char *compress_buf = (char*)malloc(bound);
-			if (!compress_buf) failf("Failed to allocate lossless compression buffer");
-
-			sptex_header header;
-			header.header.magic = SPFILE_HEADER_SPTEX;
-			header.header.version = 1;
-			header.header.header_info_size = sizeof(sptex_info);
-			header.header.num_sections = num_mips;
-			header.info.format = res_opts.linear ? fmt.sp_linear : fmt.sp_srgb;
-			header.info.width = (uint16_t)mips[0].width;
-			header.info.height = (uint16_t)mips[0].height;
-			header.info.uncropped_width = (uint16_t)(uncropped_width >> mip_drop);
-			header.info.uncropped_height = (uint16_t)(uncropped_height >> mip_drop);
-			header.info.crop_min_x = (uint16_t)input_rect.min_x;
-			header.info.crop_min_y = (uint16_t)input_rect.min_y;
-			header.info.crop_max_x = (uint16_t)input_rect.max_x;
-			header.info.crop_max_y = (uint16_t)input_rect.max_y;
-			header.info.num_mips = num_mips;
-
-			uint32_t header_size = sizeof(spfile_header) + sizeof(sptex_info) + sizeof(spfile_section) * num_mips;
-			size_t compress_offset = 0;
-
-			for (int i = 0; i < num_mips; i++) {
-				while ((compress_offset + header_size) % 16 != 0) {
-					compress_offset++;
-					compress_buf[compress_offset] = '\0';
-				}
+		}
+	});
+	if (astc_failed.load()) failf("Failed to allocate memory for ASTC source image");
 
-				spfile_section *s_mip = &header.s_mips[i];
-				size_t compressed_size = sp_compress_buffer(compression_type,
-					compress_buf + compress_offset, bound - compress_offset,
-					mips[i].data, mips[i].data_size, level);
-
-				double no_compress_ratio = 1.05;
-				sp_compression_type mip_type = compression_type;
-				if ((double)mips[i].data_size / (double)compressed_size < no_compress_ratio) {
-					mip_type = SP_COMPRESSION_NONE;
-					memcpy(compress_buf + compress_offset, mips[i].data, mips[i].data_size);
-					compressed_size = mips[i].data_size;
-				}
+	for (int i = 0; i < num_targets; i++) {
+		astcenc_encoder_free(astc_encoders[i]);
+	}
 
-				if (verbose) {
-					if (mips[i].data_size > 1000) {
-						printf("Compressed mip %u from %.1fkB to %.1fkB, ratio %.2f\n",
-							i, (double)mips[i].data_size / 1000.0, (double)compressed_size / 1000.0,
-							(double)mips[i].data_size / (double)compressed_size);
-					} else {
-						printf("Compressed mip %d from %zub to %zub, ratio %.2f\n",
-							i, mips[i].data_size, compressed_size,
-							(double)mips[i].data_size / (double)compressed_size);
-					}
-				}
+	for (int i = 0; i < num_levels; i++) {
+		free(levels[i].pixels);
+		free(levels[i].hdr_pixels);
+	}
 
-				s_mip->magic = SPFILE_SECTION_MIP;
-				s_mip->index = i;
-				s_mip->compression_type = mip_type;
-				s_mip->uncompressed_size = (uint32_t)mips[i].data_size;
-				s_mip->compressed_size = (uint32_t)compressed_size;
-				s_mip->offset = (uint32_t)compress_offset + header_size;
+	static char output_expanded[4096];
 
-				compress_offset += compressed_size;
+	for (int target_ix = 0; target_ix < num_targets; target_ix++) {
+		output_target *target = &targets[target_ix];
+		pixel_format fmt = format_list[target->format];
+
+		// Compress the mips only once, the copies with dropped mips share the
+		// same sections
+		int max_drop = target->num_mips - 1;
+		if (target->container == CONTAINER_SPTEX) {
+			target->num_tail_mips = 0;
+			if (mip_tail_extent > 0) {
+				int first_tail = target->num_mips;
+				while (first_tail > 0 && target->num_mips - first_tail < SPTEX_MAX_TAIL_MIPS
+					&& target->mips[first_tail - 1].width < mip_tail_extent && target->mips[first_tail - 1].height < mip_tail_extent) {
+					first_tail--;
+				}
+				if (target->num_mips - first_tail >= 2) target->num_tail_mips = target->num_mips - first_tail;
 			}
 
-			write_data(f, &header, header_size);
-			write_data(f, compress_buf, compress_offset);
-
-			if (compress_offset + header_size < sizeof(sptex_header)) {
-				char zero_buf[sizeof(sptex_header)] = { };
-				write_data(f, zero_buf, sizeof(sptex_header) - (compress_offset + header_size));
+			int num_section_mips = target->num_mips - target->num_tail_mips;
+			if (num_section_mips > 16) {
+				failf("sptex supports only up to 16 mip levels outside of the mip tail");
 			}
 
-			free(compress_buf);
+			tile_layout tiles = { };
+			if (tile_size > 0) {
+				if (tile_size % fmt.block_width != 0 || tile_size % fmt.block_height != 0) {
+					failf("Tile size %d is not a multiple of the %dx%d %s blocks", tile_size, fmt.block_width, fmt.block_height, fmt.name);
+				}
+				if (tile_border % fmt.block_width != 0 || tile_border % fmt.block_height != 0) {
+					failf("Tile border %d is not a multiple of the %dx%d %s blocks", tile_border, fmt.block_width, fmt.block_height, fmt.name);
+				}
+				tiles.tile_blocks_x = tile_size / fmt.block_width;
+				tiles.tile_blocks_y = tile_size / fmt.block_height;
+				tiles.border_blocks_x = tile_border / fmt.block_width;
+				tiles.border_blocks_y = tile_border / fmt.block_height;
+				tiles.block_size = fmt.block_size;
+			}
 
-		} break;
+			sp_block_split split = get_block_split(fmt);
+			const sp_block_split *p_split = block_split ? &split : NULL;
+			compress_mips(target->compressed, target->mips, num_section_mips, level, chunk_rows, tile_size > 0 ? &tiles : NULL, p_split, num_threads, verbose);
+			if (target->num_tail_mips > 0) {
+				target->tail = compress_mip_tail(target->mips, target->num_mips, target->num_tail_mips, level, p_split);
+				if (verbose) {
+					printf("Packed %d mips into a mip tail of %zub\n", target->num_tail_mips, target->tail.size);
+				}
 
-		case CONTAINER_DDS: {
-
-			dds_header header = { 0 };
-			memcpy(header.magic, "DDS ", 4);
-			header.size = 124;
-			header.flags = 0xa1007; // CAPS|HEIGHT|WIDTH|PIXELFORMAT|MIPMAPCOUNT|LINEARSIZE
-			header.height = (uint32_t)mips[0].width;
-			header.width = (uint32_t)mips[0].height;
-			header.pitch_or_linear_size = (uint32_t)mips[0].data_size;
-			header.depth = 1;
-			header.mip_map_count = (uint32_t)num_mips;
-			if (format == FORMAT_RGBA8) {
-				header.pixelformat_flags = 0x41; // RGB|ALPHAPIXELS
-				header.pixelformat_bitcount = 32;
-				header.pixelformat_r_mask = 0x000000ff;
-				header.pixelformat_g_mask = 0x0000ff00;
-				header.pixelformat_b_mask = 0x00ff0000;
-				header.pixelformat_a_mask = 0xff000000;
-			} else {
-				header.pixelformat_flags = 0x4; // FOURCC
-			}
-			header.pixelformat_size = 32;
-			header.caps[0] = 0x1000; // TEXTURE
-			if (num_mips > 1) {
-				header.caps[0] |= 0x400008; // COMPLEX|MIPMAP
+				// Copies can drop mips only up to the start of the tail
+				max_drop = num_section_mips;
 			}
+		}
 
-			if (dds_d3d9) {
-				switch (format) {
-				case FORMAT_BC1: memcpy(header.pixelformat_fourcc, "DXT1", 4); break;
-				case FORMAT_BC3: memcpy(header.pixelformat_fourcc, "DXT5", 4); break;
-				case FORMAT_BC4: memcpy(header.pixelformat_fourcc, "BC4U", 4); break;
-				case FORMAT_BC5: memcpy(header.pixelformat_fourcc, "BC5U", 4); break;
-				default: /* Just ignore unsupported formats for now */ break;
+		int num_copies = mip_drop_index ? 0 : mip_drop_copies;
+		int num_drops = 0;
+		if (mip_drop_index) {
+			num_drops = mip_drop_copies + 1 < target->num_mips ? mip_drop_copies + 1 : target->num_mips;
+			if (num_drops > max_drop + 1) num_drops = max_drop + 1;
+		}
+
+		for (int mip_drop = 0; mip_drop <= num_copies; mip_drop++) {
+
+			if (mip_drop > max_drop) break;
+			mip_data *mips = target->mips + mip_drop;
+			int num_mips = target->num_mips - mip_drop;
+
+			expand_var vars[3], *p_var = vars;
+			push_var(p_var++, "width", "%d", mips[0].width);
+			push_var(p_var++, "height", "%d", mips[0].height);
+			push_var(p_var++, "format", "%s", fmt.name);
+			size_t num_vars = p_var - vars;
+			assert(num_vars <= array_size(vars));
+
+			expand_name(output_expanded, sizeof(output_expanded), target->output_file, vars, num_vars);
+
+			// TODO: Windows UTF-16
+			FILE *f = fopen(output_expanded, "wb");
+			if (!f) failf("Failed to open output file: %s", output_expanded);
+
+			switch (target->container) {
+
+			case CONTAINER_NONE: {
+				write_mips(f, mips, num_mips);
+			} break;
+
+			case CONTAINER_SPTEX: {
+				sptex_info info = { };
+				info.format = res_opts.linear ? fmt.sp_linear : fmt.sp_srgb;
+				info.width = (uint16_t)mips[0].width;
+				info.height = (uint16_t)mips[0].height;
+				info.uncropped_width = (uint16_t)(uncropped_width >> mip_drop);
+				info.uncropped_height = (uint16_t)(uncropped_height >> mip_drop);
+				info.crop_min_x = (uint16_t)input_rect.min_x;
+				info.crop_min_y = (uint16_t)input_rect.min_y;
+				info.crop_max_x = (uint16_t)input_rect.max_x;
+				info.crop_max_y = (uint16_t)input_rect.max_y;
+				info.tile_width = (uint16_t)tile_size;
+				info.tile_height = (uint16_t)tile_size;
+				info.tile_border = (uint32_t)tile_border;
+
+				write_sptex(f, &info, mips, target->compressed + mip_drop, num_mips, &target->tail, target->num_tail_mips, num_drops, write_block_size);
+			} break;
+
+			case CONTAINER_DDS: {
+
+				dds_header header = { 0 };
+				memcpy(header.magic, "DDS ", 4);
+				header.size = 124;
+				header.flags = 0xa1007; // CAPS|HEIGHT|WIDTH|PIXELFORMAT|MIPMAPCOUNT|LINEARSIZE
+				header.height = (uint32_t)mips[0].width;
+				header.width = (uint32_t)mips[0].height;
+				header.pitch_or_linear_size = (uint32_t)mips[0].data_size;
+				header.depth = 1;
+				header.mip_map_count = (uint32_t)num_mips;
+				if (target->format == FORMAT_RGBA8) {
+					header.pixelformat_flags = 0x41; // RGB|ALPHAPIXELS
+					header.pixelformat_bitcount = 32;
+					header.pixelformat_r_mask = 0x000000ff;
+					header.pixelformat_g_mask = 0x0000ff00;
+					header.pixelformat_b_mask = 0x00ff0000;
+					header.pixelformat_a_mask = 0xff000000;
+				} else {
+					header.pixelformat_flags = 0x4; // FOURCC
 				}
-			} else {
-				memcpy(header.pixelformat_fourcc, "DX10", 4);
-				switch (format) {
-				case FORMAT_RGBA8: header.dxgi_format = res_opts.linear ? 28 : 29; break; // R8G8B8A8_UNORM(_SRGB)
-				case FORMAT_BC1: header.dxgi_format = res_opts.linear ? 71 : 72; break; // BC1_UNORM(_SRGB)
-				case FORMAT_BC3: header.dxgi_format = res_opts.linear ? 77 : 78; break; // BC3_UNORM(_SRGB)
-				case FORMAT_BC4: header.dxgi_format = 80; break; // BC4_UNORM
-				case FORMAT_BC5: header.dxgi_format = 83; break; // BC5_UNORM TODO: snorm?
-				case FORMAT_BC7: header.dxgi_format = res_opts.linear ? 98 : 99; break; // BC7_UNORM(_SRGB)
-				default: header.dxgi_format = 0; break;
+				header.pixelformat_size = 32;
+				header.caps[0] = 0x1000; // TEXTURE
+				if (num_mips > 1) {
+					header.caps[0] |= 0x400008; // COMPLEX|MIPMAP
 				}
-				header.resource_dimension = 3; // D3D10_RESOURCE_DIMENSION_TEXTURE2D
-				header.array_size = 1;
-			}
 
-			if (dds_d3d9) {
-				write_data(f, &header, 4 + 124);
-			} else {
-				write_data(f, &header, sizeof(header));
-			}
+				if (dds_d3d9) {
+					switch (target->format) {
+					case FORMAT_BC1: memcpy(header.pixelformat_fourcc, "DXT1", 4); break;
+					case FORMAT_BC3: memcpy(header.pixelformat_fourcc, "DXT5", 4); break;
+					case FORMAT_BC4: memcpy(header.pixelformat_fourcc, "BC4U", 4); break;
+					case FORMAT_BC5: memcpy(header.pixelformat_fourcc, "BC5U", 4); break;
+					default: /* Just ignore unsupported formats for now */ break;
+					}
+				} else {
+					memcpy(header.pixelformat_fourcc, "DX10", 4);
+					switch (target->format) {
+					case FORMAT_RGBA8: header.dxgi_format = res_opts.linear ? 28 : 29; break; // R8G8B8A8_UNORM(_SRGB)
+					case FORMAT_BC1: header.dxgi_format = res_opts.linear ? 71 : 72; break; // BC1_UNORM(_SRGB)
+					case FORMAT_BC3: header.dxgi_format = res_opts.linear ? 77 : 78; break; // BC3_UNORM(_SRGB)
+					case FORMAT_BC4: header.dxgi_format = 80; break; // BC4_UNORM
+					case FORMAT_BC5: header.dxgi_format = 83; break; // BC5_UNORM TODO: snorm?
+					case FORMAT_BC7: header.dxgi_format = res_opts.linear ? 98 : 99; break; // BC7_UNORM(_SRGB)
+					default: header.dxgi_format = 0; break;
+					}
+					header.resource_dimension = 3; // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+					header.array_size = 1;
+				}
 
-			write_mips(f, mips, num_mips);
+				if (dds_d3d9) {
+					write_data(f, &header, 4 + 124);
+				} else {
+					write_data(f, &header, sizeof(header));
+				}
 
-		} break;
+				write_mips(f, mips, num_mips);
 
-		case CONTAINER_KTX: {
-			failf("Unimplemented");
-		} break;
+			} break;
 
-		case CONTAINER_ASTC: {
-
-			astc_header header;
-			memcpy(header.magic, "\x13\xAB\xA1\x5C", 4);
-			header.xdim = (uint8_t)fmt.block_width;
-			header.ydim = (uint8_t)fmt.block_height;
-			header.zdim = 1;
-			header.width[0] = (uint8_t)(mips[0].width & 0xff);
-			header.width[1] = (uint8_t)((mips[0].width >> 8) & 0xff);
-			header.width[2] = (uint8_t)((mips[0].width >> 16) & 0xff);
-			header.height[0] = (uint8_t)(mips[0].height & 0xff);
-			header.height[1] = (uint8_t)((mips[0].height >> 8) & 0xff);
-			header.height[2] = (uint8_t)((mips[0].height >> 16) & 0xff);
-			header.depth[0] = 1;
-			header.depth[1] = 0;
-			header.depth[2] = 0;
-
-			write_data(f, &header, sizeof(header));
-			write_mips(f, mips, num_mips);
+			case CONTAINER_KTX: {
+				failf("Unimplemented");
+			} break;
 
-		} break;
+			case CONTAINER_ASTC: {
 
-		}
+				astc_header header;
+				memcpy(header.magic, "\x13\xAB\xA1\x5C", 4);
+				header.xdim = (uint8_t)fmt.block_width;
+				header.ydim = (uint8_t)fmt.block_height;
+				header.zdim = 1;
+				header.width[0] = (uint8_t)(mips[0].width & 0xff);
+				header.width[1] = (uint8_t)((mips[0].width >> 8) & 0xff);
+				header.width[2] = (uint8_t)((mips[0].width >> 16) & 0xff);
+				header.height[0] = (uint8_t)(mips[0].height & 0xff);
+				header.height[1] = (uint8_t)((mips[0].height >> 8) & 0xff);
+				header.height[2] = (uint8_t)((mips[0].height >> 16) & 0xff);
+				header.depth[0] = 1;
+				header.depth[1] = 0;
+				header.depth[2] = 0;
+
+				write_data(f, &header, sizeof(header));
+				write_mips(f, mips, num_mips);
+
+			} break;
+
+			}
+
+			if (fclose(f) != 0) {
+				failf("Failed to flush output file: %s", output_expanded);
+			}
 
-		if (fclose(f) != 0) {
-			failf("Failed to flush output file: %s", output_expanded);
 		}
 
 	}
 
-	for (int i = 0; i < num_real_mips; i++) {
-		free(real_mips[i].data);
+	for (int t = 0; t < num_targets; t++) {
+		for (int i = 0; i < targets[t].num_mips; i++) {
+			free(targets[t].mips[i].data);
+			free(targets[t].compressed[i].data);
+		}
 	}
 
 	return 0;